@@ -0,0 +1,53 @@
+#ifndef AUDIO_DSP_ADPCM_H
+#define AUDIO_DSP_ADPCM_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+/**
+ * IMA-ADPCM, 4 bits per sample. Audio is cut into blocks of
+ * ADPCM_BLOCK_FRAMES frames that each start with the decoder state, so
+ * decoding can begin at any block and a bit error never spreads past one.
+ *
+ *   per channel: i16 predictor, u8 step index, u8 reserved
+ *   nibbles, low nibble first: mono has two consecutive samples per byte,
+ *   stereo one frame per byte with left in the low nibble
+ *
+ * The last block is padded to full size.
+ */
+
+#define ADPCM_BLOCK_FRAMES 256
+#define ADPCM_CHANNEL_HEADER_SIZE 4
+
+typedef struct {
+    int16_t predictor;
+    uint8_t step_index;
+} adpcm_channel;
+
+/**
+ * Decodes one clip front to back. Holds no pointer into anything but the
+ * encoded data, so a decoder can sit in a voice slot and be copied freely.
+ */
+typedef struct {
+    const uint8_t *data;
+    uint8_t channels;
+    uint32_t position;
+    adpcm_channel state[2];
+} adpcm_decoder;
+
+//! Bytes a block of `channels` channels takes up
+static inline size_t adpcm_block_size(uint8_t channels) {
+    return channels * (ADPCM_CHANNEL_HEADER_SIZE + ADPCM_BLOCK_FRAMES / 2);
+}
+
+size_t adpcm_encoded_size(uint32_t frames, uint8_t channels);
+
+void adpcm_encode(const int16_t *input, uint32_t frames, uint8_t channels,
+                  uint8_t *output);
+
+void adpcm_decoder_init(adpcm_decoder *decoder, const uint8_t *data,
+                        uint8_t channels);
+
+void adpcm_decode(adpcm_decoder *decoder, int16_t *output, size_t frames);
+
+#endif
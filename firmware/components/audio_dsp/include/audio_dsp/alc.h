@@ -0,0 +1,71 @@
+#ifndef AUDIO_DSP_ALC_H
+#define AUDIO_DSP_ALC_H
+
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#define ALC_MAX_TARGET 15
+#define ALC_MAX_MAX_GAIN 7
+#define ALC_MAX_HOLD 15
+#define ALC_MAX_DECAY 10
+#define ALC_MAX_ATTACK 10
+#define ALC_MAX_GATE_THRESHOLD 31
+
+/**
+ * Automatic level control and noise gate settings, in the step units of the
+ * WM8988's ALC and noise gate registers so the same settings mean the same
+ * thing whether the codec or alc_process applies them
+ */
+typedef struct {
+    bool enabled;
+    //! Level the peaks are held at, -28.5 dBFS plus 1.5 dB a step
+    uint8_t target;
+    //! Most gain ever applied, -12 dB plus 6 dB a step
+    uint8_t max_gain;
+    //! Wait before gain is raised again, none at 0 and 2.67 ms doubling a
+    //! step from 1
+    uint8_t hold;
+    //! Time to raise the gain by 6 dB, 24 ms doubling a step
+    uint8_t decay;
+    //! Time to lower the gain by 6 dB, 6 ms doubling a step
+    uint8_t attack;
+    bool gate;
+    //! Input peak the gate closes below, -76.5 dBFS plus 1.5 dB a step
+    uint8_t gate_threshold;
+    //! Mute while the gate is closed instead of just freezing the gain
+    bool gate_mutes;
+} alc_config;
+
+bool alc_config_valid(const alc_config *config);
+
+/**
+ * Software version of the codec's ALC for the voice path, a mono pipeline
+ * stage. The gain follows the peak of each block against the target, moving
+ * at the attack and decay rates and waiting out the hold before rising, and
+ * ramps across the block so it never steps. Unlike the codec, which sets its
+ * analog input gain, this gains up the digitized signal, so its noise floor
+ * comes up with it.
+ */
+typedef struct {
+    //! Packed alc_config, written by the control side and picked up at the
+    //! next block boundary
+    _Atomic uint32_t requested;
+    uint32_t packed;
+    alc_config config;
+
+    uint32_t sample_rate;
+    float gain_db;
+    //! Linear gain the last block ended on, Q10 with 8 more bits for ramping
+    int32_t applied;
+    uint32_t hold_remaining;
+} alc;
+
+void alc_init(alc *alc, uint32_t sample_rate);
+
+bool alc_configure(alc *alc, const alc_config *config);
+
+void alc_process(void *ctx, int16_t *samples, size_t frames);
+
+#endif
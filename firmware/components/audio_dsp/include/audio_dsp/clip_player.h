@@ -0,0 +1,52 @@
+#ifndef AUDIO_DSP_CLIP_PLAYER_H
+#define AUDIO_DSP_CLIP_PLAYER_H
+
+#include "audio_dsp/adpcm.h"
+#include "audio_dsp/soundbank.h"
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+//! Clips that can sound at once, the oldest is cut off to start another
+#define CLIP_PLAYER_VOICES 8
+
+//! Unity voice gain
+#define CLIP_PLAYER_UNITY_GAIN 256
+
+typedef struct {
+    soundbank_clip clip;
+    uint32_t position;
+    //! Only used by compressed clips
+    adpcm_decoder decoder;
+    //! Linear gain, CLIP_PLAYER_UNITY_GAIN is unity
+    uint16_t gain;
+    //! Start order, the lowest active one is stolen first
+    uint32_t started;
+    bool active;
+} clip_voice;
+
+/**
+ * Plays soundbank clips over an output block. Clip data is read in place and
+ * compressed clips are decoded a slice at a time while mixing, so starting a
+ * voice costs nothing beyond filling in its slot. Not thread safe,
+ * everything is expected to run on the task that mixes.
+ */
+typedef struct {
+    clip_voice voices[CLIP_PLAYER_VOICES];
+    uint32_t next_start;
+    //! Voices cut off to make room for a new clip
+    uint32_t steals;
+} clip_player;
+
+void clip_player_init(clip_player *player);
+
+int clip_player_start(clip_player *player, const soundbank_clip *clip,
+                      uint16_t gain);
+
+void clip_player_stop_all(clip_player *player);
+
+size_t clip_player_active(const clip_player *player);
+
+void clip_player_mix(clip_player *player, int16_t *stereo, size_t frames);
+
+#endif
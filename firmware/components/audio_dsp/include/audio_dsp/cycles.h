@@ -0,0 +1,34 @@
+#ifndef AUDIO_DSP_CYCLES_H
+#define AUDIO_DSP_CYCLES_H
+
+#include <stdint.h>
+
+/**
+ * Counter the DSP code times itself with. On the ESP32 it is the CPU cycle
+ * counter. The host has no portable equivalent, so there it counts nanoseconds
+ * and budgets are derived from DSP_HOST_CYCLE_HZ instead of the CPU clock.
+ */
+
+#ifdef ESP_PLATFORM
+
+#include "esp_cpu.h"
+
+static inline uint32_t dsp_cycle_count(void) {
+    return esp_cpu_get_cycle_count();
+}
+
+#else
+
+#include <time.h>
+
+#define DSP_HOST_CYCLE_HZ 1000000000u
+
+static inline uint32_t dsp_cycle_count(void) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (uint64_t)now.tv_sec * DSP_HOST_CYCLE_HZ + now.tv_nsec;
+}
+
+#endif
+
+#endif
@@ -0,0 +1,79 @@
+#ifndef AUDIO_DSP_FEEDBACK_H
+#define AUDIO_DSP_FEEDBACK_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+//! Samples per analysis frame, about 11 ms at 48 kHz with 94 Hz bins
+#define FEEDBACK_FFT_SIZE 512
+
+//! Notches that can be locked onto resonances at once
+#define FEEDBACK_MAX_NOTCHES 6
+
+//! Spectral peaks followed from frame to frame for howl
+#define FEEDBACK_MAX_CANDIDATES 4
+
+//! Each detection of a resonance deepens its notch by this much
+#define FEEDBACK_DEPTH_STEP_DB 6
+#define FEEDBACK_MAX_DEPTH_STEPS 4
+
+typedef struct {
+    //! Q28 coefficients with a0 normalised out
+    int32_t b0, b1, b2, a1, a2;
+    //! Last inputs and, with 8 fraction bits, outputs
+    int32_t x1, x2, y1, y2;
+
+    //! Centre in Hz, tracking the resonance as it drifts
+    float frequency;
+    //! Cut in FEEDBACK_DEPTH_STEP_DB steps, 0 while the notch is free
+    uint8_t depth;
+    //! Samples since the resonance was last detected
+    uint32_t idle;
+} feedback_notch;
+
+typedef struct {
+    //! FFT bin of the peak, 0 while the slot is free
+    uint16_t bin;
+    //! Consecutive frames it has looked like howl
+    uint8_t hits;
+    float power;
+} feedback_candidate;
+
+/**
+ * Acoustic feedback suppressor for the mono voice pipeline. The mic input is
+ * analysed a frame at a time for howl, a narrow peak that persists, stands
+ * well above the rest of the spectrum and lacks the harmonics of a voice, and
+ * a notch is locked onto each one found. Notches deepen while their resonance
+ * keeps coming back and release a step at a time once it has not.
+ *
+ * Analysis happens once per FEEDBACK_FFT_SIZE samples and at most
+ * FEEDBACK_MAX_NOTCHES filters run per sample, so the worst case block cost is
+ * fixed whatever the input.
+ */
+typedef struct {
+    uint32_t sample_rate;
+    //! Analysed bins, from roughly 200 Hz to 10 kHz
+    uint16_t low_bin;
+    uint16_t high_bin;
+
+    int16_t frame[FEEDBACK_FFT_SIZE];
+    size_t frame_fill;
+
+    float window[FEEDBACK_FFT_SIZE];
+    //! e^(-2 pi i k / FEEDBACK_FFT_SIZE) for the first half of the circle
+    float twiddle_re[FEEDBACK_FFT_SIZE / 2];
+    float twiddle_im[FEEDBACK_FFT_SIZE / 2];
+    uint8_t bit_reverse[FEEDBACK_FFT_SIZE / 2];
+    float re[FEEDBACK_FFT_SIZE / 2];
+    float im[FEEDBACK_FFT_SIZE / 2];
+    float power[FEEDBACK_FFT_SIZE / 2 + 1];
+
+    feedback_candidate candidates[FEEDBACK_MAX_CANDIDATES];
+    feedback_notch notches[FEEDBACK_MAX_NOTCHES];
+} feedback_suppressor;
+
+void feedback_init(feedback_suppressor *suppressor, uint32_t sample_rate);
+
+void feedback_process(void *ctx, int16_t *samples, size_t frames);
+
+#endif
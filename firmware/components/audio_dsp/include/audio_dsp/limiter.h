@@ -0,0 +1,122 @@
+#ifndef AUDIO_DSP_LIMITER_H
+#define AUDIO_DSP_LIMITER_H
+
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+//! Longest lookahead, 5 ms at 48 kHz
+#define LIMITER_MAX_LOOKAHEAD 240
+
+//! Compressor bands, split at LIMITER_LOW_CROSSOVER_HZ and
+//! LIMITER_HIGH_CROSSOVER_HZ
+#define LIMITER_BANDS 3
+#define LIMITER_LOW_CROSSOVER_HZ 250
+#define LIMITER_HIGH_CROSSOVER_HZ 4000
+
+#define LIMITER_MAX_CEILING_DB 24
+#define LIMITER_MIN_RELEASE_MS 10
+#define LIMITER_MAX_RELEASE_MS 2550
+#define LIMITER_MAX_THRESHOLD_DB 63
+#define LIMITER_MAX_RATIO 15
+
+typedef struct {
+    //! Level the band starts being compressed at, in dB below full scale
+    uint8_t threshold_db;
+    //! Compression above the threshold as ratio to 1, 1 leaves the band alone
+    uint8_t ratio;
+} limiter_band;
+
+typedef struct {
+    //! Highest peak let through, in dB below full scale
+    uint8_t ceiling_db;
+    //! Time the gain takes to recover most of the way after a peak, in steps
+    //! of 10 ms
+    uint16_t release_ms;
+    //! Compress bass, mids and treble separately ahead of the limiter
+    bool compressor;
+    limiter_band bands[LIMITER_BANDS];
+} limiter_config;
+
+//! Peaks held 1 dB under full scale, recovering over 100 ms. The compressor,
+//! when turned on, holds the bass back hardest since that is what small
+//! drivers suffer from.
+#define LIMITER_DEFAULT_CONFIG()                                               \
+    {                                                                          \
+        .ceiling_db = 1,                                                       \
+        .release_ms = 100,                                                     \
+        .compressor = false,                                                   \
+        .bands =                                                               \
+            {                                                                  \
+                {.threshold_db = 18, .ratio = 4},                              \
+                {.threshold_db = 12, .ratio = 2},                              \
+                {.threshold_db = 12, .ratio = 2},                              \
+            },                                                                 \
+    }
+
+bool limiter_config_valid(const limiter_config *config);
+
+/**
+ * Lookahead peak limiter for an interleaved stereo bus, with an optional three
+ * band compressor in front of it. The signal is delayed by the lookahead so
+ * the gain has already come down by the time a peak leaves, which lets it
+ * hold the ceiling without ever hard clipping. Both channels share one
+ * gain so the image does not shift.
+ *
+ * Envelopes and gains are fixed point. Only the compressor's gain curve uses
+ * floats, once per band every few dozen frames.
+ */
+typedef struct {
+    //! Packed ceiling and release, and packed compressor settings, written by
+    //! the control side and picked up at the next block boundary
+    _Atomic uint32_t requested_limit;
+    _Atomic uint32_t requested_bands;
+    uint32_t limit_packed;
+    uint32_t bands_packed;
+
+    uint32_t sample_rate;
+
+    int16_t delay[LIMITER_MAX_LOOKAHEAD * 2];
+    size_t lookahead;
+    size_t position;
+
+    int32_t ceiling;
+    //! Gain in Q30, the gain held until the last peak has passed and the per
+    //! frame step taken towards it
+    int32_t gain;
+    int32_t target;
+    int32_t step;
+    uint32_t hold;
+    //! One pole release towards unity in Q24
+    int32_t release;
+
+    bool compressor;
+    //! One pole crossovers in Q15 and their states, with 4 fraction bits
+    int32_t low_coefficient;
+    int32_t high_coefficient;
+    int32_t low_state[2];
+    int32_t high_state[2];
+    //! Per band peak envelopes, and thresholds to compare them against
+    int32_t envelopes[LIMITER_BANDS];
+    int32_t thresholds[LIMITER_BANDS];
+    //! 1 - 1 / ratio for each band
+    float slopes[LIMITER_BANDS];
+    //! Band gains in Q15 the last slice ended on
+    int32_t band_gains[LIMITER_BANDS];
+    //! Envelope attack and release coefficients in Q15
+    int32_t envelope_attack;
+    int32_t envelope_release;
+} limiter;
+
+void limiter_init(limiter *limiter, uint32_t sample_rate, size_t lookahead);
+
+bool limiter_configure(limiter *limiter, const limiter_config *config);
+
+void limiter_get_config(const limiter *limiter, limiter_config *config);
+
+void limiter_set_lookahead(limiter *limiter, size_t lookahead);
+
+void limiter_process(limiter *limiter, int16_t *stereo, size_t frames);
+
+#endif
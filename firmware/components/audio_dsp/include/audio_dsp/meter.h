@@ -0,0 +1,44 @@
+#ifndef AUDIO_DSP_METER_H
+#define AUDIO_DSP_METER_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+typedef enum {
+    //! The A2DP stream after resampling, before the voice is mixed in
+    MeterMusic,
+    //! The voice pipeline's output
+    MeterVoice,
+    MeterSourceCount,
+} MeterSource;
+
+typedef struct {
+    //! Highest absolute sample since the level was last read
+    uint16_t peak;
+    //! Smoothed over roughly the last four blocks
+    uint16_t rms;
+} meter_level;
+
+//! Samples of the output mix kept for spectrum analysis, about 21 ms at 48 kHz
+#define METER_TAP_SIZE 1024
+
+//! Octave bands from 125 Hz to 16 kHz
+#define METER_SPECTRUM_BINS 8
+
+void meter_init(uint32_t sample_rate);
+
+void meter_set_enabled(bool enabled);
+
+bool meter_enabled(void);
+
+void meter_update(MeterSource source, const int16_t *samples, size_t frames,
+                  size_t channels);
+
+void meter_tap(const int16_t *stereo, size_t frames);
+
+void meter_read(MeterSource source, meter_level *level);
+
+void meter_spectrum(uint8_t bins[METER_SPECTRUM_BINS]);
+
+#endif
@@ -0,0 +1,108 @@
+#ifndef AUDIO_DSP_MIXER_H
+#define AUDIO_DSP_MIXER_H
+
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+//! Sources one mixer sums
+#define MIXER_MAX_SOURCES 8
+
+//! Unity source gain, the largest gain is just under 16 times, +24 dB
+#define MIXER_UNITY_GAIN 4096
+
+//! Sum level where the soft limiter starts bending, about -2.5 dBFS
+#define MIXER_DEFAULT_KNEE 24576
+
+typedef enum {
+    //! The source's level drives the ducker, whether or not it is muted
+    MixerSidechain = 1 << 0,
+    //! The source dips while a sidechain source is above the threshold
+    MixerDucked = 1 << 1,
+} MixerSourceFlags;
+
+typedef struct {
+    //! Interleaved block to mix from next, NULL when the source has nothing
+    //! this block. Only touched by the mixing task.
+    const int16_t *samples;
+    uint8_t channels;
+    uint8_t flags;
+    //! Left out of the sum, though a sidechain is still measured
+    bool muted;
+    //! Gain asked for, MIXER_UNITY_GAIN is unity. May be set from any task.
+    _Atomic uint16_t gain;
+    //! Gain the previous block ended on, ducking included
+    uint16_t applied;
+} mixer_source;
+
+typedef struct {
+    uint16_t attack_ms;
+    uint16_t release_ms;
+    //! How long ducking holds after the sidechain drops, so music does not
+    //! swell back between words
+    uint16_t hold_ms;
+} mixer_ducking_times;
+
+#define MIXER_DEFAULT_DUCKING_TIMES()                                          \
+    {                                                                          \
+        .attack_ms = 10,                                                       \
+        .release_ms = 400,                                                     \
+        .hold_ms = 250,                                                        \
+    }
+
+/**
+ * Sums up to MIXER_MAX_SOURCES blocks of 16 bit audio into one interleaved
+ * stereo block. Each input is read once and the output written once, through a
+ * small 32 bit accumulator, and the sum goes through a soft limiter instead of
+ * hard clipping. Gain changes ramp across a block so they never click.
+ *
+ * Ducking follows the peak of the sidechain sources: while it is above the
+ * threshold every ducked source is pulled down to the duck depth. The level is
+ * measured while mixing, so ducking reacts from the block after the one that
+ * crossed the threshold.
+ *
+ * Not thread safe apart from the atomic fields, which other tasks may set.
+ */
+typedef struct {
+    mixer_source sources[MIXER_MAX_SOURCES];
+    size_t source_count;
+
+    int32_t knee;
+    //! Peak sidechain level that starts ducking, 0 never ducks
+    _Atomic uint16_t duck_threshold;
+    //! Gain ducked sources drop to, MIXER_UNITY_GAIN does nothing
+    _Atomic uint16_t duck_depth;
+
+    //! Gain steps per frame while ducking in and out
+    uint32_t attack_step;
+    uint32_t release_step;
+    uint32_t hold_frames;
+
+    //! Current ducking gain and how long it has left to hold
+    uint16_t duck_gain;
+    uint32_t hold_remaining;
+    //! Sidechain peak of the last block mixed
+    uint16_t sidechain_peak;
+
+    //! Samples the soft limiter bent, for telling how hot the mix runs
+    uint32_t limited_samples;
+} mixer;
+
+void mixer_init(mixer *mixer, uint32_t sample_rate,
+                const mixer_ducking_times *times);
+
+int mixer_add_source(mixer *mixer, uint8_t channels, uint8_t flags,
+                     uint16_t gain);
+
+void mixer_set_gain(mixer *mixer, int source, uint16_t gain);
+
+void mixer_set_duck_threshold(mixer *mixer, uint16_t threshold);
+
+void mixer_set_duck_depth(mixer *mixer, uint16_t depth);
+
+void mixer_process(mixer *mixer, int16_t *stereo, size_t frames);
+
+uint16_t mixer_gain_from_db(float db);
+
+#endif
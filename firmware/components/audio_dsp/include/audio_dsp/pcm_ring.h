@@ -0,0 +1,36 @@
+#ifndef AUDIO_DSP_PCM_RING_H
+#define AUDIO_DSP_PCM_RING_H
+
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/**
+ * Single-producer/single-consumer lock-free byte ring used to hand PCM between
+ * the Bluetooth stack and the I2S writer.
+ *
+ * The producer only ever stores `head` and the consumer only ever stores
+ * `tail`, so neither side takes a lock or blocks. Both indices run freely and
+ * are masked on access, which requires the capacity to be a power of two.
+ */
+typedef struct {
+    uint8_t *buffer;
+    size_t capacity;
+    size_t mask;
+    _Atomic size_t head;
+    _Atomic size_t tail;
+} pcm_ring;
+
+bool pcm_ring_init(pcm_ring *ring, uint8_t *storage, size_t capacity);
+
+// Producer side
+size_t pcm_ring_write(pcm_ring *ring, const uint8_t *data, size_t len);
+size_t pcm_ring_space(const pcm_ring *ring);
+
+// Consumer side
+size_t pcm_ring_read(pcm_ring *ring, uint8_t *dest, size_t len);
+size_t pcm_ring_fill(const pcm_ring *ring);
+void pcm_ring_discard(pcm_ring *ring);
+
+#endif
@@ -0,0 +1,72 @@
+#ifndef AUDIO_DSP_PIPELINE_H
+#define AUDIO_DSP_PIPELINE_H
+
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#define AUDIO_PIPELINE_MAX_STAGES 8
+
+/**
+ * Processes one block of mono 16 bit samples in place. Stages run back to back
+ * on the audio core and must not block or allocate.
+ */
+typedef void (*audio_stage_process)(void *ctx, int16_t *samples,
+                                    size_t frames);
+
+typedef struct {
+    const char *name;
+    audio_stage_process process;
+    void *ctx;
+    //! Cycles the stage may spend per block, 0 leaves it unbudgeted
+    uint32_t cycle_budget;
+    //! Frames the stage delays the signal by, beyond the block itself
+    uint32_t latency_frames;
+    atomic_bool enabled;
+
+    uint32_t last_cycles;
+    uint32_t max_cycles;
+    uint32_t budget_overruns;
+} audio_stage;
+
+typedef struct {
+    audio_stage stages[AUDIO_PIPELINE_MAX_STAGES];
+    _Atomic size_t stage_count;
+
+    size_t block_frames;
+    uint32_t sample_rate;
+    uint32_t cpu_hz;
+    //! Cycles available per block before the block deadline is missed
+    uint32_t block_cycles;
+
+    uint32_t last_cycles;
+    uint32_t max_cycles;
+    uint32_t deadline_misses;
+} audio_pipeline;
+
+bool audio_pipeline_init(audio_pipeline *pipeline, size_t block_frames,
+                         uint32_t sample_rate, uint32_t cpu_hz);
+
+int audio_pipeline_add_stage(audio_pipeline *pipeline, const char *name,
+                             audio_stage_process process, void *ctx,
+                             uint32_t cycle_budget);
+
+void audio_pipeline_set_enabled(audio_pipeline *pipeline, int stage,
+                                bool enabled);
+
+void audio_pipeline_set_latency(audio_pipeline *pipeline, int stage,
+                                uint32_t frames);
+
+uint32_t audio_pipeline_latency_frames(const audio_pipeline *pipeline);
+
+void audio_pipeline_process(audio_pipeline *pipeline, int16_t *samples);
+
+void audio_pipeline_set_block_frames(audio_pipeline *pipeline,
+                                     size_t block_frames);
+
+void audio_pipeline_set_cpu_hz(audio_pipeline *pipeline, uint32_t cpu_hz);
+
+uint32_t audio_pipeline_block_us(const audio_pipeline *pipeline);
+
+#endif
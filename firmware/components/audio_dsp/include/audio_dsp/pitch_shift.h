@@ -0,0 +1,81 @@
+#ifndef AUDIO_DSP_PITCH_SHIFT_H
+#define AUDIO_DSP_PITCH_SHIFT_H
+
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#define PITCH_SHIFT_MAX_SEMITONES 12
+
+//! History of input samples, must be a power of two and hold the longest delay
+//! plus a grain either side of it
+#define PITCH_SHIFT_BUFFER_SIZE 4096
+#define PITCH_SHIFT_DECIMATION 8
+#define PITCH_SHIFT_DECIMATED_SIZE 256
+#define PITCH_SHIFT_WINDOW_SIZE 1024
+
+/**
+ * Fixed point real time pitch shifter for the voice path, based on TD-PSOLA.
+ *
+ * The pitch period is tracked with an AMDF on a decimated copy of the input and
+ * two period grains are re-spaced at the target period. With formant
+ * preservation the grains are copied as is, keeping the spectral envelope (and
+ * with it the formants). Without it the grains are also resampled by the pitch
+ * ratio, so formants move with the pitch.
+ *
+ * While shifting, the output runs one pitch period behind the input, the one
+ * detected when shifting started but never more than default_period, 5 ms at
+ * 48 kHz. At 0 semitones the shifter is bypassed and adds no delay at all.
+ * Going in and out of the bypass crossfades over one block.
+ */
+typedef struct {
+    int16_t input[PITCH_SHIFT_BUFFER_SIZE];
+    int32_t output[PITCH_SHIFT_BUFFER_SIZE];
+    int16_t decimated[PITCH_SHIFT_DECIMATED_SIZE];
+    int16_t window[PITCH_SHIFT_WINDOW_SIZE];
+
+    //! Absolute sample counts, only ever compared through differences so
+    //! wrapping is harmless
+    uint32_t write_pos;
+    uint32_t decimated_pos;
+    int32_t decimation_sum;
+    uint8_t decimation_count;
+
+    uint16_t min_period;
+    uint16_t max_period;
+    uint16_t default_period;
+    uint16_t period;
+    bool voiced;
+
+    //! PSOLA state, the next synthesis mark with its Q16 fraction and the
+    //! analysis mark it is currently taking grains from
+    uint32_t synthesis_mark;
+    uint32_t synthesis_frac;
+    uint32_t analysis_mark;
+    //! First output sample that has not been emitted yet
+    uint32_t output_pos;
+    //! Samples output_pos runs behind write_pos, fixed while shifting
+    uint16_t lag;
+    //! Passing the input straight through at unity ratio
+    bool bypassed;
+
+    //! Pitch ratio in Q16, written by the control side and picked up at the
+    //! next block boundary
+    _Atomic int32_t requested_ratio;
+    atomic_bool requested_formant;
+    int32_t ratio;
+    bool formant;
+} pitch_shift;
+
+void pitch_shift_init(pitch_shift *shifter, uint32_t sample_rate);
+
+bool pitch_shift_set_semitones(pitch_shift *shifter, int8_t semitones);
+
+void pitch_shift_set_formant_preservation(pitch_shift *shifter, bool enabled);
+
+void pitch_shift_process(void *ctx, int16_t *samples, size_t frames);
+
+uint32_t pitch_shift_latency_frames(const pitch_shift *shifter);
+
+#endif
@@ -0,0 +1,222 @@
+#ifndef AUDIO_DSP_PROTOCOL_H
+#define AUDIO_DSP_PROTOCOL_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/**
+ * Frames on the control channel are laid out as
+ *
+ *   u8 start, u8 type, u8 sequence, u16 payload length, payload, u16 CRC
+ *
+ * All multi byte fields are little endian. The CRC is CRC-16/CCITT-FALSE over
+ * everything from the type byte to the end of the payload.
+ */
+
+#define PROTOCOL_START_OF_FRAME 0xA5
+#define PROTOCOL_HEADER_SIZE 5
+#define PROTOCOL_CRC_SIZE 2
+#define PROTOCOL_MAX_PAYLOAD 1024
+#define PROTOCOL_MAX_FRAME                                                     \
+    (PROTOCOL_HEADER_SIZE + PROTOCOL_MAX_PAYLOAD + PROTOCOL_CRC_SIZE)
+
+//! Replies carry the request's type with this bit set and the same sequence.
+//! Their payload always starts with a ProtocolStatus byte.
+#define PROTOCOL_RESPONSE 0x80
+
+typedef enum {
+    MessagePing = 0x01,
+    //! A batch of parameter records, applied all or nothing. The reply adds
+    //! the index of the offending record after the status.
+    MessageSetParameters = 0x02,
+    //! Replied to with the binary instrumentation snapshot
+    MessageGetSnapshot = 0x03,
+    //! Replied to with the active latency profile's report
+    MessageGetLatencyReport = 0x04,
+    //! u8 rate in Hz, 0 stops the stream, followed by a u8 TelemetryField mask
+    MessageSetTelemetry = 0x05,
+    //! u16 soundbank clip index followed by a u8 volume, 255 is unity
+    MessagePlayClip = 0x06,
+    //! Silences every playing clip
+    MessageStopClips = 0x07,
+    //! Starts or resumes a soundbank upload, u32 image size and u32 CRC-32 of
+    //! the image. Replied to with u32 offset to continue from, u16 largest
+    //! chunk data length and u8 chunks the sender may have unacknowledged.
+    //! After a StatusOk reply the link is in bulk mode, see below.
+    MessageUploadBegin = 0x08,
+    //! Unsolicited, one sample per frame with a running sequence number so the
+    //! client can tell how many were dropped under congestion
+    MessageTelemetry = 0x40,
+    //! Unsolicited, one per bulk chunk processed: u8 ProtocolStatus, u32
+    //! offset of the chunk and u32 bytes of the image committed so far.
+    //! StatusMalformed means the chunk was lost, resend from the committed
+    //! offset. StatusInvalidParameter means it did not follow on from the
+    //! committed offset and was dropped.
+    MessageUploadProgress = 0x41,
+} MessageType;
+
+/**
+ * In bulk mode the sender streams raw chunks instead of frames:
+ *
+ *   u8 start, u8 reserved, u16 data length, u32 image offset, data, u32 CRC
+ *
+ * The CRC is CRC-32 (zlib) over everything from the reserved byte to the end
+ * of the data. Any control frame in place of the next chunk ends bulk mode.
+ */
+
+#define PROTOCOL_CHUNK_START 0xB5
+#define PROTOCOL_CHUNK_HEADER_SIZE 8
+#define PROTOCOL_CHUNK_CRC_SIZE 4
+//! One flash sector, so every chunk is a single aligned program operation
+#define PROTOCOL_CHUNK_MAX_DATA 4096
+#define PROTOCOL_CHUNK_MAX_SIZE                                                \
+    (PROTOCOL_CHUNK_HEADER_SIZE + PROTOCOL_CHUNK_MAX_DATA +                    \
+     PROTOCOL_CHUNK_CRC_SIZE)
+
+/**
+ * Sections of a MessageTelemetry payload. The payload is the field mask and a
+ * u32 millisecond timestamp followed by each present section in this order:
+ *
+ *   levels:   u16 music peak, music RMS, voice peak, voice RMS
+ *   spectrum: u8 per octave band from 125 Hz, dB above -96 dBFS
+ *   battery:  u16 millivolts, u8 state of charge in percent, 0 if unknown,
+ *             u8 PowerMode the governor is in
+ *   pipeline: u32 underruns, overruns, voice max cycles, deadline misses
+ */
+typedef enum {
+    TelemetryLevels = 1 << 0,
+    TelemetrySpectrum = 1 << 1,
+    TelemetryBattery = 1 << 2,
+    TelemetryPipeline = 1 << 3,
+} TelemetryField;
+
+typedef enum {
+    StatusOk,
+    StatusUnknownType,
+    StatusMalformed,
+    StatusInvalidParameter,
+    //! The request was valid but could not be applied right now
+    StatusBusy,
+} ProtocolStatus;
+
+/**
+ * Records in a MessageSetParameters payload are a parameter byte followed by a
+ * u16 value
+ */
+#define PROTOCOL_PARAMETER_SIZE 3
+
+typedef enum {
+    ParamInputVolumeLeft = 0x01,
+    ParamInputVolumeRight = 0x02,
+    ParamOutputVolumeLeft = 0x03,
+    ParamOutputVolumeRight = 0x04,
+    ParamDacVolumeLeft = 0x05,
+    ParamDacVolumeRight = 0x06,
+    ParamDacMute = 0x07,
+    ParamSpeakerVolumeLeft = 0x08,
+    ParamSpeakerVolumeRight = 0x09,
+    //! Signed semitones in the low byte
+    ParamPitchSemitones = 0x10,
+    ParamFormantPreservation = 0x11,
+    //! Voice pipeline stage index in the high byte, enabled in the low byte
+    ParamStageEnabled = 0x12,
+    //! DspPreset applied to the mic's level control and every output's tone
+    ParamDspPreset = 0x13,
+    //! VoiceFxPreset the voice is switched to, crossfading over 10 ms
+    ParamVoicePreset = 0x14,
+    ParamLatencyProfile = 0x20,
+    ParamResamplerQuality = 0x21,
+    //! AudioSource in the high byte, mask of AudioOutputs it is mixed into in
+    //! the low byte
+    ParamRoute = 0x22,
+    //! AudioSource in the high byte, signed dB from -60 to +12 in the low
+    //! byte, -60 mutes
+    ParamSourceGain = 0x23,
+    //! dB the stream is ducked by while the wearer speaks, 0 to 60
+    ParamDuckDepth = 0x24,
+    //! Voice peak in dB below full scale that ducks the stream, 0 never ducks
+    ParamDuckThreshold = 0x25,
+    //! AudioOutput in the high byte, dB below full scale its limiter holds
+    //! peaks under in the low byte
+    ParamLimiterCeiling = 0x26,
+    //! AudioOutput in the high byte, its three band compressor enabled in the
+    //! low byte
+    ParamCompressor = 0x27,
+    //! 0 lets the governor follow the battery, 1 + PowerMode pins a mode
+    ParamPowerMode = 0x30,
+    //! Seconds of silence before the audio hardware powers down, 0 never
+    ParamIdleTimeout = 0x31,
+} ProtocolParameter;
+
+typedef struct {
+    uint8_t type;
+    uint8_t sequence;
+    uint16_t length;
+    //! Points into the buffer that was fed to the parser, only valid for the
+    //! duration of the handler call
+    const uint8_t *payload;
+} protocol_frame;
+
+typedef struct {
+    uint8_t parameter;
+    uint16_t value;
+} protocol_parameter;
+
+typedef struct {
+    uint32_t offset;
+    uint16_t length;
+    //! Points into the chunk that was decoded
+    const uint8_t *data;
+} protocol_chunk;
+
+typedef void (*protocol_frame_handler)(void *ctx, const protocol_frame *frame);
+
+typedef struct {
+    protocol_frame_handler handler;
+    void *ctx;
+
+    //! Holds a frame that straddles two feeds, complete frames are parsed in
+    //! place and never copied
+    uint8_t partial[PROTOCOL_MAX_FRAME];
+    size_t partial_length;
+
+    uint32_t frames;
+    uint32_t crc_errors;
+    uint32_t length_errors;
+    //! Bytes skipped while looking for the start of a frame
+    uint32_t dropped_bytes;
+} protocol_parser;
+
+uint16_t protocol_crc16(uint16_t crc, const uint8_t *data, size_t len);
+
+uint32_t protocol_crc32(uint32_t crc, const uint8_t *data, size_t len);
+
+void protocol_parser_init(protocol_parser *parser,
+                          protocol_frame_handler handler, void *ctx);
+
+void protocol_parser_feed(protocol_parser *parser, const uint8_t *data,
+                          size_t len);
+
+void protocol_parser_reset(protocol_parser *parser);
+
+size_t protocol_encode(uint8_t *out, size_t capacity, uint8_t type,
+                       uint8_t sequence, const uint8_t *payload,
+                       uint16_t length);
+
+size_t protocol_append_parameter(uint8_t *payload, size_t length,
+                                 size_t capacity, uint8_t parameter,
+                                 uint16_t value);
+
+bool protocol_next_parameter(const protocol_frame *frame, size_t *offset,
+                             protocol_parameter *parameter);
+
+size_t protocol_encode_chunk(uint8_t *out, size_t capacity, uint32_t offset,
+                             const uint8_t *data, uint16_t length);
+
+int protocol_chunk_length(const uint8_t header[PROTOCOL_CHUNK_HEADER_SIZE]);
+
+bool protocol_decode_chunk(const uint8_t *data, size_t size,
+                           protocol_chunk *chunk);
+
+#endif
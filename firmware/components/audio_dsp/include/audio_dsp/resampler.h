@@ -0,0 +1,56 @@
+#ifndef AUDIO_DSP_RESAMPLER_H
+#define AUDIO_DSP_RESAMPLER_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+//! 44.1 kHz to 48 kHz needs 160 phases (48000 / 44100 = 160 / 147)
+#define RESAMPLER_MAX_PHASES 160
+#define RESAMPLER_MAX_TAPS 32
+#define RESAMPLER_CHANNELS 2
+
+/**
+ * Filter length per phase, trading stopband rejection and passband width
+ * against CPU time
+ */
+typedef enum {
+    ResamplerLow = 8,
+    ResamplerMedium = 16,
+    ResamplerHigh = 32,
+} ResamplerQuality;
+
+/**
+ * Polyphase FIR sample rate converter for interleaved 16 bit stereo. The
+ * conversion ratio is reduced to up / down, and each output frame is one
+ * `taps` long dot product against the phase selected by the running position.
+ */
+typedef struct {
+    int16_t coeffs[RESAMPLER_MAX_PHASES * RESAMPLER_MAX_TAPS];
+    //! Input history per channel, stored twice so every dot product can read
+    //! a contiguous window
+    int16_t history[RESAMPLER_CHANNELS][2 * RESAMPLER_MAX_TAPS];
+
+    uint32_t input_rate;
+    uint32_t output_rate;
+    uint16_t up;
+    uint16_t down;
+    uint16_t taps;
+    uint16_t phase;
+    uint16_t history_pos;
+    bool passthrough;
+} resampler;
+
+bool resampler_configure(resampler *converter, uint32_t input_rate,
+                         uint32_t output_rate, ResamplerQuality quality);
+
+void resampler_reset(resampler *converter);
+
+size_t resampler_process(resampler *converter, const int16_t *input,
+                         size_t input_frames, size_t *consumed,
+                         int16_t *output, size_t output_frames);
+
+size_t resampler_input_needed(const resampler *converter,
+                              size_t output_frames);
+
+#endif
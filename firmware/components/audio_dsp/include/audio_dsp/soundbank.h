@@ -0,0 +1,67 @@
+#ifndef AUDIO_DSP_SOUNDBANK_H
+#define AUDIO_DSP_SOUNDBANK_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/**
+ * A soundbank image holds the costume's sound effects, laid out so clips can
+ * be played straight from memory mapped flash. All fields are little endian:
+ *
+ *   header, 16 bytes:
+ *     u32 magic "SBNK", u16 version, u16 clip count, u32 sample rate,
+ *     u32 image size including the header
+ *   clip table, 32 bytes per clip:
+ *     u32 data offset from the start of the image, a multiple of 4
+ *     u32 data size in bytes, u32 frames, u8 channels, u8 SoundbankEncoding,
+ *     u16 reserved, char name[16] padded with NUL
+ *   clip data
+ */
+
+#define SOUNDBANK_MAGIC 0x4B4E4253
+#define SOUNDBANK_VERSION 1
+
+#define SOUNDBANK_HEADER_SIZE 16
+#define SOUNDBANK_ENTRY_SIZE 32
+#define SOUNDBANK_NAME_SIZE 16
+
+#define SOUNDBANK_MAX_CLIPS 256
+
+typedef enum {
+    //! Interleaved signed 16 bit samples
+    SoundbankPcm16 = 0,
+    //! IMA-ADPCM blocks as laid out in adpcm.h, about a quarter of the size
+    SoundbankImaAdpcm = 1,
+    SoundbankEncodingCount,
+} SoundbankEncoding;
+
+typedef struct {
+    const uint8_t *image;
+    uint32_t size;
+    uint16_t clip_count;
+    uint32_t sample_rate;
+} soundbank;
+
+typedef struct {
+    //! Points into the image, nothing is copied
+    const uint8_t *data;
+    uint32_t size;
+    uint32_t frames;
+    uint8_t channels;
+    SoundbankEncoding encoding;
+    char name[SOUNDBANK_NAME_SIZE + 1];
+} soundbank_clip;
+
+//! Size the header claims, for mapping the rest once the header is readable.
+//! Returns 0 if `header` does not start a soundbank image.
+uint32_t soundbank_image_size(const uint8_t header[SOUNDBANK_HEADER_SIZE]);
+
+bool soundbank_open(soundbank *bank, const void *image, size_t size);
+
+bool soundbank_clip_at(const soundbank *bank, uint16_t index,
+                       soundbank_clip *clip);
+
+int soundbank_find(const soundbank *bank, const char *name);
+
+#endif
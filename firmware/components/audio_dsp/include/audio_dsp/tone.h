@@ -0,0 +1,80 @@
+#ifndef AUDIO_DSP_TONE_H
+#define AUDIO_DSP_TONE_H
+
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+//! Shelf gains in 1.5 dB steps, the WM8988's range
+#define TONE_MIN_STEPS -4
+#define TONE_MAX_STEPS 6
+
+#define TONE_MAX_DEPTH_3D 15
+
+/**
+ * Bass, treble and 3D settings in the step units of the WM8988's tone and 3D
+ * registers, so the codec and tone_process give the same response
+ */
+typedef struct {
+    //! Low shelf, 1.5 dB a step from -6 dB to +9 dB, 0 bypasses it
+    int8_t bass;
+    //! Moves the bass corner from 130 Hz up to 200 Hz
+    bool bass_high_cutoff;
+    //! High shelf, in the same steps as the bass
+    int8_t treble;
+    //! Moves the treble corner from 8 kHz down to 4 kHz
+    bool treble_low_cutoff;
+    //! Stereo widening in fifteenths, 0 turns it off
+    uint8_t depth_3d;
+    //! Moves the bottom of the widened band from 200 Hz up to 500 Hz
+    bool narrow_3d_low;
+    //! Moves the top of the widened band from 2.2 kHz down to 1.5 kHz
+    bool narrow_3d_high;
+} tone_config;
+
+bool tone_config_valid(const tone_config *config);
+
+typedef struct {
+    //! Q28 coefficients with a0 normalised out
+    int32_t b0, b1, b2, a1, a2;
+    //! Per channel inputs and, with 8 fraction bits, outputs
+    int32_t x[2][2];
+    int32_t y[2][2];
+} tone_biquad;
+
+/**
+ * Software version of the codec's tone control and 3D enhancement for an
+ * interleaved stereo output. The shelves are fixed point biquads designed for
+ * the codec's corner frequencies, and the widening adds the band limited
+ * difference of the two channels back to each with opposite sign.
+ */
+typedef struct {
+    //! Packed tone_config, written by the control side and picked up at the
+    //! next block boundary
+    _Atomic uint32_t requested;
+    uint32_t packed;
+    tone_config config;
+
+    uint32_t sample_rate;
+    tone_biquad bass;
+    tone_biquad treble;
+
+    //! One pole corners of the widened band in Q15, their states and the
+    //! depth in Q14
+    int32_t low_coefficient;
+    int32_t high_coefficient;
+    int32_t low_state;
+    int32_t high_state;
+    int32_t depth;
+} tone_control;
+
+void tone_init(tone_control *tone, uint32_t sample_rate);
+
+bool tone_configure(tone_control *tone, const tone_config *config);
+
+bool tone_active(const tone_config *config);
+
+void tone_process(tone_control *tone, int16_t *stereo, size_t frames);
+
+#endif
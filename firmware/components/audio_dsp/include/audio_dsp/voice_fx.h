@@ -0,0 +1,182 @@
+#ifndef AUDIO_DSP_VOICE_FX_H
+#define AUDIO_DSP_VOICE_FX_H
+
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+//! Length of the crossfade between two presets, 10 ms at 48 kHz
+#define VOICE_FX_CROSSFADE_FRAMES 480
+
+//! Frames each stage works through at a time, which bounds its stack use
+#define VOICE_FX_CHUNK_FRAMES 32
+
+//! Entries in the carrier sine table, a power of two
+#define VOICE_FX_SINE_SIZE 256
+
+//! Vocoder bands, spaced half an octave apart from
+//! VOICE_FX_VOCODER_LOW_HZ up
+#define VOICE_FX_VOCODER_BANDS 12
+#define VOICE_FX_VOCODER_LOW_HZ 150
+
+//! Chorus history, a power of two holding the longest sweep plus a chunk
+#define VOICE_FX_CHORUS_SIZE 1024
+#define VOICE_FX_CHORUS_BASE_MS 12
+#define VOICE_FX_CHORUS_MAX_DEPTH_MS 8
+#define VOICE_FX_CHORUS_MAX_VOICES 2
+
+//! Character voices, each a combination of the effects below
+typedef enum {
+    VoiceFxOff,
+    //! Vocoded onto a monotone buzz
+    VoiceFxRobot,
+    //! Ring modulated by a slow sine, the classic metallic alien
+    VoiceFxMetallic,
+    //! Few bits at a quarter of the rate, a cheap radio
+    VoiceFxRadio,
+    //! Two swept copies under the voice, a crowd speaking as one
+    VoiceFxChorus,
+    //! Ring modulated by a square, crushed and doubled
+    VoiceFxDroid,
+    VoiceFxPresetCount,
+} VoiceFxPreset;
+
+typedef struct {
+    //! Carrier the voice is multiplied with in Hz, 0 turns it off
+    uint16_t ring_hz;
+    //! Square carrier instead of a sine, which is harsher
+    bool ring_square;
+    //! Pitch of the vocoder's carrier in Hz, 0 turns it off
+    uint16_t vocoder_hz;
+    //! Pulse train carrier instead of a sawtooth, which is buzzier
+    bool vocoder_pulse;
+    //! Bits kept of each sample, 0 or 16 leave them alone
+    uint8_t crush_bits;
+    //! Each kept sample is held for this many, 0 or 1 keep the full rate
+    uint8_t crush_hold;
+    //! Swept copies mixed under the voice, 0 turns the chorus off
+    uint8_t chorus_voices;
+    //! How far the copies sweep either side of VOICE_FX_CHORUS_BASE_MS
+    uint8_t chorus_depth_ms;
+    //! Sweep rate in tenths of a Hz
+    uint8_t chorus_rate;
+} voice_fx_config;
+
+//! Runs one slot of an effect over a chunk in place
+typedef void (*voice_fx_kernel)(void *slot, int16_t *samples, size_t frames);
+
+/**
+ * What every effect stage has in common: two slots of the effect's state, the
+ * one playing and the one the last preset switch left behind, faded between
+ * over VOICE_FX_CROSSFADE_FRAMES
+ */
+typedef struct {
+    //! Kernel specialised for each slot's settings, NULL while it is off
+    voice_fx_kernel kernels[2];
+    void *slots[2];
+    //! Slot playing, or being faded to
+    uint8_t active;
+    //! Frames into the crossfade, VOICE_FX_CROSSFADE_FRAMES once settled
+    uint16_t fade;
+    //! Preset the active slot was set up for
+    VoiceFxPreset preset;
+} voice_fx_switch;
+
+typedef struct {
+    const int16_t *sine;
+    //! Carrier phase and step, a whole cycle being 2^32
+    uint32_t phase;
+    uint32_t increment;
+} voice_fx_ring_slot;
+
+typedef struct {
+    //! Analysis and synthesis filter states, with 2 fraction bits
+    int32_t modulator_low[VOICE_FX_VOCODER_BANDS];
+    int32_t modulator_band[VOICE_FX_VOCODER_BANDS];
+    int32_t carrier_low[VOICE_FX_VOCODER_BANDS];
+    int32_t carrier_band[VOICE_FX_VOCODER_BANDS];
+    //! Envelope of each analysis band, with 8 fraction bits
+    int32_t envelopes[VOICE_FX_VOCODER_BANDS];
+    //! Shared band tuning, in Q12
+    const int16_t *frequencies;
+    const int16_t *dampings;
+    uint32_t phase;
+    uint32_t increment;
+    //! Breath mixed into the carrier so consonants still come through
+    uint32_t noise;
+} voice_fx_vocoder_slot;
+
+typedef struct {
+    //! Keeps the bits above this one
+    int16_t mask;
+    uint8_t hold;
+    uint8_t count;
+    int16_t held;
+} voice_fx_crush_slot;
+
+typedef struct {
+    //! Shared history, written once per chunk before either slot reads it
+    const int16_t *history;
+    uint32_t chunk_start;
+    //! Sweep centre and depth, in frames with 8 fraction bits
+    int32_t base;
+    int32_t depth;
+    uint32_t phase;
+    uint32_t increment;
+} voice_fx_chorus_slot;
+
+/**
+ * Character voice effects for the mono voice pipeline: a ring modulator, a
+ * channel vocoder with its own carrier oscillator, a bit crusher and a chorus.
+ * Each is a pipeline stage of its own, so each is budgeted and timed per block
+ * like any other stage, and stages that are off cost next to nothing.
+ *
+ * Presets are switched at block boundaries. Every stage whose settings change
+ * runs the old and the new settings side by side on separate state and
+ * crossfades from one to the other, so a switch never clicks. Every kernel is
+ * fixed point and specialised for its settings when the preset is applied,
+ * keeping the per sample loops free of branches on them.
+ */
+typedef struct {
+    //! Written by the control side and picked up at the next block boundary
+    _Atomic VoiceFxPreset requested;
+    uint32_t sample_rate;
+
+    int16_t sine[VOICE_FX_SINE_SIZE + 1];
+    int16_t vocoder_frequencies[VOICE_FX_VOCODER_BANDS];
+    int16_t vocoder_dampings[VOICE_FX_VOCODER_BANDS];
+
+    voice_fx_switch ring;
+    voice_fx_ring_slot ring_slots[2];
+
+    voice_fx_switch vocoder;
+    voice_fx_vocoder_slot vocoder_slots[2];
+
+    voice_fx_switch crush;
+    voice_fx_crush_slot crush_slots[2];
+
+    voice_fx_switch chorus;
+    voice_fx_chorus_slot chorus_slots[2];
+    int16_t chorus_history[VOICE_FX_CHORUS_SIZE];
+    uint32_t chorus_position;
+} voice_fx;
+
+const voice_fx_config *voice_fx_preset(VoiceFxPreset preset);
+
+void voice_fx_init(voice_fx *fx, uint32_t sample_rate);
+
+bool voice_fx_set_preset(voice_fx *fx, VoiceFxPreset preset);
+
+VoiceFxPreset voice_fx_get_preset(const voice_fx *fx);
+
+//! Pipeline stages, each taking the voice_fx as its context
+void voice_fx_ring_process(void *ctx, int16_t *samples, size_t frames);
+
+void voice_fx_vocoder_process(void *ctx, int16_t *samples, size_t frames);
+
+void voice_fx_crush_process(void *ctx, int16_t *samples, size_t frames);
+
+void voice_fx_chorus_process(void *ctx, int16_t *samples, size_t frames);
+
+#endif
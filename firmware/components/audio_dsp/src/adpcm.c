@@ -0,0 +1,206 @@
+/**
+ * This file contains the IMA-ADPCM codec used for soundbank clips. Decoding a
+ * sample is a table lookup, a few shifts and adds and two clamps, cheap enough
+ * to run every sound effect voice next to the music path.
+ */
+
+#include "audio_dsp/adpcm.h"
+#include <string.h>
+
+#define STEP_COUNT 89
+
+static const int16_t STEPS[STEP_COUNT] = {
+    7,     8,     9,     10,    11,    12,    13,    14,    16,    17,
+    19,    21,    23,    25,    28,    31,    34,    37,    41,    45,
+    50,    55,    60,    66,    73,    80,    88,    97,    107,   118,
+    130,   143,   157,   173,   190,   209,   230,   253,   279,   307,
+    337,   371,   408,   449,   494,   544,   598,   658,   724,   796,
+    876,   963,   1060,  1166,  1282,  1411,  1552,  1707,  1878,  2066,
+    2272,  2499,  2749,  3024,  3327,  3660,  4026,  4428,  4871,  5358,
+    5894,  6484,  7132,  7845,  8630,  9493,  10442, 11487, 12635, 13899,
+    15289, 16818, 18500, 20350, 22385, 24623, 27086, 29794, 32767,
+};
+
+static const int8_t INDEX_ADJUST[8] = {-1, -1, -1, -1, 2, 4, 6, 8};
+
+static inline int16_t get_i16(const uint8_t *in) {
+    return (int16_t)(in[0] | (in[1] << 8));
+}
+
+/**
+ * Applies one nibble to the channel state and returns the new sample. The
+ * encoder runs the same function, so both sides track identical state.
+ */
+static inline int16_t step(adpcm_channel *channel, uint8_t nibble) {
+    int32_t size = STEPS[channel->step_index];
+    int32_t diff = size >> 3;
+
+    if (nibble & 4) {
+        diff += size;
+    }
+    if (nibble & 2) {
+        diff += size >> 1;
+    }
+    if (nibble & 1) {
+        diff += size >> 2;
+    }
+
+    int32_t predictor = channel->predictor + (nibble & 8 ? -diff : diff);
+    if (predictor > INT16_MAX) {
+        predictor = INT16_MAX;
+    } else if (predictor < INT16_MIN) {
+        predictor = INT16_MIN;
+    }
+
+    int index = channel->step_index + INDEX_ADJUST[nibble & 7];
+    if (index < 0) {
+        index = 0;
+    } else if (index >= STEP_COUNT) {
+        index = STEP_COUNT - 1;
+    }
+
+    channel->predictor = predictor;
+    channel->step_index = index;
+
+    return predictor;
+}
+
+static uint8_t encode_sample(adpcm_channel *channel, int16_t sample) {
+    int32_t size = STEPS[channel->step_index];
+    int32_t diff = sample - channel->predictor;
+    uint8_t nibble = 0;
+
+    if (diff < 0) {
+        nibble = 8;
+        diff = -diff;
+    }
+
+    if (diff >= size) {
+        nibble |= 4;
+        diff -= size;
+    }
+    if (diff >= size >> 1) {
+        nibble |= 2;
+        diff -= size >> 1;
+    }
+    if (diff >= size >> 2) {
+        nibble |= 1;
+    }
+
+    step(channel, nibble);
+
+    return nibble;
+}
+
+size_t adpcm_encoded_size(uint32_t frames, uint8_t channels) {
+    size_t blocks = (frames + ADPCM_BLOCK_FRAMES - 1) / ADPCM_BLOCK_FRAMES;
+    return blocks * adpcm_block_size(channels);
+}
+
+/**
+ * Encodes interleaved `input` into adpcm_encoded_size() bytes at `output`.
+ * The step size carries over between blocks so quiet passages stay precise.
+ */
+void adpcm_encode(const int16_t *input, uint32_t frames, uint8_t channels,
+                  uint8_t *output) {
+    adpcm_channel state[2] = {0};
+
+    memset(output, 0, adpcm_encoded_size(frames, channels));
+
+    for (uint32_t first = 0; first < frames; first += ADPCM_BLOCK_FRAMES) {
+        uint32_t count = frames - first;
+        if (count > ADPCM_BLOCK_FRAMES) {
+            count = ADPCM_BLOCK_FRAMES;
+        }
+
+        const int16_t *in = &input[first * channels];
+        uint8_t *header = output;
+        uint8_t *nibbles = output + channels * ADPCM_CHANNEL_HEADER_SIZE;
+
+        for (uint8_t c = 0; c < channels; c++) {
+            state[c].predictor = in[c];
+
+            header[0] = state[c].predictor;
+            header[1] = (uint16_t)state[c].predictor >> 8;
+            header[2] = state[c].step_index;
+            header += ADPCM_CHANNEL_HEADER_SIZE;
+        }
+
+        for (uint32_t i = 0; i < count; i++) {
+            for (uint8_t c = 0; c < channels; c++) {
+                uint8_t nibble = encode_sample(&state[c], in[i * channels + c]);
+                size_t index = i * channels + c;
+
+                nibbles[index / 2] |= index & 1 ? nibble << 4 : nibble;
+            }
+        }
+
+        output += adpcm_block_size(channels);
+    }
+}
+
+void adpcm_decoder_init(adpcm_decoder *decoder, const uint8_t *data,
+                        uint8_t channels) {
+    memset(decoder, 0, sizeof(*decoder));
+    decoder->data = data;
+    decoder->channels = channels;
+}
+
+/**
+ * Decodes the next `frames` frames as interleaved samples. The caller keeps
+ * track of the clip length, padding past it decodes as whatever it encodes.
+ */
+void adpcm_decode(adpcm_decoder *decoder, int16_t *output, size_t frames) {
+    uint8_t channels = decoder->channels;
+    size_t block_size = adpcm_block_size(channels);
+
+    while (frames > 0) {
+        uint32_t offset = decoder->position % ADPCM_BLOCK_FRAMES;
+        const uint8_t *block =
+            decoder->data + decoder->position / ADPCM_BLOCK_FRAMES * block_size;
+
+        if (offset == 0) {
+            for (uint8_t c = 0; c < channels; c++) {
+                const uint8_t *header = &block[c * ADPCM_CHANNEL_HEADER_SIZE];
+                decoder->state[c].predictor = get_i16(header);
+                decoder->state[c].step_index =
+                    header[2] < STEP_COUNT ? header[2] : STEP_COUNT - 1;
+            }
+        }
+
+        size_t count = ADPCM_BLOCK_FRAMES - offset;
+        if (count > frames) {
+            count = frames;
+        }
+
+        const uint8_t *nibbles = block + channels * ADPCM_CHANNEL_HEADER_SIZE;
+
+        if (channels == 2) {
+            adpcm_channel left = decoder->state[0];
+            adpcm_channel right = decoder->state[1];
+            const uint8_t *in = &nibbles[offset];
+
+            for (size_t i = 0; i < count; i++) {
+                output[2 * i] = step(&left, in[i] & 0x0F);
+                output[2 * i + 1] = step(&right, in[i] >> 4);
+            }
+
+            decoder->state[0] = left;
+            decoder->state[1] = right;
+        } else {
+            adpcm_channel mono = decoder->state[0];
+
+            for (size_t i = 0; i < count; i++) {
+                size_t index = offset + i;
+                uint8_t byte = nibbles[index / 2];
+                output[i] = step(&mono, index & 1 ? byte >> 4 : byte & 0x0F);
+            }
+
+            decoder->state[0] = mono;
+        }
+
+        output += count * channels;
+        decoder->position += count;
+        frames -= count;
+    }
+}
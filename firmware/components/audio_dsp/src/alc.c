@@ -0,0 +1,172 @@
+/**
+ * This file contains the software automatic level control. Levels and times
+ * come from the WM8988's step tables, and everything but the per sample gain
+ * ramp is worked out once per block.
+ */
+
+#include "audio_dsp/alc.h"
+#include <math.h>
+
+//! Fraction bits of the linear gain, and further bits carried while ramping
+#define GAIN_SHIFT 10
+#define RAMP_SHIFT 8
+
+//! Least gain the codec's input PGA goes down to
+#define MIN_GAIN_DB -17.25f
+
+//! Level a block of digital silence is taken to have
+#define SILENCE_DB -96.0f
+
+//! The codec's ALC defaults, disabled
+static const alc_config RESET_CONFIG = {
+    .target = 11,
+    .max_gain = 7,
+    .decay = 3,
+    .attack = 2,
+};
+
+bool alc_config_valid(const alc_config *config) {
+    return config->target <= ALC_MAX_TARGET &&
+           config->max_gain <= ALC_MAX_MAX_GAIN &&
+           config->hold <= ALC_MAX_HOLD && config->decay <= ALC_MAX_DECAY &&
+           config->attack <= ALC_MAX_ATTACK &&
+           config->gate_threshold <= ALC_MAX_GATE_THRESHOLD;
+}
+
+static uint32_t pack(const alc_config *config) {
+    return config->enabled | config->target << 1 | config->max_gain << 5 |
+           config->hold << 8 | config->decay << 12 | config->attack << 16 |
+           config->gate << 20 | config->gate_threshold << 21 |
+           (uint32_t)config->gate_mutes << 26;
+}
+
+static alc_config unpack(uint32_t packed) {
+    return (alc_config){
+        .enabled = packed & 1,
+        .target = (packed >> 1) & 0xF,
+        .max_gain = (packed >> 5) & 0x7,
+        .hold = (packed >> 8) & 0xF,
+        .decay = (packed >> 12) & 0xF,
+        .attack = (packed >> 16) & 0xF,
+        .gate = (packed >> 20) & 1,
+        .gate_threshold = (packed >> 21) & 0x1F,
+        .gate_mutes = (packed >> 26) & 1,
+    };
+}
+
+void alc_init(alc *alc, uint32_t sample_rate) {
+    alc->packed = pack(&RESET_CONFIG);
+    alc->config = RESET_CONFIG;
+    atomic_init(&alc->requested, alc->packed);
+
+    alc->sample_rate = sample_rate;
+    alc->gain_db = 0;
+    alc->applied = (1 << GAIN_SHIFT) << RAMP_SHIFT;
+    alc->hold_remaining = 0;
+}
+
+/**
+ * Takes effect from the next block. The gain carries on from where it is, so
+ * changing settings never jumps the level. Returns false for settings out of
+ * range.
+ */
+bool alc_configure(alc *alc, const alc_config *config) {
+    if (!alc_config_valid(config)) {
+        return false;
+    }
+
+    atomic_store(&alc->requested, pack(config));
+
+    return true;
+}
+
+static uint32_t block_peak(const int16_t *samples, size_t frames) {
+    uint32_t peak = 0;
+
+    for (size_t i = 0; i < frames; i++) {
+        uint32_t level = samples[i] < 0 ? -samples[i] : samples[i];
+        peak = level > peak ? level : peak;
+    }
+
+    return peak;
+}
+
+/**
+ * Moves the gain in dB for one block with the given input peak, returning
+ * false if the gate is closed and mutes
+ */
+static bool update_gain(alc *alc, float peak_db, size_t frames) {
+    const alc_config *config = &alc->config;
+    float rate = alc->sample_rate;
+
+    if (config->gate && peak_db < -76.5f + 1.5f * config->gate_threshold) {
+        // The gain freezes, so the first word after a pause is not met by a
+        // gain that rose all through the silence
+        return !config->gate_mutes;
+    }
+
+    float target_db = -28.5f + 1.5f * config->target;
+    float max_gain_db = -12.0f + 6.0f * config->max_gain;
+    float wanted = target_db - peak_db;
+
+    if (wanted < alc->gain_db) {
+        float attack_frames = rate * 0.006f * (1 << config->attack);
+        float step = 6.0f * frames / attack_frames;
+
+        alc->gain_db = fmaxf(alc->gain_db - step, wanted);
+        alc->hold_remaining =
+            config->hold == 0 ? 0
+                              : rate * 0.00267f * (1 << (config->hold - 1));
+    } else if (alc->hold_remaining > 0) {
+        alc->hold_remaining -=
+            frames < alc->hold_remaining ? frames : alc->hold_remaining;
+    } else {
+        float decay_frames = rate * 0.024f * (1 << config->decay);
+        float step = 6.0f * frames / decay_frames;
+
+        alc->gain_db = fminf(alc->gain_db + step, wanted);
+    }
+
+    alc->gain_db = fminf(fmaxf(alc->gain_db, MIN_GAIN_DB), max_gain_db);
+
+    return true;
+}
+
+void alc_process(void *ctx, int16_t *samples, size_t frames) {
+    alc *alc = ctx;
+
+    uint32_t requested =
+        atomic_load_explicit(&alc->requested, memory_order_relaxed);
+    if (requested != alc->packed) {
+        alc->packed = requested;
+        alc->config = unpack(requested);
+    }
+
+    if (!alc->config.enabled || frames == 0) {
+        return;
+    }
+
+    uint32_t peak = block_peak(samples, frames);
+    float peak_db =
+        peak == 0 ? SILENCE_DB : 20.0f * log10f(peak / 32768.0f);
+
+    int32_t end = 0;
+    if (update_gain(alc, peak_db, frames)) {
+        end = powf(10.0f, alc->gain_db / 20.0f) * (1 << GAIN_SHIFT) *
+              (1 << RAMP_SHIFT);
+    }
+
+    int32_t gain = alc->applied;
+    int32_t step = (end - gain) / (int32_t)frames;
+
+    for (size_t i = 0; i < frames; i++) {
+        int32_t sample = (samples[i] * (gain >> RAMP_SHIFT)) >> GAIN_SHIFT;
+
+        samples[i] = sample > INT16_MAX   ? INT16_MAX
+                     : sample < INT16_MIN ? INT16_MIN
+                                          : sample;
+        gain += step;
+    }
+
+    alc->applied = end;
+}
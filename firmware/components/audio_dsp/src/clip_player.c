@@ -0,0 +1,164 @@
+/**
+ * This file contains the sound effect voices. Voices are summed into a small
+ * 32 bit accumulator a slice at a time and the result is added to the output
+ * with saturation, so overlapping clips are only clamped once, at the end.
+ */
+
+#include "audio_dsp/clip_player.h"
+#include <string.h>
+
+//! Frames accumulated per pass, bounds the accumulator on the stack
+#define MIX_SLICE_FRAMES 64
+
+static inline int16_t saturate(int32_t sample) {
+    if (sample > INT16_MAX) {
+        return INT16_MAX;
+    }
+    if (sample < INT16_MIN) {
+        return INT16_MIN;
+    }
+    return sample;
+}
+
+void clip_player_init(clip_player *player) {
+    memset(player, 0, sizeof(*player));
+}
+
+/**
+ * Starts `clip` on a free voice, cutting off the oldest one if all are busy.
+ * Returns the voice used, or -1 if the clip cannot be played.
+ */
+int clip_player_start(clip_player *player, const soundbank_clip *clip,
+                      uint16_t gain) {
+    if (clip->frames == 0 || clip->encoding >= SoundbankEncodingCount) {
+        return -1;
+    }
+
+    int chosen = -1;
+
+    for (int i = 0; i < CLIP_PLAYER_VOICES; i++) {
+        const clip_voice *voice = &player->voices[i];
+
+        if (!voice->active) {
+            chosen = i;
+            break;
+        }
+
+        if (chosen < 0 || voice->started < player->voices[chosen].started) {
+            chosen = i;
+        }
+    }
+
+    clip_voice *voice = &player->voices[chosen];
+    if (voice->active) {
+        player->steals++;
+    }
+
+    *voice = (clip_voice){
+        .clip = *clip,
+        .position = 0,
+        .gain = gain,
+        .started = player->next_start++,
+        .active = true,
+    };
+
+    if (clip->encoding == SoundbankImaAdpcm) {
+        adpcm_decoder_init(&voice->decoder, clip->data, clip->channels);
+    }
+
+    return chosen;
+}
+
+void clip_player_stop_all(clip_player *player) {
+    for (size_t i = 0; i < CLIP_PLAYER_VOICES; i++) {
+        player->voices[i].active = false;
+    }
+}
+
+size_t clip_player_active(const clip_player *player) {
+    size_t count = 0;
+
+    for (size_t i = 0; i < CLIP_PLAYER_VOICES; i++) {
+        count += player->voices[i].active;
+    }
+
+    return count;
+}
+
+/**
+ * Adds up to `frames` frames of the voice to the accumulator and advances it,
+ * returning false once the clip has finished. `scratch` receives the decoded
+ * samples of compressed clips.
+ */
+static bool accumulate(clip_voice *voice, int32_t *acc, size_t frames,
+                       int16_t *scratch) {
+    const soundbank_clip *clip = &voice->clip;
+
+    size_t remaining = clip->frames - voice->position;
+    if (frames > remaining) {
+        frames = remaining;
+    }
+
+    const int16_t *in;
+    if (clip->encoding == SoundbankImaAdpcm) {
+        adpcm_decode(&voice->decoder, scratch, frames);
+        in = scratch;
+    } else {
+        in = (const int16_t *)clip->data + voice->position * clip->channels;
+    }
+
+    int32_t gain = voice->gain;
+
+    if (clip->channels == 2) {
+        for (size_t i = 0; i < frames * 2; i++) {
+            acc[i] += (in[i] * gain) >> 8;
+        }
+    } else {
+        for (size_t i = 0; i < frames; i++) {
+            int32_t sample = (in[i] * gain) >> 8;
+            acc[2 * i] += sample;
+            acc[2 * i + 1] += sample;
+        }
+    }
+
+    voice->position += frames;
+
+    return voice->position < clip->frames;
+}
+
+/**
+ * Mixes every active voice into an interleaved stereo block. Voices that run
+ * out free themselves.
+ */
+void clip_player_mix(clip_player *player, int16_t *stereo, size_t frames) {
+    int32_t acc[MIX_SLICE_FRAMES * 2];
+    int16_t scratch[MIX_SLICE_FRAMES * 2];
+
+    for (size_t done = 0; done < frames; done += MIX_SLICE_FRAMES) {
+        size_t slice = frames - done;
+        if (slice > MIX_SLICE_FRAMES) {
+            slice = MIX_SLICE_FRAMES;
+        }
+
+        bool any = false;
+        memset(acc, 0, slice * 2 * sizeof(int32_t));
+
+        for (size_t i = 0; i < CLIP_PLAYER_VOICES; i++) {
+            clip_voice *voice = &player->voices[i];
+
+            if (voice->active) {
+                voice->active = accumulate(voice, acc, slice, scratch);
+                any = true;
+            }
+        }
+
+        if (!any) {
+            return;
+        }
+
+        int16_t *out = &stereo[done * 2];
+        for (size_t i = 0; i < slice * 2; i++) {
+            out[i] = saturate(out[i] + acc[i]);
+        }
+    }
+}
@@ -0,0 +1,435 @@
+/**
+ * This file contains the feedback suppressor. Each analysis frame is windowed
+ * and run through a real FFT, done as a half length complex one, and every
+ * peak in the voice band is tested the way howl detectors usually do it:
+ * against the average of the band (PAPR), its neighbouring bins (PNPR) and its
+ * second harmonic (PHPR). A peak that passes for several frames in a row
+ * without fading gets a notch, centred between bins by fitting a parabola to
+ * the log spectrum around it.
+ *
+ * The analysis looks at the mic before the notches, so a resonance that has
+ * been tamed stops being detected and its notch slowly releases. If it was
+ * still needed the howl builds again and the notch comes straight back.
+ */
+
+#include "audio_dsp/feedback.h"
+#include <math.h>
+#include <stdbool.h>
+#include <string.h>
+
+#define COEFFICIENT_SHIFT 28
+//! Fraction bits kept on the filter outputs fed back
+#define STATE_SHIFT 8
+
+//! Edges of the analysed band in Hz, a helmet speaker does not howl outside it
+#define LOW_HZ 200.0f
+#define HIGH_HZ 10000.0f
+
+//! Quietest peak treated as howl, relative to a full scale sine
+#define FLOOR_DB -60.0f
+//! How far a howl peak stands above the band average, its neighbours three
+//! bins either side and its second harmonic
+#define PAPR_DB 15.0f
+#define PNPR_DB 10.0f
+#define PHPR_DB 10.0f
+#define NEIGHBOUR_BINS 3
+
+//! Most a peak may fade between frames and still count as the same howl
+#define FADE_DB 3.0f
+//! Consecutive frames a peak has to look like howl before it is notched
+#define PERSISTENCE_FRAMES 3
+
+//! Notch width, narrow enough to leave the voice around it alone
+#define NOTCH_Q 16.0f
+//! Depth of a new notch in steps
+#define INITIAL_DEPTH_STEPS 2
+//! Time without a detection before a notch is made a step shallower
+#define RELEASE_S 4
+
+static float from_db(float db) { return powf(10.0f, db / 10.0f); }
+
+static int32_t to_fixed(double value) {
+    return (int32_t)lround(value * (1 << COEFFICIENT_SHIFT));
+}
+
+void feedback_init(feedback_suppressor *suppressor, uint32_t sample_rate) {
+    memset(suppressor, 0, sizeof(*suppressor));
+
+    suppressor->sample_rate = sample_rate;
+
+    float bin_hz = (float)sample_rate / FEEDBACK_FFT_SIZE;
+    suppressor->low_bin = ceilf(LOW_HZ / bin_hz);
+    suppressor->high_bin = HIGH_HZ / bin_hz;
+
+    // Both harmonic bins have to be below the top of the spectrum
+    if (suppressor->high_bin > FEEDBACK_FFT_SIZE / 4 - 1) {
+        suppressor->high_bin = FEEDBACK_FFT_SIZE / 4 - 1;
+    }
+
+    for (size_t i = 0; i < FEEDBACK_FFT_SIZE; i++) {
+        suppressor->window[i] =
+            0.5f - 0.5f * cosf(2.0f * (float)M_PI * i / FEEDBACK_FFT_SIZE);
+    }
+
+    for (size_t i = 0; i < FEEDBACK_FFT_SIZE / 2; i++) {
+        float angle = -2.0f * (float)M_PI * i / FEEDBACK_FFT_SIZE;
+        suppressor->twiddle_re[i] = cosf(angle);
+        suppressor->twiddle_im[i] = sinf(angle);
+
+        uint8_t reversed = 0;
+        for (size_t bit = 1; bit < FEEDBACK_FFT_SIZE / 2; bit <<= 1) {
+            reversed = (reversed << 1) | ((i & bit) != 0);
+        }
+        suppressor->bit_reverse[i] = reversed;
+    }
+}
+
+/**
+ * In place radix 2 FFT of re and im, FEEDBACK_FFT_SIZE / 2 points long. Its
+ * twiddles are every other entry of the full size table.
+ */
+static void fft(feedback_suppressor *suppressor) {
+    const size_t n = FEEDBACK_FFT_SIZE / 2;
+    float *re = suppressor->re;
+    float *im = suppressor->im;
+
+    for (size_t i = 0; i < n; i++) {
+        size_t j = suppressor->bit_reverse[i];
+        if (j > i) {
+            float t = re[i];
+            re[i] = re[j];
+            re[j] = t;
+            t = im[i];
+            im[i] = im[j];
+            im[j] = t;
+        }
+    }
+
+    for (size_t size = 2; size <= n; size *= 2) {
+        size_t half = size / 2;
+        size_t stride = FEEDBACK_FFT_SIZE / size;
+
+        for (size_t start = 0; start < n; start += size) {
+            for (size_t k = 0; k < half; k++) {
+                float wr = suppressor->twiddle_re[k * stride];
+                float wi = suppressor->twiddle_im[k * stride];
+                size_t a = start + k;
+                size_t b = a + half;
+
+                float tr = re[b] * wr - im[b] * wi;
+                float ti = re[b] * wi + im[b] * wr;
+
+                re[b] = re[a] - tr;
+                im[b] = im[a] - ti;
+                re[a] += tr;
+                im[a] += ti;
+            }
+        }
+    }
+}
+
+/**
+ * Fills power with the windowed frame's spectrum. Even samples go in as the
+ * real part and odd ones as the imaginary part, and the two halves are pulled
+ * apart again afterwards.
+ */
+static void analyse_spectrum(feedback_suppressor *suppressor) {
+    const size_t n = FEEDBACK_FFT_SIZE / 2;
+
+    for (size_t i = 0; i < n; i++) {
+        suppressor->re[i] =
+            suppressor->frame[2 * i] * suppressor->window[2 * i];
+        suppressor->im[i] =
+            suppressor->frame[2 * i + 1] * suppressor->window[2 * i + 1];
+    }
+
+    fft(suppressor);
+
+    for (size_t k = 1; k < n; k++) {
+        float ar = suppressor->re[k];
+        float ai = suppressor->im[k];
+        float br = suppressor->re[n - k];
+        float bi = suppressor->im[n - k];
+
+        float even_re = 0.5f * (ar + br);
+        float even_im = 0.5f * (ai - bi);
+        float odd_re = 0.5f * (ai + bi);
+        float odd_im = -0.5f * (ar - br);
+
+        float wr = suppressor->twiddle_re[k];
+        float wi = suppressor->twiddle_im[k];
+        float re = even_re + wr * odd_re - wi * odd_im;
+        float im = even_im + wr * odd_im + wi * odd_re;
+
+        suppressor->power[k] = re * re + im * im;
+    }
+}
+
+//! Power ratios a peak has to beat, worked out once per frame
+typedef struct {
+    float floor;
+    float band;
+    float neighbours;
+    float harmonic;
+} howl_limits;
+
+//! Whether the peak at `bin` has the shape of howl rather than voice
+static bool looks_like_howl(const feedback_suppressor *suppressor, size_t bin,
+                            const howl_limits *limits) {
+    const float *power = suppressor->power;
+    float peak = power[bin];
+
+    if (peak < limits->floor || peak < limits->band) {
+        return false;
+    }
+
+    float neighbours = fmaxf(power[bin - NEIGHBOUR_BINS],
+                             power[bin + NEIGHBOUR_BINS]);
+    if (peak < neighbours * limits->neighbours) {
+        return false;
+    }
+
+    float harmonic = fmaxf(power[2 * bin],
+                           fmaxf(power[2 * bin - 1], power[2 * bin + 1]));
+
+    return peak >= harmonic * limits->harmonic;
+}
+
+//! Frequency of the peak at `bin`, interpolated from the bins either side
+static float peak_frequency(const feedback_suppressor *suppressor,
+                            size_t bin) {
+    const float *power = suppressor->power;
+    float before = logf(power[bin - 1] + 1e-9f);
+    float centre = logf(power[bin] + 1e-9f);
+    float after = logf(power[bin + 1] + 1e-9f);
+
+    float curvature = before - 2.0f * centre + after;
+    float offset =
+        curvature < 0.0f ? 0.5f * (before - after) / curvature : 0.0f;
+
+    return (bin + offset) * suppressor->sample_rate / FEEDBACK_FFT_SIZE;
+}
+
+static void design_notch(feedback_notch *notch, uint32_t sample_rate) {
+    double a = pow(10.0, -(double)notch->depth * FEEDBACK_DEPTH_STEP_DB / 40);
+    double w0 = 2.0 * M_PI * notch->frequency / sample_rate;
+    double alpha = sin(w0) / (2.0 * NOTCH_Q);
+    double cosine = cos(w0);
+    double a0 = 1.0 + alpha / a;
+
+    notch->b0 = to_fixed((1.0 + alpha * a) / a0);
+    notch->b1 = to_fixed(-2.0 * cosine / a0);
+    notch->b2 = to_fixed((1.0 - alpha * a) / a0);
+    notch->a1 = notch->b1;
+    notch->a2 = to_fixed((1.0 - alpha / a) / a0);
+}
+
+/**
+ * Deepens the notch already on `frequency`, or puts a new one there. With
+ * every notch taken, the shallowest one longest without a detection goes.
+ */
+static void lock_notch(feedback_suppressor *suppressor, float frequency) {
+    float bin_hz = (float)suppressor->sample_rate / FEEDBACK_FFT_SIZE;
+    feedback_notch *target = NULL;
+
+    for (size_t i = 0; i < FEEDBACK_MAX_NOTCHES; i++) {
+        feedback_notch *notch = &suppressor->notches[i];
+
+        if (notch->depth != 0 && fabsf(notch->frequency - frequency) < bin_hz) {
+            notch->frequency = 0.5f * (notch->frequency + frequency);
+            if (notch->depth < FEEDBACK_MAX_DEPTH_STEPS) {
+                notch->depth++;
+            }
+            notch->idle = 0;
+            design_notch(notch, suppressor->sample_rate);
+            return;
+        }
+
+        if (target == NULL || notch->depth < target->depth ||
+            (notch->depth == target->depth && notch->idle > target->idle)) {
+            target = notch;
+        }
+    }
+
+    memset(target, 0, sizeof(*target));
+    target->frequency = frequency;
+    target->depth = INITIAL_DEPTH_STEPS;
+    design_notch(target, suppressor->sample_rate);
+}
+
+/**
+ * Follows the strongest howl-like peaks of the new spectrum from the last
+ * frame's, notching any that have persisted long enough
+ */
+static void track_peaks(feedback_suppressor *suppressor) {
+    const float *power = suppressor->power;
+
+    float average = 0.0f;
+    for (size_t k = suppressor->low_bin; k <= suppressor->high_bin; k++) {
+        average += power[k];
+    }
+    average /= suppressor->high_bin - suppressor->low_bin + 1;
+
+    // A full scale sine peaks at a quarter of the frame through the window
+    float full_scale = (float)FEEDBACK_FFT_SIZE / 4 * INT16_MAX;
+
+    howl_limits limits = {
+        .floor = full_scale * full_scale * from_db(FLOOR_DB),
+        .band = average * from_db(PAPR_DB),
+        .neighbours = from_db(PNPR_DB),
+        .harmonic = from_db(PHPR_DB),
+    };
+
+    // The strongest peaks, strongest first
+    size_t peaks[FEEDBACK_MAX_CANDIDATES];
+    size_t peak_count = 0;
+
+    size_t first = suppressor->low_bin;
+    if (first < NEIGHBOUR_BINS) {
+        first = NEIGHBOUR_BINS;
+    }
+
+    for (size_t k = first; k <= suppressor->high_bin; k++) {
+        if (power[k] <= power[k - 1] || power[k] < power[k + 1] ||
+            !looks_like_howl(suppressor, k, &limits)) {
+            continue;
+        }
+
+        size_t slot = peak_count;
+        while (slot > 0 && power[peaks[slot - 1]] < power[k]) {
+            slot--;
+        }
+        if (slot == FEEDBACK_MAX_CANDIDATES) {
+            continue;
+        }
+
+        size_t last = peak_count < FEEDBACK_MAX_CANDIDATES
+                          ? peak_count
+                          : FEEDBACK_MAX_CANDIDATES - 1;
+        memmove(&peaks[slot + 1], &peaks[slot],
+                (last - slot) * sizeof(peaks[0]));
+        peaks[slot] = k;
+        if (peak_count < FEEDBACK_MAX_CANDIDATES) {
+            peak_count++;
+        }
+    }
+
+    feedback_candidate next[FEEDBACK_MAX_CANDIDATES] = {0};
+    float fade = from_db(-FADE_DB);
+
+    for (size_t i = 0; i < peak_count; i++) {
+        size_t bin = peaks[i];
+        feedback_candidate *candidate = &next[i];
+
+        candidate->bin = bin;
+        candidate->power = power[bin];
+        candidate->hits = 1;
+
+        for (size_t j = 0; j < FEEDBACK_MAX_CANDIDATES; j++) {
+            const feedback_candidate *previous = &suppressor->candidates[j];
+
+            if (previous->bin != 0 && previous->bin + 1u >= bin &&
+                previous->bin <= bin + 1 &&
+                power[bin] >= previous->power * fade) {
+                candidate->hits = previous->hits + 1;
+                break;
+            }
+        }
+
+        if (candidate->hits >= PERSISTENCE_FRAMES) {
+            lock_notch(suppressor, peak_frequency(suppressor, bin));
+            candidate->hits = 0;
+        }
+    }
+
+    memcpy(suppressor->candidates, next, sizeof(next));
+}
+
+//! Makes notches a step shallower once their resonance has been quiet a while
+static void release_notches(feedback_suppressor *suppressor) {
+    uint32_t release = suppressor->sample_rate * RELEASE_S;
+
+    for (size_t i = 0; i < FEEDBACK_MAX_NOTCHES; i++) {
+        feedback_notch *notch = &suppressor->notches[i];
+
+        if (notch->depth == 0) {
+            continue;
+        }
+
+        notch->idle += FEEDBACK_FFT_SIZE;
+        if (notch->idle >= release) {
+            notch->depth--;
+            notch->idle = 0;
+            design_notch(notch, suppressor->sample_rate);
+        }
+    }
+}
+
+static inline int16_t saturate(int32_t sample) {
+    if (sample > INT16_MAX) {
+        return INT16_MAX;
+    }
+    if (sample < INT16_MIN) {
+        return INT16_MIN;
+    }
+    return sample;
+}
+
+static void run_notch(feedback_notch *notch, int16_t *samples, size_t frames) {
+    int32_t x1 = notch->x1;
+    int32_t x2 = notch->x2;
+    int32_t y1 = notch->y1;
+    int32_t y2 = notch->y2;
+
+    for (size_t i = 0; i < frames; i++) {
+        int32_t x0 = samples[i];
+
+        int64_t acc = ((int64_t)notch->b0 * x0 + (int64_t)notch->b1 * x1 +
+                       (int64_t)notch->b2 * x2) *
+                      (1 << STATE_SHIFT);
+        acc -= (int64_t)notch->a1 * y1 + (int64_t)notch->a2 * y2;
+
+        int32_t y0 = acc >> COEFFICIENT_SHIFT;
+
+        samples[i] = saturate(y0 >> STATE_SHIFT);
+
+        x2 = x1;
+        x1 = x0;
+        y2 = y1;
+        y1 = y0;
+    }
+
+    notch->x1 = x1;
+    notch->x2 = x2;
+    notch->y1 = y1;
+    notch->y2 = y2;
+}
+
+void feedback_process(void *ctx, int16_t *samples, size_t frames) {
+    feedback_suppressor *suppressor = ctx;
+
+    for (size_t i = 0; i < frames;) {
+        size_t count = FEEDBACK_FFT_SIZE - suppressor->frame_fill;
+        if (count > frames - i) {
+            count = frames - i;
+        }
+
+        memcpy(&suppressor->frame[suppressor->frame_fill], &samples[i],
+               count * sizeof(int16_t));
+        suppressor->frame_fill += count;
+        i += count;
+
+        if (suppressor->frame_fill == FEEDBACK_FFT_SIZE) {
+            analyse_spectrum(suppressor);
+            release_notches(suppressor);
+            track_peaks(suppressor);
+            suppressor->frame_fill = 0;
+        }
+    }
+
+    for (size_t i = 0; i < FEEDBACK_MAX_NOTCHES; i++) {
+        if (suppressor->notches[i].depth != 0) {
+            run_notch(&suppressor->notches[i], samples, frames);
+        }
+    }
+}
@@ -0,0 +1,364 @@
+/**
+ * This file contains the output limiter and its compressor. The limiter sees
+ * each frame as it enters the delay line and works out the gain that frame
+ * will need when it leaves. The gain ramps down to it linearly over the
+ * lookahead, holds until the frame is out and then recovers along a one pole
+ * curve, so it never overshoots and never pumps faster than the release.
+ *
+ * The compressor splits the bus with one pole low passes whose differences
+ * make up the bands, so the bands always add back up to the input exactly.
+ */
+
+#include "audio_dsp/limiter.h"
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define UNITY_GAIN (1 << 30)
+#define BAND_UNITY_GAIN (1 << 15)
+
+//! Extra fraction bits carried while ramping band gains
+#define RAMP_SHIFT 8
+//! Frames each compressor gain is ramped over before it is worked out again
+#define SLICE_FRAMES 32
+
+//! Compressor envelope times, quick enough to catch a kick drum and slow
+//! enough not to follow the waveform of the bass
+#define ENVELOPE_ATTACK_MS 5
+#define ENVELOPE_RELEASE_MS 150
+
+bool limiter_config_valid(const limiter_config *config) {
+    if (config->ceiling_db > LIMITER_MAX_CEILING_DB ||
+        config->release_ms < LIMITER_MIN_RELEASE_MS ||
+        config->release_ms > LIMITER_MAX_RELEASE_MS) {
+        return false;
+    }
+
+    for (size_t i = 0; i < LIMITER_BANDS; i++) {
+        if (config->bands[i].threshold_db > LIMITER_MAX_THRESHOLD_DB ||
+            config->bands[i].ratio == 0 ||
+            config->bands[i].ratio > LIMITER_MAX_RATIO) {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+static uint32_t pack_limit(const limiter_config *config) {
+    return config->ceiling_db | (uint32_t)(config->release_ms / 10) << 5;
+}
+
+static uint32_t pack_bands(const limiter_config *config) {
+    uint32_t packed = config->compressor;
+
+    for (size_t i = 0; i < LIMITER_BANDS; i++) {
+        packed |= (uint32_t)config->bands[i].threshold_db << (1 + 10 * i);
+        packed |= (uint32_t)config->bands[i].ratio << (7 + 10 * i);
+    }
+
+    return packed;
+}
+
+static void unpack(uint32_t limit, uint32_t bands, limiter_config *config) {
+    config->ceiling_db = limit & 0x1F;
+    config->release_ms = ((limit >> 5) & 0xFF) * 10;
+    config->compressor = bands & 1;
+
+    for (size_t i = 0; i < LIMITER_BANDS; i++) {
+        config->bands[i].threshold_db = (bands >> (1 + 10 * i)) & 0x3F;
+        config->bands[i].ratio = (bands >> (7 + 10 * i)) & 0xF;
+    }
+}
+
+//! Peak level `db` below full scale
+static int32_t level_from_db(uint8_t db) {
+    return INT16_MAX * powf(10.0f, -(float)db / 20.0f);
+}
+
+//! One pole coefficient for a time constant of `ms`, with `shift` fraction
+//! bits
+static int32_t time_coefficient(float ms, uint32_t sample_rate, int shift) {
+    return (1.0 - exp(-1000.0 / (ms * sample_rate))) * (1 << shift);
+}
+
+static int32_t corner_coefficient(float hz, uint32_t sample_rate) {
+    return (1.0 - exp(-2.0 * M_PI * hz / sample_rate)) * (1 << 15);
+}
+
+static void apply_limit(limiter *limiter, uint32_t packed) {
+    limiter_config config;
+    unpack(packed, 0, &config);
+
+    limiter->limit_packed = packed;
+    limiter->ceiling = level_from_db(config.ceiling_db);
+    limiter->release =
+        time_coefficient(config.release_ms, limiter->sample_rate, 24);
+}
+
+static void reset_compressor(limiter *limiter) {
+    memset(limiter->low_state, 0, sizeof(limiter->low_state));
+    memset(limiter->high_state, 0, sizeof(limiter->high_state));
+    memset(limiter->envelopes, 0, sizeof(limiter->envelopes));
+
+    for (size_t i = 0; i < LIMITER_BANDS; i++) {
+        limiter->band_gains[i] = BAND_UNITY_GAIN;
+    }
+}
+
+static void apply_bands(limiter *limiter, uint32_t packed) {
+    limiter_config config;
+    unpack(0, packed, &config);
+
+    // Coming on, the crossovers would start from stale history
+    if (config.compressor && !limiter->compressor) {
+        reset_compressor(limiter);
+    }
+
+    limiter->bands_packed = packed;
+    limiter->compressor = config.compressor;
+
+    for (size_t i = 0; i < LIMITER_BANDS; i++) {
+        // Envelopes carry 4 fraction bits
+        limiter->thresholds[i] = level_from_db(config.bands[i].threshold_db)
+                                 << 4;
+        limiter->slopes[i] = 1.0f - 1.0f / config.bands[i].ratio;
+    }
+}
+
+void limiter_init(limiter *limiter, uint32_t sample_rate, size_t lookahead) {
+    limiter_config config = LIMITER_DEFAULT_CONFIG();
+
+    memset(limiter, 0, sizeof(*limiter));
+
+    limiter->sample_rate = sample_rate;
+    limiter->gain = UNITY_GAIN;
+    limiter->target = UNITY_GAIN;
+
+    limiter->low_coefficient =
+        corner_coefficient(LIMITER_LOW_CROSSOVER_HZ, sample_rate);
+    limiter->high_coefficient =
+        corner_coefficient(LIMITER_HIGH_CROSSOVER_HZ, sample_rate);
+    limiter->envelope_attack =
+        time_coefficient(ENVELOPE_ATTACK_MS, sample_rate, 15);
+    limiter->envelope_release =
+        time_coefficient(ENVELOPE_RELEASE_MS, sample_rate, 15);
+
+    apply_limit(limiter, pack_limit(&config));
+    apply_bands(limiter, pack_bands(&config));
+    atomic_init(&limiter->requested_limit, limiter->limit_packed);
+    atomic_init(&limiter->requested_bands, limiter->bands_packed);
+
+    limiter_set_lookahead(limiter, lookahead);
+}
+
+/**
+ * Takes effect from the next block. Returns false for settings out of range.
+ */
+bool limiter_configure(limiter *limiter, const limiter_config *config) {
+    if (!limiter_config_valid(config)) {
+        return false;
+    }
+
+    atomic_store(&limiter->requested_limit, pack_limit(config));
+    atomic_store(&limiter->requested_bands, pack_bands(config));
+
+    return true;
+}
+
+//! The settings last asked for, whether or not they have taken effect yet
+void limiter_get_config(const limiter *limiter, limiter_config *config) {
+    unpack(atomic_load(&limiter->requested_limit),
+           atomic_load(&limiter->requested_bands), config);
+}
+
+/**
+ * Changes the delay, up to LIMITER_MAX_LOOKAHEAD frames. Only from the task
+ * that processes, between blocks. Whatever was in the delay line is dropped.
+ */
+void limiter_set_lookahead(limiter *limiter, size_t lookahead) {
+    if (lookahead > LIMITER_MAX_LOOKAHEAD) {
+        lookahead = LIMITER_MAX_LOOKAHEAD;
+    }
+
+    memset(limiter->delay, 0, sizeof(limiter->delay));
+    limiter->lookahead = lookahead;
+    limiter->position = 0;
+    limiter->hold = 0;
+}
+
+static inline int16_t saturate(int64_t sample) {
+    if (sample > INT16_MAX) {
+        return INT16_MAX;
+    }
+    if (sample < INT16_MIN) {
+        return INT16_MIN;
+    }
+    return sample;
+}
+
+//! Band gain in Q15 for the band's envelope right now
+static int32_t band_gain(const limiter *limiter, size_t band) {
+    int32_t envelope = limiter->envelopes[band];
+    int32_t threshold = limiter->thresholds[band];
+
+    if (envelope <= threshold || limiter->slopes[band] == 0.0f) {
+        return BAND_UNITY_GAIN;
+    }
+
+    float over = log2f((float)threshold / envelope);
+
+    return exp2f(limiter->slopes[band] * over) * BAND_UNITY_GAIN;
+}
+
+static void compress(limiter *limiter, int16_t *stereo, size_t frames) {
+    for (size_t start = 0; start < frames; start += SLICE_FRAMES) {
+        size_t count = frames - start < SLICE_FRAMES ? frames - start
+                                                     : SLICE_FRAMES;
+
+        int32_t gains[LIMITER_BANDS];
+        int32_t steps[LIMITER_BANDS];
+
+        for (size_t band = 0; band < LIMITER_BANDS; band++) {
+            int32_t end = band_gain(limiter, band);
+
+            gains[band] = limiter->band_gains[band] << RAMP_SHIFT;
+            steps[band] = (end - limiter->band_gains[band]) *
+                          (1 << RAMP_SHIFT) / (int32_t)count;
+            limiter->band_gains[band] = end;
+        }
+
+        for (size_t i = start; i < start + count; i++) {
+            int32_t bands[2][LIMITER_BANDS];
+            int32_t levels[LIMITER_BANDS] = {0};
+
+            for (size_t channel = 0; channel < 2; channel++) {
+                int32_t x = stereo[2 * i + channel] * 16;
+                int32_t *low = &limiter->low_state[channel];
+                int32_t *high = &limiter->high_state[channel];
+
+                *low += ((int64_t)(x - *low) * limiter->low_coefficient) >> 15;
+                *high +=
+                    ((int64_t)(x - *high) * limiter->high_coefficient) >> 15;
+
+                bands[channel][0] = *low;
+                bands[channel][1] = *high - *low;
+                bands[channel][2] = x - *high;
+
+                for (size_t band = 0; band < LIMITER_BANDS; band++) {
+                    int32_t level = abs(bands[channel][band]);
+                    levels[band] = level > levels[band] ? level : levels[band];
+                }
+            }
+
+            for (size_t band = 0; band < LIMITER_BANDS; band++) {
+                int32_t *envelope = &limiter->envelopes[band];
+                int32_t coefficient = levels[band] > *envelope
+                                          ? limiter->envelope_attack
+                                          : limiter->envelope_release;
+
+                *envelope +=
+                    ((int64_t)(levels[band] - *envelope) * coefficient) >> 15;
+            }
+
+            for (size_t channel = 0; channel < 2; channel++) {
+                int64_t sum = 0;
+
+                for (size_t band = 0; band < LIMITER_BANDS; band++) {
+                    sum += (int64_t)bands[channel][band] *
+                           (gains[band] >> RAMP_SHIFT);
+                }
+
+                stereo[2 * i + channel] = saturate(sum >> (15 + 4));
+            }
+
+            for (size_t band = 0; band < LIMITER_BANDS; band++) {
+                gains[band] += steps[band];
+            }
+        }
+    }
+}
+
+/**
+ * Moves the gain one frame on, after `peak` has entered the delay line
+ */
+static inline void update_gain(limiter *limiter, uint32_t peak) {
+    if (peak > (uint32_t)limiter->ceiling) {
+        // Rounded down so the frame comes out at the ceiling or just under
+        int32_t needed = (((uint32_t)limiter->ceiling << 15) / peak) << 15;
+
+        if (needed < limiter->target) {
+            limiter->target = needed;
+        }
+
+        // Reach it by the time this frame leaves, this update included
+        int32_t frames = limiter->lookahead + 1;
+        int32_t step = (limiter->gain - limiter->target + frames - 1) / frames;
+        if (step > limiter->step) {
+            limiter->step = step;
+        }
+
+        limiter->hold = frames;
+    }
+
+    if (limiter->hold > 0) {
+        // Already below what this peak needs, still recovering from a bigger
+        // one, the gain just waits
+        if (limiter->gain > limiter->target) {
+            limiter->gain -= limiter->step;
+            if (limiter->gain <= limiter->target) {
+                limiter->gain = limiter->target;
+                limiter->step = 0;
+            }
+        }
+        limiter->hold--;
+    } else {
+        limiter->target = UNITY_GAIN;
+        limiter->step = 0;
+        limiter->gain +=
+            ((int64_t)(UNITY_GAIN - limiter->gain) * limiter->release) >> 24;
+    }
+}
+
+void limiter_process(limiter *limiter, int16_t *stereo, size_t frames) {
+    uint32_t limit =
+        atomic_load_explicit(&limiter->requested_limit, memory_order_relaxed);
+    if (limit != limiter->limit_packed) {
+        apply_limit(limiter, limit);
+    }
+
+    uint32_t bands =
+        atomic_load_explicit(&limiter->requested_bands, memory_order_relaxed);
+    if (bands != limiter->bands_packed) {
+        apply_bands(limiter, bands);
+    }
+
+    if (limiter->compressor) {
+        compress(limiter, stereo, frames);
+    }
+
+    for (size_t i = 0; i < frames; i++) {
+        int16_t left = stereo[2 * i];
+        int16_t right = stereo[2 * i + 1];
+        uint32_t peak_left = left < 0 ? -left : left;
+        uint32_t peak_right = right < 0 ? -right : right;
+
+        update_gain(limiter, peak_left > peak_right ? peak_left : peak_right);
+
+        if (limiter->lookahead > 0) {
+            int16_t *slot = &limiter->delay[2 * limiter->position];
+
+            stereo[2 * i] = slot[0];
+            stereo[2 * i + 1] = slot[1];
+            slot[0] = left;
+            slot[1] = right;
+
+            if (++limiter->position == limiter->lookahead) {
+                limiter->position = 0;
+            }
+        }
+
+        stereo[2 * i] = ((int64_t)stereo[2 * i] * limiter->gain) >> 30;
+        stereo[2 * i + 1] = ((int64_t)stereo[2 * i + 1] * limiter->gain) >> 30;
+    }
+}
@@ -0,0 +1,136 @@
+/**
+ * This file contains the level and spectrum meters behind telemetry. The audio
+ * core only records peaks, a running mean square and a copy of the output mix,
+ * and only while metering is enabled. The expensive part, the spectrum, is
+ * computed by whichever task reads it.
+ */
+
+#include "audio_dsp/meter.h"
+#include <math.h>
+#include <stdatomic.h>
+
+//! Weight of each block in the running mean square, as a shift
+#define MEAN_SQUARE_SHIFT 2
+
+static atomic_bool enabled;
+
+static _Atomic uint32_t peaks[MeterSourceCount];
+static _Atomic uint32_t mean_squares[MeterSourceCount];
+
+static int16_t tap[METER_TAP_SIZE];
+static _Atomic size_t tap_position;
+
+//! Goertzel coefficients, 2cos(w) for each band's centre frequency
+static float coefficients[METER_SPECTRUM_BINS];
+
+void meter_init(uint32_t sample_rate) {
+    float frequency = 125.0f;
+
+    for (size_t i = 0; i < METER_SPECTRUM_BINS; i++) {
+        coefficients[i] =
+            2.0f * cosf(2.0f * (float)M_PI * frequency / sample_rate);
+        frequency *= 2.0f;
+    }
+}
+
+void meter_set_enabled(bool enable) { atomic_store(&enabled, enable); }
+
+bool meter_enabled(void) {
+    return atomic_load_explicit(&enabled, memory_order_relaxed);
+}
+
+/**
+ * Records one block. Multi channel blocks are interleaved and metered as their
+ * mono sum.
+ */
+void meter_update(MeterSource source, const int16_t *samples, size_t frames,
+                  size_t channels) {
+    if (frames == 0) {
+        return;
+    }
+
+    uint32_t peak = 0;
+    uint64_t sum = 0;
+
+    for (size_t i = 0; i < frames; i++) {
+        int32_t sample = samples[i * channels];
+        if (channels > 1) {
+            sample = (sample + samples[i * channels + 1]) >> 1;
+        }
+
+        uint32_t magnitude = sample < 0 ? -sample : sample;
+        if (magnitude > peak) {
+            peak = magnitude;
+        }
+        sum += (uint32_t)(sample * sample);
+    }
+
+    // Only the audio core raises the peak, readers reset it to zero
+    uint32_t current = atomic_load(&peaks[source]);
+    while (peak > current &&
+           !atomic_compare_exchange_weak(&peaks[source], &current, peak)) {
+    }
+
+    uint32_t mean_square = atomic_load(&mean_squares[source]);
+    int64_t block = sum / frames;
+    mean_square += (block - (int64_t)mean_square) >> MEAN_SQUARE_SHIFT;
+    atomic_store(&mean_squares[source], mean_square);
+}
+
+/**
+ * Keeps the most recent METER_TAP_SIZE samples of the output mix
+ */
+void meter_tap(const int16_t *stereo, size_t frames) {
+    size_t position = atomic_load_explicit(&tap_position, memory_order_relaxed);
+
+    for (size_t i = 0; i < frames; i++) {
+        tap[position] = (stereo[2 * i] + stereo[2 * i + 1]) >> 1;
+        position = (position + 1) % METER_TAP_SIZE;
+    }
+
+    atomic_store_explicit(&tap_position, position, memory_order_release);
+}
+
+void meter_read(MeterSource source, meter_level *level) {
+    uint32_t peak = atomic_exchange(&peaks[source], 0);
+
+    level->peak = peak > INT16_MAX ? INT16_MAX : peak;
+    level->rms = sqrtf(atomic_load(&mean_squares[source]));
+}
+
+/**
+ * Fills each bin with the band's level in dB above -96 dBFS. The tap may be
+ * written while this runs, which at worst smears one block into the window.
+ */
+void meter_spectrum(uint8_t bins[METER_SPECTRUM_BINS]) {
+    size_t start = atomic_load_explicit(&tap_position, memory_order_acquire);
+
+    // A full scale sine peaks at N / 2 times its amplitude
+    const float full_scale = (float)METER_TAP_SIZE / 2 * INT16_MAX;
+
+    for (size_t bin = 0; bin < METER_SPECTRUM_BINS; bin++) {
+        float coefficient = coefficients[bin];
+        float previous = 0.0f;
+        float before = 0.0f;
+
+        for (size_t i = 0; i < METER_TAP_SIZE; i++) {
+            float current = tap[(start + i) % METER_TAP_SIZE] +
+                            coefficient * previous - before;
+            before = previous;
+            previous = current;
+        }
+
+        float power = previous * previous + before * before -
+                      coefficient * previous * before;
+        float db = 10.0f * log10f(power / (full_scale * full_scale) + 1e-10f);
+
+        if (db < -96.0f) {
+            db = -96.0f;
+        }
+        if (db > 0.0f) {
+            db = 0.0f;
+        }
+
+        bins[bin] = db + 96.0f;
+    }
+}
@@ -0,0 +1,290 @@
+/**
+ * This file contains the output mixer. Sources are summed a slice at a time
+ * into a 32 bit accumulator small enough to stay in cache, each one read
+ * straight from the block it was rendered into, and the slice is written out
+ * through the soft limiter. Gains are Q12 and ramp linearly from the value the
+ * previous block ended on, carried in Q8 steps so the ramp costs one add per
+ * frame.
+ */
+
+#include "audio_dsp/mixer.h"
+#include <math.h>
+#include <string.h>
+
+//! Frames accumulated per pass, bounds the accumulator on the stack
+#define MIX_SLICE_FRAMES 64
+
+//! Fraction bits of a gain while it ramps
+#define RAMP_SHIFT 8
+
+void mixer_init(mixer *mixer, uint32_t sample_rate,
+                const mixer_ducking_times *times) {
+    memset(mixer, 0, sizeof(*mixer));
+
+    mixer->knee = MIXER_DEFAULT_KNEE;
+    mixer->duck_gain = MIXER_UNITY_GAIN;
+    atomic_init(&mixer->duck_threshold, 0);
+    atomic_init(&mixer->duck_depth, MIXER_UNITY_GAIN);
+
+    uint32_t attack_frames = (uint64_t)sample_rate * times->attack_ms / 1000;
+    uint32_t release_frames = (uint64_t)sample_rate * times->release_ms / 1000;
+
+    // Steps are Q8 so a slow release still moves every block
+    mixer->attack_step = ((uint32_t)MIXER_UNITY_GAIN << RAMP_SHIFT) /
+                         (attack_frames > 0 ? attack_frames : 1);
+    mixer->release_step = ((uint32_t)MIXER_UNITY_GAIN << RAMP_SHIFT) /
+                          (release_frames > 0 ? release_frames : 1);
+    mixer->hold_frames = (uint64_t)sample_rate * times->hold_ms / 1000;
+}
+
+/**
+ * Adds a mono or stereo source and returns its index, or -1 if the mixer is
+ * full. Mono sources go to both sides at the same level.
+ */
+int mixer_add_source(mixer *mixer, uint8_t channels, uint8_t flags,
+                     uint16_t gain) {
+    if (mixer->source_count >= MIXER_MAX_SOURCES ||
+        (channels != 1 && channels != 2)) {
+        return -1;
+    }
+
+    mixer_source *source = &mixer->sources[mixer->source_count];
+
+    *source = (mixer_source){
+        .channels = channels,
+        .flags = flags,
+        .applied = gain,
+    };
+    atomic_init(&source->gain, gain);
+
+    return mixer->source_count++;
+}
+
+void mixer_set_gain(mixer *mixer, int source, uint16_t gain) {
+    if (source < 0 || (size_t)source >= mixer->source_count) {
+        return;
+    }
+
+    atomic_store(&mixer->sources[source].gain, gain);
+}
+
+/**
+ * Ducks every MixerDucked source while the sidechain peaks at or above
+ * `threshold`. 0 turns ducking off.
+ */
+void mixer_set_duck_threshold(mixer *mixer, uint16_t threshold) {
+    atomic_store(&mixer->duck_threshold, threshold);
+}
+
+//! Sets the gain ducked sources drop to
+void mixer_set_duck_depth(mixer *mixer, uint16_t depth) {
+    atomic_store(&mixer->duck_depth, depth);
+}
+
+//! Unity gain for `db`, saturating at the largest gain the mixer takes
+uint16_t mixer_gain_from_db(float db) {
+    float gain = MIXER_UNITY_GAIN * powf(10.0f, db / 20.0f);
+
+    return gain >= UINT16_MAX ? UINT16_MAX : (uint16_t)(gain + 0.5f);
+}
+
+/**
+ * Moves the ducking gain towards where the last block's sidechain level puts
+ * it, attacking down and releasing up at their own rates
+ */
+static void update_ducking(mixer *mixer, size_t frames) {
+    uint16_t threshold = atomic_load(&mixer->duck_threshold);
+    uint16_t target = MIXER_UNITY_GAIN;
+
+    if (threshold != 0 && mixer->sidechain_peak >= threshold) {
+        mixer->hold_remaining = mixer->hold_frames;
+        target = atomic_load(&mixer->duck_depth);
+    } else if (threshold != 0 && mixer->hold_remaining > 0) {
+        mixer->hold_remaining -= frames < mixer->hold_remaining
+                                     ? frames
+                                     : mixer->hold_remaining;
+        target = atomic_load(&mixer->duck_depth);
+    }
+
+    uint32_t gain = mixer->duck_gain;
+
+    if (gain > target) {
+        uint32_t step = mixer->attack_step * frames >> RAMP_SHIFT;
+        gain = gain - target > step ? gain - step : target;
+    } else if (gain < target) {
+        uint32_t step = mixer->release_step * frames >> RAMP_SHIFT;
+        gain = target - gain > step ? gain + step : target;
+    }
+
+    mixer->duck_gain = gain;
+}
+
+static inline uint32_t magnitude(int32_t sample) {
+    return sample < 0 ? -sample : sample;
+}
+
+/**
+ * Adds `frames` frames of `in` to the accumulator with the gain ramping from
+ * `gain` by `step` each frame, both Q8. Returns the peak of the input if
+ * `measure` is set, for the sidechain.
+ */
+static uint32_t accumulate(const int16_t *in, uint8_t channels, int32_t *acc,
+                           size_t frames, int32_t gain, int32_t step,
+                           bool measure) {
+    uint32_t peak = 0;
+
+    if (channels == 2) {
+        for (size_t i = 0; i < frames; i++) {
+            int32_t g = gain >> RAMP_SHIFT;
+            int32_t left = in[2 * i];
+            int32_t right = in[2 * i + 1];
+
+            acc[2 * i] += (left * g) >> 12;
+            acc[2 * i + 1] += (right * g) >> 12;
+            gain += step;
+
+            if (measure) {
+                uint32_t level = magnitude(left);
+                peak = level > peak ? level : peak;
+                level = magnitude(right);
+                peak = level > peak ? level : peak;
+            }
+        }
+    } else {
+        for (size_t i = 0; i < frames; i++) {
+            int32_t sample = in[i];
+            int32_t scaled = (sample * (gain >> RAMP_SHIFT)) >> 12;
+
+            acc[2 * i] += scaled;
+            acc[2 * i + 1] += scaled;
+            gain += step;
+
+            if (measure) {
+                uint32_t level = magnitude(sample);
+                peak = level > peak ? level : peak;
+            }
+        }
+    }
+
+    return peak;
+}
+
+static uint32_t measure_peak(const int16_t *in, size_t samples) {
+    uint32_t peak = 0;
+
+    for (size_t i = 0; i < samples; i++) {
+        uint32_t level = magnitude(in[i]);
+        peak = level > peak ? level : peak;
+    }
+
+    return peak;
+}
+
+/**
+ * Passes the sum through below the knee and bends it towards full scale above,
+ * so it approaches but never reaches clipping. The curve's slope is 1 at the
+ * knee, so there is no corner to hear.
+ */
+static inline int16_t soft_limit(int32_t sample, int32_t knee,
+                                 uint32_t *limited) {
+    uint32_t level = magnitude(sample);
+
+    if (level <= (uint32_t)knee) {
+        return sample;
+    }
+
+    (*limited)++;
+
+    // Bounded so the product below stays within 32 bits
+    uint32_t over = level - knee;
+    if (over > UINT16_MAX) {
+        over = UINT16_MAX;
+    }
+
+    uint32_t range = INT16_MAX - knee;
+    int32_t bent = knee + over * range / (over + range);
+
+    return sample < 0 ? -bent : bent;
+}
+
+/**
+ * Mixes every source into `stereo`, overwriting it. Sources without samples
+ * this block contribute nothing and skip straight to their new gain when they
+ * return.
+ */
+void mixer_process(mixer *mixer, int16_t *stereo, size_t frames) {
+    int32_t acc[MIX_SLICE_FRAMES * 2];
+    int32_t gains[MIXER_MAX_SOURCES];
+    int32_t steps[MIXER_MAX_SOURCES];
+    uint32_t sidechain = 0;
+    uint32_t limited = 0;
+
+    if (frames == 0) {
+        return;
+    }
+
+    update_ducking(mixer, frames);
+
+    for (size_t s = 0; s < mixer->source_count; s++) {
+        mixer_source *source = &mixer->sources[s];
+        uint32_t end = 0;
+
+        if (!source->muted) {
+            end = atomic_load_explicit(&source->gain, memory_order_relaxed);
+            if (source->flags & MixerDucked) {
+                end = end * mixer->duck_gain / MIXER_UNITY_GAIN;
+            }
+        }
+
+        if (source->samples == NULL) {
+            source->applied = end;
+        }
+
+        gains[s] = (int32_t)source->applied << RAMP_SHIFT;
+        steps[s] = ((int32_t)end - source->applied) * (1 << RAMP_SHIFT) /
+                   (int32_t)frames;
+        source->applied = end;
+    }
+
+    for (size_t done = 0; done < frames; done += MIX_SLICE_FRAMES) {
+        size_t slice = frames - done;
+        if (slice > MIX_SLICE_FRAMES) {
+            slice = MIX_SLICE_FRAMES;
+        }
+
+        memset(acc, 0, slice * 2 * sizeof(int32_t));
+
+        for (size_t s = 0; s < mixer->source_count; s++) {
+            const mixer_source *source = &mixer->sources[s];
+            bool measure = source->flags & MixerSidechain;
+
+            if (source->samples == NULL) {
+                continue;
+            }
+
+            const int16_t *in = &source->samples[done * source->channels];
+
+            // A source faded all the way out is only looked at for its level
+            if (gains[s] == 0 && steps[s] == 0) {
+                if (measure) {
+                    uint32_t peak = measure_peak(in, slice * source->channels);
+                    sidechain = peak > sidechain ? peak : sidechain;
+                }
+                continue;
+            }
+
+            uint32_t peak = accumulate(in, source->channels, acc, slice,
+                                       gains[s], steps[s], measure);
+            sidechain = peak > sidechain ? peak : sidechain;
+            gains[s] += steps[s] * (int32_t)slice;
+        }
+
+        int16_t *out = &stereo[done * 2];
+        for (size_t i = 0; i < slice * 2; i++) {
+            out[i] = soft_limit(acc[i], mixer->knee, &limited);
+        }
+    }
+
+    mixer->sidechain_peak = sidechain > INT16_MAX ? INT16_MAX : sidechain;
+    mixer->limited_samples += limited;
+}
@@ -0,0 +1,85 @@
+#include "audio_dsp/pcm_ring.h"
+#include <string.h>
+
+bool pcm_ring_init(pcm_ring *ring, uint8_t *storage, size_t capacity) {
+    // Masking the free running indices only works for powers of two
+    if (storage == NULL || capacity == 0 || (capacity & (capacity - 1)) != 0) {
+        return false;
+    }
+
+    ring->buffer = storage;
+    ring->capacity = capacity;
+    ring->mask = capacity - 1;
+    atomic_init(&ring->head, 0);
+    atomic_init(&ring->tail, 0);
+
+    return true;
+}
+
+size_t pcm_ring_space(const pcm_ring *ring) {
+    size_t head = atomic_load_explicit(&ring->head, memory_order_relaxed);
+    size_t tail = atomic_load_explicit(&ring->tail, memory_order_acquire);
+
+    return ring->capacity - (head - tail);
+}
+
+size_t pcm_ring_fill(const pcm_ring *ring) {
+    size_t head = atomic_load_explicit(&ring->head, memory_order_acquire);
+    size_t tail = atomic_load_explicit(&ring->tail, memory_order_relaxed);
+
+    return head - tail;
+}
+
+size_t pcm_ring_write(pcm_ring *ring, const uint8_t *data, size_t len) {
+    size_t head = atomic_load_explicit(&ring->head, memory_order_relaxed);
+    size_t tail = atomic_load_explicit(&ring->tail, memory_order_acquire);
+
+    size_t space = ring->capacity - (head - tail);
+    if (len > space) {
+        len = space;
+    }
+
+    size_t offset = head & ring->mask;
+    size_t first = ring->capacity - offset;
+    if (first > len) {
+        first = len;
+    }
+
+    memcpy(ring->buffer + offset, data, first);
+    memcpy(ring->buffer, data + first, len - first);
+
+    // Publish the copied bytes before the consumer can observe the new head
+    atomic_store_explicit(&ring->head, head + len, memory_order_release);
+
+    return len;
+}
+
+size_t pcm_ring_read(pcm_ring *ring, uint8_t *dest, size_t len) {
+    size_t tail = atomic_load_explicit(&ring->tail, memory_order_relaxed);
+    size_t head = atomic_load_explicit(&ring->head, memory_order_acquire);
+
+    size_t fill = head - tail;
+    if (len > fill) {
+        len = fill;
+    }
+
+    size_t offset = tail & ring->mask;
+    size_t first = ring->capacity - offset;
+    if (first > len) {
+        first = len;
+    }
+
+    memcpy(dest, ring->buffer + offset, first);
+    memcpy(dest + first, ring->buffer, len - first);
+
+    // Only hand the space back to the producer once the copy has finished
+    atomic_store_explicit(&ring->tail, tail + len, memory_order_release);
+
+    return len;
+}
+
+void pcm_ring_discard(pcm_ring *ring) {
+    size_t head = atomic_load_explicit(&ring->head, memory_order_acquire);
+
+    atomic_store_explicit(&ring->tail, head, memory_order_release);
+}
@@ -0,0 +1,187 @@
+/**
+ * This file contains the block based processing chain for the voice path.
+ * Effects register themselves as stages and every stage is timed with the CPU
+ * cycle counter against its own budget and the overall block deadline.
+ */
+
+#include "audio_dsp/pipeline.h"
+#include "audio_dsp/cycles.h"
+
+bool audio_pipeline_init(audio_pipeline *pipeline, size_t block_frames,
+                         uint32_t sample_rate, uint32_t cpu_hz) {
+    if (block_frames == 0 || sample_rate == 0) {
+        return false;
+    }
+
+    *pipeline = (audio_pipeline){
+        .block_frames = block_frames,
+        .sample_rate = sample_rate,
+        .cpu_hz = cpu_hz,
+        .block_cycles = (uint64_t)cpu_hz * block_frames / sample_rate,
+    };
+
+    atomic_init(&pipeline->stage_count, 0);
+
+    return true;
+}
+
+/**
+ * Appends a stage to the end of the chain and returns its index, or -1 if the
+ * chain is full. Stages may be added while the pipeline is running since the
+ * new stage is only published once it is fully initialised.
+ */
+int audio_pipeline_add_stage(audio_pipeline *pipeline, const char *name,
+                             audio_stage_process process, void *ctx,
+                             uint32_t cycle_budget) {
+    size_t index = atomic_load(&pipeline->stage_count);
+
+    if (index >= AUDIO_PIPELINE_MAX_STAGES || process == NULL) {
+        return -1;
+    }
+
+    audio_stage *stage = &pipeline->stages[index];
+
+    *stage = (audio_stage){
+        .name = name,
+        .process = process,
+        .ctx = ctx,
+        .cycle_budget = cycle_budget,
+    };
+
+    atomic_init(&stage->enabled, true);
+    atomic_store_explicit(&pipeline->stage_count, index + 1,
+                          memory_order_release);
+
+    return index;
+}
+
+void audio_pipeline_set_enabled(audio_pipeline *pipeline, int stage,
+                                bool enabled) {
+    if (stage < 0 || stage >= (int)atomic_load(&pipeline->stage_count)) {
+        return;
+    }
+
+    atomic_store(&pipeline->stages[stage].enabled, enabled);
+}
+
+/**
+ * Records the algorithmic delay of a stage, such as a lookahead or a history
+ * it synthesises from, so it is counted into the latency of the path
+ */
+void audio_pipeline_set_latency(audio_pipeline *pipeline, int stage,
+                                uint32_t frames) {
+    if (stage < 0 || stage >= (int)atomic_load(&pipeline->stage_count)) {
+        return;
+    }
+
+    pipeline->stages[stage].latency_frames = frames;
+}
+
+/**
+ * Frames the stages delay the signal by together. Disabled stages count too,
+ * as they may be enabled at any time.
+ */
+uint32_t audio_pipeline_latency_frames(const audio_pipeline *pipeline) {
+    size_t count = atomic_load(&pipeline->stage_count);
+    uint32_t frames = 0;
+
+    for (size_t i = 0; i < count; i++) {
+        frames += pipeline->stages[i].latency_frames;
+    }
+
+    return frames;
+}
+
+void audio_pipeline_process(audio_pipeline *pipeline, int16_t *samples) {
+    size_t count =
+        atomic_load_explicit(&pipeline->stage_count, memory_order_acquire);
+
+    uint32_t block_start = dsp_cycle_count();
+
+    for (size_t i = 0; i < count; i++) {
+        audio_stage *stage = &pipeline->stages[i];
+
+        if (!atomic_load_explicit(&stage->enabled, memory_order_relaxed)) {
+            continue;
+        }
+
+        uint32_t start = dsp_cycle_count();
+        stage->process(stage->ctx, samples, pipeline->block_frames);
+        uint32_t cycles = dsp_cycle_count() - start;
+
+        stage->last_cycles = cycles;
+        if (cycles > stage->max_cycles) {
+            stage->max_cycles = cycles;
+        }
+        if (stage->cycle_budget != 0 && cycles > stage->cycle_budget) {
+            stage->budget_overruns++;
+        }
+    }
+
+    uint32_t cycles = dsp_cycle_count() - block_start;
+
+    pipeline->last_cycles = cycles;
+    if (cycles > pipeline->max_cycles) {
+        pipeline->max_cycles = cycles;
+    }
+    if (cycles > pipeline->block_cycles) {
+        pipeline->deadline_misses++;
+    }
+}
+
+/**
+ * Changes the block size the pipeline is driven with. Stage budgets are scaled
+ * with the block so each stage keeps the same share of the deadline. Must be
+ * called from the task that runs the pipeline.
+ */
+void audio_pipeline_set_block_frames(audio_pipeline *pipeline,
+                                     size_t block_frames) {
+    if (block_frames == 0 || block_frames == pipeline->block_frames) {
+        return;
+    }
+
+    size_t count = atomic_load(&pipeline->stage_count);
+
+    for (size_t i = 0; i < count; i++) {
+        audio_stage *stage = &pipeline->stages[i];
+
+        stage->cycle_budget = (uint64_t)stage->cycle_budget * block_frames /
+                              pipeline->block_frames;
+        stage->max_cycles = 0;
+    }
+
+    pipeline->block_frames = block_frames;
+    pipeline->block_cycles =
+        (uint64_t)pipeline->cpu_hz * block_frames / pipeline->sample_rate;
+    pipeline->max_cycles = 0;
+}
+
+/**
+ * Changes the clock budgets are measured against, after the CPU frequency was
+ * scaled. Stage budgets keep their share of the deadline like they do for a
+ * block size change. Must be called from the task that runs the pipeline.
+ */
+void audio_pipeline_set_cpu_hz(audio_pipeline *pipeline, uint32_t cpu_hz) {
+    if (cpu_hz == 0 || cpu_hz == pipeline->cpu_hz) {
+        return;
+    }
+
+    size_t count = atomic_load(&pipeline->stage_count);
+
+    for (size_t i = 0; i < count; i++) {
+        audio_stage *stage = &pipeline->stages[i];
+
+        stage->cycle_budget =
+            (uint64_t)stage->cycle_budget * cpu_hz / pipeline->cpu_hz;
+        stage->max_cycles = 0;
+    }
+
+    pipeline->cpu_hz = cpu_hz;
+    pipeline->block_cycles =
+        (uint64_t)cpu_hz * pipeline->block_frames / pipeline->sample_rate;
+    pipeline->max_cycles = 0;
+}
+
+uint32_t audio_pipeline_block_us(const audio_pipeline *pipeline) {
+    return (uint64_t)pipeline->block_frames * 1000000 / pipeline->sample_rate;
+}
@@ -0,0 +1,383 @@
+/**
+ * This file contains the fixed point pitch shifter used on the voice path.
+ * Everything on the per sample path is integer arithmetic, floating point is
+ * only used once at init to build the window table.
+ */
+
+#include "audio_dsp/pitch_shift.h"
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define BUFFER_MASK (PITCH_SHIFT_BUFFER_SIZE - 1)
+#define DECIMATED_MASK (PITCH_SHIFT_DECIMATED_SIZE - 1)
+
+#define UNITY_Q16 65536
+
+//! Decimated samples compared per lag by the coarse pitch search
+#define AMDF_WINDOW 64
+//! Full rate samples compared per lag when refining the coarse estimate
+#define REFINE_WINDOW 256
+//! Mean absolute decimated level below which the input is treated as silence
+#define SILENCE_LEVEL 64
+
+//! 2^(n/12) in Q16 for n = -12..12
+static const int32_t SEMITONE_RATIOS[2 * PITCH_SHIFT_MAX_SEMITONES + 1] = {
+    32768, 34716, 36781, 38968,  41285,  43740,  46341,  49097,  52016,
+    55109, 58386, 61858, 65536,  69433,  73562,  77936,  82570,  87480,
+    92682, 98193, 104032, 110218, 116772, 123715, 131072,
+};
+
+static inline int16_t saturate(int32_t sample) {
+    if (sample > INT16_MAX) {
+        return INT16_MAX;
+    }
+    if (sample < INT16_MIN) {
+        return INT16_MIN;
+    }
+    return sample;
+}
+
+/**
+ * Starts synthesis over, one period behind the input. Grains that would need
+ * input beyond what has arrived are taken a whole period earlier instead, so
+ * a longer lag only buys grains closer in time to the output, not alignment.
+ */
+static void reset_synthesis(pitch_shift *shifter) {
+    memset(shifter->output, 0, sizeof(shifter->output));
+
+    shifter->lag = shifter->period < shifter->default_period
+                       ? shifter->period
+                       : shifter->default_period;
+    shifter->output_pos = shifter->write_pos - shifter->lag;
+    shifter->synthesis_mark = shifter->output_pos;
+    shifter->synthesis_frac = 0;
+    shifter->analysis_mark = shifter->synthesis_mark;
+}
+
+void pitch_shift_init(pitch_shift *shifter, uint32_t sample_rate) {
+    memset(shifter, 0, sizeof(*shifter));
+
+    for (int i = 0; i < PITCH_SHIFT_WINDOW_SIZE; i++) {
+        float hann = 0.5f - 0.5f * cosf(2.0f * (float)M_PI * i /
+                                        PITCH_SHIFT_WINDOW_SIZE);
+        shifter->window[i] = (int16_t)(hann * 32767.0f);
+    }
+
+    // Voices sit between roughly 100 Hz and 1 kHz
+    shifter->min_period = sample_rate / 1000;
+    shifter->max_period = sample_rate / 100;
+    shifter->default_period = sample_rate / 200;
+    shifter->period = shifter->default_period;
+
+    // Start far enough in that the first grains read zeroed history
+    shifter->write_pos = PITCH_SHIFT_BUFFER_SIZE;
+
+    shifter->ratio = UNITY_Q16;
+    shifter->bypassed = true;
+    atomic_init(&shifter->requested_ratio, UNITY_Q16);
+    atomic_init(&shifter->requested_formant, false);
+
+    reset_synthesis(shifter);
+}
+
+bool pitch_shift_set_semitones(pitch_shift *shifter, int8_t semitones) {
+    if (semitones < -PITCH_SHIFT_MAX_SEMITONES ||
+        semitones > PITCH_SHIFT_MAX_SEMITONES) {
+        return false;
+    }
+
+    atomic_store(&shifter->requested_ratio,
+                 SEMITONE_RATIOS[semitones + PITCH_SHIFT_MAX_SEMITONES]);
+
+    return true;
+}
+
+void pitch_shift_set_formant_preservation(pitch_shift *shifter, bool enabled) {
+    atomic_store(&shifter->requested_formant, enabled);
+}
+
+static void push_input(pitch_shift *shifter, const int16_t *samples,
+                       size_t frames) {
+    for (size_t i = 0; i < frames; i++) {
+        shifter->input[shifter->write_pos & BUFFER_MASK] = samples[i];
+        shifter->write_pos++;
+
+        shifter->decimation_sum += samples[i];
+
+        if (++shifter->decimation_count == PITCH_SHIFT_DECIMATION) {
+            shifter->decimated[shifter->decimated_pos & DECIMATED_MASK] =
+                shifter->decimation_sum / PITCH_SHIFT_DECIMATION;
+            shifter->decimated_pos++;
+            shifter->decimation_sum = 0;
+            shifter->decimation_count = 0;
+        }
+    }
+}
+
+/**
+ * Estimates the pitch period with a coarse AMDF on the decimated history, then
+ * refines it at full rate around the coarse minimum. Unvoiced or silent input
+ * falls back to a fixed grain period.
+ */
+static void detect_pitch(pitch_shift *shifter) {
+    uint32_t min_lag = shifter->min_period / PITCH_SHIFT_DECIMATION;
+    uint32_t max_lag = shifter->max_period / PITCH_SHIFT_DECIMATION;
+
+    if (min_lag < 2) {
+        min_lag = 2;
+    }
+
+    uint32_t scores[PITCH_SHIFT_DECIMATED_SIZE - AMDF_WINDOW];
+    uint32_t start = shifter->decimated_pos - AMDF_WINDOW;
+    uint32_t best = UINT32_MAX;
+    uint64_t total = 0;
+    uint32_t level = 0;
+
+    for (uint32_t i = 0; i < AMDF_WINDOW; i++) {
+        level += abs(shifter->decimated[(start + i) & DECIMATED_MASK]);
+    }
+
+    for (uint32_t lag = min_lag; lag <= max_lag; lag++) {
+        uint32_t score = 0;
+
+        for (uint32_t i = 0; i < AMDF_WINDOW; i++) {
+            int32_t a = shifter->decimated[(start + i) & DECIMATED_MASK];
+            int32_t b = shifter->decimated[(start + i - lag) & DECIMATED_MASK];
+            score += abs(a - b);
+        }
+
+        scores[lag - min_lag] = score;
+        total += score;
+        if (score < best) {
+            best = score;
+        }
+    }
+
+    uint32_t mean = total / (max_lag - min_lag + 1);
+
+    shifter->voiced =
+        level > SILENCE_LEVEL * AMDF_WINDOW && best * 10 < mean * 3;
+
+    if (!shifter->voiced) {
+        shifter->period = shifter->default_period;
+        return;
+    }
+
+    // AMDF dips at every multiple of the period, so take the shortest lag
+    // that is about as good as the best one to avoid octave errors
+    uint32_t coarse = max_lag;
+    for (uint32_t lag = min_lag; lag <= max_lag; lag++) {
+        if (scores[lag - min_lag] * 10 <= best * 11) {
+            coarse = lag;
+            break;
+        }
+    }
+
+    uint32_t low = coarse * PITCH_SHIFT_DECIMATION - PITCH_SHIFT_DECIMATION;
+    uint32_t high = coarse * PITCH_SHIFT_DECIMATION + PITCH_SHIFT_DECIMATION;
+    if (low < shifter->min_period) {
+        low = shifter->min_period;
+    }
+    if (high > shifter->max_period) {
+        high = shifter->max_period;
+    }
+
+    uint32_t refine_start = shifter->write_pos - REFINE_WINDOW;
+    uint32_t refined = coarse * PITCH_SHIFT_DECIMATION;
+    best = UINT32_MAX;
+
+    for (uint32_t period = low; period <= high; period++) {
+        uint32_t score = 0;
+
+        for (uint32_t i = 0; i < REFINE_WINDOW; i++) {
+            int32_t a = shifter->input[(refine_start + i) & BUFFER_MASK];
+            int32_t b =
+                shifter->input[(refine_start + i - period) & BUFFER_MASK];
+            score += abs(a - b);
+        }
+
+        if (score < best) {
+            best = score;
+            refined = period;
+        }
+    }
+
+    shifter->period = refined;
+}
+
+/**
+ * Overlap-adds a Hann windowed grain covering two periods of input around
+ * `centre` into the output accumulator around `mark`. The grain is read with a
+ * Q16 step of `rate` so it spans 2 * period / rate output samples. Any part of
+ * the grain that lands on samples already emitted is dropped.
+ */
+static void add_grain(pitch_shift *shifter, uint32_t centre, uint32_t mark,
+                      uint32_t period, uint32_t half, int32_t rate) {
+    uint32_t length = 2 * half;
+    uint32_t step = ((uint32_t)PITCH_SHIFT_WINDOW_SIZE << 16) / length;
+
+    uint32_t in = centre - period;
+    uint32_t out = mark - half;
+
+    uint32_t first = 0;
+    if ((int32_t)(out - shifter->output_pos) < 0) {
+        first = shifter->output_pos - out;
+    }
+
+    uint32_t position = first * step;
+    uint32_t read = first * (uint32_t)rate;
+
+    for (uint32_t i = first; i < length; i++) {
+        uint32_t index = in + (read >> 16);
+        int32_t frac = read & 0xFFFF;
+
+        int32_t a = shifter->input[index & BUFFER_MASK];
+        int32_t b = shifter->input[(index + 1) & BUFFER_MASK];
+        int32_t sample = a + (((b - a) * frac) >> 16);
+
+        int32_t gain = shifter->window[position >> 16];
+
+        shifter->output[(out + i) & BUFFER_MASK] += (sample * gain) >> 15;
+
+        position += step;
+        read += rate;
+    }
+}
+
+/**
+ * Pitch synchronous overlap-add. Grains are taken a period apart from the input
+ * and laid down period / ratio apart in the output.
+ *
+ * With formant preservation each grain is copied at its original rate, so the
+ * spectral envelope inside it is untouched and only the spacing (the pitch)
+ * changes. Without it each grain is also resampled by the ratio, which moves
+ * the formants with the pitch like a tape speed change but keeps the duration.
+ */
+static void process_grains(pitch_shift *shifter, int16_t *samples,
+                           size_t frames) {
+    push_input(shifter, samples, frames);
+    detect_pitch(shifter);
+
+    uint32_t period = shifter->period;
+    uint32_t hop = ((uint64_t)period << 32) / (uint32_t)shifter->ratio;
+
+    int32_t rate = shifter->formant ? UNITY_Q16 : shifter->ratio;
+    uint32_t half = shifter->formant ? period : hop >> 16;
+
+    // Samples before this point receive no further grains once every grain
+    // starting before it has been placed
+    uint32_t output_end = shifter->write_pos - shifter->lag;
+
+    while ((int32_t)(shifter->synthesis_mark - half - output_end) < 0) {
+        // Analysis marks advance a period at a time, always taking the one
+        // nearest the synthesis mark
+        while ((int32_t)(shifter->analysis_mark + period / 2 -
+                         shifter->synthesis_mark) < 0) {
+            shifter->analysis_mark += period;
+        }
+
+        // The newest grains can run past the input that has arrived so far,
+        // step back whole periods to stay phase aligned
+        uint32_t centre = shifter->analysis_mark;
+        while ((int32_t)(centre + period - shifter->write_pos) > 0) {
+            centre -= period;
+        }
+
+        add_grain(shifter, centre, shifter->synthesis_mark, period, half,
+                  rate);
+
+        shifter->synthesis_frac += hop;
+        shifter->synthesis_mark += shifter->synthesis_frac >> 16;
+        shifter->synthesis_frac &= 0xFFFF;
+    }
+
+    // Resampled grains are half overlapped and sum to unity. Unresampled ones
+    // overlap by the ratio, so scale back down but never boost when grains are
+    // spread apart for downward shifts.
+    int32_t norm = 4096;
+    if (shifter->formant && shifter->ratio > UNITY_Q16) {
+        norm = ((int64_t)4096 * UNITY_Q16) / shifter->ratio;
+    }
+
+    for (size_t i = 0; i < frames; i++) {
+        uint32_t index = (shifter->output_pos + i) & BUFFER_MASK;
+
+        samples[i] = saturate((shifter->output[index] * norm) >> 12);
+        shifter->output[index] = 0;
+    }
+
+    shifter->output_pos += frames;
+}
+
+/**
+ * Fades the block from the shifted output to the input it was made from, or
+ * the other way around, so entering or leaving the bypass does not click on
+ * the jump in delay
+ */
+static void crossfade_bypass(pitch_shift *shifter, int16_t *samples,
+                             size_t frames, bool to_input) {
+    uint32_t start = shifter->write_pos - frames;
+
+    for (size_t i = 0; i < frames; i++) {
+        int32_t input = shifter->input[(start + i) & BUFFER_MASK];
+        int32_t gain = (int32_t)(((i + 1) << 15) / frames);
+        if (!to_input) {
+            gain = 32768 - gain;
+        }
+
+        samples[i] = samples[i] + (((input - samples[i]) * gain) >> 15);
+    }
+}
+
+/**
+ * Pipeline stage entry point, `ctx` is the pitch_shift instance
+ */
+void pitch_shift_process(void *ctx, int16_t *samples, size_t frames) {
+    pitch_shift *shifter = ctx;
+
+    bool formant = atomic_load_explicit(&shifter->requested_formant,
+                                        memory_order_relaxed);
+    int32_t ratio = atomic_load_explicit(&shifter->requested_ratio,
+                                         memory_order_relaxed);
+    bool bypass = ratio == UNITY_Q16;
+
+    if (bypass && shifter->bypassed) {
+        // Only the history is kept, synthesis starts from it when shifting
+        // resumes
+        push_input(shifter, samples, frames);
+        return;
+    }
+
+    if (shifter->bypassed) {
+        // The tracker sat idle in the bypass, the lag comes from the period
+        // of the voice as it is now
+        detect_pitch(shifter);
+    }
+
+    if (formant != shifter->formant || shifter->bypassed) {
+        shifter->formant = formant;
+        reset_synthesis(shifter);
+    }
+
+    // The block faded out into the bypass keeps the old ratio, a new one
+    // would change the level of the grains already laid down
+    if (!bypass) {
+        shifter->ratio = ratio;
+    }
+
+    process_grains(shifter, samples, frames);
+
+    if (bypass != shifter->bypassed) {
+        crossfade_bypass(shifter, samples, frames, bypass);
+        shifter->bypassed = bypass;
+    }
+}
+
+/**
+ * Most frames the output runs behind the input, for the latency the stage adds
+ * to the voice path
+ */
+uint32_t pitch_shift_latency_frames(const pitch_shift *shifter) {
+    return shifter->default_period;
+}
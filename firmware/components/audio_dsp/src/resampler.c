@@ -0,0 +1,192 @@
+/**
+ * This file contains the polyphase resampler that converts A2DP streams to the
+ * fixed I2S rate. Coefficients are designed with floating point when the rate
+ * changes, the per sample path is integer only.
+ */
+
+#include "audio_dsp/resampler.h"
+#include <math.h>
+#include <string.h>
+
+//! Fraction of the narrower Nyquist band left in the passband per quality
+static float passband(ResamplerQuality quality) {
+    switch (quality) {
+        case ResamplerLow:
+            return 0.80f;
+        case ResamplerMedium:
+            return 0.90f;
+        default:
+            return 0.95f;
+    }
+}
+
+static uint32_t gcd(uint32_t a, uint32_t b) {
+    while (b != 0) {
+        uint32_t t = a % b;
+        a = b;
+        b = t;
+    }
+    return a;
+}
+
+void resampler_reset(resampler *converter) {
+    memset(converter->history, 0, sizeof(converter->history));
+    converter->phase = 0;
+    converter->history_pos = 0;
+}
+
+/**
+ * Designs a Blackman windowed sinc low pass at the upsampled rate and splits
+ * it into `up` phases of `quality` taps. Returns false for ratios that would
+ * need more phases than the table holds.
+ */
+bool resampler_configure(resampler *converter, uint32_t input_rate,
+                         uint32_t output_rate, ResamplerQuality quality) {
+    if (input_rate == 0 || output_rate == 0) {
+        return false;
+    }
+
+    uint32_t divisor = gcd(input_rate, output_rate);
+    uint32_t up = output_rate / divisor;
+    uint32_t down = input_rate / divisor;
+
+    if (up > RESAMPLER_MAX_PHASES || quality > RESAMPLER_MAX_TAPS) {
+        return false;
+    }
+
+    converter->input_rate = input_rate;
+    converter->output_rate = output_rate;
+    converter->up = up;
+    converter->down = down;
+    converter->taps = quality;
+    converter->passthrough = input_rate == output_rate;
+
+    resampler_reset(converter);
+
+    if (converter->passthrough) {
+        return true;
+    }
+
+    uint32_t length = up * quality;
+    float centre = (length - 1) / 2.0f;
+    float cutoff = 0.5f * passband(quality) / (up > down ? up : down);
+
+    for (uint32_t n = 0; n < length; n++) {
+        float x = n - centre;
+        float sinc = x == 0.0f ? 2.0f * cutoff
+                               : sinf(2.0f * (float)M_PI * cutoff * x) /
+                                     ((float)M_PI * x);
+        float window = 0.42f -
+                       0.5f * cosf(2.0f * (float)M_PI * n / (length - 1)) +
+                       0.08f * cosf(4.0f * (float)M_PI * n / (length - 1));
+
+        // Interpolating by `up` loses that much gain, put it back here
+        float value = sinc * window * up * 32768.0f;
+
+        // Phase p holds taps p, p + up, p + 2 * up... in reverse so the dot
+        // product can walk the history forwards
+        uint32_t phase = n % up;
+        uint32_t tap = quality - 1 - n / up;
+
+        converter->coeffs[phase * quality + tap] =
+            (int16_t)lrintf(fmaxf(fminf(value, 32767.0f), -32768.0f));
+    }
+
+    return true;
+}
+
+/**
+ * Input frames needed to produce `output_frames` from the current position
+ */
+size_t resampler_input_needed(const resampler *converter,
+                              size_t output_frames) {
+    if (converter->passthrough) {
+        return output_frames;
+    }
+
+    uint64_t position = converter->phase + (uint64_t)output_frames *
+                                               converter->down;
+
+    return position / converter->up;
+}
+
+static inline int16_t saturate(int32_t sample) {
+    if (sample > INT16_MAX) {
+        return INT16_MAX;
+    }
+    if (sample < INT16_MIN) {
+        return INT16_MIN;
+    }
+    return sample;
+}
+
+static inline void push_frame(resampler *converter, const int16_t *frame) {
+    uint16_t pos = converter->history_pos;
+    uint16_t taps = converter->taps;
+
+    for (int channel = 0; channel < RESAMPLER_CHANNELS; channel++) {
+        converter->history[channel][pos] = frame[channel];
+        converter->history[channel][pos + taps] = frame[channel];
+    }
+
+    converter->history_pos = pos + 1 == taps ? 0 : pos + 1;
+}
+
+/**
+ * Converts as much as possible, stopping when either the output is full or the
+ * input runs out. Returns output frames written and reports input frames used
+ * through `consumed`.
+ */
+size_t resampler_process(resampler *converter, const int16_t *input,
+                         size_t input_frames, size_t *consumed,
+                         int16_t *output, size_t output_frames) {
+    if (converter->passthrough) {
+        size_t frames =
+            input_frames < output_frames ? input_frames : output_frames;
+
+        memcpy(output, input, frames * RESAMPLER_CHANNELS * sizeof(int16_t));
+        *consumed = frames;
+        return frames;
+    }
+
+    size_t used = 0;
+    size_t produced = 0;
+    uint16_t taps = converter->taps;
+
+    while (produced < output_frames) {
+        // Advance the input until the current phase lands inside it
+        while (converter->phase >= converter->up) {
+            if (used == input_frames) {
+                *consumed = used;
+                return produced;
+            }
+
+            push_frame(converter, &input[used * RESAMPLER_CHANNELS]);
+            used++;
+            converter->phase -= converter->up;
+        }
+
+        const int16_t *coeffs = &converter->coeffs[converter->phase * taps];
+
+        for (int channel = 0; channel < RESAMPLER_CHANNELS; channel++) {
+            const int16_t *history =
+                &converter->history[channel][converter->history_pos];
+
+            // The sum of absolute Q15 coefficients in a phase stays well
+            // below 2, so a 32 bit accumulator cannot overflow
+            int32_t acc = 0;
+            for (uint16_t k = 0; k < taps; k++) {
+                acc += coeffs[k] * history[k];
+            }
+
+            output[produced * RESAMPLER_CHANNELS + channel] =
+                saturate((acc + (1 << 14)) >> 15);
+        }
+
+        produced++;
+        converter->phase += converter->down;
+    }
+
+    *consumed = used;
+    return produced;
+}
@@ -0,0 +1,129 @@
+/**
+ * This file contains the soundbank container parser. Every clip is validated
+ * once when the bank is opened, so lookups afterwards can trust the table.
+ */
+
+#include "audio_dsp/soundbank.h"
+#include "audio_dsp/adpcm.h"
+#include <string.h>
+
+static uint16_t get_u16(const uint8_t *in) { return in[0] | (in[1] << 8); }
+
+static uint32_t get_u32(const uint8_t *in) {
+    return in[0] | (in[1] << 8) | (in[2] << 16) | ((uint32_t)in[3] << 24);
+}
+
+uint32_t soundbank_image_size(const uint8_t header[SOUNDBANK_HEADER_SIZE]) {
+    if (get_u32(&header[0]) != SOUNDBANK_MAGIC ||
+        get_u16(&header[4]) != SOUNDBANK_VERSION) {
+        return 0;
+    }
+
+    return get_u32(&header[12]);
+}
+
+static void read_entry(const soundbank *bank, uint16_t index,
+                       soundbank_clip *clip) {
+    const uint8_t *entry =
+        bank->image + SOUNDBANK_HEADER_SIZE + index * SOUNDBANK_ENTRY_SIZE;
+
+    clip->data = bank->image + get_u32(&entry[0]);
+    clip->size = get_u32(&entry[4]);
+    clip->frames = get_u32(&entry[8]);
+    clip->channels = entry[12];
+    clip->encoding = entry[13];
+
+    memcpy(clip->name, &entry[16], SOUNDBANK_NAME_SIZE);
+    clip->name[SOUNDBANK_NAME_SIZE] = '\0';
+}
+
+static bool entry_valid(const soundbank *bank, const uint8_t *entry) {
+    uint32_t offset = get_u32(&entry[0]);
+    uint32_t size = get_u32(&entry[4]);
+    uint32_t frames = get_u32(&entry[8]);
+    uint8_t channels = entry[12];
+    uint8_t encoding = entry[13];
+
+    if (offset % 4 != 0 || offset > bank->size || size > bank->size - offset) {
+        return false;
+    }
+
+    if (channels < 1 || channels > 2 || encoding >= SoundbankEncodingCount) {
+        return false;
+    }
+
+    if (encoding == SoundbankImaAdpcm) {
+        uint64_t blocks =
+            ((uint64_t)frames + ADPCM_BLOCK_FRAMES - 1) / ADPCM_BLOCK_FRAMES;
+        return blocks * adpcm_block_size(channels) == size;
+    }
+
+    return (uint64_t)frames * channels * sizeof(int16_t) == size;
+}
+
+/**
+ * Checks the image and every clip in it. The bank only refers to `image`, which
+ * has to stay mapped while it is in use.
+ */
+bool soundbank_open(soundbank *bank, const void *image, size_t size) {
+    const uint8_t *bytes = image;
+
+    if (size < SOUNDBANK_HEADER_SIZE) {
+        return false;
+    }
+
+    uint32_t image_size = soundbank_image_size(bytes);
+    uint16_t clip_count = get_u16(&bytes[6]);
+
+    if (image_size < SOUNDBANK_HEADER_SIZE || image_size > size ||
+        clip_count > SOUNDBANK_MAX_CLIPS ||
+        SOUNDBANK_HEADER_SIZE + clip_count * (uint32_t)SOUNDBANK_ENTRY_SIZE >
+            image_size) {
+        return false;
+    }
+
+    soundbank candidate = {
+        .image = bytes,
+        .size = image_size,
+        .clip_count = clip_count,
+        .sample_rate = get_u32(&bytes[8]),
+    };
+
+    for (uint16_t i = 0; i < clip_count; i++) {
+        if (!entry_valid(&candidate, bytes + SOUNDBANK_HEADER_SIZE +
+                                         i * SOUNDBANK_ENTRY_SIZE)) {
+            return false;
+        }
+    }
+
+    *bank = candidate;
+
+    return true;
+}
+
+bool soundbank_clip_at(const soundbank *bank, uint16_t index,
+                       soundbank_clip *clip) {
+    if (index >= bank->clip_count) {
+        return false;
+    }
+
+    read_entry(bank, index, clip);
+
+    return true;
+}
+
+/**
+ * Index of the clip called `name`, -1 if there is none
+ */
+int soundbank_find(const soundbank *bank, const char *name) {
+    for (uint16_t i = 0; i < bank->clip_count; i++) {
+        const uint8_t *entry =
+            bank->image + SOUNDBANK_HEADER_SIZE + i * SOUNDBANK_ENTRY_SIZE;
+
+        if (strncmp((const char *)&entry[16], name, SOUNDBANK_NAME_SIZE) == 0) {
+            return i;
+        }
+    }
+
+    return -1;
+}
@@ -0,0 +1,226 @@
+/**
+ * This file contains the software tone control. The shelves are the usual
+ * second order shelving filters with a slope of one, which is what the codec's
+ * curves look like, placed at the codec's corners for the chosen setting.
+ * Filters are only redesigned when the settings change, between blocks.
+ */
+
+#include "audio_dsp/tone.h"
+#include <math.h>
+#include <string.h>
+
+#define COEFFICIENT_SHIFT 28
+//! Fraction bits kept on the filter outputs fed back, so the low bass corner
+//! does not round away into a limit cycle
+#define STATE_SHIFT 8
+
+bool tone_config_valid(const tone_config *config) {
+    return config->bass >= TONE_MIN_STEPS && config->bass <= TONE_MAX_STEPS &&
+           config->treble >= TONE_MIN_STEPS &&
+           config->treble <= TONE_MAX_STEPS &&
+           config->depth_3d <= TONE_MAX_DEPTH_3D;
+}
+
+//! Whether the settings change the sound at all
+bool tone_active(const tone_config *config) {
+    return config->bass != 0 || config->treble != 0 || config->depth_3d != 0;
+}
+
+static uint32_t pack(const tone_config *config) {
+    return (uint8_t)config->bass | (uint8_t)config->treble << 8 |
+           config->depth_3d << 16 | config->bass_high_cutoff << 20 |
+           config->treble_low_cutoff << 21 | config->narrow_3d_low << 22 |
+           (uint32_t)config->narrow_3d_high << 23;
+}
+
+static tone_config unpack(uint32_t packed) {
+    return (tone_config){
+        .bass = (int8_t)(packed & 0xFF),
+        .treble = (int8_t)((packed >> 8) & 0xFF),
+        .depth_3d = (packed >> 16) & 0xF,
+        .bass_high_cutoff = (packed >> 20) & 1,
+        .treble_low_cutoff = (packed >> 21) & 1,
+        .narrow_3d_low = (packed >> 22) & 1,
+        .narrow_3d_high = (packed >> 23) & 1,
+    };
+}
+
+static int32_t to_fixed(double value, int shift) {
+    return (int32_t)lround(value * (1 << shift));
+}
+
+/**
+ * Designs a shelf at `corner` Hz with `steps` of 1.5 dB gain, low or high.
+ * The filter state is kept so a change does not click.
+ */
+static void design_shelf(tone_biquad *filter, bool high, float corner,
+                         int8_t steps, uint32_t sample_rate) {
+    double a = pow(10.0, steps * 1.5 / 40.0);
+    double w0 = 2.0 * M_PI * corner / sample_rate;
+    double cosine = cos(w0);
+    double alpha = sin(w0) / 2.0 * sqrt(2.0);
+    double root = 2.0 * sqrt(a) * alpha;
+    double sign = high ? -1.0 : 1.0;
+
+    double b0 = a * ((a + 1) - sign * (a - 1) * cosine + root);
+    double b1 = sign * 2.0 * a * ((a - 1) - sign * (a + 1) * cosine);
+    double b2 = a * ((a + 1) - sign * (a - 1) * cosine - root);
+    double a0 = (a + 1) + sign * (a - 1) * cosine + root;
+    double a1 = -sign * 2.0 * ((a - 1) + sign * (a + 1) * cosine);
+    double a2 = (a + 1) + sign * (a - 1) * cosine - root;
+
+    filter->b0 = to_fixed(b0 / a0, COEFFICIENT_SHIFT);
+    filter->b1 = to_fixed(b1 / a0, COEFFICIENT_SHIFT);
+    filter->b2 = to_fixed(b2 / a0, COEFFICIENT_SHIFT);
+    filter->a1 = to_fixed(a1 / a0, COEFFICIENT_SHIFT);
+    filter->a2 = to_fixed(a2 / a0, COEFFICIENT_SHIFT);
+}
+
+static int32_t one_pole(float corner, uint32_t sample_rate) {
+    return to_fixed(1.0 - exp(-2.0 * M_PI * corner / sample_rate), 15);
+}
+
+static void design(tone_control *tone) {
+    const tone_config *config = &tone->config;
+
+    design_shelf(&tone->bass, false, config->bass_high_cutoff ? 200 : 130,
+                 config->bass, tone->sample_rate);
+    design_shelf(&tone->treble, true, config->treble_low_cutoff ? 4000 : 8000,
+                 config->treble, tone->sample_rate);
+
+    tone->low_coefficient =
+        one_pole(config->narrow_3d_low ? 500 : 200, tone->sample_rate);
+    tone->high_coefficient =
+        one_pole(config->narrow_3d_high ? 1500 : 2200, tone->sample_rate);
+    tone->depth = (config->depth_3d << 14) / TONE_MAX_DEPTH_3D;
+}
+
+void tone_init(tone_control *tone, uint32_t sample_rate) {
+    memset(tone, 0, sizeof(*tone));
+
+    tone->sample_rate = sample_rate;
+    atomic_init(&tone->requested, 0);
+    design(tone);
+}
+
+/**
+ * Takes effect from the next block. Returns false for settings out of range.
+ */
+bool tone_configure(tone_control *tone, const tone_config *config) {
+    if (!tone_config_valid(config)) {
+        return false;
+    }
+
+    atomic_store(&tone->requested, pack(config));
+
+    return true;
+}
+
+static inline int16_t saturate(int32_t sample) {
+    if (sample > INT16_MAX) {
+        return INT16_MAX;
+    }
+    if (sample < INT16_MIN) {
+        return INT16_MIN;
+    }
+    return sample;
+}
+
+static void reset_history(tone_biquad *filter) {
+    memset(filter->x, 0, sizeof(filter->x));
+    memset(filter->y, 0, sizeof(filter->y));
+}
+
+static void run_biquad(tone_biquad *filter, int16_t *stereo, size_t frames) {
+    for (size_t channel = 0; channel < 2; channel++) {
+        int32_t x1 = filter->x[channel][0];
+        int32_t x2 = filter->x[channel][1];
+        int32_t y1 = filter->y[channel][0];
+        int32_t y2 = filter->y[channel][1];
+
+        for (size_t i = 0; i < frames; i++) {
+            int32_t x0 = stereo[2 * i + channel];
+
+            int64_t acc = ((int64_t)filter->b0 * x0 +
+                           (int64_t)filter->b1 * x1 +
+                           (int64_t)filter->b2 * x2) *
+                          (1 << STATE_SHIFT);
+            acc -= (int64_t)filter->a1 * y1 + (int64_t)filter->a2 * y2;
+
+            int32_t y0 = acc >> COEFFICIENT_SHIFT;
+
+            stereo[2 * i + channel] = saturate(y0 >> STATE_SHIFT);
+
+            x2 = x1;
+            x1 = x0;
+            y2 = y1;
+            y1 = y0;
+        }
+
+        filter->x[channel][0] = x1;
+        filter->x[channel][1] = x2;
+        filter->y[channel][0] = y1;
+        filter->y[channel][1] = y2;
+    }
+}
+
+/**
+ * Widens the image by adding the difference of the channels, band limited to
+ * where it is heard as width, to one side and taking it from the other
+ */
+static void run_3d(tone_control *tone, int16_t *stereo, size_t frames) {
+    int32_t low = tone->low_state;
+    int32_t high = tone->high_state;
+
+    for (size_t i = 0; i < frames; i++) {
+        int32_t side = (stereo[2 * i] - stereo[2 * i + 1]) * 16;
+
+        // Low passed at the top corner, then high passed at the bottom one by
+        // taking away its own low passed copy. The states carry 4 fraction
+        // bits so the slow bottom corner does not stall on rounding.
+        high += ((int64_t)(side - high) * tone->high_coefficient) >> 15;
+        low += ((int64_t)(high - low) * tone->low_coefficient) >> 15;
+
+        int32_t band = (((high - low) >> 4) * tone->depth) >> 14;
+
+        stereo[2 * i] = saturate(stereo[2 * i] + band);
+        stereo[2 * i + 1] = saturate(stereo[2 * i + 1] - band);
+    }
+
+    tone->low_state = low;
+    tone->high_state = high;
+}
+
+void tone_process(tone_control *tone, int16_t *stereo, size_t frames) {
+    uint32_t requested =
+        atomic_load_explicit(&tone->requested, memory_order_relaxed);
+    if (requested != tone->packed) {
+        tone_config previous = tone->config;
+
+        tone->packed = requested;
+        tone->config = unpack(requested);
+        design(tone);
+
+        // A filter coming back from bypass would start from stale history
+        if (previous.bass == 0) {
+            reset_history(&tone->bass);
+        }
+        if (previous.treble == 0) {
+            reset_history(&tone->treble);
+        }
+        if (previous.depth_3d == 0) {
+            tone->low_state = 0;
+            tone->high_state = 0;
+        }
+    }
+
+    if (tone->config.bass != 0) {
+        run_biquad(&tone->bass, stereo, frames);
+    }
+    if (tone->config.treble != 0) {
+        run_biquad(&tone->treble, stereo, frames);
+    }
+    if (tone->config.depth_3d != 0) {
+        run_3d(tone, stereo, frames);
+    }
+}
@@ -0,0 +1,593 @@
+/**
+ * This file contains the character voice effects and the switching between
+ * their presets. Each effect has a kernel per variant of its settings, built
+ * from one inline body with the variant fixed at compile time, and the preset
+ * picks which of them a slot runs.
+ *
+ * The vocoder's analysis and synthesis banks are Chamberlin state variable
+ * filters, two multiplies per pole pair with int32 state, so twelve bands of
+ * both stay cheap enough for the voice block.
+ */
+
+#include "audio_dsp/voice_fx.h"
+#include <math.h>
+#include <string.h>
+
+//! Bits of the sine table index, log2 of VOICE_FX_SINE_SIZE
+#define SINE_BITS 8
+
+//! Vocoder envelope one pole time constant as a shift, 512 samples or about
+//! 11 ms at 48 kHz
+#define ENVELOPE_SHIFT 9
+
+//! Breath noise is this far below the carrier, as a shift
+#define NOISE_SHIFT 3
+
+//! Vocoder output gain in Q8, bringing speech out about as loud as it went
+//! in. The pulse train needs more since less of its energy lands in the bands
+//! where speech is loudest.
+#define SAW_MAKEUP 1280
+#define PULSE_MAKEUP 2048
+
+//! Duty cycle of the pulse carrier as a phase, an eighth of a cycle, and the
+//! levels either side of it that keep it free of DC
+#define PULSE_WIDTH (1u << 29)
+#define PULSE_HIGH 28000
+#define PULSE_LOW -4000
+
+static const voice_fx_config PRESETS[VoiceFxPresetCount] = {
+    // VoiceFxOff is all zeroes
+    [VoiceFxRobot] =
+        {
+            .vocoder_hz = 110,
+            .vocoder_pulse = true,
+        },
+    [VoiceFxMetallic] =
+        {
+            .ring_hz = 30,
+        },
+    [VoiceFxRadio] =
+        {
+            .crush_bits = 6,
+            .crush_hold = 4,
+        },
+    [VoiceFxChorus] =
+        {
+            .chorus_voices = 2,
+            .chorus_depth_ms = 4,
+            .chorus_rate = 8,
+        },
+    [VoiceFxDroid] =
+        {
+            .ring_hz = 90,
+            .ring_square = true,
+            .crush_bits = 8,
+            .crush_hold = 2,
+            .chorus_voices = 1,
+            .chorus_depth_ms = 2,
+            .chorus_rate = 30,
+        },
+};
+
+const voice_fx_config *voice_fx_preset(VoiceFxPreset preset) {
+    return preset < VoiceFxPresetCount ? &PRESETS[preset] : NULL;
+}
+
+static inline int16_t saturate(int32_t sample) {
+    if (sample > INT16_MAX) {
+        return INT16_MAX;
+    }
+    if (sample < INT16_MIN) {
+        return INT16_MIN;
+    }
+    return sample;
+}
+
+//! Phase step of an oscillator at `hz`, a whole cycle being 2^32
+static uint32_t phase_increment(uint32_t hz, uint32_t sample_rate) {
+    return ((uint64_t)hz << 32) / sample_rate;
+}
+
+/**
+ * Sets a slot up for `config` and returns the kernel it runs, or NULL if the
+ * effect is off in it
+ */
+typedef voice_fx_kernel (*slot_setup)(voice_fx *fx, void *slot,
+                                      const voice_fx_config *config);
+
+//! Whether an effect sounds the same under both settings
+typedef bool (*settings_match)(const voice_fx_config *a,
+                               const voice_fx_config *b);
+
+/**
+ * Moves a stage on to the requested preset if it is not still fading from the
+ * last switch. Returns whether the stage has anything to do this block.
+ */
+static bool follow_preset(voice_fx *fx, voice_fx_switch *stage,
+                          slot_setup setup, settings_match match) {
+    VoiceFxPreset requested =
+        atomic_load_explicit(&fx->requested, memory_order_relaxed);
+
+    if (requested != stage->preset &&
+        stage->fade == VOICE_FX_CROSSFADE_FRAMES) {
+        const voice_fx_config *next = &PRESETS[requested];
+
+        if (!match(&PRESETS[stage->preset], next)) {
+            uint8_t slot = stage->active ^ 1;
+
+            stage->kernels[slot] = setup(fx, stage->slots[slot], next);
+            stage->active = slot;
+            stage->fade = 0;
+        }
+
+        stage->preset = requested;
+    }
+
+    return stage->fade < VOICE_FX_CROSSFADE_FRAMES ||
+           stage->kernels[stage->active] != NULL;
+}
+
+/**
+ * Runs the active slot, and while a switch is fading the previous one too,
+ * crossfading linearly from the previous slot's output to the active one's
+ */
+static void run_stage(voice_fx_switch *stage, int16_t *samples,
+                      size_t frames) {
+    uint8_t active = stage->active;
+    voice_fx_kernel next = stage->kernels[active];
+
+    if (stage->fade == VOICE_FX_CROSSFADE_FRAMES) {
+        next(stage->slots[active], samples, frames);
+        return;
+    }
+
+    voice_fx_kernel previous = stage->kernels[active ^ 1];
+
+    for (size_t start = 0; start < frames; start += VOICE_FX_CHUNK_FRAMES) {
+        size_t count = frames - start < VOICE_FX_CHUNK_FRAMES
+                           ? frames - start
+                           : VOICE_FX_CHUNK_FRAMES;
+        int16_t *to = &samples[start];
+        int16_t from[VOICE_FX_CHUNK_FRAMES];
+
+        memcpy(from, to, count * sizeof(int16_t));
+
+        if (previous != NULL) {
+            previous(stage->slots[active ^ 1], from, count);
+        }
+        if (next != NULL) {
+            next(stage->slots[active], to, count);
+        }
+
+        for (size_t i = 0; i < count; i++) {
+            if (stage->fade < VOICE_FX_CROSSFADE_FRAMES) {
+                to[i] = from[i] + (to[i] - from[i]) * stage->fade /
+                                      VOICE_FX_CROSSFADE_FRAMES;
+                stage->fade++;
+            }
+        }
+    }
+}
+
+/**
+ * Ring modulator, the voice multiplied by the carrier. Its own pitch is lost
+ * under the sum and difference of every partial with the carrier.
+ */
+static inline void ring_kernel(voice_fx_ring_slot *ring, int16_t *samples,
+                               size_t frames, const bool square) {
+    for (size_t i = 0; i < frames; i++) {
+        uint32_t phase = ring->phase;
+        int32_t sample = samples[i];
+
+        if (square) {
+            sample = phase >> 31 ? -sample : sample;
+        } else {
+            uint32_t index = phase >> (32 - SINE_BITS);
+            int32_t fraction = (phase >> (32 - SINE_BITS - 15)) & 0x7FFF;
+            int32_t a = ring->sine[index];
+            int32_t b = ring->sine[index + 1];
+            int32_t carrier = a + (((b - a) * fraction) >> 15);
+
+            sample = (sample * carrier) >> 15;
+        }
+
+        samples[i] = saturate(sample);
+        ring->phase = phase + ring->increment;
+    }
+}
+
+static void ring_sine(void *slot, int16_t *samples, size_t frames) {
+    ring_kernel(slot, samples, frames, false);
+}
+
+static void ring_square(void *slot, int16_t *samples, size_t frames) {
+    ring_kernel(slot, samples, frames, true);
+}
+
+static voice_fx_kernel ring_setup(voice_fx *fx, void *slot,
+                                  const voice_fx_config *config) {
+    voice_fx_ring_slot *ring = slot;
+
+    if (config->ring_hz == 0) {
+        return NULL;
+    }
+
+    ring->sine = fx->sine;
+    ring->phase = 0;
+    ring->increment = phase_increment(config->ring_hz, fx->sample_rate);
+
+    return config->ring_square ? ring_square : ring_sine;
+}
+
+static bool ring_match(const voice_fx_config *a, const voice_fx_config *b) {
+    return a->ring_hz == b->ring_hz &&
+           (a->ring_hz == 0 || a->ring_square == b->ring_square);
+}
+
+/**
+ * One state variable filter step on `input`, already scaled by the damping so
+ * the band pass peaks at unity. Returns the band pass output.
+ */
+static inline int32_t band_pass(int32_t *low, int32_t *band, int32_t input,
+                                int32_t frequency, int32_t damping) {
+    *low += (frequency * *band) >> 12;
+    int32_t high = input - *low - ((damping * *band) >> 12);
+    *band += (frequency * high) >> 12;
+
+    return *band;
+}
+
+/**
+ * Channel vocoder. The voice is split into bands whose envelopes then shape
+ * the same bands of the carrier, so it speaks with the carrier's pitch and
+ * timbre. A little noise in the carrier keeps the consonants.
+ *
+ * Each chunk is run a band at a time so a band's filter states stay in
+ * registers across the chunk.
+ */
+static inline void vocoder_kernel(voice_fx_vocoder_slot *vocoder,
+                                  int16_t *samples, size_t frames,
+                                  const bool pulse) {
+    const int32_t makeup = pulse ? PULSE_MAKEUP : SAW_MAKEUP;
+
+    for (size_t start = 0; start < frames; start += VOICE_FX_CHUNK_FRAMES) {
+        size_t count = frames - start < VOICE_FX_CHUNK_FRAMES
+                           ? frames - start
+                           : VOICE_FX_CHUNK_FRAMES;
+        int16_t *chunk = &samples[start];
+        int32_t carriers[VOICE_FX_CHUNK_FRAMES];
+        int32_t output[VOICE_FX_CHUNK_FRAMES] = {0};
+
+        for (size_t i = 0; i < count; i++) {
+            uint32_t phase = vocoder->phase;
+
+            if (pulse) {
+                carriers[i] = phase < PULSE_WIDTH ? PULSE_HIGH : PULSE_LOW;
+            } else {
+                carriers[i] = (int16_t)(phase >> 16);
+            }
+
+            vocoder->phase = phase + vocoder->increment;
+            vocoder->noise = vocoder->noise * 1664525u + 1013904223u;
+            carriers[i] += (int16_t)(vocoder->noise >> 16) >> NOISE_SHIFT;
+        }
+
+        for (size_t band = 0; band < VOICE_FX_VOCODER_BANDS; band++) {
+            int32_t frequency = vocoder->frequencies[band];
+            int32_t damping = vocoder->dampings[band];
+            int32_t modulator_low = vocoder->modulator_low[band];
+            int32_t modulator_band = vocoder->modulator_band[band];
+            int32_t carrier_low = vocoder->carrier_low[band];
+            int32_t carrier_band = vocoder->carrier_band[band];
+            int32_t envelope = vocoder->envelopes[band];
+
+            for (size_t i = 0; i < count; i++) {
+                // Inputs gain the state's 2 fraction bits here
+                int32_t voice = band_pass(&modulator_low, &modulator_band,
+                                          (chunk[i] * damping) >> 10,
+                                          frequency, damping);
+                int32_t tone = band_pass(&carrier_low, &carrier_band,
+                                         (carriers[i] * damping) >> 10,
+                                         frequency, damping);
+                int32_t level = voice < 0 ? -voice : voice;
+
+                envelope += ((level << 6) - envelope) >> ENVELOPE_SHIFT;
+                output[i] += ((tone >> 3) * (envelope >> 8)) >> 14;
+            }
+
+            vocoder->modulator_low[band] = modulator_low;
+            vocoder->modulator_band[band] = modulator_band;
+            vocoder->carrier_low[band] = carrier_low;
+            vocoder->carrier_band[band] = carrier_band;
+            vocoder->envelopes[band] = envelope;
+        }
+
+        for (size_t i = 0; i < count; i++) {
+            chunk[i] = saturate(((int64_t)output[i] * makeup) >> 8);
+        }
+    }
+}
+
+static void vocoder_saw(void *slot, int16_t *samples, size_t frames) {
+    vocoder_kernel(slot, samples, frames, false);
+}
+
+static void vocoder_pulse(void *slot, int16_t *samples, size_t frames) {
+    vocoder_kernel(slot, samples, frames, true);
+}
+
+static voice_fx_kernel vocoder_setup(voice_fx *fx, void *slot,
+                                     const voice_fx_config *config) {
+    voice_fx_vocoder_slot *vocoder = slot;
+
+    if (config->vocoder_hz == 0) {
+        return NULL;
+    }
+
+    memset(vocoder, 0, sizeof(*vocoder));
+    vocoder->frequencies = fx->vocoder_frequencies;
+    vocoder->dampings = fx->vocoder_dampings;
+    vocoder->increment = phase_increment(config->vocoder_hz, fx->sample_rate);
+    vocoder->noise = 1;
+
+    return config->vocoder_pulse ? vocoder_pulse : vocoder_saw;
+}
+
+static bool vocoder_match(const voice_fx_config *a, const voice_fx_config *b) {
+    return a->vocoder_hz == b->vocoder_hz &&
+           (a->vocoder_hz == 0 || a->vocoder_pulse == b->vocoder_pulse);
+}
+
+/**
+ * Bit crusher, quantising to fewer bits and optionally holding each kept
+ * sample to lower the rate, aliasing included
+ */
+static inline void crush_kernel(voice_fx_crush_slot *crush, int16_t *samples,
+                                size_t frames, const bool hold) {
+    for (size_t i = 0; i < frames; i++) {
+        if (!hold) {
+            samples[i] &= crush->mask;
+            continue;
+        }
+
+        if (crush->count == 0) {
+            crush->held = samples[i] & crush->mask;
+            crush->count = crush->hold;
+        }
+
+        crush->count--;
+        samples[i] = crush->held;
+    }
+}
+
+static void crush_bits(void *slot, int16_t *samples, size_t frames) {
+    crush_kernel(slot, samples, frames, false);
+}
+
+static void crush_bits_held(void *slot, int16_t *samples, size_t frames) {
+    crush_kernel(slot, samples, frames, true);
+}
+
+static voice_fx_kernel crush_setup(voice_fx *fx, void *slot,
+                                   const voice_fx_config *config) {
+    voice_fx_crush_slot *crush = slot;
+    uint8_t bits = config->crush_bits;
+
+    if (bits == 0 || bits > 16) {
+        bits = 16;
+    }
+
+    if (bits == 16 && config->crush_hold <= 1) {
+        return NULL;
+    }
+
+    crush->mask = ~((1 << (16 - bits)) - 1);
+    crush->hold = config->crush_hold;
+    crush->count = 0;
+
+    return config->crush_hold > 1 ? crush_bits_held : crush_bits;
+}
+
+static bool crush_match(const voice_fx_config *a, const voice_fx_config *b) {
+    return a->crush_bits % 16 == b->crush_bits % 16 &&
+           (a->crush_hold > 1 ? a->crush_hold : 1) ==
+               (b->crush_hold > 1 ? b->crush_hold : 1);
+}
+
+/**
+ * Chorus, the voice with copies of itself read from the history at delays
+ * swept by triangle waves, half a cycle apart when there are two
+ */
+static inline void chorus_kernel(voice_fx_chorus_slot *chorus,
+                                 int16_t *samples, size_t frames,
+                                 const int voices) {
+    const uint32_t mask = VOICE_FX_CHORUS_SIZE - 1;
+
+    for (size_t i = 0; i < frames; i++) {
+        uint32_t now = chorus->chunk_start + i;
+        int32_t wet = 0;
+
+        for (int voice = 0; voice < voices; voice++) {
+            uint32_t phase = chorus->phase + (voice == 0 ? 0 : 0x80000000u);
+            // Triangle from -2048 to 2047
+            int32_t sweep = ((phase >> 31 ? ~phase : phase) >> 19) - 2048;
+            int32_t delay = chorus->base + ((chorus->depth * sweep) >> 11);
+
+            uint32_t whole = delay >> 8;
+            int32_t fraction = delay & 0xFF;
+            int32_t a = chorus->history[(now - whole) & mask];
+            int32_t b = chorus->history[(now - whole - 1) & mask];
+
+            wet += a + (((b - a) * fraction) >> 8);
+        }
+
+        chorus->phase += chorus->increment;
+
+        if (voices == 1) {
+            samples[i] = (samples[i] + wet) >> 1;
+        } else {
+            samples[i] = (2 * samples[i] + wet) >> 2;
+        }
+    }
+}
+
+static void chorus_single(void *slot, int16_t *samples, size_t frames) {
+    chorus_kernel(slot, samples, frames, 1);
+}
+
+static void chorus_double(void *slot, int16_t *samples, size_t frames) {
+    chorus_kernel(slot, samples, frames, 2);
+}
+
+static voice_fx_kernel chorus_setup(voice_fx *fx, void *slot,
+                                    const voice_fx_config *config) {
+    voice_fx_chorus_slot *chorus = slot;
+    uint8_t depth_ms = config->chorus_depth_ms;
+
+    if (config->chorus_voices == 0) {
+        return NULL;
+    }
+
+    // The history is only kept while the chorus is on
+    if (fx->chorus.kernels[fx->chorus.active] == NULL) {
+        memset(fx->chorus_history, 0, sizeof(fx->chorus_history));
+    }
+
+    if (depth_ms > VOICE_FX_CHORUS_MAX_DEPTH_MS) {
+        depth_ms = VOICE_FX_CHORUS_MAX_DEPTH_MS;
+    }
+
+    // Longest sweep has to stay clear of the chunk being written
+    int32_t longest = (VOICE_FX_CHORUS_SIZE - VOICE_FX_CHUNK_FRAMES - 2) << 8;
+    int32_t base = (VOICE_FX_CHORUS_BASE_MS * fx->sample_rate << 8) / 1000;
+    int32_t depth = (depth_ms * fx->sample_rate << 8) / 1000;
+
+    if (base + depth > longest) {
+        base = longest / 2;
+        depth = longest / 2;
+    }
+
+    chorus->history = fx->chorus_history;
+    chorus->base = base;
+    chorus->depth = depth;
+    chorus->phase = 0;
+    chorus->increment =
+        ((uint64_t)config->chorus_rate << 32) / (10 * fx->sample_rate);
+
+    return config->chorus_voices == 1 ? chorus_single : chorus_double;
+}
+
+static bool chorus_match(const voice_fx_config *a, const voice_fx_config *b) {
+    return a->chorus_voices == b->chorus_voices &&
+           (a->chorus_voices == 0 ||
+            (a->chorus_depth_ms == b->chorus_depth_ms &&
+             a->chorus_rate == b->chorus_rate));
+}
+
+static void init_stage(voice_fx_switch *stage, void *first, void *second) {
+    *stage = (voice_fx_switch){
+        .slots = {first, second},
+        .fade = VOICE_FX_CROSSFADE_FRAMES,
+        .preset = VoiceFxOff,
+    };
+}
+
+void voice_fx_init(voice_fx *fx, uint32_t sample_rate) {
+    memset(fx, 0, sizeof(*fx));
+
+    fx->sample_rate = sample_rate;
+    atomic_init(&fx->requested, VoiceFxOff);
+
+    for (size_t i = 0; i <= VOICE_FX_SINE_SIZE; i++) {
+        fx->sine[i] = INT16_MAX * sinf(2.0f * M_PI * i / VOICE_FX_SINE_SIZE);
+    }
+
+    // Bands half an octave apart and half an octave wide
+    float damping = powf(2.0f, 0.25f) - powf(2.0f, -0.25f);
+
+    for (size_t i = 0; i < VOICE_FX_VOCODER_BANDS; i++) {
+        float centre = VOICE_FX_VOCODER_LOW_HZ * powf(2.0f, i / 2.0f);
+
+        fx->vocoder_frequencies[i] =
+            2.0f * sinf(M_PI * centre / sample_rate) * (1 << 12);
+        fx->vocoder_dampings[i] = damping * (1 << 12);
+    }
+
+    init_stage(&fx->ring, &fx->ring_slots[0], &fx->ring_slots[1]);
+    init_stage(&fx->vocoder, &fx->vocoder_slots[0], &fx->vocoder_slots[1]);
+    init_stage(&fx->crush, &fx->crush_slots[0], &fx->crush_slots[1]);
+    init_stage(&fx->chorus, &fx->chorus_slots[0], &fx->chorus_slots[1]);
+}
+
+/**
+ * Switches every stage to `preset` from the next block, crossfading those whose
+ * settings change. Returns false for an unknown preset.
+ */
+bool voice_fx_set_preset(voice_fx *fx, VoiceFxPreset preset) {
+    if (preset >= VoiceFxPresetCount) {
+        return false;
+    }
+
+    atomic_store(&fx->requested, preset);
+
+    return true;
+}
+
+//! The preset last asked for, whether or not every stage has reached it yet
+VoiceFxPreset voice_fx_get_preset(const voice_fx *fx) {
+    return atomic_load(&fx->requested);
+}
+
+void voice_fx_ring_process(void *ctx, int16_t *samples, size_t frames) {
+    voice_fx *fx = ctx;
+
+    if (follow_preset(fx, &fx->ring, ring_setup, ring_match)) {
+        run_stage(&fx->ring, samples, frames);
+    }
+}
+
+void voice_fx_vocoder_process(void *ctx, int16_t *samples, size_t frames) {
+    voice_fx *fx = ctx;
+
+    if (follow_preset(fx, &fx->vocoder, vocoder_setup, vocoder_match)) {
+        run_stage(&fx->vocoder, samples, frames);
+    }
+}
+
+void voice_fx_crush_process(void *ctx, int16_t *samples, size_t frames) {
+    voice_fx *fx = ctx;
+
+    if (follow_preset(fx, &fx->crush, crush_setup, crush_match)) {
+        run_stage(&fx->crush, samples, frames);
+    }
+}
+
+/**
+ * The history is written a chunk ahead of the slots reading it, so both slots
+ * of a crossfade read the same voice
+ */
+void voice_fx_chorus_process(void *ctx, int16_t *samples, size_t frames) {
+    voice_fx *fx = ctx;
+    const uint32_t mask = VOICE_FX_CHORUS_SIZE - 1;
+
+    if (!follow_preset(fx, &fx->chorus, chorus_setup, chorus_match)) {
+        return;
+    }
+
+    for (size_t start = 0; start < frames; start += VOICE_FX_CHUNK_FRAMES) {
+        size_t count = frames - start < VOICE_FX_CHUNK_FRAMES
+                           ? frames - start
+                           : VOICE_FX_CHUNK_FRAMES;
+
+        for (size_t i = 0; i < count; i++) {
+            fx->chorus_history[(fx->chorus_position + i) & mask] =
+                samples[start + i];
+        }
+
+        fx->chorus_slots[0].chunk_start = fx->chorus_position;
+        fx->chorus_slots[1].chunk_start = fx->chorus_position;
+        fx->chorus_position += count;
+
+        run_stage(&fx->chorus, &samples[start], count);
+    }
+}
@@ -0,0 +1,677 @@
+/**
+ * Benchmarks the DSP kernels the firmware runs on its audio core. Each kernel
+ * is run block by block over synthetic input and reported as throughput, as a
+ * multiple of real time, and as its worst single block against the block
+ * deadline at 48 kHz. The allocator is wrapped at link time so any allocation
+ * a kernel makes while running shows up as well.
+ *
+ * Usage: dsp_bench [seconds of audio per kernel]
+ */
+
+#include "audio_dsp/adpcm.h"
+#include "audio_dsp/alc.h"
+#include "audio_dsp/clip_player.h"
+#include "audio_dsp/cycles.h"
+#include "audio_dsp/feedback.h"
+#include "audio_dsp/limiter.h"
+#include "audio_dsp/meter.h"
+#include "audio_dsp/mixer.h"
+#include "audio_dsp/pcm_ring.h"
+#include "audio_dsp/pipeline.h"
+#include "audio_dsp/pitch_shift.h"
+#include "audio_dsp/protocol.h"
+#include "audio_dsp/resampler.h"
+#include "audio_dsp/tone.h"
+#include "audio_dsp/voice_fx.h"
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#define SAMPLE_RATE 48000
+
+//! Music path block, the largest latency profile block
+#define MUSIC_BLOCK_FRAMES 480
+//! Voice path block, the low latency profile block
+#define VOICE_BLOCK_FRAMES 120
+
+#define DEFAULT_SECONDS 20
+
+static size_t allocations;
+static size_t allocated_bytes;
+
+void *__real_malloc(size_t size);
+void *__real_calloc(size_t count, size_t size);
+void *__real_realloc(void *ptr, size_t size);
+void __real_free(void *ptr);
+
+void *__wrap_malloc(size_t size) {
+    allocations++;
+    allocated_bytes += size;
+    return __real_malloc(size);
+}
+
+void *__wrap_calloc(size_t count, size_t size) {
+    allocations++;
+    allocated_bytes += count * size;
+    return __real_calloc(count, size);
+}
+
+void *__wrap_realloc(void *ptr, size_t size) {
+    allocations++;
+    allocated_bytes += size;
+    return __real_realloc(ptr, size);
+}
+
+void __wrap_free(void *ptr) { __real_free(ptr); }
+
+typedef struct {
+    const char *name;
+    //! Output frames per block, which also sets the block deadline
+    size_t block_frames;
+    void (*setup)(void);
+    void (*run)(void);
+} kernel;
+
+static int16_t stereo_in[MUSIC_BLOCK_FRAMES * 4];
+static int16_t stereo_out[MUSIC_BLOCK_FRAMES * 2];
+static int16_t mono[MUSIC_BLOCK_FRAMES];
+static size_t input_offset;
+
+/**
+ * A voice-like test signal, a 140 Hz pulse train through a crude resonance,
+ * so the pitch tracker has something periodic to lock onto
+ */
+static void fill_voice(int16_t *out, size_t frames) {
+    static double phase;
+    static double resonance[2];
+    static double coefficient;
+
+    if (coefficient == 0) {
+        coefficient = 1.8 * cos(2 * M_PI * 700.0 / SAMPLE_RATE);
+    }
+
+    for (size_t i = 0; i < frames; i++) {
+        phase += 140.0 / SAMPLE_RATE;
+        double pulse = phase >= 1.0 ? 8000.0 : 0.0;
+        if (phase >= 1.0) {
+            phase -= 1.0;
+        }
+
+        double sample =
+            pulse + coefficient * resonance[0] - 0.81 * resonance[1];
+        resonance[1] = resonance[0];
+        resonance[0] = sample;
+
+        out[i] = sample > 32767 ? 32767 : sample < -32768 ? -32768 : sample;
+    }
+}
+
+//! One second of 44.1 kHz stereo test music, generated once so producing
+//! input costs a copy rather than a sin() per sample
+#define MUSIC_FRAMES 44100
+static int16_t music[MUSIC_FRAMES * 2];
+
+static void fill_music(int16_t *out, size_t frames) {
+    if (music[2] == 0) {
+        for (size_t i = 0; i < MUSIC_FRAMES; i++) {
+            double t = (double)i / MUSIC_FRAMES;
+            music[2 * i] = 12000 * sin(2 * M_PI * 440 * t) +
+                           4000 * sin(2 * M_PI * 3520 * t);
+            music[2 * i + 1] = 12000 * sin(2 * M_PI * 554 * t);
+        }
+    }
+
+    for (size_t i = 0; i < frames; i++) {
+        size_t frame = (input_offset + i) % MUSIC_FRAMES;
+        out[2 * i] = music[2 * frame];
+        out[2 * i + 1] = music[2 * frame + 1];
+    }
+    input_offset += frames;
+}
+
+static pcm_ring ring;
+static uint8_t ring_storage[16384];
+
+static void ring_setup(void) {
+    pcm_ring_init(&ring, ring_storage, sizeof(ring_storage));
+    fill_music(stereo_in, MUSIC_BLOCK_FRAMES);
+}
+
+static void ring_run(void) {
+    size_t bytes = MUSIC_BLOCK_FRAMES * 4;
+    pcm_ring_write(&ring, (const uint8_t *)stereo_in, bytes);
+    pcm_ring_read(&ring, (uint8_t *)stereo_out, bytes);
+}
+
+static resampler converter;
+static int16_t staging[MUSIC_BLOCK_FRAMES * 4];
+static size_t staged;
+
+static void resampler_setup(ResamplerQuality quality) {
+    resampler_configure(&converter, 44100, SAMPLE_RATE, quality);
+    staged = 0;
+    input_offset = 0;
+}
+
+static void resampler_low_setup(void) { resampler_setup(ResamplerLow); }
+static void resampler_medium_setup(void) { resampler_setup(ResamplerMedium); }
+static void resampler_high_setup(void) { resampler_setup(ResamplerHigh); }
+
+static void resampler_run(void) {
+    size_t needed = resampler_input_needed(&converter, MUSIC_BLOCK_FRAMES);
+    if (staged < needed) {
+        fill_music(&staging[staged * 2], needed - staged);
+        staged = needed;
+    }
+
+    size_t consumed;
+    resampler_process(&converter, staging, staged, &consumed, stereo_out,
+                      MUSIC_BLOCK_FRAMES);
+
+    staged -= consumed;
+    memmove(staging, &staging[consumed * 2], staged * 4);
+}
+
+static pitch_shift shifter;
+
+static void pitch_setup(bool formant) {
+    pitch_shift_init(&shifter, SAMPLE_RATE);
+    pitch_shift_set_semitones(&shifter, 5);
+    pitch_shift_set_formant_preservation(&shifter, formant);
+}
+
+static void pitch_formant_setup(void) { pitch_setup(true); }
+static void pitch_plain_setup(void) { pitch_setup(false); }
+
+static void pitch_run(void) {
+    fill_voice(mono, VOICE_BLOCK_FRAMES);
+    pitch_shift_process(&shifter, mono, VOICE_BLOCK_FRAMES);
+}
+
+static audio_pipeline pipeline;
+
+static void pipeline_setup(void) {
+    pitch_setup(true);
+    audio_pipeline_init(&pipeline, VOICE_BLOCK_FRAMES, SAMPLE_RATE,
+                        DSP_HOST_CYCLE_HZ);
+    audio_pipeline_add_stage(&pipeline, "pitch", pitch_shift_process,
+                             &shifter, pipeline.block_cycles / 2);
+}
+
+static void pipeline_run(void) {
+    fill_voice(mono, VOICE_BLOCK_FRAMES);
+    audio_pipeline_process(&pipeline, mono);
+}
+
+static void meter_setup(void) {
+    meter_init(SAMPLE_RATE);
+    meter_set_enabled(true);
+    fill_music(stereo_in, MUSIC_BLOCK_FRAMES);
+}
+
+static void meter_run(void) {
+    meter_update(MeterMusic, stereo_in, MUSIC_BLOCK_FRAMES, 2);
+    meter_tap(stereo_in, MUSIC_BLOCK_FRAMES);
+}
+
+static void spectrum_run(void) {
+    uint8_t bins[METER_SPECTRUM_BINS];
+    meter_spectrum(bins);
+}
+
+//! Encoded control traffic, parameter batches of varying size back to back
+static uint8_t protocol_stream[64 * 1024];
+static size_t protocol_length;
+static size_t protocol_offset;
+static protocol_parser parser;
+static size_t parsed_parameters;
+
+static void count_parameters(void *ctx, const protocol_frame *frame) {
+    protocol_parameter parameter;
+    size_t offset = 0;
+
+    while (protocol_next_parameter(frame, &offset, &parameter)) {
+        parsed_parameters++;
+    }
+}
+
+static void protocol_setup(void) {
+    uint8_t payload[PROTOCOL_MAX_PAYLOAD];
+    uint8_t sequence = 0;
+
+    protocol_length = 0;
+    while (protocol_length + PROTOCOL_MAX_FRAME <= sizeof(protocol_stream)) {
+        size_t length = 0;
+        size_t records = 1 + sequence % 24;
+
+        for (size_t i = 0; i < records; i++) {
+            length = protocol_append_parameter(payload, length, sizeof(payload),
+                                               ParamOutputVolumeLeft, i);
+        }
+
+        protocol_length += protocol_encode(
+            &protocol_stream[protocol_length],
+            sizeof(protocol_stream) - protocol_length, MessageSetParameters,
+            sequence++, payload, length);
+    }
+
+    protocol_offset = 0;
+    protocol_parser_init(&parser, count_parameters, NULL);
+}
+
+/**
+ * Feeds the stream in SPP sized pieces that do not line up with frame
+ * boundaries, so the split frame path is exercised too
+ */
+static void protocol_run(void) {
+    size_t piece = 990;
+
+    if (protocol_offset + piece > protocol_length) {
+        piece = protocol_length - protocol_offset;
+    }
+
+    protocol_parser_feed(&parser, &protocol_stream[protocol_offset], piece);
+
+    protocol_offset += piece;
+    if (protocol_offset == protocol_length) {
+        protocol_offset = 0;
+    }
+}
+
+//! One second clips, the music encoded once per format
+static int16_t clip_pcm[SAMPLE_RATE * 2];
+static uint8_t clip_adpcm[SAMPLE_RATE * 2];
+static adpcm_decoder decoder;
+static clip_player player;
+static soundbank_clip bench_clip;
+static size_t clip_voices;
+
+static void encode_clips(void) {
+    if (clip_pcm[2] == 0) {
+        input_offset = 0;
+        fill_music(clip_pcm, SAMPLE_RATE);
+        adpcm_encode(clip_pcm, SAMPLE_RATE, 2, clip_adpcm);
+    }
+}
+
+static void adpcm_setup(void) {
+    encode_clips();
+    adpcm_decoder_init(&decoder, clip_adpcm, 2);
+}
+
+static void adpcm_run(void) {
+    if (decoder.position + MUSIC_BLOCK_FRAMES > SAMPLE_RATE) {
+        adpcm_decoder_init(&decoder, clip_adpcm, 2);
+    }
+    adpcm_decode(&decoder, stereo_out, MUSIC_BLOCK_FRAMES);
+}
+
+static void clips_setup(SoundbankEncoding encoding, size_t voices) {
+    encode_clips();
+    clip_player_init(&player);
+
+    bench_clip = (soundbank_clip){
+        .data = encoding == SoundbankImaAdpcm ? clip_adpcm
+                                              : (const uint8_t *)clip_pcm,
+        .size = encoding == SoundbankImaAdpcm
+                    ? adpcm_encoded_size(SAMPLE_RATE, 2)
+                    : sizeof(clip_pcm),
+        .frames = SAMPLE_RATE,
+        .channels = 2,
+        .encoding = encoding,
+    };
+    clip_voices = voices;
+}
+
+static void clips_pcm_8_setup(void) { clips_setup(SoundbankPcm16, 8); }
+static void clips_adpcm_1_setup(void) { clips_setup(SoundbankImaAdpcm, 1); }
+static void clips_adpcm_8_setup(void) { clips_setup(SoundbankImaAdpcm, 8); }
+
+/**
+ * Mixes over quiet music, retriggering finished voices so the count stays
+ * constant
+ */
+static void clips_run(void) {
+    for (size_t i = clip_player_active(&player); i < clip_voices; i++) {
+        clip_player_start(&player, &bench_clip, CLIP_PLAYER_UNITY_GAIN / 8);
+    }
+
+    memset(stereo_out, 0, sizeof(stereo_out));
+    clip_player_mix(&player, stereo_out, MUSIC_BLOCK_FRAMES);
+}
+
+static mixer bench_mixer;
+static int16_t mixer_stereo[4][MUSIC_BLOCK_FRAMES * 2];
+static int16_t mixer_mono[4][MUSIC_BLOCK_FRAMES];
+static size_t mixer_blocks;
+
+/**
+ * Sets up the firmware's sources, music ducked under a voice sidechain with
+ * effects on top, or eight sources with every one of them moving its gain
+ * each block, the worst case the mixer handles
+ */
+static void mixer_setup(size_t sources) {
+    mixer_ducking_times times = MIXER_DEFAULT_DUCKING_TIMES();
+
+    mixer_init(&bench_mixer, SAMPLE_RATE, &times);
+    mixer_set_duck_threshold(&bench_mixer, 2000);
+    mixer_set_duck_depth(&bench_mixer, mixer_gain_from_db(-12));
+
+    input_offset = 0;
+    for (size_t i = 0; i < 4; i++) {
+        fill_music(mixer_stereo[i], MUSIC_BLOCK_FRAMES);
+        fill_voice(mixer_mono[i], MUSIC_BLOCK_FRAMES);
+    }
+
+    for (size_t i = 0; i < sources; i++) {
+        bool stereo = i % 2 == 0;
+        uint8_t flags = i == 0 ? MixerDucked : i == 1 ? MixerSidechain : 0;
+        int index = mixer_add_source(&bench_mixer, stereo ? 2 : 1, flags,
+                                     MIXER_UNITY_GAIN / 2);
+
+        bench_mixer.sources[index].samples =
+            stereo ? mixer_stereo[i / 2] : mixer_mono[i / 2];
+    }
+
+    mixer_blocks = 0;
+}
+
+static void mixer_3_setup(void) { mixer_setup(3); }
+static void mixer_8_setup(void) { mixer_setup(8); }
+
+static void mixer_run(void) {
+    mixer_process(&bench_mixer, stereo_out, MUSIC_BLOCK_FRAMES);
+}
+
+static void mixer_ramp_run(void) {
+    uint16_t gain = mixer_blocks++ % 2 ? MIXER_UNITY_GAIN / 4
+                                       : MIXER_UNITY_GAIN / 2;
+
+    for (size_t i = 0; i < bench_mixer.source_count; i++) {
+        mixer_set_gain(&bench_mixer, i, gain);
+    }
+
+    mixer_process(&bench_mixer, stereo_out, MUSIC_BLOCK_FRAMES);
+}
+
+static alc leveller;
+static int16_t alc_voice[VOICE_BLOCK_FRAMES];
+
+/**
+ * The voice preset's level control and gate, what running it in software
+ * costs the voice path when the codec cannot do it
+ */
+static void alc_setup(void) {
+    alc_config config = {
+        .enabled = true,
+        .target = 11,
+        .max_gain = 5,
+        .hold = 6,
+        .decay = 3,
+        .attack = 1,
+        .gate = true,
+        .gate_threshold = 11,
+        .gate_mutes = true,
+    };
+
+    alc_init(&leveller, SAMPLE_RATE);
+    alc_configure(&leveller, &config);
+    fill_voice(alc_voice, VOICE_BLOCK_FRAMES);
+}
+
+static void alc_run(void) {
+    memcpy(mono, alc_voice, sizeof(alc_voice));
+    alc_process(&leveller, mono, VOICE_BLOCK_FRAMES);
+}
+
+static feedback_suppressor suppressor;
+static double howl_phase;
+static bool howling;
+
+static void feedback_setup(bool howl) {
+    feedback_init(&suppressor, SAMPLE_RATE);
+    howl_phase = 0;
+    howling = howl;
+}
+
+static void feedback_voice_setup(void) { feedback_setup(false); }
+static void feedback_howl_setup(void) { feedback_setup(true); }
+
+/**
+ * Voice alone only costs the analysis, adding a steady 2.6 kHz howl also
+ * brings notches in once it has been detected
+ */
+static void feedback_run(void) {
+    fill_voice(mono, VOICE_BLOCK_FRAMES);
+
+    for (size_t i = 0; howling && i < VOICE_BLOCK_FRAMES; i++) {
+        howl_phase += 2 * M_PI * 2600.0 / SAMPLE_RATE;
+        mono[i] = mono[i] / 4 + 12000 * sin(howl_phase);
+    }
+
+    feedback_process(&suppressor, mono, VOICE_BLOCK_FRAMES);
+}
+
+static tone_control tone;
+static int16_t tone_music[MUSIC_BLOCK_FRAMES * 2];
+
+static void tone_setup(uint8_t depth_3d) {
+    tone_config config = {
+        .bass = 2,
+        .treble = 1,
+        .depth_3d = depth_3d,
+    };
+
+    tone_init(&tone, SAMPLE_RATE);
+    tone_configure(&tone, &config);
+
+    input_offset = 0;
+    fill_music(tone_music, MUSIC_BLOCK_FRAMES);
+}
+
+static void tone_shelves_setup(void) { tone_setup(0); }
+static void tone_3d_setup(void) { tone_setup(5); }
+
+static void tone_run(void) {
+    memcpy(stereo_out, tone_music, sizeof(tone_music));
+    tone_process(&tone, stereo_out, MUSIC_BLOCK_FRAMES);
+}
+
+static limiter output_limiter;
+static int16_t hot_music[MUSIC_BLOCK_FRAMES * 2];
+
+/**
+ * Music 6 dB too hot, peaking at 32000 against the default ceiling of 29204,
+ * so the gain is always on its way down, holding or releasing
+ */
+static void limiter_setup(size_t lookahead, bool compressor) {
+    limiter_config config = LIMITER_DEFAULT_CONFIG();
+    config.compressor = compressor;
+
+    limiter_init(&output_limiter, SAMPLE_RATE, lookahead);
+    limiter_configure(&output_limiter, &config);
+
+    input_offset = 0;
+    fill_music(hot_music, MUSIC_BLOCK_FRAMES);
+    for (size_t i = 0; i < MUSIC_BLOCK_FRAMES * 2; i++) {
+        hot_music[i] *= 2;
+    }
+}
+
+static void limiter_instant_setup(void) { limiter_setup(0, false); }
+static void limiter_lookahead_setup(void) {
+    limiter_setup(LIMITER_MAX_LOOKAHEAD, false);
+}
+static void limiter_compressor_setup(void) {
+    limiter_setup(LIMITER_MAX_LOOKAHEAD, true);
+}
+
+static void limiter_voice_run(void) {
+    memcpy(stereo_out, hot_music, VOICE_BLOCK_FRAMES * 2 * sizeof(int16_t));
+    limiter_process(&output_limiter, stereo_out, VOICE_BLOCK_FRAMES);
+}
+
+static void limiter_music_run(void) {
+    memcpy(stereo_out, hot_music, sizeof(hot_music));
+    limiter_process(&output_limiter, stereo_out, MUSIC_BLOCK_FRAMES);
+}
+
+static voice_fx effects;
+static size_t effects_blocks;
+//! Presets the switching kernel cycles through, every effect changing on
+//! each switch
+static const VoiceFxPreset SWITCHED[] = {VoiceFxRobot, VoiceFxDroid};
+
+static void voice_fx_setup(VoiceFxPreset preset) {
+    voice_fx_init(&effects, SAMPLE_RATE);
+    voice_fx_set_preset(&effects, preset);
+    effects_blocks = 0;
+}
+
+static void voice_fx_robot_setup(void) { voice_fx_setup(VoiceFxRobot); }
+static void voice_fx_metallic_setup(void) { voice_fx_setup(VoiceFxMetallic); }
+static void voice_fx_radio_setup(void) { voice_fx_setup(VoiceFxRadio); }
+static void voice_fx_chorus_setup(void) { voice_fx_setup(VoiceFxChorus); }
+static void voice_fx_droid_setup(void) { voice_fx_setup(VoiceFxDroid); }
+static void voice_fx_switch_setup(void) { voice_fx_setup(VoiceFxOff); }
+
+//! The four stages in pipeline order, as main.c adds them
+static void voice_fx_run(void) {
+    fill_voice(mono, VOICE_BLOCK_FRAMES);
+
+    voice_fx_vocoder_process(&effects, mono, VOICE_BLOCK_FRAMES);
+    voice_fx_ring_process(&effects, mono, VOICE_BLOCK_FRAMES);
+    voice_fx_crush_process(&effects, mono, VOICE_BLOCK_FRAMES);
+    voice_fx_chorus_process(&effects, mono, VOICE_BLOCK_FRAMES);
+}
+
+/**
+ * Switches preset every four blocks, the length of a crossfade, so every
+ * block runs both slots of every stage
+ */
+static void voice_fx_switch_run(void) {
+    if (effects_blocks++ % 4 == 0) {
+        voice_fx_set_preset(&effects, SWITCHED[effects_blocks / 4 % 2]);
+    }
+
+    voice_fx_run();
+}
+
+static const kernel KERNELS[] = {
+    {"pcm_ring write+read", MUSIC_BLOCK_FRAMES, ring_setup, ring_run},
+    {"resampler low", MUSIC_BLOCK_FRAMES, resampler_low_setup, resampler_run},
+    {"resampler medium", MUSIC_BLOCK_FRAMES, resampler_medium_setup,
+     resampler_run},
+    {"resampler high", MUSIC_BLOCK_FRAMES, resampler_high_setup,
+     resampler_run},
+    {"pitch_shift formant", VOICE_BLOCK_FRAMES, pitch_formant_setup,
+     pitch_run},
+    {"pitch_shift plain", VOICE_BLOCK_FRAMES, pitch_plain_setup, pitch_run},
+    {"pipeline (pitch)", VOICE_BLOCK_FRAMES, pipeline_setup, pipeline_run},
+    {"meter update+tap", MUSIC_BLOCK_FRAMES, meter_setup, meter_run},
+    // One spectrum per telemetry sample, timed against a 30 Hz period
+    {"meter spectrum", SAMPLE_RATE / 30, meter_setup, spectrum_run},
+    // One SPP packet per block, far more control traffic than real use
+    {"protocol parse 990B", MUSIC_BLOCK_FRAMES, protocol_setup, protocol_run},
+    {"adpcm decode stereo", MUSIC_BLOCK_FRAMES, adpcm_setup, adpcm_run},
+    // Per voice cost is the difference between the voice counts
+    {"clips pcm 8 voices", MUSIC_BLOCK_FRAMES, clips_pcm_8_setup, clips_run},
+    {"clips adpcm 1 voice", MUSIC_BLOCK_FRAMES, clips_adpcm_1_setup,
+     clips_run},
+    {"clips adpcm 8 voices", MUSIC_BLOCK_FRAMES, clips_adpcm_8_setup,
+     clips_run},
+    // The writer mixes once per output, three sources each
+    {"mixer 3 sources", MUSIC_BLOCK_FRAMES, mixer_3_setup, mixer_run},
+    {"mixer 8 sources", MUSIC_BLOCK_FRAMES, mixer_8_setup, mixer_run},
+    {"mixer 8 ramping", MUSIC_BLOCK_FRAMES, mixer_8_setup, mixer_ramp_run},
+    // Nothing while the codecs do these, this is the software fallback
+    {"alc voice preset", VOICE_BLOCK_FRAMES, alc_setup, alc_run},
+    {"tone bass+treble", MUSIC_BLOCK_FRAMES, tone_shelves_setup, tone_run},
+    {"tone bass+treble+3d", MUSIC_BLOCK_FRAMES, tone_3d_setup, tone_run},
+    // The worst block is the one that completes an analysis frame
+    {"feedback voice", VOICE_BLOCK_FRAMES, feedback_voice_setup,
+     feedback_run},
+    {"feedback howling", VOICE_BLOCK_FRAMES, feedback_howl_setup,
+     feedback_run},
+    // Presets use one to three of the four stages, the switch is the worst
+    // case of all four running both their slots
+    {"voice_fx robot", VOICE_BLOCK_FRAMES, voice_fx_robot_setup, voice_fx_run},
+    {"voice_fx metallic", VOICE_BLOCK_FRAMES, voice_fx_metallic_setup,
+     voice_fx_run},
+    {"voice_fx radio", VOICE_BLOCK_FRAMES, voice_fx_radio_setup, voice_fx_run},
+    {"voice_fx chorus", VOICE_BLOCK_FRAMES, voice_fx_chorus_setup,
+     voice_fx_run},
+    {"voice_fx droid", VOICE_BLOCK_FRAMES, voice_fx_droid_setup, voice_fx_run},
+    {"voice_fx switching", VOICE_BLOCK_FRAMES, voice_fx_switch_setup,
+     voice_fx_switch_run},
+    // Once per output per block, with each profile's lookahead
+    {"limiter voice profile", VOICE_BLOCK_FRAMES, limiter_instant_setup,
+     limiter_voice_run},
+    {"limiter lookahead 5ms", MUSIC_BLOCK_FRAMES, limiter_lookahead_setup,
+     limiter_music_run},
+    {"limiter + compressor", MUSIC_BLOCK_FRAMES, limiter_compressor_setup,
+     limiter_music_run},
+};
+
+static uint64_t now_ns(void) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (uint64_t)now.tv_sec * 1000000000u + now.tv_nsec;
+}
+
+static void run_kernel(const kernel *k, double seconds) {
+    size_t blocks = seconds * SAMPLE_RATE / k->block_frames;
+    double deadline_ns = 1e9 * k->block_frames / SAMPLE_RATE;
+
+    k->setup();
+
+    // Warm up caches and let stateful kernels settle before measuring
+    for (size_t i = 0; i < blocks / 20 + 1; i++) {
+        k->run();
+    }
+
+    size_t allocations_before = allocations;
+    size_t bytes_before = allocated_bytes;
+    uint64_t worst = 0;
+    uint64_t start = now_ns();
+
+    for (size_t i = 0; i < blocks; i++) {
+        uint64_t block_start = now_ns();
+        k->run();
+        uint64_t elapsed = now_ns() - block_start;
+
+        if (elapsed > worst) {
+            worst = elapsed;
+        }
+    }
+
+    double total = now_ns() - start;
+    double average = total / blocks;
+
+    printf("%-22s %8zu %10.1f %9.0fx %10.0f %10.0f %7.2f%% %6zu %8zu\n",
+           k->name, blocks, blocks * k->block_frames / total * 1e3,
+           deadline_ns / average, average, (double)worst,
+           100.0 * worst / deadline_ns, allocations - allocations_before,
+           allocated_bytes - bytes_before);
+}
+
+int main(int argc, char **argv) {
+    double seconds = argc > 1 ? atof(argv[1]) : DEFAULT_SECONDS;
+
+    if (seconds <= 0) {
+        fprintf(stderr, "usage: %s [seconds of audio per kernel]\n", argv[0]);
+        return 1;
+    }
+
+    printf("%-22s %8s %10s %10s %10s %10s %8s %6s %8s\n", "kernel", "blocks",
+           "Mframes/s", "realtime", "avg ns", "worst ns", "of block",
+           "allocs", "bytes");
+
+    for (size_t i = 0; i < sizeof(KERNELS) / sizeof(KERNELS[0]); i++) {
+        run_kernel(&KERNELS[i], seconds);
+    }
+
+    return 0;
+}
@@ -0,0 +1,352 @@
+/**
+ * This file contains the simulated Bluetooth stack and the phone on the other
+ * end of it. Every callback is delivered from the event task, which stands in
+ * for the Bluedroid task, so the firmware sees the same threading as on the
+ * device.
+ */
+
+#include "esp_a2dp_api.h"
+#include "esp_bt.h"
+#include "esp_bt_main.h"
+#include "esp_gap_bt_api.h"
+#include "esp_log.h"
+#include "esp_spp_api.h"
+#include "sim.h"
+#include <poll.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#define TAG "SIM_BT"
+
+//! Frames decoded from one A2DP packet, a typical SBC payload
+#define A2DP_PACKET_FRAMES 512
+
+//! Sustained SPP throughput, each write completes after its bytes would have
+//! gone out at this rate
+#define SPP_BYTES_PER_SECOND 100000
+
+//! Largest piece of SPP input delivered at once, the negotiated MTU
+#define SPP_MTU 990
+#define SPP_INPUT_INTERVAL_US 10000
+
+#define SPP_SERVER_HANDLE 0x81
+
+static esp_bt_gap_cb_t gap_callback;
+static esp_a2d_cb_t a2dp_callback;
+static esp_a2d_sink_data_cb_t a2dp_data_callback;
+static esp_spp_cb_t spp_callback;
+
+static bool spp_started;
+static bool spp_connected;
+
+static sim_bt_scenario scenario;
+
+//! Time the first packet was due and packets delivered since
+static uint64_t stream_start_us;
+static uint64_t packets;
+static uint64_t last_packet_us;
+static uint32_t jitter_state;
+
+typedef struct {
+    esp_a2d_cb_event_t event;
+    esp_a2d_cb_param_t param;
+} a2dp_event;
+
+typedef struct {
+    esp_spp_cb_event_t event;
+    esp_spp_cb_param_t param;
+} spp_event;
+
+static void deliver_a2dp(void *arg) {
+    a2dp_event *e = arg;
+    if (a2dp_callback != NULL) {
+        a2dp_callback(e->event, &e->param);
+    }
+    free(e);
+}
+
+static void post_a2dp(uint64_t at_us, esp_a2d_cb_event_t event,
+                      esp_a2d_cb_param_t param) {
+    a2dp_event *e = malloc(sizeof(*e));
+    if (e == NULL) {
+        abort();
+    }
+
+    *e = (a2dp_event){.event = event, .param = param};
+    sim_schedule(at_us, deliver_a2dp, e);
+}
+
+static void deliver_spp(void *arg) {
+    spp_event *e = arg;
+
+    if (e->event == ESP_SPP_SRV_OPEN_EVT) {
+        spp_connected = true;
+    }
+
+    if (spp_callback != NULL) {
+        spp_callback(e->event, &e->param);
+    }
+
+    free(e);
+}
+
+static void post_spp(uint64_t at_us, esp_spp_cb_event_t event,
+                     esp_spp_cb_param_t param) {
+    spp_event *e = malloc(sizeof(*e));
+    if (e == NULL) {
+        abort();
+    }
+
+    *e = (spp_event){.event = event, .param = param};
+    sim_schedule(at_us, deliver_spp, e);
+}
+
+esp_err_t esp_bt_controller_mem_release(esp_bt_mode_t mode) { return ESP_OK; }
+
+esp_err_t esp_bt_controller_init(esp_bt_controller_config_t *cfg) {
+    return ESP_OK;
+}
+
+esp_err_t esp_bt_controller_enable(esp_bt_mode_t mode) { return ESP_OK; }
+
+esp_err_t esp_bluedroid_init(void) { return ESP_OK; }
+
+esp_err_t esp_bluedroid_enable(void) { return ESP_OK; }
+
+esp_err_t esp_bt_gap_set_device_name(const char *name) {
+    ESP_LOGD(TAG, "Device name %s", name);
+    return ESP_OK;
+}
+
+esp_err_t esp_bt_gap_register_callback(esp_bt_gap_cb_t callback) {
+    gap_callback = callback;
+    return ESP_OK;
+}
+
+esp_err_t esp_bt_gap_set_security_param(esp_bt_sp_param_t param_type,
+                                        void *value, uint8_t len) {
+    return ESP_OK;
+}
+
+esp_err_t esp_bt_gap_set_scan_mode(esp_bt_connection_mode_t c_mode,
+                                   esp_bt_discovery_mode_t d_mode) {
+    ESP_LOGI(TAG, "Scan mode: %sconnectable, %sdiscoverable",
+             c_mode == ESP_BT_CONNECTABLE ? "" : "not ",
+             d_mode == ESP_BT_NON_DISCOVERABLE ? "not " : "");
+    return ESP_OK;
+}
+
+esp_err_t esp_a2d_register_callback(esp_a2d_cb_t callback) {
+    a2dp_callback = callback;
+    return ESP_OK;
+}
+
+esp_err_t esp_a2d_sink_register_data_callback(esp_a2d_sink_data_cb_t callback) {
+    a2dp_data_callback = callback;
+    return ESP_OK;
+}
+
+esp_err_t esp_a2d_sink_init(void) { return ESP_OK; }
+
+esp_err_t esp_spp_register_callback(esp_spp_cb_t callback) {
+    spp_callback = callback;
+    return ESP_OK;
+}
+
+esp_err_t esp_spp_enhanced_init(const esp_spp_cfg_t *cfg) {
+    post_spp(sim_now_us(), ESP_SPP_INIT_EVT,
+             (esp_spp_cb_param_t){.init = {.status = ESP_SPP_SUCCESS}});
+    return ESP_OK;
+}
+
+esp_err_t esp_spp_start_srv(esp_spp_sec_t sec_mask, esp_spp_role_t role,
+                            uint8_t local_scn, const char *name) {
+    spp_started = true;
+    post_spp(sim_now_us(), ESP_SPP_START_EVT,
+             (esp_spp_cb_param_t){.start = {.status = ESP_SPP_SUCCESS,
+                                            .handle = SPP_SERVER_HANDLE,
+                                            .scn = 1}});
+    return ESP_OK;
+}
+
+/**
+ * Hands the data to the phone right away and reports completion once it would
+ * have been sent. Like the real stack the buffer is not copied, the firmware
+ * keeps it untouched until ESP_SPP_WRITE_EVT.
+ */
+esp_err_t esp_spp_write(uint32_t handle, int len, uint8_t *p_data) {
+    if (!spp_connected || len <= 0) {
+        return ESP_FAIL;
+    }
+
+    if (scenario.spp_output != NULL) {
+        fwrite(p_data, 1, len, scenario.spp_output);
+        if (scenario.spp_interactive) {
+            fflush(scenario.spp_output);
+        }
+    }
+
+    uint64_t duration_us = (uint64_t)len * 1000000 / SPP_BYTES_PER_SECOND;
+
+    post_spp(sim_now_us() + duration_us, ESP_SPP_WRITE_EVT,
+             (esp_spp_cb_param_t){.write = {.status = ESP_SPP_SUCCESS,
+                                            .handle = handle,
+                                            .len = len,
+                                            .cong = false}});
+    return ESP_OK;
+}
+
+static uint8_t a2dp_sample_frequency(uint32_t sample_rate) {
+    // Same encoding bt_audio.c decodes
+    switch (sample_rate) {
+        case 96000:
+            return 0;
+        case 48000:
+            return 1;
+        case 44100:
+            return 2;
+        case 32000:
+            return 3;
+        default:
+            return 4;
+    }
+}
+
+static uint32_t next_jitter_us(void) {
+    if (scenario.jitter_us == 0) {
+        return 0;
+    }
+
+    // xorshift32, reproducible from the seed
+    jitter_state ^= jitter_state << 13;
+    jitter_state ^= jitter_state >> 17;
+    jitter_state ^= jitter_state << 5;
+
+    return jitter_state % (scenario.jitter_us + 1);
+}
+
+static void schedule_packet(void);
+
+static void deliver_packet(void *arg) {
+    static int16_t samples[A2DP_PACKET_FRAMES * 2];
+
+    size_t frames =
+        wav_read_stereo(scenario.music, samples, A2DP_PACKET_FRAMES);
+
+    if (frames == 0) {
+        ESP_LOGI(TAG, "Music finished, suspending the stream");
+
+        uint64_t now = sim_now_us();
+        post_a2dp(now, ESP_A2D_AUDIO_STATE_EVT,
+                  (esp_a2d_cb_param_t){
+                      .audio_stat = {.state = ESP_A2D_AUDIO_STATE_SUSPEND}});
+        post_a2dp(now + 500000, ESP_A2D_CONNECTION_STATE_EVT,
+                  (esp_a2d_cb_param_t){
+                      .conn_stat = {.state =
+                                        ESP_A2D_CONNECTION_STATE_DISCONNECTED}});
+        return;
+    }
+
+    if (a2dp_data_callback != NULL) {
+        a2dp_data_callback((const uint8_t *)samples,
+                           frames * 2 * sizeof(int16_t));
+    }
+
+    packets++;
+    schedule_packet();
+}
+
+static void schedule_packet(void) {
+    uint64_t nominal = stream_start_us + packets * A2DP_PACKET_FRAMES *
+                                             1000000 /
+                                             scenario.music->sample_rate;
+    uint64_t at = nominal + next_jitter_us();
+
+    // A late packet delays the ones behind it, they never overtake
+    if (at < last_packet_us) {
+        at = last_packet_us;
+    }
+
+    last_packet_us = at;
+    sim_schedule(at, deliver_packet, NULL);
+}
+
+static void deliver_spp_input(void *arg) {
+    static uint8_t chunk[SPP_MTU];
+
+    int fd = fileno(scenario.spp_input);
+    ssize_t len = 0;
+
+    // An interactive peer may simply have nothing to say yet, it is only read
+    // once something is waiting
+    if (scenario.spp_interactive) {
+        struct pollfd ready = {.fd = fd, .events = POLLIN};
+        if (poll(&ready, 1, 0) == 1 && (ready.revents & POLLIN)) {
+            len = read(fd, chunk, sizeof(chunk));
+        }
+    } else {
+        len = read(fd, chunk, sizeof(chunk));
+        if (len <= 0) {
+            return;
+        }
+    }
+
+    if (len > 0 && spp_callback != NULL) {
+        esp_spp_cb_param_t param = {
+            .data_ind = {.status = ESP_SPP_SUCCESS,
+                         .handle = SPP_SERVER_HANDLE,
+                         .len = len,
+                         .data = chunk},
+        };
+        spp_callback(ESP_SPP_DATA_IND_EVT, &param);
+    }
+
+    sim_schedule(sim_now_us() + SPP_INPUT_INTERVAL_US, deliver_spp_input,
+                 NULL);
+}
+
+static void phone_connect(void *arg) {
+    uint64_t now = sim_now_us();
+
+    if (scenario.music != NULL) {
+        ESP_LOGI(TAG, "Phone connected, streaming %lu Hz",
+                 (unsigned long)scenario.music->sample_rate);
+
+        esp_a2d_cb_param_t config = {0};
+        config.audio_cfg.mcc.cie.sbc_info.samp_freq =
+            a2dp_sample_frequency(scenario.music->sample_rate);
+
+        post_a2dp(now, ESP_A2D_CONNECTION_STATE_EVT,
+                  (esp_a2d_cb_param_t){
+                      .conn_stat = {.state =
+                                        ESP_A2D_CONNECTION_STATE_CONNECTED}});
+        post_a2dp(now, ESP_A2D_AUDIO_CFG_EVT, config);
+        post_a2dp(now, ESP_A2D_AUDIO_STATE_EVT,
+                  (esp_a2d_cb_param_t){
+                      .audio_stat = {.state = ESP_A2D_AUDIO_STATE_STARTED}});
+
+        stream_start_us = now;
+        last_packet_us = now;
+        schedule_packet();
+    }
+
+    if (spp_started) {
+        post_spp(now, ESP_SPP_SRV_OPEN_EVT,
+                 (esp_spp_cb_param_t){
+                     .srv_open = {.status = ESP_SPP_SUCCESS,
+                                  .handle = SPP_SERVER_HANDLE,
+                                  .new_listen_handle = SPP_SERVER_HANDLE}});
+
+        if (scenario.spp_input != NULL) {
+            sim_schedule(now + SPP_INPUT_INTERVAL_US, deliver_spp_input, NULL);
+        }
+    }
+}
+
+void sim_bt_run(const sim_bt_scenario *config) {
+    scenario = *config;
+    jitter_state = scenario.seed != 0 ? scenario.seed : 1;
+
+    sim_schedule(scenario.connect_us, phone_connect, NULL);
+}
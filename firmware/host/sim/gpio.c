@@ -0,0 +1,248 @@
+/**
+ * This file contains the simulated GPIO matrix. Inputs read their pull
+ * resistor unless the scenario drives them, outputs read back what was set.
+ * Which peripheral signal drives an output is only recorded, for the drivers
+ * that follow signals routed between peripherals.
+ *
+ * Edge interrupts run their handler on the thread that drove the pin, which is
+ * the event task for anything a scenario schedules, much like an ISR preempting
+ * whatever the firmware was doing.
+ */
+
+#include "driver/gpio.h"
+#include "esp_rom_gpio.h"
+#include "sim.h"
+#include "soc/gpio_sig_map.h"
+
+typedef struct {
+    gpio_mode_t mode;
+    bool pull_up;
+    bool driven;
+    int external_level;
+    int output_level;
+    //! Signal the pin outputs, 0 is taken as SIG_GPIO_OUT_IDX
+    uint32_t out_signal;
+
+    gpio_int_type_t intr_type;
+    bool intr_enabled;
+    gpio_isr_t isr;
+    void *isr_arg;
+} pin_state;
+
+static pin_state pins[GPIO_NUM_MAX];
+static pthread_mutex_t pin_lock = PTHREAD_MUTEX_INITIALIZER;
+static bool isr_service_installed;
+
+static bool valid_pin(gpio_num_t gpio_num) {
+    return gpio_num >= 0 && gpio_num < GPIO_NUM_MAX;
+}
+
+//! Level the pin reads, pin_lock must be held
+static int level_locked(const pin_state *pin) {
+    if (pin->mode == GPIO_MODE_OUTPUT) {
+        return pin->output_level;
+    }
+
+    if (pin->driven) {
+        return pin->external_level;
+    }
+
+    return pin->pull_up;
+}
+
+static bool triggers(gpio_int_type_t type, int from, int to) {
+    switch (type) {
+        case GPIO_INTR_POSEDGE:
+        case GPIO_INTR_HIGH_LEVEL:
+            return !from && to;
+        case GPIO_INTR_NEGEDGE:
+        case GPIO_INTR_LOW_LEVEL:
+            return from && !to;
+        case GPIO_INTR_ANYEDGE:
+            return from != to;
+        default:
+            return false;
+    }
+}
+
+esp_err_t gpio_config(const gpio_config_t *config) {
+    if (config->pin_bit_mask >> GPIO_NUM_MAX) {
+        return ESP_ERR_INVALID_ARG;
+    }
+
+    pthread_mutex_lock(&pin_lock);
+
+    for (gpio_num_t pin = 0; pin < GPIO_NUM_MAX; pin++) {
+        if (config->pin_bit_mask & (1ULL << pin)) {
+            pins[pin].mode = config->mode;
+            pins[pin].pull_up = config->pull_up_en == GPIO_PULLUP_ENABLE;
+            pins[pin].intr_type = config->intr_type;
+            pins[pin].intr_enabled = config->intr_type != GPIO_INTR_DISABLE;
+        }
+    }
+
+    pthread_mutex_unlock(&pin_lock);
+
+    return ESP_OK;
+}
+
+esp_err_t gpio_set_direction(gpio_num_t gpio_num, gpio_mode_t mode) {
+    if (!valid_pin(gpio_num)) {
+        return ESP_ERR_INVALID_ARG;
+    }
+
+    pthread_mutex_lock(&pin_lock);
+    pins[gpio_num].mode = mode;
+    // Enabling the output hands it back to the GPIO level, as IDF does
+    if (mode & GPIO_MODE_OUTPUT) {
+        pins[gpio_num].out_signal = SIG_GPIO_OUT_IDX;
+    }
+    pthread_mutex_unlock(&pin_lock);
+
+    return ESP_OK;
+}
+
+void esp_rom_gpio_connect_out_signal(uint32_t gpio_num, uint32_t signal_idx,
+                                     bool out_inv, bool oen_inv) {
+    if (!valid_pin(gpio_num)) {
+        return;
+    }
+
+    pthread_mutex_lock(&pin_lock);
+    pins[gpio_num].out_signal = signal_idx;
+    pthread_mutex_unlock(&pin_lock);
+}
+
+uint32_t sim_gpio_out_signal(gpio_num_t gpio_num) {
+    if (!valid_pin(gpio_num)) {
+        return SIG_GPIO_OUT_IDX;
+    }
+
+    pthread_mutex_lock(&pin_lock);
+    uint32_t signal = pins[gpio_num].out_signal;
+    pthread_mutex_unlock(&pin_lock);
+
+    return signal != 0 ? signal : SIG_GPIO_OUT_IDX;
+}
+
+int gpio_get_level(gpio_num_t gpio_num) {
+    if (!valid_pin(gpio_num)) {
+        return 0;
+    }
+
+    pthread_mutex_lock(&pin_lock);
+    int level = level_locked(&pins[gpio_num]);
+    pthread_mutex_unlock(&pin_lock);
+
+    return level;
+}
+
+esp_err_t gpio_set_level(gpio_num_t gpio_num, uint32_t level) {
+    if (!valid_pin(gpio_num)) {
+        return ESP_ERR_INVALID_ARG;
+    }
+
+    pthread_mutex_lock(&pin_lock);
+    pins[gpio_num].output_level = level != 0;
+    pthread_mutex_unlock(&pin_lock);
+
+    return ESP_OK;
+}
+
+esp_err_t gpio_install_isr_service(int intr_alloc_flags) {
+    if (isr_service_installed) {
+        return ESP_ERR_INVALID_STATE;
+    }
+
+    isr_service_installed = true;
+    return ESP_OK;
+}
+
+esp_err_t gpio_isr_handler_add(gpio_num_t gpio_num, gpio_isr_t isr_handler,
+                               void *args) {
+    if (!valid_pin(gpio_num)) {
+        return ESP_ERR_INVALID_ARG;
+    }
+
+    if (!isr_service_installed) {
+        return ESP_ERR_INVALID_STATE;
+    }
+
+    pthread_mutex_lock(&pin_lock);
+    pins[gpio_num].isr = isr_handler;
+    pins[gpio_num].isr_arg = args;
+    pthread_mutex_unlock(&pin_lock);
+
+    return ESP_OK;
+}
+
+esp_err_t gpio_isr_handler_remove(gpio_num_t gpio_num) {
+    return gpio_isr_handler_add(gpio_num, NULL, NULL);
+}
+
+esp_err_t gpio_set_intr_type(gpio_num_t gpio_num, gpio_int_type_t intr_type) {
+    if (!valid_pin(gpio_num)) {
+        return ESP_ERR_INVALID_ARG;
+    }
+
+    pthread_mutex_lock(&pin_lock);
+    pins[gpio_num].intr_type = intr_type;
+    pthread_mutex_unlock(&pin_lock);
+
+    return ESP_OK;
+}
+
+static esp_err_t set_intr_enabled(gpio_num_t gpio_num, bool enabled) {
+    if (!valid_pin(gpio_num)) {
+        return ESP_ERR_INVALID_ARG;
+    }
+
+    pthread_mutex_lock(&pin_lock);
+    pins[gpio_num].intr_enabled = enabled;
+    pthread_mutex_unlock(&pin_lock);
+
+    return ESP_OK;
+}
+
+esp_err_t gpio_intr_enable(gpio_num_t gpio_num) {
+    return set_intr_enabled(gpio_num, true);
+}
+
+esp_err_t gpio_intr_disable(gpio_num_t gpio_num) {
+    return set_intr_enabled(gpio_num, false);
+}
+
+esp_err_t gpio_wakeup_enable(gpio_num_t gpio_num, gpio_int_type_t intr_type) {
+    if (intr_type != GPIO_INTR_LOW_LEVEL && intr_type != GPIO_INTR_HIGH_LEVEL) {
+        return ESP_ERR_INVALID_ARG;
+    }
+
+    return gpio_set_intr_type(gpio_num, intr_type);
+}
+
+esp_err_t gpio_wakeup_disable(gpio_num_t gpio_num) {
+    return valid_pin(gpio_num) ? ESP_OK : ESP_ERR_INVALID_ARG;
+}
+
+void sim_gpio_drive(gpio_num_t gpio_num, int level) {
+    pthread_mutex_lock(&pin_lock);
+
+    pin_state *pin = &pins[gpio_num];
+    int before = level_locked(pin);
+
+    pin->driven = true;
+    pin->external_level = level != 0;
+
+    gpio_isr_t isr = NULL;
+    if (pin->intr_enabled &&
+        triggers(pin->intr_type, before, level_locked(pin))) {
+        isr = pin->isr;
+    }
+    void *isr_arg = pin->isr_arg;
+
+    pthread_mutex_unlock(&pin_lock);
+
+    if (isr != NULL) {
+        isr(isr_arg);
+    }
+}
@@ -0,0 +1,260 @@
+/**
+ * This file contains the simulated I2C master and the devices on the bus.
+ *
+ * The PCF8574 expander on the button board is modelled as its datasheet
+ * describes it: quasi-bidirectional pins pulled high unless the latch or a
+ * button pulls them low, and an open drain INT line that asserts whenever an
+ * input changes and releases once the port is read or written.
+ *
+ * The ADC081C021 on the power board converts on every read of its result
+ * register. Its other registers read back what was written to them.
+ */
+
+#include "driver/i2c_master.h"
+#include "sim.h"
+#include <stdlib.h>
+
+//! Start and address, each byte is followed by an ACK bit
+#define BITS_PER_BYTE 9
+
+struct i2c_master_bus_t {
+    i2c_port_num_t port;
+};
+
+struct i2c_master_dev_t {
+    uint16_t address;
+    uint32_t scl_speed_hz;
+};
+
+typedef struct {
+    bool attached;
+    uint16_t address;
+    gpio_num_t int_pin;
+    uint8_t latch;
+    //! Pins a button holds low
+    uint8_t pulled_low;
+    //! Port state the last read or write saw, INT asserts when it changes
+    uint8_t seen;
+} pcf8574_model;
+
+typedef struct {
+    bool attached;
+    uint16_t address;
+    uint32_t reference_mv;
+    uint32_t input_mv;
+    uint8_t pointer;
+    uint16_t registers[8];
+} adc081c021_model;
+
+//! The only register that is a single byte wide
+#define ADC_CONFIG_REGISTER 0x02
+
+static pcf8574_model expander = {.int_pin = -1, .latch = 0xFF};
+static adc081c021_model adc;
+static pthread_mutex_t bus_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static uint8_t expander_port_locked(void) {
+    return expander.latch & ~expander.pulled_low;
+}
+
+//! Drives the INT line from the port state, bus_lock must be held
+static void update_interrupt_locked(void) {
+    if (expander.int_pin >= 0) {
+        sim_gpio_drive(expander.int_pin,
+                       expander_port_locked() == expander.seen);
+    }
+}
+
+void sim_pcf8574_attach(uint16_t address, gpio_num_t int_pin) {
+    pthread_mutex_lock(&bus_lock);
+
+    expander.attached = true;
+    expander.address = address;
+    expander.int_pin = int_pin;
+    expander.seen = expander_port_locked();
+    update_interrupt_locked();
+
+    pthread_mutex_unlock(&bus_lock);
+}
+
+void sim_pcf8574_drive(int pin, int level) {
+    pthread_mutex_lock(&bus_lock);
+
+    if (level) {
+        expander.pulled_low &= ~(1 << pin);
+    } else {
+        expander.pulled_low |= 1 << pin;
+    }
+    update_interrupt_locked();
+
+    pthread_mutex_unlock(&bus_lock);
+}
+
+void sim_adc081c021_attach(uint16_t address, uint32_t reference_mv) {
+    pthread_mutex_lock(&bus_lock);
+
+    adc.attached = true;
+    adc.address = address;
+    adc.reference_mv = reference_mv;
+
+    pthread_mutex_unlock(&bus_lock);
+}
+
+void sim_adc081c021_set_input(uint32_t millivolts) {
+    pthread_mutex_lock(&bus_lock);
+    adc.input_mv = millivolts;
+    pthread_mutex_unlock(&bus_lock);
+}
+
+//! Result register contents, the 8 bit code sits in bits 11 to 4
+static uint16_t adc_convert_locked(void) {
+    uint32_t code = (adc.input_mv * 256 + adc.reference_mv / 2) /
+                    adc.reference_mv;
+    if (code > 0xFF) {
+        code = 0xFF;
+    }
+
+    return code << 4;
+}
+
+static void adc_write_locked(const uint8_t *data, size_t size) {
+    if (size == 0) {
+        return;
+    }
+
+    adc.pointer = data[0] & 0x07;
+
+    if (size == 2 && adc.pointer == ADC_CONFIG_REGISTER) {
+        adc.registers[adc.pointer] = data[1];
+    } else if (size == 3 && adc.pointer != 0) {
+        adc.registers[adc.pointer] = data[1] << 8 | data[2];
+    }
+}
+
+static void adc_read_locked(uint8_t *data, size_t size) {
+    uint16_t value = adc.pointer == 0 ? adc_convert_locked()
+                                      : adc.registers[adc.pointer];
+
+    // Big endian, the configuration register is a single byte
+    if (adc.pointer == ADC_CONFIG_REGISTER) {
+        value <<= 8;
+    }
+
+    for (size_t i = 0; i < size; i++) {
+        data[i] = i < 2 ? value >> (8 * (1 - i)) : 0;
+    }
+}
+
+esp_err_t i2c_new_master_bus(const i2c_master_bus_config_t *bus_config,
+                             i2c_master_bus_handle_t *ret_bus_handle) {
+    i2c_master_bus_handle_t bus = calloc(1, sizeof(*bus));
+    if (bus == NULL) {
+        return ESP_ERR_NO_MEM;
+    }
+
+    bus->port = bus_config->i2c_port;
+    *ret_bus_handle = bus;
+
+    return ESP_OK;
+}
+
+esp_err_t i2c_master_bus_add_device(i2c_master_bus_handle_t bus_handle,
+                                    const i2c_device_config_t *dev_config,
+                                    i2c_master_dev_handle_t *ret_handle) {
+    i2c_master_dev_handle_t device = calloc(1, sizeof(*device));
+    if (device == NULL) {
+        return ESP_ERR_NO_MEM;
+    }
+
+    device->address = dev_config->device_address;
+    device->scl_speed_hz = dev_config->scl_speed_hz;
+    *ret_handle = device;
+
+    return ESP_OK;
+}
+
+//! Holds the calling task for the time `bytes` take on the wire
+static void clock_bytes(i2c_master_dev_handle_t device, size_t bytes) {
+    uint64_t bits = (uint64_t)bytes * BITS_PER_BYTE;
+    sim_sleep_until(sim_now_us() + bits * 1000000 / device->scl_speed_hz);
+}
+
+static bool expander_addressed(i2c_master_dev_handle_t device) {
+    return expander.attached && device->address == expander.address;
+}
+
+static bool adc_addressed(i2c_master_dev_handle_t device) {
+    return adc.attached && device->address == adc.address;
+}
+
+esp_err_t i2c_master_transmit(i2c_master_dev_handle_t i2c_dev,
+                              const uint8_t *write_buffer, size_t write_size,
+                              int xfer_timeout_ms) {
+    clock_bytes(i2c_dev, 1 + write_size);
+
+    pthread_mutex_lock(&bus_lock);
+
+    if (adc_addressed(i2c_dev)) {
+        adc_write_locked(write_buffer, write_size);
+        pthread_mutex_unlock(&bus_lock);
+        return ESP_OK;
+    }
+
+    if (!expander_addressed(i2c_dev)) {
+        pthread_mutex_unlock(&bus_lock);
+        return ESP_ERR_INVALID_STATE;
+    }
+
+    if (write_size > 0) {
+        expander.latch = write_buffer[write_size - 1];
+    }
+    expander.seen = expander_port_locked();
+    update_interrupt_locked();
+
+    pthread_mutex_unlock(&bus_lock);
+
+    return ESP_OK;
+}
+
+esp_err_t i2c_master_receive(i2c_master_dev_handle_t i2c_dev,
+                             uint8_t *read_buffer, size_t read_size,
+                             int xfer_timeout_ms) {
+    clock_bytes(i2c_dev, 1 + read_size);
+
+    pthread_mutex_lock(&bus_lock);
+
+    if (adc_addressed(i2c_dev)) {
+        adc_read_locked(read_buffer, read_size);
+        pthread_mutex_unlock(&bus_lock);
+        return ESP_OK;
+    }
+
+    if (!expander_addressed(i2c_dev)) {
+        pthread_mutex_unlock(&bus_lock);
+        return ESP_ERR_INVALID_STATE;
+    }
+
+    // The port is sampled at each byte's ACK, they all read the same here
+    expander.seen = expander_port_locked();
+    for (size_t i = 0; i < read_size; i++) {
+        read_buffer[i] = expander.seen;
+    }
+    update_interrupt_locked();
+
+    pthread_mutex_unlock(&bus_lock);
+
+    return ESP_OK;
+}
+
+esp_err_t i2c_master_transmit_receive(i2c_master_dev_handle_t i2c_dev,
+                                      const uint8_t *write_buffer,
+                                      size_t write_size, uint8_t *read_buffer,
+                                      size_t read_size, int xfer_timeout_ms) {
+    esp_err_t result =
+        i2c_master_transmit(i2c_dev, write_buffer, write_size, xfer_timeout_ms);
+    if (result != ESP_OK) {
+        return result;
+    }
+
+    return i2c_master_receive(i2c_dev, read_buffer, read_size, xfer_timeout_ms);
+}
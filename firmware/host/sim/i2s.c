@@ -0,0 +1,469 @@
+/**
+ * This file contains the simulated I2S driver. TX channels append to the
+ * output file of their port and block for as long as the written samples take
+ * to play, which is what paces the firmware's writer task. RX channels return
+ * the port's input file, or silence once it runs out.
+ *
+ * Time keeps passing while a channel is stopped: the output file gets silence
+ * for the gap and the input file skips ahead, so both stay aligned with the
+ * clock.
+ *
+ * A slave channel runs off whichever port's master clock the GPIO matrix
+ * routes to its BCLK pin. Enabled before that clock starts it begins with the
+ * master's first frame, enabled later it joins mid stream.
+ *
+ * With feedback set, everything played is also heard by the mic: the outputs'
+ * mono sum, delayed and through a resonance, is added to what RX channels
+ * read, on the same clock as the outputs.
+ *
+ * A port given its codec plays silence while that codec's DAC soft mute is
+ * on, the way the real DAC would.
+ */
+
+#include "codec/registers.h"
+#include "driver/i2s_std.h"
+#include "esp_log.h"
+#include "sim.h"
+#include "soc/gpio_sig_map.h"
+#include <math.h>
+#include <stdatomic.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define TAG "SIM_I2S"
+
+struct i2s_channel_obj_t {
+    i2s_port_t port;
+    bool tx;
+    bool initialized;
+    bool enabled;
+    uint32_t sample_rate;
+    bool slave;
+    int bclk_pin;
+    //! A slave enabled while its clock is stopped, which moves nothing
+    bool awaiting_clock;
+    //! Simulated time the channel was enabled and frames moved since, which
+    //! gives the time the next write completes without accumulating rounding
+    uint64_t enabled_us;
+    uint64_t frames;
+};
+
+//! Frames of silence written or input skipped at a time to cover a gap
+#define GAP_CHUNK_FRAMES 256
+
+typedef struct {
+    wav_reader *input;
+    wav_writer *output;
+    //! Channels allocated on the port, TX first
+    i2s_chan_handle_t channels[2];
+    //! When each direction was stopped, 0 while it runs
+    uint64_t stopped_us[2];
+    //! Chip select of the codec whose DAC the TX feeds, see sim_i2s_set_codec
+    bool has_codec;
+    int codec_chip_select;
+} i2s_port_state;
+
+//! DACMU in ADCDACControl
+#define DAC_SOFT_MUTE (1 << 3)
+
+static i2s_port_state ports[I2S_NUM_MAX];
+
+//! Guards the files, which the main thread closes while tasks may still run
+static pthread_mutex_t file_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static _Atomic int running_channels;
+
+//! Sharpness of the resonance on the acoustic path
+#define ACOUSTIC_Q 8.0f
+
+//! Frames of played audio kept for the acoustic path, far beyond any delay
+#define ACOUSTIC_FRAMES 8192
+
+//! Speaker to mic coupling, see sim_i2s_set_feedback
+static struct {
+    bool enabled;
+    uint32_t delay_frames;
+    //! Resonance as a band pass biquad, a0 normalised out and the gain at
+    //! its peak folded into the b coefficients
+    float b0, b2, a1, a2;
+    float x1, x2, y1, y2;
+    //! Played frames summed over the outputs, by frame on the shared clock
+    int32_t played[ACOUSTIC_FRAMES];
+    uint64_t played_frame[ACOUSTIC_FRAMES];
+} acoustic;
+
+//! BCLK each port outputs as a master
+static const uint32_t BCLK_SIGNALS[I2S_NUM_MAX] = {
+    [I2S_NUM_0] = I2S0O_BCK_OUT_IDX,
+    [I2S_NUM_1] = I2S1O_BCK_OUT_IDX,
+};
+
+//! The master TX clocking a slave, NULL if its BCLK pin carries no I2S clock
+static i2s_chan_handle_t clock_master(i2s_chan_handle_t slave) {
+    uint32_t signal = sim_gpio_out_signal(slave->bclk_pin);
+
+    for (size_t i = 0; i < I2S_NUM_MAX; i++) {
+        i2s_chan_handle_t master = ports[i].channels[0];
+
+        if (signal == BCLK_SIGNALS[i] && master != NULL && !master->slave) {
+            return master;
+        }
+    }
+
+    return NULL;
+}
+
+bool sim_i2s_running(void) { return atomic_load(&running_channels) != 0; }
+
+void sim_i2s_set_feedback(float gain_db, float delay_ms, float resonance_hz,
+                          uint32_t sample_rate) {
+    float gain = powf(10.0f, gain_db / 20.0f);
+    float w0 = 2.0f * (float)M_PI * resonance_hz / sample_rate;
+    float alpha = sinf(w0) / (2.0f * ACOUSTIC_Q);
+    float a0 = 1.0f + alpha;
+
+    pthread_mutex_lock(&file_lock);
+    acoustic.enabled = true;
+    acoustic.delay_frames = delay_ms * sample_rate / 1000;
+    acoustic.b0 = gain * alpha / a0;
+    acoustic.b2 = -gain * alpha / a0;
+    acoustic.a1 = -2.0f * cosf(w0) / a0;
+    acoustic.a2 = (1.0f - alpha) / a0;
+    pthread_mutex_unlock(&file_lock);
+}
+
+//! Frame on the clock shared by every channel, for the channel's next frame
+static uint64_t clock_frame(i2s_chan_handle_t handle) {
+    return handle->enabled_us * handle->sample_rate / 1000000 +
+           handle->frames;
+}
+
+//! Remembers frames played from `first` on, file_lock must be held
+static void play_acoustic_locked(uint64_t first, const int16_t *samples,
+                                 size_t frames) {
+    for (size_t i = 0; i < frames; i++) {
+        uint64_t frame = first + i;
+        size_t slot = frame % ACOUSTIC_FRAMES;
+
+        // Another output may already have played into this frame
+        if (acoustic.played_frame[slot] != frame) {
+            acoustic.played_frame[slot] = frame;
+            acoustic.played[slot] = 0;
+        }
+        acoustic.played[slot] += (samples[2 * i] + samples[2 * i + 1]) / 2;
+    }
+}
+
+//! Adds what the mic hears of the outputs to frames read from `first` on,
+//! file_lock must be held
+static void hear_acoustic_locked(uint64_t first, int16_t *samples,
+                                 size_t frames) {
+    for (size_t i = 0; i < frames; i++) {
+        uint64_t frame = first + i - acoustic.delay_frames;
+        size_t slot = frame % ACOUSTIC_FRAMES;
+
+        float x0 = first + i >= acoustic.delay_frames &&
+                           acoustic.played_frame[slot] == frame
+                       ? acoustic.played[slot]
+                       : 0.0f;
+        float y0 = acoustic.b0 * x0 + acoustic.b2 * acoustic.x2 -
+                   acoustic.a1 * acoustic.y1 - acoustic.a2 * acoustic.y2;
+
+        acoustic.x2 = acoustic.x1;
+        acoustic.x1 = x0;
+        acoustic.y2 = acoustic.y1;
+        acoustic.y1 = y0;
+
+        for (size_t channel = 0; channel < 2; channel++) {
+            float sample = samples[2 * i + channel] + y0;
+            samples[2 * i + channel] = sample > INT16_MAX   ? INT16_MAX
+                                       : sample < INT16_MIN ? INT16_MIN
+                                                            : sample;
+        }
+    }
+}
+
+//! Catches the port's files up with time spent stopped, file_lock must be held
+static void cover_gap_locked(i2s_port_state *port, bool tx,
+                             uint32_t sample_rate, uint64_t gap_us) {
+    int16_t samples[GAP_CHUNK_FRAMES * 2] = {0};
+    uint64_t frames = gap_us * sample_rate / 1000000;
+
+    while (frames > 0) {
+        size_t count = frames < GAP_CHUNK_FRAMES ? frames : GAP_CHUNK_FRAMES;
+
+        if (tx && port->output != NULL) {
+            wav_write(port->output, samples, count);
+        } else if (!tx && port->input != NULL) {
+            wav_read_stereo(port->input, samples, count);
+        }
+
+        frames -= count;
+    }
+}
+
+void sim_i2s_attach(i2s_port_t port, wav_reader *input, wav_writer *output) {
+    pthread_mutex_lock(&file_lock);
+    ports[port].input = input;
+    ports[port].output = output;
+    pthread_mutex_unlock(&file_lock);
+}
+
+void sim_i2s_set_codec(i2s_port_t port, int chip_select) {
+    pthread_mutex_lock(&file_lock);
+    ports[port].has_codec = true;
+    ports[port].codec_chip_select = chip_select;
+    pthread_mutex_unlock(&file_lock);
+}
+
+//! Whether the codec on `port` has its DAC muted, file_lock must be held
+static bool dac_muted_locked(const i2s_port_state *port) {
+    return port->has_codec &&
+           (sim_power_codec_register(port->codec_chip_select, ADCDACControl) &
+            DAC_SOFT_MUTE) != 0;
+}
+
+void sim_i2s_detach(void) {
+    pthread_mutex_lock(&file_lock);
+    for (size_t i = 0; i < I2S_NUM_MAX; i++) {
+        // An output stopped at the end still lasts the whole run
+        if (ports[i].output != NULL && ports[i].stopped_us[0] != 0) {
+            cover_gap_locked(&ports[i], true, ports[i].output->sample_rate,
+                             sim_now_us() - ports[i].stopped_us[0]);
+        }
+
+        // One still running ends where its clock is now. Writes queued past
+        // that were never shifted out, and a port the writer had not got to
+        // yet underran into silence, so every port of a domain ends together.
+        i2s_chan_handle_t tx = ports[i].channels[0];
+        if (ports[i].output != NULL && tx != NULL && tx->enabled &&
+            !tx->awaiting_clock) {
+            uint64_t played =
+                (sim_now_us() - tx->enabled_us) * tx->sample_rate / 1000000;
+
+            if (tx->frames > played) {
+                wav_truncate(ports[i].output, ports[i].output->frames -
+                                                  (tx->frames - played));
+            } else {
+                cover_gap_locked(&ports[i], true, tx->sample_rate,
+                                 (played - tx->frames) * 1000000 /
+                                     tx->sample_rate);
+            }
+        }
+
+        ports[i].input = NULL;
+        ports[i].output = NULL;
+    }
+    pthread_mutex_unlock(&file_lock);
+}
+
+esp_err_t i2s_new_channel(const i2s_chan_config_t *chan_cfg,
+                          i2s_chan_handle_t *ret_tx_handle,
+                          i2s_chan_handle_t *ret_rx_handle) {
+    if (chan_cfg->id >= I2S_NUM_MAX) {
+        return ESP_ERR_NOT_FOUND;
+    }
+
+    i2s_port_state *port = &ports[chan_cfg->id];
+
+    if (port->channels[0] != NULL || port->channels[1] != NULL) {
+        return ESP_ERR_NOT_FOUND;
+    }
+
+    i2s_chan_handle_t *handles[] = {ret_tx_handle, ret_rx_handle};
+
+    for (size_t i = 0; i < 2; i++) {
+        if (handles[i] == NULL) {
+            continue;
+        }
+
+        i2s_chan_handle_t channel = calloc(1, sizeof(*channel));
+        if (channel == NULL) {
+            return ESP_ERR_NO_MEM;
+        }
+
+        channel->port = chan_cfg->id;
+        channel->tx = i == 0;
+        channel->slave = chan_cfg->role == I2S_ROLE_SLAVE;
+        port->channels[i] = channel;
+        *handles[i] = channel;
+    }
+
+    return ESP_OK;
+}
+
+esp_err_t i2s_del_channel(i2s_chan_handle_t handle) {
+    if (handle->enabled) {
+        return ESP_ERR_INVALID_STATE;
+    }
+
+    // The port is free again once every direction allocated on it is gone
+    ports[handle->port].channels[!handle->tx] = NULL;
+
+    free(handle);
+
+    return ESP_OK;
+}
+
+esp_err_t i2s_channel_init_std_mode(i2s_chan_handle_t handle,
+                                    const i2s_std_config_t *std_cfg) {
+    if (std_cfg->slot_cfg.data_bit_width != I2S_DATA_BIT_WIDTH_16BIT ||
+        std_cfg->slot_cfg.slot_mode != I2S_SLOT_MODE_STEREO) {
+        ESP_LOGE(TAG, "Only 16 bit stereo is simulated");
+        return ESP_ERR_NOT_SUPPORTED;
+    }
+
+    handle->sample_rate = std_cfg->clk_cfg.sample_rate_hz;
+    handle->bclk_pin = std_cfg->gpio_cfg.bclk;
+    handle->initialized = true;
+
+    wav_reader *input = ports[handle->port].input;
+    if (!handle->tx && input != NULL &&
+        input->sample_rate != handle->sample_rate) {
+        ESP_LOGW(TAG, "Input file is %lu Hz, I2S%d runs at %lu Hz",
+                 (unsigned long)input->sample_rate, handle->port,
+                 (unsigned long)handle->sample_rate);
+    }
+
+    return ESP_OK;
+}
+
+esp_err_t i2s_channel_enable(i2s_chan_handle_t handle) {
+    if (!handle->initialized || handle->enabled) {
+        return ESP_ERR_INVALID_STATE;
+    }
+
+    handle->enabled = true;
+    handle->enabled_us = sim_now_us();
+    handle->frames = 0;
+    atomic_fetch_add(&running_channels, 1);
+
+    if (handle->slave) {
+        i2s_chan_handle_t master = clock_master(handle);
+        handle->awaiting_clock = master == NULL || !master->enabled;
+    } else if (handle->tx) {
+        // Slaves waiting on this clock start with its first frame
+        for (size_t i = 0; i < I2S_NUM_MAX; i++) {
+            for (size_t j = 0; j < 2; j++) {
+                i2s_chan_handle_t slave = ports[i].channels[j];
+
+                if (slave != NULL && slave->slave && slave->enabled &&
+                    slave->awaiting_clock && clock_master(slave) == handle) {
+                    slave->awaiting_clock = false;
+                    slave->enabled_us = handle->enabled_us;
+                }
+            }
+        }
+    }
+
+    uint64_t *stopped_us = &ports[handle->port].stopped_us[!handle->tx];
+
+    pthread_mutex_lock(&file_lock);
+    if (*stopped_us != 0) {
+        cover_gap_locked(&ports[handle->port], handle->tx,
+                         handle->sample_rate,
+                         handle->enabled_us - *stopped_us);
+        *stopped_us = 0;
+    }
+    pthread_mutex_unlock(&file_lock);
+
+    return ESP_OK;
+}
+
+esp_err_t i2s_channel_disable(i2s_chan_handle_t handle) {
+    if (!handle->enabled) {
+        return ESP_ERR_INVALID_STATE;
+    }
+
+    handle->enabled = false;
+    atomic_fetch_sub(&running_channels, 1);
+
+    pthread_mutex_lock(&file_lock);
+    ports[handle->port].stopped_us[!handle->tx] = sim_now_us();
+    pthread_mutex_unlock(&file_lock);
+
+    return ESP_OK;
+}
+
+esp_err_t i2s_channel_write(i2s_chan_handle_t handle, const void *src,
+                            size_t size, size_t *bytes_written,
+                            uint32_t timeout_ms) {
+    *bytes_written = 0;
+
+    if (!handle->tx || !handle->enabled) {
+        return ESP_ERR_INVALID_STATE;
+    }
+
+    // Without a clock the DMA never drains, so the write times out
+    if (handle->awaiting_clock) {
+        ESP_LOGE(TAG, "I2S%d written without a clock", handle->port);
+        return ESP_ERR_TIMEOUT;
+    }
+
+    size_t frames = size / (2 * sizeof(int16_t));
+
+    pthread_mutex_lock(&file_lock);
+    wav_writer *output = ports[handle->port].output;
+    if (dac_muted_locked(&ports[handle->port])) {
+        int16_t silence[GAP_CHUNK_FRAMES * 2] = {0};
+
+        for (size_t done = 0; done < frames;) {
+            size_t count = frames - done < GAP_CHUNK_FRAMES ? frames - done
+                                                            : GAP_CHUNK_FRAMES;
+            if (output != NULL) {
+                wav_write(output, silence, count);
+            }
+            if (acoustic.enabled) {
+                play_acoustic_locked(clock_frame(handle) + done, silence,
+                                     count);
+            }
+            done += count;
+        }
+    } else {
+        if (output != NULL) {
+            wav_write(output, src, frames);
+        }
+        if (acoustic.enabled) {
+            play_acoustic_locked(clock_frame(handle), src, frames);
+        }
+    }
+    pthread_mutex_unlock(&file_lock);
+
+    handle->frames += frames;
+    sim_sleep_until(handle->enabled_us +
+                    handle->frames * 1000000 / handle->sample_rate);
+
+    *bytes_written = frames * 2 * sizeof(int16_t);
+
+    return ESP_OK;
+}
+
+esp_err_t i2s_channel_read(i2s_chan_handle_t handle, void *dest, size_t size,
+                           size_t *bytes_read, uint32_t timeout_ms) {
+    *bytes_read = 0;
+
+    if (handle->tx || !handle->enabled) {
+        return ESP_ERR_INVALID_STATE;
+    }
+
+    size_t frames = size / (2 * sizeof(int16_t));
+    size_t got = 0;
+
+    pthread_mutex_lock(&file_lock);
+    wav_reader *input = ports[handle->port].input;
+    if (input != NULL) {
+        got = wav_read_stereo(input, dest, frames);
+    }
+
+    memset((int16_t *)dest + 2 * got, 0, (frames - got) * 2 * sizeof(int16_t));
+
+    if (acoustic.enabled) {
+        hear_acoustic_locked(clock_frame(handle), dest, frames);
+    }
+    pthread_mutex_unlock(&file_lock);
+
+    handle->frames += frames;
+    *bytes_read = frames * 2 * sizeof(int16_t);
+
+    return ESP_OK;
+}
@@ -0,0 +1,77 @@
+#ifndef SIM_DRIVER_GPIO_H
+#define SIM_DRIVER_GPIO_H
+
+#include "esp_err.h"
+#include <stdint.h>
+
+typedef int gpio_num_t;
+
+#define GPIO_NUM_MAX 40
+
+typedef enum {
+    GPIO_MODE_DISABLE = 0,
+    GPIO_MODE_INPUT = 1,
+    GPIO_MODE_OUTPUT = 2,
+    GPIO_MODE_INPUT_OUTPUT = 3,
+} gpio_mode_t;
+
+typedef enum {
+    GPIO_PULLUP_DISABLE,
+    GPIO_PULLUP_ENABLE,
+} gpio_pullup_t;
+
+typedef enum {
+    GPIO_PULLDOWN_DISABLE,
+    GPIO_PULLDOWN_ENABLE,
+} gpio_pulldown_t;
+
+typedef enum {
+    GPIO_INTR_DISABLE,
+    GPIO_INTR_POSEDGE,
+    GPIO_INTR_NEGEDGE,
+    GPIO_INTR_ANYEDGE,
+    GPIO_INTR_LOW_LEVEL,
+    GPIO_INTR_HIGH_LEVEL,
+} gpio_int_type_t;
+
+typedef struct {
+    uint64_t pin_bit_mask;
+    gpio_mode_t mode;
+    gpio_pullup_t pull_up_en;
+    gpio_pulldown_t pull_down_en;
+    gpio_int_type_t intr_type;
+} gpio_config_t;
+
+esp_err_t gpio_config(const gpio_config_t *config);
+
+esp_err_t gpio_set_direction(gpio_num_t gpio_num, gpio_mode_t mode);
+
+int gpio_get_level(gpio_num_t gpio_num);
+
+esp_err_t gpio_set_level(gpio_num_t gpio_num, uint32_t level);
+
+typedef void (*gpio_isr_t)(void *arg);
+
+//! Interrupt allocation flags are accepted and ignored
+esp_err_t gpio_install_isr_service(int intr_alloc_flags);
+
+esp_err_t gpio_isr_handler_add(gpio_num_t gpio_num, gpio_isr_t isr_handler,
+                               void *args);
+
+esp_err_t gpio_isr_handler_remove(gpio_num_t gpio_num);
+
+esp_err_t gpio_set_intr_type(gpio_num_t gpio_num, gpio_int_type_t intr_type);
+
+esp_err_t gpio_intr_enable(gpio_num_t gpio_num);
+
+esp_err_t gpio_intr_disable(gpio_num_t gpio_num);
+
+/**
+ * Like on the ESP32 the wakeup level replaces the pin's interrupt type. Levels
+ * are simulated as the edge into them.
+ */
+esp_err_t gpio_wakeup_enable(gpio_num_t gpio_num, gpio_int_type_t intr_type);
+
+esp_err_t gpio_wakeup_disable(gpio_num_t gpio_num);
+
+#endif
@@ -0,0 +1,33 @@
+#ifndef SIM_DRIVER_I2S_COMMON_H
+#define SIM_DRIVER_I2S_COMMON_H
+
+#include "driver/i2s_types.h"
+
+#define I2S_CHANNEL_DEFAULT_CONFIG(i2s_num, i2s_role)                          \
+    {                                                                          \
+        .id = i2s_num,                                                         \
+        .role = i2s_role,                                                      \
+        .dma_desc_num = 6,                                                     \
+        .dma_frame_num = 240,                                                  \
+        .auto_clear = false,                                                   \
+        .intr_priority = 0,                                                    \
+    }
+
+esp_err_t i2s_new_channel(const i2s_chan_config_t *chan_cfg,
+                          i2s_chan_handle_t *ret_tx_handle,
+                          i2s_chan_handle_t *ret_rx_handle);
+
+esp_err_t i2s_del_channel(i2s_chan_handle_t handle);
+
+esp_err_t i2s_channel_enable(i2s_chan_handle_t handle);
+
+esp_err_t i2s_channel_disable(i2s_chan_handle_t handle);
+
+esp_err_t i2s_channel_write(i2s_chan_handle_t handle, const void *src,
+                            size_t size, size_t *bytes_written,
+                            uint32_t timeout_ms);
+
+esp_err_t i2s_channel_read(i2s_chan_handle_t handle, void *dest, size_t size,
+                           size_t *bytes_read, uint32_t timeout_ms);
+
+#endif
@@ -0,0 +1,62 @@
+#ifndef SIM_DRIVER_I2S_STD_H
+#define SIM_DRIVER_I2S_STD_H
+
+#include "driver/i2s_common.h"
+
+typedef struct {
+    uint32_t sample_rate_hz;
+    int clk_src;
+    uint32_t mclk_multiple;
+} i2s_std_clk_config_t;
+
+typedef struct {
+    i2s_data_bit_width_t data_bit_width;
+    i2s_slot_bit_width_t slot_bit_width;
+    i2s_slot_mode_t slot_mode;
+    i2s_std_slot_mask_t slot_mask;
+    uint32_t ws_width;
+    bool ws_pol;
+    bool bit_shift;
+} i2s_std_slot_config_t;
+
+typedef struct {
+    int mclk;
+    int bclk;
+    int ws;
+    int dout;
+    int din;
+    struct {
+        uint32_t mclk_inv : 1;
+        uint32_t bclk_inv : 1;
+        uint32_t ws_inv : 1;
+    } invert_flags;
+} i2s_std_gpio_config_t;
+
+typedef struct {
+    i2s_std_clk_config_t clk_cfg;
+    i2s_std_slot_config_t slot_cfg;
+    i2s_std_gpio_config_t gpio_cfg;
+} i2s_std_config_t;
+
+#define I2S_STD_CLK_DEFAULT_CONFIG(rate)                                       \
+    {                                                                          \
+        .sample_rate_hz = rate,                                                \
+        .clk_src = 0,                                                          \
+        .mclk_multiple = 256,                                                  \
+    }
+
+#define I2S_STD_PHILIPS_SLOT_DEFAULT_CONFIG(bits_per_sample, mono_or_stereo)   \
+    {                                                                          \
+        .data_bit_width = bits_per_sample,                                     \
+        .slot_bit_width = I2S_SLOT_BIT_WIDTH_AUTO,                             \
+        .slot_mode = mono_or_stereo,                                           \
+        .slot_mask = I2S_STD_SLOT_BOTH,                                        \
+        .ws_width = bits_per_sample,                                           \
+        .ws_pol = false,                                                       \
+        .bit_shift = true,                                                     \
+    }
+
+esp_err_t i2s_channel_init_std_mode(i2s_chan_handle_t handle,
+                                    const i2s_std_config_t *std_cfg);
+
+#endif
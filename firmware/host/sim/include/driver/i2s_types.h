@@ -0,0 +1,56 @@
+#ifndef SIM_DRIVER_I2S_TYPES_H
+#define SIM_DRIVER_I2S_TYPES_H
+
+#include "esp_err.h"
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+typedef struct i2s_channel_obj_t *i2s_chan_handle_t;
+
+typedef enum {
+    I2S_NUM_0 = 0,
+    I2S_NUM_1 = 1,
+    I2S_NUM_MAX,
+    I2S_NUM_AUTO,
+} i2s_port_t;
+
+typedef enum {
+    I2S_ROLE_MASTER,
+    I2S_ROLE_SLAVE,
+} i2s_role_t;
+
+typedef enum {
+    I2S_DATA_BIT_WIDTH_8BIT = 8,
+    I2S_DATA_BIT_WIDTH_16BIT = 16,
+    I2S_DATA_BIT_WIDTH_24BIT = 24,
+    I2S_DATA_BIT_WIDTH_32BIT = 32,
+} i2s_data_bit_width_t;
+
+typedef enum {
+    I2S_SLOT_BIT_WIDTH_AUTO = 0,
+} i2s_slot_bit_width_t;
+
+typedef enum {
+    I2S_SLOT_MODE_MONO = 1,
+    I2S_SLOT_MODE_STEREO = 2,
+} i2s_slot_mode_t;
+
+typedef enum {
+    I2S_STD_SLOT_LEFT = 1,
+    I2S_STD_SLOT_RIGHT = 2,
+    I2S_STD_SLOT_BOTH = 3,
+} i2s_std_slot_mask_t;
+
+#define I2S_GPIO_UNUSED (-1)
+
+typedef struct {
+    i2s_port_t id;
+    i2s_role_t role;
+    uint32_t dma_desc_num;
+    uint32_t dma_frame_num;
+    bool auto_clear;
+    int intr_priority;
+} i2s_chan_config_t;
+
+#endif
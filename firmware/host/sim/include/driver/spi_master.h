@@ -0,0 +1,86 @@
+#ifndef SIM_DRIVER_SPI_MASTER_H
+#define SIM_DRIVER_SPI_MASTER_H
+
+#include "esp_err.h"
+#include "freertos/FreeRTOS.h"
+#include "hal/spi_types.h"
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#define SPI_DMA_DISABLED 0
+#define SPI_DMA_CH_AUTO 3
+
+#define SPI_DEVICE_TXBIT_LSBFIRST (1 << 0)
+#define SPI_DEVICE_NO_DUMMY (1 << 6)
+
+#define SPI_TRANS_USE_RXDATA (1 << 2)
+#define SPI_TRANS_USE_TXDATA (1 << 3)
+
+typedef struct {
+    int mosi_io_num;
+    int miso_io_num;
+    int sclk_io_num;
+    int quadwp_io_num;
+    int quadhd_io_num;
+    int max_transfer_sz;
+    uint32_t flags;
+    int intr_flags;
+} spi_bus_config_t;
+
+typedef struct spi_transaction_t {
+    uint32_t flags;
+    uint16_t cmd;
+    uint64_t addr;
+    size_t length;
+    size_t rxlength;
+    void *user;
+    union {
+        const void *tx_buffer;
+        uint8_t tx_data[4];
+    };
+    union {
+        void *rx_buffer;
+        uint8_t rx_data[4];
+    };
+} spi_transaction_t;
+
+typedef void (*transaction_cb_t)(spi_transaction_t *trans);
+
+typedef struct {
+    uint8_t command_bits;
+    uint8_t address_bits;
+    uint8_t dummy_bits;
+    uint8_t mode;
+    int clock_speed_hz;
+    int spics_io_num;
+    uint32_t flags;
+    int queue_size;
+    transaction_cb_t pre_cb;
+    transaction_cb_t post_cb;
+} spi_device_interface_config_t;
+
+typedef struct spi_device_t *spi_device_handle_t;
+
+esp_err_t spi_bus_initialize(spi_host_device_t host_id,
+                             const spi_bus_config_t *bus_config, int dma_chan);
+
+esp_err_t spi_bus_add_device(spi_host_device_t host_id,
+                             const spi_device_interface_config_t *dev_config,
+                             spi_device_handle_t *handle);
+
+esp_err_t spi_device_queue_trans(spi_device_handle_t handle,
+                                 spi_transaction_t *trans_desc,
+                                 TickType_t ticks_to_wait);
+
+esp_err_t spi_device_get_trans_result(spi_device_handle_t handle,
+                                      spi_transaction_t **trans_desc,
+                                      TickType_t ticks_to_wait);
+
+esp_err_t spi_device_transmit(spi_device_handle_t handle,
+                              spi_transaction_t *trans_desc);
+
+esp_err_t spi_device_polling_transmit(spi_device_handle_t handle,
+                                      spi_transaction_t *trans_desc);
+
+#endif
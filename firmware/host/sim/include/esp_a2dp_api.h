@@ -0,0 +1,61 @@
+#ifndef SIM_ESP_A2DP_API_H
+#define SIM_ESP_A2DP_API_H
+
+#include "esp_err.h"
+#include <stdint.h>
+
+typedef enum {
+    ESP_A2D_CONNECTION_STATE_EVT = 0,
+    ESP_A2D_AUDIO_STATE_EVT,
+    ESP_A2D_AUDIO_CFG_EVT,
+} esp_a2d_cb_event_t;
+
+typedef enum {
+    ESP_A2D_CONNECTION_STATE_DISCONNECTED = 0,
+    ESP_A2D_CONNECTION_STATE_CONNECTING,
+    ESP_A2D_CONNECTION_STATE_CONNECTED,
+    ESP_A2D_CONNECTION_STATE_DISCONNECTING,
+} esp_a2d_connection_state_t;
+
+typedef enum {
+    ESP_A2D_AUDIO_STATE_SUSPEND = 0,
+    ESP_A2D_AUDIO_STATE_STARTED,
+    ESP_A2D_AUDIO_STATE_STOPPED = ESP_A2D_AUDIO_STATE_SUSPEND,
+} esp_a2d_audio_state_t;
+
+typedef struct {
+    uint8_t samp_freq;
+    uint8_t ch_mode;
+} esp_a2d_cie_sbc_t;
+
+typedef struct {
+    uint8_t type;
+    union {
+        esp_a2d_cie_sbc_t sbc_info;
+    } cie;
+} esp_a2d_mcc_t;
+
+typedef union {
+    struct {
+        esp_a2d_connection_state_t state;
+    } conn_stat;
+    struct {
+        esp_a2d_audio_state_t state;
+    } audio_stat;
+    struct {
+        esp_a2d_mcc_t mcc;
+    } audio_cfg;
+} esp_a2d_cb_param_t;
+
+typedef void (*esp_a2d_cb_t)(esp_a2d_cb_event_t event,
+                             esp_a2d_cb_param_t *param);
+
+typedef void (*esp_a2d_sink_data_cb_t)(const uint8_t *buf, uint32_t len);
+
+esp_err_t esp_a2d_register_callback(esp_a2d_cb_t callback);
+
+esp_err_t esp_a2d_sink_register_data_callback(esp_a2d_sink_data_cb_t callback);
+
+esp_err_t esp_a2d_sink_init(void);
+
+#endif
@@ -0,0 +1,26 @@
+#ifndef SIM_ESP_BT_H
+#define SIM_ESP_BT_H
+
+#include "esp_err.h"
+
+typedef enum {
+    ESP_BT_MODE_IDLE = 0,
+    ESP_BT_MODE_BLE = 1,
+    ESP_BT_MODE_CLASSIC_BT = 2,
+    ESP_BT_MODE_BTDM = 3,
+} esp_bt_mode_t;
+
+typedef struct {
+    esp_bt_mode_t mode;
+} esp_bt_controller_config_t;
+
+#define BT_CONTROLLER_INIT_CONFIG_DEFAULT()                                    \
+    { .mode = ESP_BT_MODE_CLASSIC_BT }
+
+esp_err_t esp_bt_controller_mem_release(esp_bt_mode_t mode);
+
+esp_err_t esp_bt_controller_init(esp_bt_controller_config_t *cfg);
+
+esp_err_t esp_bt_controller_enable(esp_bt_mode_t mode);
+
+#endif
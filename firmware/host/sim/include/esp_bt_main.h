@@ -0,0 +1,10 @@
+#ifndef SIM_ESP_BT_MAIN_H
+#define SIM_ESP_BT_MAIN_H
+
+#include "esp_err.h"
+
+esp_err_t esp_bluedroid_init(void);
+
+esp_err_t esp_bluedroid_enable(void);
+
+#endif
@@ -0,0 +1,16 @@
+#ifndef SIM_ESP_CPU_H
+#define SIM_ESP_CPU_H
+
+#include <stdint.h>
+#include <time.h>
+
+typedef uint32_t esp_cpu_cycle_count_t;
+
+//! Nanoseconds of host time, matching the 1 GHz clock in the sim sdkconfig.h
+static inline esp_cpu_cycle_count_t esp_cpu_get_cycle_count(void) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (uint64_t)now.tv_sec * 1000000000u + now.tv_nsec;
+}
+
+#endif
@@ -0,0 +1,65 @@
+#ifndef SIM_ESP_GAP_BT_API_H
+#define SIM_ESP_GAP_BT_API_H
+
+#include "esp_err.h"
+#include <stdint.h>
+
+typedef enum {
+    ESP_BT_STATUS_SUCCESS = 0,
+    ESP_BT_STATUS_FAIL,
+} esp_bt_status_t;
+
+typedef enum {
+    ESP_BT_NON_CONNECTABLE,
+    ESP_BT_CONNECTABLE,
+} esp_bt_connection_mode_t;
+
+typedef enum {
+    ESP_BT_NON_DISCOVERABLE,
+    ESP_BT_LIMITED_DISCOVERABLE,
+    ESP_BT_GENERAL_DISCOVERABLE,
+} esp_bt_discovery_mode_t;
+
+typedef enum {
+    ESP_BT_GAP_DISC_RES_EVT = 0,
+    ESP_BT_GAP_AUTH_CMPL_EVT = 4,
+    ESP_BT_GAP_MODE_CHG_EVT = 13,
+} esp_bt_gap_cb_event_t;
+
+#define ESP_BT_GAP_MAX_BDNAME_LEN 248
+
+typedef union {
+    struct {
+        esp_bt_status_t stat;
+        uint8_t device_name[ESP_BT_GAP_MAX_BDNAME_LEN + 1];
+    } auth_cmpl;
+    struct {
+        uint8_t mode;
+    } mode_chg;
+} esp_bt_gap_cb_param_t;
+
+typedef void (*esp_bt_gap_cb_t)(esp_bt_gap_cb_event_t event,
+                                esp_bt_gap_cb_param_t *param);
+
+typedef enum {
+    ESP_BT_SP_IOCAP_MODE = 0,
+} esp_bt_sp_param_t;
+
+typedef uint8_t esp_bt_io_cap_t;
+
+#define ESP_BT_IO_CAP_OUT 0
+#define ESP_BT_IO_CAP_IO 1
+#define ESP_BT_IO_CAP_IN 2
+#define ESP_BT_IO_CAP_NONE 3
+
+esp_err_t esp_bt_gap_set_device_name(const char *name);
+
+esp_err_t esp_bt_gap_register_callback(esp_bt_gap_cb_t callback);
+
+esp_err_t esp_bt_gap_set_security_param(esp_bt_sp_param_t param_type,
+                                        void *value, uint8_t len);
+
+esp_err_t esp_bt_gap_set_scan_mode(esp_bt_connection_mode_t c_mode,
+                                   esp_bt_discovery_mode_t d_mode);
+
+#endif
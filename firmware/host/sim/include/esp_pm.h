@@ -0,0 +1,21 @@
+#ifndef SIM_ESP_PM_H
+#define SIM_ESP_PM_H
+
+#include "esp_err.h"
+#include <stdbool.h>
+
+typedef struct {
+    int max_freq_mhz;
+    int min_freq_mhz;
+    bool light_sleep_enable;
+} esp_pm_config_t;
+
+/**
+ * Only the frequency is simulated, and only so the battery model can charge
+ * for it. Code keeps running at the same speed whatever is configured.
+ */
+esp_err_t esp_pm_configure(const void *config);
+
+esp_err_t esp_pm_get_configuration(void *config);
+
+#endif
@@ -0,0 +1,13 @@
+#ifndef SIM_ESP_PRIVATE_ESP_CLK_H
+#define SIM_ESP_PRIVATE_ESP_CLK_H
+
+#include "sdkconfig.h"
+#include <stdint.h>
+
+//! Always the nominal clock of the sim sdkconfig.h, cycles stay nanoseconds
+//! whatever frequency power management was asked for
+static inline int esp_clk_cpu_freq(void) {
+    return CONFIG_ESP_DEFAULT_CPU_FREQ_MHZ * 1000000;
+}
+
+#endif
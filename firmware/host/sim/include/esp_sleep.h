@@ -0,0 +1,9 @@
+#ifndef SIM_ESP_SLEEP_H
+#define SIM_ESP_SLEEP_H
+
+#include "esp_err.h"
+
+//! Every simulated interrupt wakes the CPU, so this only has to succeed
+static inline esp_err_t esp_sleep_enable_gpio_wakeup(void) { return ESP_OK; }
+
+#endif
@@ -0,0 +1,125 @@
+#ifndef SIM_ESP_SPP_API_H
+#define SIM_ESP_SPP_API_H
+
+#include "esp_err.h"
+#include <stdbool.h>
+#include <stdint.h>
+
+typedef enum {
+    ESP_SPP_SUCCESS = 0,
+    ESP_SPP_FAILURE,
+    ESP_SPP_BUSY,
+    ESP_SPP_NO_DATA,
+    ESP_SPP_NO_RESOURCE,
+} esp_spp_status_t;
+
+typedef enum {
+    ESP_SPP_INIT_EVT = 0,
+    ESP_SPP_UNINIT_EVT = 1,
+    ESP_SPP_DISCOVERY_COMP_EVT = 8,
+    ESP_SPP_OPEN_EVT = 26,
+    ESP_SPP_CLOSE_EVT = 27,
+    ESP_SPP_START_EVT = 28,
+    ESP_SPP_CL_INIT_EVT = 29,
+    ESP_SPP_DATA_IND_EVT = 30,
+    ESP_SPP_CONG_EVT = 31,
+    ESP_SPP_WRITE_EVT = 33,
+    ESP_SPP_SRV_OPEN_EVT = 34,
+    ESP_SPP_SRV_STOP_EVT = 35,
+} esp_spp_cb_event_t;
+
+typedef enum {
+    ESP_SPP_MODE_CB = 0,
+    ESP_SPP_MODE_VFS,
+} esp_spp_mode_t;
+
+typedef enum {
+    ESP_SPP_ROLE_MASTER = 0,
+    ESP_SPP_ROLE_SLAVE = 1,
+} esp_spp_role_t;
+
+typedef uint16_t esp_spp_sec_t;
+
+#define ESP_SPP_SEC_NONE 0x0000
+#define ESP_SPP_SEC_AUTHENTICATE 0x0012
+
+typedef struct {
+    esp_spp_mode_t mode;
+    bool enable_l2cap_ertm;
+    uint16_t tx_buffer_size;
+} esp_spp_cfg_t;
+
+typedef union {
+    struct {
+        esp_spp_status_t status;
+    } init;
+    struct {
+        esp_spp_status_t status;
+    } uninit;
+    struct {
+        esp_spp_status_t status;
+        uint8_t scn_num;
+    } disc_comp;
+    struct {
+        esp_spp_status_t status;
+        uint32_t handle;
+    } open;
+    struct {
+        esp_spp_status_t status;
+        uint32_t handle;
+        uint32_t new_listen_handle;
+    } srv_open;
+    struct {
+        esp_spp_status_t status;
+        uint32_t port_status;
+        uint32_t handle;
+        bool async;
+    } close;
+    struct {
+        esp_spp_status_t status;
+        uint32_t handle;
+        uint8_t sec_id;
+        uint8_t scn;
+        bool use_co;
+    } start;
+    struct {
+        esp_spp_status_t status;
+    } srv_stop;
+    struct {
+        esp_spp_status_t status;
+        uint32_t handle;
+        uint8_t sec_id;
+        bool use_co;
+    } cl_init;
+    struct {
+        esp_spp_status_t status;
+        uint32_t handle;
+        int len;
+        bool cong;
+    } write;
+    struct {
+        esp_spp_status_t status;
+        uint32_t handle;
+        uint16_t len;
+        uint8_t *data;
+    } data_ind;
+    struct {
+        esp_spp_status_t status;
+        uint32_t handle;
+        bool cong;
+    } cong;
+} esp_spp_cb_param_t;
+
+typedef void (*esp_spp_cb_t)(esp_spp_cb_event_t event,
+                             esp_spp_cb_param_t *param);
+
+esp_err_t esp_spp_register_callback(esp_spp_cb_t callback);
+
+esp_err_t esp_spp_enhanced_init(const esp_spp_cfg_t *cfg);
+
+esp_err_t esp_spp_start_srv(esp_spp_sec_t sec_mask, esp_spp_role_t role,
+                            uint8_t local_scn, const char *name);
+
+esp_err_t esp_spp_write(uint32_t handle, int len, uint8_t *p_data);
+
+#endif
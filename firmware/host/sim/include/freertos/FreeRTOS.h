@@ -0,0 +1,58 @@
+#ifndef SIM_FREERTOS_H
+#define SIM_FREERTOS_H
+
+/**
+ * FreeRTOS on top of pthreads. Every task is a thread and every timeout is
+ * measured on the simulated clock, so delays and tick counts follow simulated
+ * time whether the simulator runs in real time or faster.
+ */
+
+#include "esp_attr.h"
+#include "sdkconfig.h"
+#include <pthread.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+typedef int BaseType_t;
+typedef unsigned int UBaseType_t;
+typedef uint32_t TickType_t;
+
+#define pdTRUE 1
+#define pdFALSE 0
+#define pdPASS pdTRUE
+#define pdFAIL pdFALSE
+
+#define portMAX_DELAY ((TickType_t)0xffffffffu)
+#define configTICK_RATE_HZ CONFIG_FREERTOS_HZ
+#define portTICK_PERIOD_MS ((TickType_t)1000 / configTICK_RATE_HZ)
+#define pdMS_TO_TICKS(ms)                                                      \
+    ((TickType_t)(((uint64_t)(ms) * configTICK_RATE_HZ) / 1000))
+#define pdTICKS_TO_MS(ticks)                                                   \
+    ((TickType_t)(((uint64_t)(ticks) * 1000) / configTICK_RATE_HZ))
+
+#define tskNO_AFFINITY 0x7fffffff
+
+//! Critical sections only serialise the threads sharing a lock, there are no
+//! interrupts to mask on the host
+typedef struct {
+    pthread_mutex_t mutex;
+} portMUX_TYPE;
+
+#define portMUX_INITIALIZER_UNLOCKED {PTHREAD_RECURSIVE_MUTEX_INITIALIZER_NP}
+
+void vPortMuxInitialize(portMUX_TYPE *mux);
+void vPortEnterCritical(portMUX_TYPE *mux);
+void vPortExitCritical(portMUX_TYPE *mux);
+
+#define portMUX_INITIALIZE(mux) vPortMuxInitialize(mux)
+#define portENTER_CRITICAL(mux) vPortEnterCritical(mux)
+#define portEXIT_CRITICAL(mux) vPortExitCritical(mux)
+#define portENTER_CRITICAL_ISR(mux) vPortEnterCritical(mux)
+#define portEXIT_CRITICAL_ISR(mux) vPortExitCritical(mux)
+#define portYIELD_FROM_ISR(woken) ((void)(woken))
+
+#include "freertos/queue.h"
+#include "freertos/task.h"
+
+#endif
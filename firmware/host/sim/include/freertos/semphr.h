@@ -0,0 +1,22 @@
+#ifndef SIM_FREERTOS_SEMPHR_H
+#define SIM_FREERTOS_SEMPHR_H
+
+#include "freertos/FreeRTOS.h"
+
+//! Semaphores are queues of zero sized items, as in FreeRTOS itself
+typedef QueueHandle_t SemaphoreHandle_t;
+
+SemaphoreHandle_t xSemaphoreCreateCounting(UBaseType_t max_count,
+                                           UBaseType_t initial_count);
+
+#define xSemaphoreCreateBinary() xSemaphoreCreateCounting(1, 0)
+#define xSemaphoreCreateMutex() xSemaphoreCreateCounting(1, 1)
+
+#define xSemaphoreTake(semaphore, ticks)                                       \
+    xQueueReceive((semaphore), NULL, (ticks))
+#define xSemaphoreGive(semaphore) xQueueSend((semaphore), NULL, 0)
+#define xSemaphoreGiveFromISR(semaphore, woken)                                \
+    xQueueSendFromISR((semaphore), NULL, (woken))
+#define vSemaphoreDelete(semaphore) vQueueDelete(semaphore)
+
+#endif
@@ -0,0 +1,11 @@
+#ifndef SIM_HAL_SPI_TYPES_H
+#define SIM_HAL_SPI_TYPES_H
+
+typedef enum {
+    SPI1_HOST = 0,
+    SPI2_HOST = 1,
+    SPI3_HOST = 2,
+    SPI_HOST_MAX,
+} spi_host_device_t;
+
+#endif
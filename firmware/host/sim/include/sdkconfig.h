@@ -0,0 +1,18 @@
+#ifndef SIM_SDKCONFIG_H
+#define SIM_SDKCONFIG_H
+
+/**
+ * Configuration the firmware is compiled with in the simulator. Cycle counts
+ * are nanoseconds on the host, so the "CPU" runs at 1 GHz to keep stage
+ * budgets derived from the clock in the same unit as the measurements.
+ */
+
+#define CONFIG_IDF_TARGET "linux"
+#define CONFIG_ESP_DEFAULT_CPU_FREQ_MHZ 1000
+#define CONFIG_FREERTOS_HZ 100
+#define CONFIG_AUDIO_INSTRUMENTATION 1
+#define CONFIG_SPEAKER_CODEC 1
+#define CONFIG_SPEAKER_CODEC_CSB_PIN 23
+#define CONFIG_IDLE_TIMEOUT_S 60
+
+#endif
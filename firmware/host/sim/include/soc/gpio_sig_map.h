@@ -0,0 +1,14 @@
+#ifndef SIM_SOC_GPIO_SIG_MAP_H
+#define SIM_SOC_GPIO_SIG_MAP_H
+
+// The subset of the ESP32's GPIO matrix signals the firmware routes by hand
+
+#define I2S0O_BCK_OUT_IDX 15
+#define I2S0O_WS_OUT_IDX 16
+#define I2S1O_BCK_OUT_IDX 27
+#define I2S1O_WS_OUT_IDX 28
+
+//! Output driven by the pin's GPIO level rather than a peripheral
+#define SIG_GPIO_OUT_IDX 256
+
+#endif
@@ -0,0 +1,513 @@
+/**
+ * This file contains the simulator's scheduler and the FreeRTOS API built on
+ * it. Tasks are threads, but only one notion of time exists: the simulated
+ * clock, which the clock thread moves forward whenever every registered thread
+ * is blocked. Blocking calls all go through sim_wait_locked, so a thread counts
+ * as runnable from the moment it is woken until it waits again.
+ */
+
+#include "esp_log.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/semphr.h"
+#include "sim.h"
+#include <errno.h>
+#include <stdatomic.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#define TAG "SIM"
+
+#define US_PER_TICK (1000000 / configTICK_RATE_HZ)
+
+struct tskTaskControlBlock {
+    TaskFunction_t function;
+    void *parameters;
+    char name[16];
+    uint32_t notification;
+};
+
+struct QueueDefinition {
+    uint8_t *items;
+    size_t item_size;
+    UBaseType_t length;
+    UBaseType_t count;
+    UBaseType_t head;
+};
+
+typedef struct waiter {
+    uint64_t deadline_us;
+    bool woken;
+    struct waiter *next;
+} waiter;
+
+typedef struct event {
+    uint64_t at_us;
+    sim_event_fn fn;
+    void *arg;
+    struct event *next;
+} event;
+
+static pthread_mutex_t kernel_lock = PTHREAD_MUTEX_INITIALIZER;
+//! Blocked threads wait on this, each checks its own waiter once woken
+static pthread_cond_t task_wake = PTHREAD_COND_INITIALIZER;
+//! Signalled whenever the number of runnable threads may have dropped to zero
+static pthread_cond_t clock_wake = PTHREAD_COND_INITIALIZER;
+
+static _Atomic uint64_t now_us;
+static bool realtime;
+static struct timespec wall_start;
+
+static waiter *waiters;
+static unsigned runnable;
+
+static event *events;
+
+static _Thread_local TaskHandle_t current_task;
+
+void sim_lock(void) { pthread_mutex_lock(&kernel_lock); }
+
+void sim_unlock(void) { pthread_mutex_unlock(&kernel_lock); }
+
+uint64_t sim_now_us(void) { return atomic_load(&now_us); }
+
+uint64_t sim_deadline(TickType_t ticks) {
+    if (ticks == portMAX_DELAY) {
+        return SIM_FOREVER;
+    }
+
+    return sim_now_us() + (uint64_t)ticks * US_PER_TICK;
+}
+
+bool sim_wait_locked(uint64_t deadline_us) {
+    if (sim_now_us() >= deadline_us) {
+        return false;
+    }
+
+    waiter self = {.deadline_us = deadline_us, .woken = false, .next = waiters};
+    waiters = &self;
+
+    if (--runnable == 0) {
+        pthread_cond_signal(&clock_wake);
+    }
+
+    // Whoever wakes us unlinks the waiter and counts us as runnable again
+    while (!self.woken) {
+        pthread_cond_wait(&task_wake, &kernel_lock);
+    }
+
+    return true;
+}
+
+void sim_wake_all_locked(void) {
+    if (waiters == NULL) {
+        return;
+    }
+
+    for (waiter *w = waiters; w != NULL; w = w->next) {
+        w->woken = true;
+        runnable++;
+    }
+
+    waiters = NULL;
+    pthread_cond_broadcast(&task_wake);
+}
+
+/**
+ * Wakes the waiters whose deadline has been reached, the rest stay blocked
+ */
+static void wake_expired_locked(void) {
+    waiter **link = &waiters;
+    bool any = false;
+
+    while (*link != NULL) {
+        waiter *w = *link;
+
+        if (w->deadline_us <= sim_now_us()) {
+            *link = w->next;
+            w->woken = true;
+            runnable++;
+            any = true;
+        } else {
+            link = &w->next;
+        }
+    }
+
+    if (any) {
+        pthread_cond_broadcast(&task_wake);
+    }
+}
+
+void sim_sleep_until(uint64_t deadline_us) {
+    sim_lock();
+    while (sim_wait_locked(deadline_us)) {
+    }
+    sim_unlock();
+}
+
+void sim_register_thread(const char *name) {
+    sim_lock();
+    runnable++;
+    sim_unlock();
+}
+
+static void unregister_thread(void) {
+    sim_lock();
+    if (--runnable == 0) {
+        pthread_cond_signal(&clock_wake);
+    }
+    sim_unlock();
+}
+
+static void sleep_until_wall(uint64_t target_us) {
+    struct timespec deadline = wall_start;
+    deadline.tv_sec += target_us / 1000000;
+    deadline.tv_nsec += (target_us % 1000000) * 1000;
+    if (deadline.tv_nsec >= 1000000000) {
+        deadline.tv_sec++;
+        deadline.tv_nsec -= 1000000000;
+    }
+
+    while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &deadline, NULL) ==
+           EINTR) {
+    }
+}
+
+static void *clock_thread(void *arg) {
+    sim_lock();
+
+    while (true) {
+        uint64_t next = SIM_FOREVER;
+        for (waiter *w = waiters; w != NULL; w = w->next) {
+            if (w->deadline_us < next) {
+                next = w->deadline_us;
+            }
+        }
+
+        // Time only moves while nothing can run. With nothing to wait for
+        // either, every task is blocked for good and the simulation stalls.
+        if (runnable > 0 || next == SIM_FOREVER) {
+            pthread_cond_wait(&clock_wake, &kernel_lock);
+            continue;
+        }
+
+        if (realtime) {
+            sim_unlock();
+            sleep_until_wall(next);
+            sim_lock();
+
+            if (runnable > 0) {
+                continue;
+            }
+        }
+
+        if (next > sim_now_us()) {
+            atomic_store(&now_us, next);
+        }
+
+        wake_expired_locked();
+    }
+
+    return NULL;
+}
+
+/**
+ * Stands in for the Bluedroid task, running scheduled events in order of their
+ * due time
+ */
+static void event_task(void *parameters) {
+    sim_lock();
+
+    while (true) {
+        event *head = events;
+
+        if (head != NULL && head->at_us <= sim_now_us()) {
+            events = head->next;
+            sim_unlock();
+
+            head->fn(head->arg);
+            free(head);
+
+            sim_lock();
+            continue;
+        }
+
+        sim_wait_locked(head != NULL ? head->at_us : SIM_FOREVER);
+    }
+}
+
+void sim_schedule(uint64_t at_us, sim_event_fn fn, void *arg) {
+    event *e = malloc(sizeof(*e));
+    if (e == NULL) {
+        abort();
+    }
+
+    *e = (event){.at_us = at_us, .fn = fn, .arg = arg};
+
+    sim_lock();
+
+    // Events due at the same time run in the order they were scheduled
+    event **link = &events;
+    while (*link != NULL && (*link)->at_us <= at_us) {
+        link = &(*link)->next;
+    }
+
+    e->next = *link;
+    *link = e;
+
+    sim_wake_all_locked();
+    sim_unlock();
+}
+
+void sim_kernel_start(bool realtime_clock) {
+    realtime = realtime_clock;
+    clock_gettime(CLOCK_MONOTONIC, &wall_start);
+
+    pthread_t thread;
+    if (pthread_create(&thread, NULL, clock_thread, NULL) != 0) {
+        abort();
+    }
+    pthread_detach(thread);
+
+    xTaskCreatePinnedToCore(event_task, "BTC", 4096, NULL, 19, NULL, 0);
+}
+
+void vPortMuxInitialize(portMUX_TYPE *mux) {
+    pthread_mutexattr_t attr;
+    pthread_mutexattr_init(&attr);
+    pthread_mutexattr_settype(&attr, PTHREAD_MUTEX_RECURSIVE);
+    pthread_mutex_init(&mux->mutex, &attr);
+    pthread_mutexattr_destroy(&attr);
+}
+
+void vPortEnterCritical(portMUX_TYPE *mux) { pthread_mutex_lock(&mux->mutex); }
+
+void vPortExitCritical(portMUX_TYPE *mux) { pthread_mutex_unlock(&mux->mutex); }
+
+static void *task_entry(void *arg) {
+    TaskHandle_t task = arg;
+    current_task = task;
+
+    pthread_setname_np(pthread_self(), task->name);
+
+    task->function(task->parameters);
+
+    // FreeRTOS tasks must not return, treat it like deleting itself
+    ESP_LOGW(TAG, "Task %s returned", task->name);
+    vTaskDelete(NULL);
+
+    return NULL;
+}
+
+BaseType_t xTaskCreatePinnedToCore(TaskFunction_t function, const char *name,
+                                   uint32_t stack_depth, void *parameters,
+                                   UBaseType_t priority,
+                                   TaskHandle_t *created_task,
+                                   BaseType_t core_id) {
+    TaskHandle_t task = calloc(1, sizeof(*task));
+    if (task == NULL) {
+        return pdFAIL;
+    }
+
+    task->function = function;
+    task->parameters = parameters;
+    strncpy(task->name, name, sizeof(task->name) - 1);
+
+    // Counted before it starts so the clock cannot move in between
+    sim_register_thread(name);
+
+    pthread_t thread;
+    if (pthread_create(&thread, NULL, task_entry, task) != 0) {
+        unregister_thread();
+        free(task);
+        return pdFAIL;
+    }
+    pthread_detach(thread);
+
+    if (created_task != NULL) {
+        *created_task = task;
+    }
+
+    return pdPASS;
+}
+
+BaseType_t xTaskCreate(TaskFunction_t function, const char *name,
+                       uint32_t stack_depth, void *parameters,
+                       UBaseType_t priority, TaskHandle_t *created_task) {
+    return xTaskCreatePinnedToCore(function, name, stack_depth, parameters,
+                                   priority, created_task, tskNO_AFFINITY);
+}
+
+void vTaskDelete(TaskHandle_t task) {
+    if (task != NULL && task != current_task) {
+        // Nothing in the firmware deletes other tasks
+        ESP_LOGE(TAG, "Deleting another task is not simulated");
+        abort();
+    }
+
+    // The handle stays allocated, others may still hold it
+    unregister_thread();
+    pthread_exit(NULL);
+}
+
+void vTaskDelay(TickType_t ticks) {
+    if (ticks == 0) {
+        sched_yield();
+        return;
+    }
+
+    sim_sleep_until(sim_deadline(ticks));
+}
+
+TickType_t xTaskGetTickCount(void) { return sim_now_us() / US_PER_TICK; }
+
+TaskHandle_t xTaskGetCurrentTaskHandle(void) { return current_task; }
+
+uint32_t ulTaskNotifyTake(BaseType_t clear_on_exit, TickType_t ticks_to_wait) {
+    TaskHandle_t task = current_task;
+    uint64_t deadline = sim_deadline(ticks_to_wait);
+
+    sim_lock();
+
+    while (task->notification == 0 && sim_wait_locked(deadline)) {
+    }
+
+    uint32_t value = task->notification;
+    if (value > 0) {
+        task->notification = clear_on_exit ? 0 : value - 1;
+    }
+
+    sim_unlock();
+
+    return value;
+}
+
+BaseType_t xTaskNotifyGive(TaskHandle_t task) {
+    sim_lock();
+    task->notification++;
+    sim_wake_all_locked();
+    sim_unlock();
+
+    return pdPASS;
+}
+
+void vTaskNotifyGiveFromISR(TaskHandle_t task, BaseType_t *woken) {
+    xTaskNotifyGive(task);
+
+    if (woken != NULL) {
+        *woken = pdFALSE;
+    }
+}
+
+QueueHandle_t xQueueCreate(UBaseType_t length, UBaseType_t item_size) {
+    QueueHandle_t queue = calloc(1, sizeof(*queue));
+    if (queue == NULL) {
+        return NULL;
+    }
+
+    queue->item_size = item_size;
+    queue->length = length;
+
+    if (item_size > 0) {
+        queue->items = malloc((size_t)length * item_size);
+        if (queue->items == NULL) {
+            free(queue);
+            return NULL;
+        }
+    }
+
+    return queue;
+}
+
+SemaphoreHandle_t xSemaphoreCreateCounting(UBaseType_t max_count,
+                                           UBaseType_t initial_count) {
+    QueueHandle_t queue = xQueueCreate(max_count, 0);
+    if (queue != NULL) {
+        queue->count = initial_count;
+    }
+
+    return queue;
+}
+
+void vQueueDelete(QueueHandle_t queue) {
+    free(queue->items);
+    free(queue);
+}
+
+BaseType_t xQueueSend(QueueHandle_t queue, const void *item,
+                      TickType_t ticks_to_wait) {
+    uint64_t deadline = sim_deadline(ticks_to_wait);
+
+    sim_lock();
+
+    while (queue->count == queue->length) {
+        if (!sim_wait_locked(deadline)) {
+            sim_unlock();
+            return pdFAIL;
+        }
+    }
+
+    if (queue->item_size > 0) {
+        UBaseType_t tail = (queue->head + queue->count) % queue->length;
+        memcpy(&queue->items[tail * queue->item_size], item, queue->item_size);
+    }
+
+    queue->count++;
+    sim_wake_all_locked();
+    sim_unlock();
+
+    return pdPASS;
+}
+
+BaseType_t xQueueSendFromISR(QueueHandle_t queue, const void *item,
+                             BaseType_t *woken) {
+    if (woken != NULL) {
+        *woken = pdFALSE;
+    }
+
+    return xQueueSend(queue, item, 0);
+}
+
+BaseType_t xQueueReceive(QueueHandle_t queue, void *item,
+                         TickType_t ticks_to_wait) {
+    uint64_t deadline = sim_deadline(ticks_to_wait);
+
+    sim_lock();
+
+    while (queue->count == 0) {
+        if (!sim_wait_locked(deadline)) {
+            sim_unlock();
+            return pdFAIL;
+        }
+    }
+
+    if (queue->item_size > 0) {
+        memcpy(item, &queue->items[queue->head * queue->item_size],
+               queue->item_size);
+        queue->head = (queue->head + 1) % queue->length;
+    }
+
+    queue->count--;
+    sim_wake_all_locked();
+    sim_unlock();
+
+    return pdPASS;
+}
+
+BaseType_t xQueueReset(QueueHandle_t queue) {
+    sim_lock();
+    queue->count = 0;
+    queue->head = 0;
+    sim_wake_all_locked();
+    sim_unlock();
+
+    return pdPASS;
+}
+
+UBaseType_t uxQueueMessagesWaiting(QueueHandle_t queue) {
+    sim_lock();
+    UBaseType_t count = queue->count;
+    sim_unlock();
+
+    return count;
+}
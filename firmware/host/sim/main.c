@@ -0,0 +1,520 @@
+/**
+ * Runs the complete firmware on the host. app_main boots exactly as on the
+ * device, against simulated drivers: music reaches the A2DP sink from a WAV
+ * file, the mic reads another and everything the DAC would play is recorded,
+ * together with every codec register write.
+ */
+
+#include "audio/audio_output.h"
+#include "audio/sound_effects.h"
+#include "freertos/FreeRTOS.h"
+#include "i2c/i2c_bus.h"
+#include "input/input.h"
+#include "power/battery.h"
+#include "power/governor.h"
+#include "power/idle.h"
+#include "sdkconfig.h"
+#include "sim.h"
+#include "wav.h"
+#include <fcntl.h>
+#include <getopt.h>
+#include <inttypes.h>
+#include <stdlib.h>
+#include <termios.h>
+#include <unistd.h>
+
+//! Rate the firmware drives the DAC at, the output file is recorded with it
+#define OUTPUT_SAMPLE_RATE 48000
+
+//! Chip select of the codec on each port, EXT_INT_CSB_PIN in main/main.c for
+//! the headset
+#define HEADSET_CODEC_CSB_PIN 4
+#define SPEAKER_CODEC_CSB_PIN CONFIG_SPEAKER_CODEC_CSB_PIN
+
+//! Boot has long finished by then
+#define DEFAULT_CONNECT_US 500000
+
+//! Played past the end of the music, so the disconnect is captured as well
+#define DEFAULT_TAIL_US 1000000
+
+#define DEFAULT_DURATION_US 10000000
+
+#define DEFAULT_PRESS_MS 200
+
+//! A cell about half discharged
+#define DEFAULT_BATTERY_MV 3800
+
+#define MAX_PRESSES 16
+
+//! Acoustic path of --feedback unless given, a short hop across a helmet
+//! with its cavity ringing in the middle of the voice band
+#define DEFAULT_FEEDBACK_DELAY_MS 1.0f
+#define DEFAULT_FEEDBACK_RESONANCE_HZ 2500.0f
+
+//! Every press and release chatters like this before it settles, offsets in
+//! microseconds from the first edge
+static const uint32_t BOUNCE_US[] = {0, 400, 1100, 1600, 2500};
+#define BOUNCE_EDGES (sizeof(BOUNCE_US) / sizeof(BOUNCE_US[0]))
+
+void app_main(void);
+
+typedef struct {
+    //! GPIO, or an expander pin if `expander` is set
+    int pin;
+    bool expander;
+    uint64_t at_us;
+    uint64_t length_us;
+} button_press;
+
+typedef struct {
+    const button_press *press;
+    int level;
+} button_edge;
+
+static void usage(const char *name) {
+    fprintf(stderr,
+            "Usage: %s [options]\n"
+            "  --music FILE      WAV streamed to the A2DP sink\n"
+            "  --mic FILE        WAV captured by the mic input\n"
+            "  --out FILE        WAV the DAC output is recorded to\n"
+            "  --speaker FILE    WAV the speaker codec's DAC output is\n"
+            "                    recorded to\n"
+            "  --registers FILE  CSV log of every codec register write\n"
+            "  --soundbank FILE  image flashed to the soundbank partition\n"
+            "  --spp-in FILE     bytes sent to the SPP server once connected\n"
+            "  --spp-out FILE    bytes the firmware sends over SPP\n"
+            "  --spp-pty         serve SPP on a pseudo terminal, in real time\n"
+            "  --duration SEC    simulated time to run for\n"
+            "  --connect SEC     when the phone connects\n"
+            "  --jitter MS       random delay added to each A2DP packet\n"
+            "  --seed N          seed for the jitter\n"
+            "  --battery MV      cell voltage the power board measures\n"
+            "  --battery-mah N   discharge a full cell of N mAh instead\n"
+            "  --press PIN:SEC[:MS]  hold an active low button, PIN is a\n"
+            "                    GPIO or P0 to P7 on the button board\n"
+            "  --feedback DB[:MS[:HZ]]  let the mic hear the outputs, DB\n"
+            "                    above unity at a HZ resonance, MS later\n"
+            "  --realtime        run no faster than the wall clock\n"
+            "  --verbose         include debug logs\n",
+            name);
+}
+
+static uint64_t seconds_to_us(const char *text) {
+    return (uint64_t)(strtod(text, NULL) * 1000000);
+}
+
+static bool parse_press(const char *text, button_press *press) {
+    char *end;
+
+    press->expander = text[0] == 'P';
+    press->pin = strtol(press->expander ? text + 1 : text, &end, 10);
+
+    int pins = press->expander ? EXPANDER_BUTTONS : GPIO_NUM_MAX;
+    if (*end != ':' || press->pin < 0 || press->pin >= pins) {
+        return false;
+    }
+
+    press->at_us = (uint64_t)(strtod(end + 1, &end) * 1000000);
+    press->length_us = DEFAULT_PRESS_MS * 1000;
+
+    if (*end == ':') {
+        press->length_us = strtoull(end + 1, &end, 10) * 1000;
+    }
+
+    return *end == '\0';
+}
+
+static void drive_button(void *arg) {
+    button_edge *edge = arg;
+
+    if (edge->press->expander) {
+        sim_pcf8574_drive(edge->press->pin, edge->level);
+    } else {
+        sim_gpio_drive(edge->press->pin, edge->level);
+    }
+
+    free(edge);
+}
+
+//! Schedules the contacts chattering into `level`
+static void schedule_bouncing(const button_press *press, uint64_t at_us,
+                              int level) {
+    for (size_t i = 0; i < BOUNCE_EDGES; i++) {
+        button_edge *edge = malloc(sizeof(*edge));
+        if (edge == NULL) {
+            abort();
+        }
+
+        *edge = (button_edge){
+            .press = press,
+            .level = (i % 2) ? !level : level,
+        };
+        sim_schedule(at_us + BOUNCE_US[i], drive_button, edge);
+    }
+}
+
+static FILE *open_file(const char *path, const char *mode) {
+    FILE *file = fopen(path, mode);
+    if (file == NULL) {
+        fprintf(stderr, "%s: cannot open\n", path);
+        exit(EXIT_FAILURE);
+    }
+
+    return file;
+}
+
+/**
+ * Creates a pseudo terminal that stands in for the phone's SPP port, so host
+ * tools can talk to the firmware as they would over /dev/rfcomm
+ */
+static bool open_spp_pty(sim_bt_scenario *scenario) {
+    int master = posix_openpt(O_RDWR | O_NOCTTY);
+    if (master < 0 || grantpt(master) != 0 || unlockpt(master) != 0) {
+        perror("posix_openpt");
+        return false;
+    }
+
+    const char *name = ptsname(master);
+
+    // Held open so the master never sees a hangup between clients, and used
+    // to put the line discipline in raw mode before anyone connects
+    int slave = open(name, O_RDWR | O_NOCTTY);
+    struct termios settings;
+    if (slave < 0 || tcgetattr(slave, &settings) != 0) {
+        perror(name);
+        return false;
+    }
+    cfmakeraw(&settings);
+    tcsetattr(slave, TCSANOW, &settings);
+
+    scenario->spp_input = fdopen(master, "rb");
+    scenario->spp_output = fdopen(dup(master), "wb");
+    scenario->spp_interactive = true;
+
+    fprintf(stderr, "SPP on %s\n", name);
+
+    return true;
+}
+
+static bool parse_feedback(const char *text) {
+    char *end;
+    float gain_db = strtof(text, &end);
+    float delay_ms = DEFAULT_FEEDBACK_DELAY_MS;
+    float resonance_hz = DEFAULT_FEEDBACK_RESONANCE_HZ;
+
+    if (end != text && *end == ':') {
+        delay_ms = strtof(end + 1, &end);
+    }
+    if (*end == ':') {
+        resonance_hz = strtof(end + 1, &end);
+    }
+
+    if (end == text || *end != '\0' || delay_ms < 0 || resonance_hz <= 0 ||
+        resonance_hz >= OUTPUT_SAMPLE_RATE / 2) {
+        return false;
+    }
+
+    sim_i2s_set_feedback(gain_db, delay_ms, resonance_hz, OUTPUT_SAMPLE_RATE);
+
+    return true;
+}
+
+static void app_main_task(void *parameters) {
+    app_main();
+
+    // Like the ESP-IDF main task, which deletes itself once app_main returns
+    vTaskDelete(NULL);
+}
+
+int main(int argc, char **argv) {
+    static const struct option options[] = {
+        {"music", required_argument, NULL, 'm'},
+        {"mic", required_argument, NULL, 'i'},
+        {"out", required_argument, NULL, 'o'},
+        {"speaker", required_argument, NULL, 'O'},
+        {"registers", required_argument, NULL, 'r'},
+        {"soundbank", required_argument, NULL, 'b'},
+        {"spp-in", required_argument, NULL, 's'},
+        {"spp-out", required_argument, NULL, 'S'},
+        {"spp-pty", no_argument, NULL, 'P'},
+        {"duration", required_argument, NULL, 'd'},
+        {"connect", required_argument, NULL, 'c'},
+        {"jitter", required_argument, NULL, 'j'},
+        {"seed", required_argument, NULL, 'x'},
+        {"press", required_argument, NULL, 'p'},
+        {"feedback", required_argument, NULL, 'f'},
+        {"battery", required_argument, NULL, 'B'},
+        {"battery-mah", required_argument, NULL, 'C'},
+        {"realtime", no_argument, NULL, 'R'},
+        {"verbose", no_argument, NULL, 'v'},
+        {"help", no_argument, NULL, 'h'},
+        {NULL, 0, NULL, 0},
+    };
+
+    const char *music_path = NULL;
+    const char *mic_path = NULL;
+    const char *out_path = "sim_out.wav";
+    const char *speaker_path = NULL;
+    const char *registers_path = NULL;
+    const char *spp_in_path = NULL;
+    const char *spp_out_path = NULL;
+    uint64_t duration_us = 0;
+    bool realtime = false;
+    bool spp_pty = false;
+    uint32_t battery_mv = DEFAULT_BATTERY_MV;
+    uint32_t battery_mah = 0;
+
+    sim_bt_scenario scenario = {.connect_us = DEFAULT_CONNECT_US, .seed = 1};
+
+    button_press presses[MAX_PRESSES];
+    size_t press_count = 0;
+
+    int option;
+    while ((option = getopt_long(argc, argv, "h", options, NULL)) != -1) {
+        switch (option) {
+            case 'm':
+                music_path = optarg;
+                break;
+            case 'i':
+                mic_path = optarg;
+                break;
+            case 'o':
+                out_path = optarg;
+                break;
+            case 'O':
+                speaker_path = optarg;
+                break;
+            case 'r':
+                registers_path = optarg;
+                break;
+            case 'b':
+                if (!sim_partition_load("soundbank", optarg)) {
+                    return EXIT_FAILURE;
+                }
+                break;
+            case 's':
+                spp_in_path = optarg;
+                break;
+            case 'S':
+                spp_out_path = optarg;
+                break;
+            case 'P':
+                spp_pty = true;
+                break;
+            case 'd':
+                duration_us = seconds_to_us(optarg);
+                break;
+            case 'c':
+                scenario.connect_us = seconds_to_us(optarg);
+                break;
+            case 'j':
+                scenario.jitter_us = strtoul(optarg, NULL, 10) * 1000;
+                break;
+            case 'x':
+                scenario.seed = strtoul(optarg, NULL, 10);
+                break;
+            case 'p':
+                if (press_count == MAX_PRESSES ||
+                    !parse_press(optarg, &presses[press_count])) {
+                    fprintf(stderr, "Invalid press: %s\n", optarg);
+                    return EXIT_FAILURE;
+                }
+                press_count++;
+                break;
+            case 'f':
+                if (!parse_feedback(optarg)) {
+                    fprintf(stderr, "Invalid feedback: %s\n", optarg);
+                    return EXIT_FAILURE;
+                }
+                break;
+            case 'B':
+                battery_mv = strtoul(optarg, NULL, 10);
+                break;
+            case 'C':
+                battery_mah = strtoul(optarg, NULL, 10);
+                break;
+            case 'R':
+                realtime = true;
+                break;
+            case 'v':
+                sim_log_set_level(ESP_LOG_DEBUG);
+                break;
+            default:
+                usage(argv[0]);
+                return option == 'h' ? EXIT_SUCCESS : EXIT_FAILURE;
+        }
+    }
+
+    static wav_reader music;
+    static wav_reader mic;
+    static wav_writer out;
+    static wav_writer speaker;
+
+    if (music_path != NULL) {
+        if (!wav_open_read(&music, music_path)) {
+            return EXIT_FAILURE;
+        }
+        scenario.music = &music;
+    }
+
+    if (mic_path != NULL && !wav_open_read(&mic, mic_path)) {
+        return EXIT_FAILURE;
+    }
+
+    if (!wav_open_write(&out, out_path, OUTPUT_SAMPLE_RATE, 2)) {
+        return EXIT_FAILURE;
+    }
+
+    if (speaker_path != NULL &&
+        !wav_open_write(&speaker, speaker_path, OUTPUT_SAMPLE_RATE, 2)) {
+        return EXIT_FAILURE;
+    }
+
+    FILE *registers = NULL;
+    if (registers_path != NULL) {
+        registers = open_file(registers_path, "w");
+    }
+
+    if (spp_in_path != NULL) {
+        scenario.spp_input = open_file(spp_in_path, "rb");
+    }
+
+    if (spp_out_path != NULL) {
+        scenario.spp_output = open_file(spp_out_path, "wb");
+    }
+
+    if (spp_pty) {
+        if (!open_spp_pty(&scenario)) {
+            return EXIT_FAILURE;
+        }
+
+        // The peer on the other end runs on the wall clock
+        realtime = true;
+    }
+
+    if (duration_us == 0) {
+        duration_us = DEFAULT_DURATION_US;
+
+        if (music_path != NULL) {
+            duration_us = scenario.connect_us +
+                          (uint64_t)music.frames * 1000000 / music.sample_rate +
+                          DEFAULT_TAIL_US;
+        }
+    }
+
+    sim_i2s_attach(I2S_NUM_0, mic_path != NULL ? &mic : NULL, &out);
+    sim_i2s_attach(I2S_NUM_1, NULL, speaker_path != NULL ? &speaker : NULL);
+    sim_i2s_set_codec(I2S_NUM_0, HEADSET_CODEC_CSB_PIN);
+    sim_i2s_set_codec(I2S_NUM_1, SPEAKER_CODEC_CSB_PIN);
+    sim_pcf8574_attach(EXPANDER_ADDRESS, EXPANDER_INT_GPIO);
+    sim_adc081c021_attach(BATTERY_ADC_ADDRESS, BATTERY_ADC_REFERENCE_MV);
+    sim_adc081c021_set_input(battery_mv / BATTERY_DIVIDER_RATIO);
+    sim_spi_set_register_log(registers);
+
+    // This thread only wakes up again at the end, the clock has to wait for
+    // it like for any task
+    sim_register_thread("sim");
+    sim_kernel_start(realtime);
+
+    sim_power_start(battery_mah);
+
+    xTaskCreate(app_main_task, "main", 3584, NULL, 1, NULL);
+
+    sim_bt_run(&scenario);
+
+    for (size_t i = 0; i < press_count; i++) {
+        schedule_bouncing(&presses[i], presses[i].at_us, 0);
+        schedule_bouncing(&presses[i], presses[i].at_us + presses[i].length_us,
+                          1);
+    }
+
+    sim_sleep_until(duration_us);
+
+    // Time stands still while this thread runs, so the files end exactly at
+    // the requested duration
+    sim_i2s_detach();
+    sim_spi_set_register_log(NULL);
+    wav_close_write(&out);
+    if (speaker_path != NULL) {
+        wav_close_write(&speaker);
+    }
+
+    if (registers != NULL) {
+        fclose(registers);
+    }
+
+    if (scenario.spp_output != NULL) {
+        fflush(scenario.spp_output);
+    }
+
+    audio_output_stats stats;
+    audio_output_get_stats(&stats);
+
+    audio_latency_report report;
+    audio_output_get_latency_report(&report);
+
+    input_stats input;
+    input_get_stats(&input);
+
+    i2c_bus_stats i2c;
+    i2c_bus_get_stats(&i2c);
+
+    power_idle_stats idle;
+    power_idle_get_stats(&idle);
+
+    sound_effects_stats effects;
+    sound_effects_get_stats(&effects);
+
+    printf("Simulated %.3f s, recorded %" PRIu32 " frames to %s\n",
+           duration_us / 1e6, out.frames, out_path);
+    if (speaker_path != NULL) {
+        printf("Recorded %" PRIu32 " speaker frames to %s\n", speaker.frames,
+               speaker_path);
+    }
+    printf("Underruns %" PRIu32 ", overruns %" PRIu32 ", dropped %" PRIu32
+           " bytes\n",
+           stats.underruns, stats.overruns, stats.dropped_bytes);
+    printf("Latency profile %s, stream latency %" PRIu32
+           " us, voice latency %" PRIu32 " us\n",
+           report.name, report.stream_latency_us, report.voice_latency_us);
+    printf("Clips triggered %" PRIu32 ", max trigger to mix latency %" PRIu32
+           " us, max trigger to DAC latency %" PRIu32 " us\n",
+           effects.triggered, effects.max_start_latency_us,
+           effects.max_dac_latency_us);
+    printf("Codec register writes %" PRIu32 "\n", sim_spi_write_count());
+    printf("Input events %" PRIu32 ", bounces %" PRIu32
+           ", max edge to action latency %" PRIu32 " us\n",
+           input.events, input.bounces, input.max_latency_us);
+    printf("I2C transactions %" PRIu32 " in %" PRIu32 " bursts, %" PRIu32
+           " errors, battery %u mV\n",
+           i2c.transactions, i2c.bursts, i2c.errors, battery_get_millivolts());
+    printf("Power mode %s, battery %u%%, drawing %.1f mA\n",
+           power_mode_name(power_governor_get_mode()), battery_get_charge(),
+           sim_power_current_ma());
+
+    sim_power_report power;
+    sim_power_get_report(&power);
+
+    printf("Idle %" PRIu32 " times, %.1f s awake averaging %.1f mA, %.1f s "
+           "light sleep averaging %.1f mA, resume %" PRIu32 " us max\n",
+           idle.suspends, power.awake_us / 1e6,
+           power.awake_us ? power.awake_mah * 3600e6 / power.awake_us : 0,
+           power.sleep_us / 1e6,
+           power.sleep_us ? power.sleep_mah * 3600e6 / power.sleep_us : 0,
+           idle.max_resume_us);
+
+    if (battery_mah != 0) {
+        printf("Used %.2f of %" PRIu32 " mAh, ", power.used_mah, battery_mah);
+        if (power.empty_us != 0) {
+            printf("empty after %.1f s\n", power.empty_us / 1e6);
+        } else {
+            printf("average %.1f mA\n",
+                   power.used_mah * 3600e6 / duration_us);
+        }
+    }
+
+    fflush(stdout);
+
+    // The firmware's tasks never return, leave without waiting for them
+    _exit(EXIT_SUCCESS);
+}
@@ -0,0 +1,171 @@
+/**
+ * This file contains the simulated flash partitions. Only the data partitions
+ * the firmware looks up are present, laid out as in partitions.csv and backed
+ * by memory that starts out erased. Mapping a partition hands out a pointer
+ * straight into that memory, like the MMU would.
+ *
+ * Writes behave like NOR flash, they can only clear bits, and erases and
+ * writes take as long as on a typical SPI flash chip. Only the calling task
+ * waits for them, the cache stall the real chip causes is not modelled.
+ */
+
+#include "esp_partition.h"
+#include "sim.h"
+#include <stdlib.h>
+#include <string.h>
+
+#define FLASH_SECTOR_SIZE 4096
+#define FLASH_PAGE_SIZE 256
+
+//! Typical timings of a 32 Mbit SPI NOR flash
+#define SECTOR_ERASE_US 45000
+#define PAGE_PROGRAM_US 700
+
+typedef struct {
+    esp_partition_t partition;
+    uint8_t *contents;
+} sim_partition;
+
+static sim_partition partitions[] = {
+    {.partition = {.type = ESP_PARTITION_TYPE_DATA,
+                   .subtype = 0x40,
+                   .address = 0x210000,
+                   .size = 0x1F0000,
+                   .erase_size = FLASH_SECTOR_SIZE,
+                   .label = "soundbank"}},
+};
+
+#define PARTITION_COUNT (sizeof(partitions) / sizeof(partitions[0]))
+
+static sim_partition *find(const char *label) {
+    for (size_t i = 0; i < PARTITION_COUNT; i++) {
+        if (strcmp(partitions[i].partition.label, label) == 0) {
+            return &partitions[i];
+        }
+    }
+
+    return NULL;
+}
+
+static uint8_t *contents(sim_partition *entry) {
+    if (entry->contents == NULL) {
+        entry->contents = malloc(entry->partition.size);
+        memset(entry->contents, 0xFF, entry->partition.size);
+    }
+
+    return entry->contents;
+}
+
+bool sim_partition_load(const char *label, const char *path) {
+    sim_partition *entry = find(label);
+    if (entry == NULL) {
+        return false;
+    }
+
+    FILE *file = fopen(path, "rb");
+    if (file == NULL) {
+        fprintf(stderr, "%s: cannot open\n", path);
+        return false;
+    }
+
+    uint8_t *flash = contents(entry);
+    size_t size = fread(flash, 1, entry->partition.size, file);
+
+    bool fits = fgetc(file) == EOF;
+    fclose(file);
+
+    if (!fits) {
+        fprintf(stderr, "%s: larger than the %s partition\n", path, label);
+        return false;
+    }
+
+    memset(flash + size, 0xFF, entry->partition.size - size);
+
+    return true;
+}
+
+const esp_partition_t *esp_partition_find_first(esp_partition_type_t type,
+                                                esp_partition_subtype_t subtype,
+                                                const char *label) {
+    for (size_t i = 0; i < PARTITION_COUNT; i++) {
+        const esp_partition_t *partition = &partitions[i].partition;
+
+        if ((type == ESP_PARTITION_TYPE_ANY || partition->type == type) &&
+            (subtype == ESP_PARTITION_SUBTYPE_ANY ||
+             partition->subtype == subtype) &&
+            (label == NULL || strcmp(partition->label, label) == 0)) {
+            return partition;
+        }
+    }
+
+    return NULL;
+}
+
+static sim_partition *entry_of(const esp_partition_t *partition) {
+    return (sim_partition *)((const uint8_t *)partition -
+                             offsetof(sim_partition, partition));
+}
+
+esp_err_t esp_partition_read(const esp_partition_t *partition,
+                             size_t src_offset, void *dst, size_t size) {
+    if (src_offset > partition->size || size > partition->size - src_offset) {
+        return ESP_ERR_INVALID_SIZE;
+    }
+
+    memcpy(dst, contents(entry_of(partition)) + src_offset, size);
+
+    return ESP_OK;
+}
+
+esp_err_t esp_partition_write(const esp_partition_t *partition,
+                              size_t dst_offset, const void *src, size_t size) {
+    if (dst_offset > partition->size || size > partition->size - dst_offset) {
+        return ESP_ERR_INVALID_SIZE;
+    }
+
+    uint8_t *flash = contents(entry_of(partition)) + dst_offset;
+    const uint8_t *data = src;
+
+    for (size_t i = 0; i < size; i++) {
+        flash[i] &= data[i];
+    }
+
+    size_t pages = (dst_offset % FLASH_PAGE_SIZE + size + FLASH_PAGE_SIZE - 1) /
+                   FLASH_PAGE_SIZE;
+    sim_sleep_until(sim_now_us() + pages * PAGE_PROGRAM_US);
+
+    return ESP_OK;
+}
+
+esp_err_t esp_partition_erase_range(const esp_partition_t *partition,
+                                    size_t offset, size_t size) {
+    if (offset % partition->erase_size != 0 ||
+        size % partition->erase_size != 0) {
+        return ESP_ERR_INVALID_ARG;
+    }
+
+    if (offset > partition->size || size > partition->size - offset) {
+        return ESP_ERR_INVALID_SIZE;
+    }
+
+    memset(contents(entry_of(partition)) + offset, 0xFF, size);
+    sim_sleep_until(sim_now_us() + size / FLASH_SECTOR_SIZE * SECTOR_ERASE_US);
+
+    return ESP_OK;
+}
+
+esp_err_t esp_partition_mmap(const esp_partition_t *partition, size_t offset,
+                             size_t size, esp_partition_mmap_memory_t memory,
+                             const void **out_ptr,
+                             esp_partition_mmap_handle_t *out_handle) {
+    if (offset > partition->size || size > partition->size - offset) {
+        return ESP_ERR_INVALID_ARG;
+    }
+
+    *out_ptr = contents(entry_of(partition)) + offset;
+    *out_handle = 1;
+
+    return ESP_OK;
+}
+
+void esp_partition_munmap(esp_partition_mmap_handle_t handle) {}
@@ -0,0 +1,278 @@
+/**
+ * Simulated power management and battery. The current drawn is estimated from
+ * the CPU frequency power management was set to and from the codec's power and
+ * volume registers as they are clocked out on the SPI bus. Integrating it
+ * discharges a cell whose loaded voltage is what the battery ADC measures, so
+ * the firmware sees the consequences of its own power decisions.
+ *
+ * The CPU is taken to light sleep whenever power management allows it and no
+ * I2S channel runs, the I2S driver's lock being what keeps it awake otherwise.
+ * Charge is accounted separately for the time awake and asleep.
+ *
+ * The figures are rough datasheet values for an ESP32 with Bluetooth connected
+ * and a WM8988 driving 32 ohm headphones with music at a typical level. They
+ * are meant for comparing configurations, not for predicting a real runtime.
+ */
+
+#include "codec/registers.h"
+#include "esp_pm.h"
+#include "power/battery.h"
+#include "sdkconfig.h"
+#include "sim.h"
+#include <math.h>
+#include <pthread.h>
+#include <string.h>
+
+//! The sim's nominal 1 GHz clock stands for the device's default one
+#define DEVICE_DEFAULT_CPU_MHZ 160
+
+#define CPU_BASE_MA 20.0
+#define CPU_MA_PER_MHZ 0.25
+#define BLUETOOTH_MA 30.0
+
+//! Light sleep with the main XTAL kept up for Bluetooth, and the controller
+//! in modem sleep waking for each sniff anchor
+#define LIGHT_SLEEP_MA 1.0
+#define BLUETOOTH_MODEM_SLEEP_MA 3.0
+
+#define CODEC_REFERENCE_MA 2.0
+//! VMID on its 500k standby divider
+#define CODEC_STANDBY_MA 0.1
+#define CODEC_PGA_MA 0.5
+#define CODEC_ADC_MA 3.0
+#define CODEC_DAC_MA 2.0
+#define CODEC_OUTPUT_MA 1.0
+//! Headphone load current per channel with the output at 0 dB (121)
+#define CODEC_LOAD_MA 15.0
+
+#define CELL_RESISTANCE_OHM 0.15
+#define DISCHARGE_STEP_US 100000
+
+typedef struct {
+    uint16_t millivolts;
+    double charge;
+} ocv_point;
+
+//! Open circuit voltage of the simulated cell against charge, highest first
+static const ocv_point OCV_CURVE[] = {
+    {4200, 1.00}, {4100, 0.90}, {4000, 0.78}, {3900, 0.65},
+    {3800, 0.50}, {3750, 0.40}, {3700, 0.30}, {3650, 0.20},
+    {3600, 0.12}, {3500, 0.05}, {3300, 0.00},
+};
+
+#define OCV_POINTS (sizeof(OCV_CURVE) / sizeof(OCV_CURVE[0]))
+
+static pthread_mutex_t power_lock = PTHREAD_MUTEX_INITIALIZER;
+static esp_pm_config_t pm_config = {
+    .max_freq_mhz = CONFIG_ESP_DEFAULT_CPU_FREQ_MHZ,
+    .min_freq_mhz = CONFIG_ESP_DEFAULT_CPU_FREQ_MHZ,
+};
+
+//! Codec registers by chip select pin, all powered down until written
+static uint16_t codec_registers[GPIO_NUM_MAX][CODEC_REGISTER_COUNT];
+
+//! ADCDACControl after a reset, with the DAC soft muted
+#define ADC_DAC_CONTROL_RESET 0x008
+
+static double capacity_mah;
+static double used_mah;
+static uint64_t empty_us;
+static sim_power_report report;
+
+esp_err_t esp_pm_configure(const void *config) {
+    const esp_pm_config_t *pm = config;
+
+    if (pm->min_freq_mhz > pm->max_freq_mhz) {
+        return ESP_ERR_INVALID_ARG;
+    }
+
+    pthread_mutex_lock(&power_lock);
+    pm_config = *pm;
+    pthread_mutex_unlock(&power_lock);
+
+    return ESP_OK;
+}
+
+esp_err_t esp_pm_get_configuration(void *config) {
+    pthread_mutex_lock(&power_lock);
+    *(esp_pm_config_t *)config = pm_config;
+    pthread_mutex_unlock(&power_lock);
+
+    return ESP_OK;
+}
+
+void sim_power_codec_write(int chip_select, uint8_t address, uint16_t value) {
+    if (chip_select < 0 || chip_select >= GPIO_NUM_MAX ||
+        address >= CODEC_REGISTER_COUNT) {
+        return;
+    }
+
+    pthread_mutex_lock(&power_lock);
+    if (address == Reset) {
+        // Only what the sim models is restored, everything else stays off
+        memset(codec_registers[chip_select], 0,
+               sizeof(codec_registers[chip_select]));
+        codec_registers[chip_select][ADCDACControl] = ADC_DAC_CONTROL_RESET;
+    } else {
+        codec_registers[chip_select][address] = value;
+    }
+    pthread_mutex_unlock(&power_lock);
+}
+
+uint16_t sim_power_codec_register(int chip_select, uint8_t address) {
+    if (chip_select < 0 || chip_select >= GPIO_NUM_MAX ||
+        address >= CODEC_REGISTER_COUNT) {
+        return 0;
+    }
+
+    pthread_mutex_lock(&power_lock);
+    uint16_t value = codec_registers[chip_select][address];
+    pthread_mutex_unlock(&power_lock);
+
+    return value;
+}
+
+static double output_ma(uint16_t volume_register) {
+    int volume = volume_register & 0x7F;
+
+    // Below 0x30 the output is muted
+    if (volume < 0x30) {
+        return 0;
+    }
+
+    return CODEC_LOAD_MA * pow(10, (volume - 121) / 20.0);
+}
+
+static double codec_ma_locked(const uint16_t *registers) {
+    uint16_t power1 = registers[PowerManagement1];
+    uint16_t power2 = registers[PowerManagement2];
+    double current = 0;
+
+    switch ((power1 >> 7) & 0b11) {
+        case 0b00:
+            break;
+        case 0b10:
+            current += CODEC_STANDBY_MA;
+            break;
+        default:
+            current += CODEC_REFERENCE_MA;
+            break;
+    }
+
+    current += CODEC_PGA_MA * (!!(power1 & (1 << 5)) + !!(power1 & (1 << 4)));
+    current += CODEC_ADC_MA * (!!(power1 & (1 << 3)) + !!(power1 & (1 << 2)));
+    current += CODEC_DAC_MA * (!!(power2 & (1 << 8)) + !!(power2 & (1 << 7)));
+
+    if (power2 & (1 << 6)) {
+        current += CODEC_OUTPUT_MA + output_ma(registers[LeftOutput1Volume]);
+    }
+    if (power2 & (1 << 5)) {
+        current += CODEC_OUTPUT_MA + output_ma(registers[RightOutput1Volume]);
+    }
+
+    return current;
+}
+
+bool sim_power_light_sleep(void) {
+    pthread_mutex_lock(&power_lock);
+    bool allowed = pm_config.light_sleep_enable;
+    pthread_mutex_unlock(&power_lock);
+
+    return allowed && !sim_i2s_running();
+}
+
+double sim_power_current_ma(void) {
+    bool asleep = sim_power_light_sleep();
+
+    pthread_mutex_lock(&power_lock);
+
+    int mhz = pm_config.max_freq_mhz;
+    if (mhz == CONFIG_ESP_DEFAULT_CPU_FREQ_MHZ) {
+        mhz = DEVICE_DEFAULT_CPU_MHZ;
+    }
+
+    double current =
+        asleep ? LIGHT_SLEEP_MA + BLUETOOTH_MODEM_SLEEP_MA
+               : CPU_BASE_MA + CPU_MA_PER_MHZ * mhz + BLUETOOTH_MA;
+
+    for (size_t i = 0; i < GPIO_NUM_MAX; i++) {
+        current += codec_ma_locked(codec_registers[i]);
+    }
+
+    pthread_mutex_unlock(&power_lock);
+
+    return current;
+}
+
+static double open_circuit_mv(double charge) {
+    if (charge >= OCV_CURVE[0].charge) {
+        return OCV_CURVE[0].millivolts;
+    }
+
+    for (size_t i = 1; i < OCV_POINTS; i++) {
+        const ocv_point *upper = &OCV_CURVE[i - 1];
+        const ocv_point *lower = &OCV_CURVE[i];
+
+        if (charge >= lower->charge) {
+            return lower->millivolts + (charge - lower->charge) *
+                                           (upper->millivolts -
+                                            lower->millivolts) /
+                                           (upper->charge - lower->charge);
+        }
+    }
+
+    return OCV_CURVE[OCV_POINTS - 1].millivolts;
+}
+
+static void discharge(void *arg) {
+    bool asleep = sim_power_light_sleep();
+    double current = sim_power_current_ma();
+    double step_mah = current * DISCHARGE_STEP_US / 3600e6;
+
+    if (asleep) {
+        report.sleep_us += DISCHARGE_STEP_US;
+        report.sleep_mah += step_mah;
+    } else {
+        report.awake_us += DISCHARGE_STEP_US;
+        report.awake_mah += step_mah;
+    }
+
+    sim_schedule(sim_now_us() + DISCHARGE_STEP_US, discharge, NULL);
+
+    // Without a capacity the cell stays at the voltage it was given
+    if (capacity_mah == 0) {
+        return;
+    }
+
+    used_mah += step_mah;
+    if (used_mah > capacity_mah) {
+        used_mah = capacity_mah;
+    }
+
+    double charge = 1 - used_mah / capacity_mah;
+    double loaded_mv = open_circuit_mv(charge) - current * CELL_RESISTANCE_OHM;
+
+    if (empty_us == 0 && charge <= 0) {
+        empty_us = sim_now_us();
+        ESP_LOGW("SIM_POWER", "Battery empty after %.1f s", empty_us / 1e6);
+    }
+
+    sim_adc081c021_set_input(loaded_mv / BATTERY_DIVIDER_RATIO);
+}
+
+void sim_power_start(uint32_t capacity) {
+    capacity_mah = capacity;
+    if (capacity != 0) {
+        sim_adc081c021_set_input(OCV_CURVE[0].millivolts /
+                                 BATTERY_DIVIDER_RATIO);
+    }
+
+    sim_schedule(DISCHARGE_STEP_US, discharge, NULL);
+}
+
+//! Only meant for once the clock has stopped
+void sim_power_get_report(sim_power_report *out) {
+    *out = report;
+    out->used_mah = used_mah;
+    out->empty_us = empty_us;
+}
@@ -0,0 +1,173 @@
+#ifndef SIM_SIM_H
+#define SIM_SIM_H
+
+/**
+ * Internals shared by the simulator's stand-ins for ESP-IDF.
+ *
+ * Time is simulated and only moves once every task is blocked, at which point
+ * the clock jumps to the earliest deadline any of them waits for. Firmware code
+ * therefore takes no simulated time to run, I2S writes take exactly as long as
+ * the samples they carry and the outcome of a run does not depend on how busy
+ * the host is.
+ */
+
+#include "driver/gpio.h"
+#include "driver/i2s_types.h"
+#include "esp_log.h"
+#include "freertos/FreeRTOS.h"
+#include "wav.h"
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+
+//! Deadline of a wait without timeout
+#define SIM_FOREVER UINT64_MAX
+
+typedef void (*sim_event_fn)(void *arg);
+
+/**
+ * Starts the clock and the event task. With `realtime` set every step of the
+ * clock also waits for the wall clock to catch up.
+ */
+void sim_kernel_start(bool realtime);
+
+uint64_t sim_now_us(void);
+
+//! Absolute deadline `ticks` from now, SIM_FOREVER for portMAX_DELAY
+uint64_t sim_deadline(TickType_t ticks);
+
+//! Serialises all simulator state that tasks block on
+void sim_lock(void);
+void sim_unlock(void);
+
+/**
+ * Blocks the calling task until it is woken or the clock reaches `deadline_us`.
+ * Must be called with the lock held. Returns false without blocking if the
+ * deadline has already passed, so callers loop until their condition holds.
+ */
+bool sim_wait_locked(uint64_t deadline_us);
+
+//! Wakes every blocked task to re-check its condition, lock must be held
+void sim_wake_all_locked(void);
+
+//! Blocks the calling task until the clock reaches `deadline_us`
+void sim_sleep_until(uint64_t deadline_us);
+
+/**
+ * Runs `fn` on the event task once the clock reaches `at_us`. This is the
+ * simulator's Bluedroid task, all stack callbacks are delivered from it.
+ */
+void sim_schedule(uint64_t at_us, sim_event_fn fn, void *arg);
+
+//! Makes the calling thread known to the clock, which then waits for it to
+//! block before moving on
+void sim_register_thread(const char *name);
+
+void sim_log_set_level(esp_log_level_t level);
+
+//! Sources and sinks of one I2S port, either may be NULL
+void sim_i2s_attach(i2s_port_t port, wav_reader *input, wav_writer *output);
+
+//! Codec whose DAC the port's TX feeds, selected by `chip_select`. While its
+//! soft mute is on, silence is recorded and heard by the mic instead.
+void sim_i2s_set_codec(i2s_port_t port, int chip_select);
+
+/**
+ * Feeds everything played back into the mic through a resonance `gain_db`
+ * above unity at `resonance_hz`, `delay_ms` after it is played, like a speaker
+ * next to the mic in a helmet
+ */
+void sim_i2s_set_feedback(float gain_db, float delay_ms, float resonance_hz,
+                          uint32_t sample_rate);
+
+//! Stops recording output, must be called before the writers are closed
+void sim_i2s_detach(void);
+
+//! Any I2S channel is enabled, which keeps the CPU out of light sleep
+bool sim_i2s_running(void);
+
+//! CSV log receiving every register write clocked out on the SPI bus
+void sim_spi_set_register_log(FILE *log);
+
+uint32_t sim_spi_write_count(void);
+
+//! Drives an input pin from outside, overriding its pull resistor
+void sim_gpio_drive(gpio_num_t gpio_num, int level);
+
+//! Peripheral signal routed to an output pin through the matrix
+uint32_t sim_gpio_out_signal(gpio_num_t gpio_num);
+
+/**
+ * Puts the button board's PCF8574 on the I2C bus, with its INT line wired to
+ * `int_pin`
+ */
+void sim_pcf8574_attach(uint16_t address, gpio_num_t int_pin);
+
+//! Drives an expander input from outside, like a button pulling it low
+void sim_pcf8574_drive(int pin, int level);
+
+//! Puts the power board's battery monitor ADC on the I2C bus
+void sim_adc081c021_attach(uint16_t address, uint32_t reference_mv);
+
+//! Voltage at the ADC's input pin
+void sim_adc081c021_set_input(uint32_t millivolts);
+
+//! Tells the power model about a register write to the codec selected by
+//! `chip_select`
+void sim_power_codec_write(int chip_select, uint8_t address, uint16_t value);
+
+//! Last value written to a register of the codec selected by `chip_select`
+uint16_t sim_power_codec_register(int chip_select, uint8_t address);
+
+//! Power management allows light sleep and nothing keeps the CPU awake
+bool sim_power_light_sleep(void);
+
+//! Current drawn from the battery in the present configuration
+double sim_power_current_ma(void);
+
+typedef struct {
+    uint64_t awake_us;
+    double awake_mah;
+    uint64_t sleep_us;
+    double sleep_mah;
+    //! Drawn from the cell and when it ran empty, 0 if it has not
+    double used_mah;
+    uint64_t empty_us;
+} sim_power_report;
+
+/**
+ * Starts accounting the current the power model estimates. With a capacity it
+ * also discharges a full cell of that many mAh, otherwise the battery stays at
+ * the voltage it was set to.
+ */
+void sim_power_start(uint32_t capacity_mah);
+
+void sim_power_get_report(sim_power_report *report);
+
+//! Flashes a file to the start of a data partition, the rest stays erased
+bool sim_partition_load(const char *label, const char *path);
+
+typedef struct {
+    //! Streamed over A2DP, NULL for no source
+    wav_reader *music;
+    //! Uniform random delay added to each A2DP packet
+    uint32_t jitter_us;
+    uint32_t seed;
+    //! Bytes delivered to the SPP server, NULL for none
+    FILE *spp_input;
+    //! Receives everything the firmware writes over SPP
+    FILE *spp_output;
+    //! The input is a live, non-blocking peer rather than a file, so running
+    //! out of it is not the end
+    bool spp_interactive;
+    //! When the phone connects
+    uint64_t connect_us;
+} sim_bt_scenario;
+
+/**
+ * Plays the role of the phone: connects, streams the music file in real time
+ * packets and feeds the SPP input once the server is up
+ */
+void sim_bt_run(const sim_bt_scenario *scenario);
+
+#endif
@@ -0,0 +1,164 @@
+/**
+ * This file contains the simulated SPI master. Transactions complete the
+ * moment they are queued: the word is decoded as a WM8988 register write and
+ * logged, the post callback runs and the result waits to be collected like it
+ * would after the real interrupt.
+ *
+ * The register log is CSV, one line per write:
+ *
+ *   time_us,chip_select,register,value
+ */
+
+#include "driver/spi_master.h"
+#include "sim.h"
+#include <inttypes.h>
+#include <stdatomic.h>
+#include <stdlib.h>
+
+struct spi_device_t {
+    spi_device_interface_config_t config;
+    //! Completed transactions not yet collected, oldest first
+    spi_transaction_t **done;
+    size_t done_head;
+    size_t done_count;
+};
+
+static FILE *register_log;
+static pthread_mutex_t log_lock = PTHREAD_MUTEX_INITIALIZER;
+static _Atomic uint32_t write_count;
+
+void sim_spi_set_register_log(FILE *log) {
+    pthread_mutex_lock(&log_lock);
+    register_log = log;
+    if (log != NULL) {
+        fprintf(log, "time_us,chip_select,register,value\n");
+    }
+    pthread_mutex_unlock(&log_lock);
+}
+
+uint32_t sim_spi_write_count(void) { return atomic_load(&write_count); }
+
+esp_err_t spi_bus_initialize(spi_host_device_t host_id,
+                             const spi_bus_config_t *bus_config, int dma_chan) {
+    return host_id < SPI_HOST_MAX ? ESP_OK : ESP_ERR_INVALID_ARG;
+}
+
+esp_err_t spi_bus_add_device(spi_host_device_t host_id,
+                             const spi_device_interface_config_t *dev_config,
+                             spi_device_handle_t *handle) {
+    if (dev_config->queue_size <= 0) {
+        return ESP_ERR_INVALID_ARG;
+    }
+
+    spi_device_handle_t device = calloc(1, sizeof(*device));
+    if (device == NULL) {
+        return ESP_ERR_NO_MEM;
+    }
+
+    device->done = calloc(dev_config->queue_size, sizeof(*device->done));
+    if (device->done == NULL) {
+        free(device);
+        return ESP_ERR_NO_MEM;
+    }
+
+    device->config = *dev_config;
+    *handle = device;
+
+    return ESP_OK;
+}
+
+/**
+ * Clocks one transaction out. Every device on the bus is a codec, so anything
+ * of at least 16 bits is a 7 bit register address followed by a 9 bit value.
+ */
+static void execute(spi_device_handle_t device, spi_transaction_t *trans) {
+    if (device->config.pre_cb != NULL) {
+        device->config.pre_cb(trans);
+    }
+
+    if (trans->length >= 16) {
+        const uint8_t *data = trans->flags & SPI_TRANS_USE_TXDATA
+                                  ? trans->tx_data
+                                  : trans->tx_buffer;
+        uint16_t word = (data[0] << 8) | data[1];
+
+        atomic_fetch_add(&write_count, 1);
+        sim_power_codec_write(device->config.spics_io_num, word >> 9,
+                              word & 0x1FF);
+
+        pthread_mutex_lock(&log_lock);
+        if (register_log != NULL) {
+            fprintf(register_log, "%" PRIu64 ",%d,0x%02X,0x%03X\n",
+                    sim_now_us(), device->config.spics_io_num, word >> 9,
+                    word & 0x1FF);
+        }
+        pthread_mutex_unlock(&log_lock);
+    }
+
+    if (device->config.post_cb != NULL) {
+        device->config.post_cb(trans);
+    }
+}
+
+esp_err_t spi_device_queue_trans(spi_device_handle_t handle,
+                                 spi_transaction_t *trans_desc,
+                                 TickType_t ticks_to_wait) {
+    uint64_t deadline = sim_deadline(ticks_to_wait);
+    size_t depth = handle->config.queue_size;
+
+    // Results that were never collected occupy the queue
+    sim_lock();
+    while (handle->done_count == depth) {
+        if (!sim_wait_locked(deadline)) {
+            sim_unlock();
+            return ESP_ERR_TIMEOUT;
+        }
+    }
+    sim_unlock();
+
+    execute(handle, trans_desc);
+
+    sim_lock();
+    handle->done[(handle->done_head + handle->done_count) % depth] = trans_desc;
+    handle->done_count++;
+    sim_wake_all_locked();
+    sim_unlock();
+
+    return ESP_OK;
+}
+
+esp_err_t spi_device_get_trans_result(spi_device_handle_t handle,
+                                      spi_transaction_t **trans_desc,
+                                      TickType_t ticks_to_wait) {
+    uint64_t deadline = sim_deadline(ticks_to_wait);
+
+    sim_lock();
+
+    while (handle->done_count == 0) {
+        if (!sim_wait_locked(deadline)) {
+            sim_unlock();
+            return ESP_ERR_TIMEOUT;
+        }
+    }
+
+    *trans_desc = handle->done[handle->done_head];
+    handle->done_head = (handle->done_head + 1) % handle->config.queue_size;
+    handle->done_count--;
+    sim_wake_all_locked();
+
+    sim_unlock();
+
+    return ESP_OK;
+}
+
+esp_err_t spi_device_transmit(spi_device_handle_t handle,
+                              spi_transaction_t *trans_desc) {
+    execute(handle, trans_desc);
+
+    return ESP_OK;
+}
+
+esp_err_t spi_device_polling_transmit(spi_device_handle_t handle,
+                                      spi_transaction_t *trans_desc) {
+    return spi_device_transmit(handle, trans_desc);
+}
@@ -0,0 +1,180 @@
+/**
+ * This file contains the simulator's logging, timer and NVS stand-ins. Log
+ * lines follow the ESP-IDF format, timestamped with simulated time.
+ */
+
+#include "esp_err.h"
+#include "esp_log.h"
+#include "esp_timer.h"
+#include "nvs_flash.h"
+#include "sim.h"
+#include <stdarg.h>
+#include <stdlib.h>
+
+static esp_log_level_t log_level = ESP_LOG_INFO;
+
+//! Keeps lines from concurrent tasks from interleaving
+static pthread_mutex_t log_lock = PTHREAD_MUTEX_INITIALIZER;
+
+void sim_log_set_level(esp_log_level_t level) { log_level = level; }
+
+void esp_log_write(esp_log_level_t level, const char *tag, const char *format,
+                   ...) {
+    static const char letters[] = "NEWIDV";
+
+    if (level > log_level) {
+        return;
+    }
+
+    va_list args;
+    va_start(args, format);
+
+    pthread_mutex_lock(&log_lock);
+    fprintf(stderr, "%c (%llu) %s: ", letters[level],
+            (unsigned long long)(sim_now_us() / 1000), tag);
+    vfprintf(stderr, format, args);
+    fputc('\n', stderr);
+    pthread_mutex_unlock(&log_lock);
+
+    va_end(args);
+}
+
+const char *esp_err_to_name(esp_err_t code) {
+    switch (code) {
+        case ESP_OK:
+            return "ESP_OK";
+        case ESP_FAIL:
+            return "ESP_FAIL";
+        case ESP_ERR_NO_MEM:
+            return "ESP_ERR_NO_MEM";
+        case ESP_ERR_INVALID_ARG:
+            return "ESP_ERR_INVALID_ARG";
+        case ESP_ERR_INVALID_STATE:
+            return "ESP_ERR_INVALID_STATE";
+        case ESP_ERR_INVALID_SIZE:
+            return "ESP_ERR_INVALID_SIZE";
+        case ESP_ERR_NOT_FOUND:
+            return "ESP_ERR_NOT_FOUND";
+        case ESP_ERR_NOT_SUPPORTED:
+            return "ESP_ERR_NOT_SUPPORTED";
+        case ESP_ERR_TIMEOUT:
+            return "ESP_ERR_TIMEOUT";
+        case ESP_ERR_INVALID_RESPONSE:
+            return "ESP_ERR_INVALID_RESPONSE";
+        case ESP_ERR_INVALID_CRC:
+            return "ESP_ERR_INVALID_CRC";
+        case ESP_ERR_INVALID_VERSION:
+            return "ESP_ERR_INVALID_VERSION";
+        case ESP_ERR_NVS_NOT_FOUND:
+            return "ESP_ERR_NVS_NOT_FOUND";
+        case ESP_ERR_NVS_NO_FREE_PAGES:
+            return "ESP_ERR_NVS_NO_FREE_PAGES";
+        case ESP_ERR_NVS_NEW_VERSION_FOUND:
+            return "ESP_ERR_NVS_NEW_VERSION_FOUND";
+        default:
+            return "UNKNOWN ERROR";
+    }
+}
+
+int64_t esp_timer_get_time(void) { return sim_now_us(); }
+
+struct esp_timer {
+    esp_timer_cb_t callback;
+    void *arg;
+    bool active;
+    //! Bumped by every start and stop, so events of earlier starts are ignored
+    uint32_t generation;
+};
+
+typedef struct {
+    esp_timer_handle_t timer;
+    uint32_t generation;
+} timer_expiry;
+
+static pthread_mutex_t timer_lock = PTHREAD_MUTEX_INITIALIZER;
+
+esp_err_t esp_timer_create(const esp_timer_create_args_t *create_args,
+                           esp_timer_handle_t *out_handle) {
+    esp_timer_handle_t timer = calloc(1, sizeof(*timer));
+    if (timer == NULL) {
+        return ESP_ERR_NO_MEM;
+    }
+
+    timer->callback = create_args->callback;
+    timer->arg = create_args->arg;
+    *out_handle = timer;
+
+    return ESP_OK;
+}
+
+static void expire_timer(void *arg) {
+    timer_expiry *expiry = arg;
+    esp_timer_handle_t timer = expiry->timer;
+
+    pthread_mutex_lock(&timer_lock);
+    bool current = timer->active && timer->generation == expiry->generation;
+    if (current) {
+        timer->active = false;
+    }
+    pthread_mutex_unlock(&timer_lock);
+
+    free(expiry);
+
+    if (current) {
+        timer->callback(timer->arg);
+    }
+}
+
+esp_err_t esp_timer_start_once(esp_timer_handle_t timer, uint64_t timeout_us) {
+    timer_expiry *expiry = malloc(sizeof(*expiry));
+    if (expiry == NULL) {
+        return ESP_ERR_NO_MEM;
+    }
+
+    pthread_mutex_lock(&timer_lock);
+
+    if (timer->active) {
+        pthread_mutex_unlock(&timer_lock);
+        free(expiry);
+        return ESP_ERR_INVALID_STATE;
+    }
+
+    timer->active = true;
+    *expiry = (timer_expiry){.timer = timer, .generation = ++timer->generation};
+
+    pthread_mutex_unlock(&timer_lock);
+
+    sim_schedule(sim_now_us() + timeout_us, expire_timer, expiry);
+
+    return ESP_OK;
+}
+
+esp_err_t esp_timer_stop(esp_timer_handle_t timer) {
+    pthread_mutex_lock(&timer_lock);
+
+    bool active = timer->active;
+    timer->active = false;
+    timer->generation++;
+
+    pthread_mutex_unlock(&timer_lock);
+
+    return active ? ESP_OK : ESP_ERR_INVALID_STATE;
+}
+
+esp_err_t esp_timer_delete(esp_timer_handle_t timer) {
+    // A pending expiry still points at the timer, so it is never freed
+    esp_timer_stop(timer);
+    return ESP_OK;
+}
+
+bool esp_timer_is_active(esp_timer_handle_t timer) {
+    pthread_mutex_lock(&timer_lock);
+    bool active = timer->active;
+    pthread_mutex_unlock(&timer_lock);
+
+    return active;
+}
+
+esp_err_t nvs_flash_init(void) { return ESP_OK; }
+
+esp_err_t nvs_flash_erase(void) { return ESP_OK; }
@@ -0,0 +1,213 @@
+#include "wav.h"
+#include <string.h>
+#include <unistd.h>
+
+#define WAV_FORMAT_PCM 1
+#define WAV_FORMAT_EXTENSIBLE 0xFFFE
+
+#define WAV_HEADER_SIZE 44
+
+//! Frames converted per read of the underlying file
+#define READ_CHUNK_FRAMES 256
+
+static uint16_t get_u16(const uint8_t *in) { return in[0] | (in[1] << 8); }
+
+static uint32_t get_u32(const uint8_t *in) {
+    return in[0] | (in[1] << 8) | (in[2] << 16) | ((uint32_t)in[3] << 24);
+}
+
+static uint8_t *put_u16(uint8_t *out, uint16_t value) {
+    out[0] = value;
+    out[1] = value >> 8;
+    return out + 2;
+}
+
+static uint8_t *put_u32(uint8_t *out, uint32_t value) {
+    out[0] = value;
+    out[1] = value >> 8;
+    out[2] = value >> 16;
+    out[3] = value >> 24;
+    return out + 4;
+}
+
+bool wav_open_read(wav_reader *reader, const char *path) {
+    memset(reader, 0, sizeof(*reader));
+
+    reader->file = fopen(path, "rb");
+    if (reader->file == NULL) {
+        fprintf(stderr, "%s: cannot open\n", path);
+        return false;
+    }
+
+    uint8_t header[12];
+    if (fread(header, 1, sizeof(header), reader->file) != sizeof(header) ||
+        memcmp(header, "RIFF", 4) != 0 || memcmp(&header[8], "WAVE", 4) != 0) {
+        fprintf(stderr, "%s: not a WAV file\n", path);
+        wav_close_read(reader);
+        return false;
+    }
+
+    bool have_format = false;
+    uint8_t chunk[8];
+
+    // Walk the chunks until the samples start, everything but the format is
+    // skipped
+    while (fread(chunk, 1, sizeof(chunk), reader->file) == sizeof(chunk)) {
+        uint32_t size = get_u32(&chunk[4]);
+
+        if (memcmp(chunk, "fmt ", 4) == 0) {
+            uint8_t format[16];
+            if (size < sizeof(format) ||
+                fread(format, 1, sizeof(format), reader->file) !=
+                    sizeof(format)) {
+                break;
+            }
+
+            uint16_t tag = get_u16(&format[0]);
+            uint16_t bits = get_u16(&format[14]);
+            reader->channels = get_u16(&format[2]);
+            reader->sample_rate = get_u32(&format[4]);
+
+            if ((tag != WAV_FORMAT_PCM && tag != WAV_FORMAT_EXTENSIBLE) ||
+                bits != 16 || reader->channels == 0) {
+                fprintf(stderr, "%s: only 16 bit PCM is supported\n", path);
+                wav_close_read(reader);
+                return false;
+            }
+
+            have_format = true;
+            size -= sizeof(format);
+        } else if (memcmp(chunk, "data", 4) == 0 && have_format) {
+            reader->frames = size / (reader->channels * sizeof(int16_t));
+            return true;
+        }
+
+        // Chunks are padded to an even size
+        if (fseek(reader->file, size + (size & 1), SEEK_CUR) != 0) {
+            break;
+        }
+    }
+
+    fprintf(stderr, "%s: no PCM data found\n", path);
+    wav_close_read(reader);
+    return false;
+}
+
+size_t wav_read_stereo(wav_reader *reader, int16_t *out, size_t frames) {
+    int16_t samples[READ_CHUNK_FRAMES * 8];
+    size_t max_chunk = sizeof(samples) / sizeof(int16_t) / reader->channels;
+    size_t total = 0;
+
+    if (frames > reader->frames - reader->position) {
+        frames = reader->frames - reader->position;
+    }
+
+    while (total < frames) {
+        size_t wanted = frames - total;
+        if (wanted > max_chunk) {
+            wanted = max_chunk;
+        }
+
+        size_t got = fread(samples, reader->channels * sizeof(int16_t), wanted,
+                           reader->file);
+
+        for (size_t i = 0; i < got; i++) {
+            const int16_t *frame = &samples[i * reader->channels];
+            out[2 * (total + i)] = frame[0];
+            out[2 * (total + i) + 1] =
+                reader->channels > 1 ? frame[1] : frame[0];
+        }
+
+        total += got;
+
+        if (got < wanted) {
+            // Truncated file, treat the rest as missing
+            reader->frames = reader->position + total;
+            break;
+        }
+    }
+
+    reader->position += total;
+    return total;
+}
+
+void wav_close_read(wav_reader *reader) {
+    if (reader->file != NULL) {
+        fclose(reader->file);
+        reader->file = NULL;
+    }
+}
+
+static bool write_header(wav_writer *writer) {
+    uint8_t header[WAV_HEADER_SIZE];
+    uint32_t data_size = writer->frames * writer->channels * sizeof(int16_t);
+    uint16_t block_align = writer->channels * sizeof(int16_t);
+
+    uint8_t *cursor = header;
+    memcpy(cursor, "RIFF", 4);
+    cursor = put_u32(cursor + 4, WAV_HEADER_SIZE - 8 + data_size);
+    memcpy(cursor, "WAVEfmt ", 8);
+    cursor = put_u32(cursor + 8, 16);
+    cursor = put_u16(cursor, WAV_FORMAT_PCM);
+    cursor = put_u16(cursor, writer->channels);
+    cursor = put_u32(cursor, writer->sample_rate);
+    cursor = put_u32(cursor, writer->sample_rate * block_align);
+    cursor = put_u16(cursor, block_align);
+    cursor = put_u16(cursor, 16);
+    memcpy(cursor, "data", 4);
+    put_u32(cursor + 4, data_size);
+
+    return fseek(writer->file, 0, SEEK_SET) == 0 &&
+           fwrite(header, 1, sizeof(header), writer->file) == sizeof(header);
+}
+
+bool wav_open_write(wav_writer *writer, const char *path, uint32_t sample_rate,
+                    uint16_t channels) {
+    writer->channels = channels;
+    writer->sample_rate = sample_rate;
+    writer->frames = 0;
+
+    writer->file = fopen(path, "wb");
+    if (writer->file == NULL) {
+        fprintf(stderr, "%s: cannot create\n", path);
+        return false;
+    }
+
+    // Written again with the real sizes on close
+    return write_header(writer);
+}
+
+bool wav_write(wav_writer *writer, const int16_t *samples, size_t frames) {
+    size_t written = fwrite(samples, writer->channels * sizeof(int16_t),
+                            frames, writer->file);
+    writer->frames += written;
+    return written == frames;
+}
+
+bool wav_truncate(wav_writer *writer, uint32_t frames) {
+    if (frames >= writer->frames) {
+        return true;
+    }
+
+    long size =
+        WAV_HEADER_SIZE + (long)frames * writer->channels * sizeof(int16_t);
+
+    if (fflush(writer->file) != 0 ||
+        ftruncate(fileno(writer->file), size) != 0 ||
+        fseek(writer->file, 0, SEEK_END) != 0) {
+        return false;
+    }
+
+    writer->frames = frames;
+    return true;
+}
+
+void wav_close_write(wav_writer *writer) {
+    if (writer->file == NULL) {
+        return;
+    }
+
+    write_header(writer);
+    fclose(writer->file);
+    writer->file = NULL;
+}
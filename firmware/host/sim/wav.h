@@ -0,0 +1,52 @@
+#ifndef SIM_WAV_H
+#define SIM_WAV_H
+
+/**
+ * Minimal reader and writer for 16 bit PCM WAV files, the only format the
+ * simulator exchanges audio in
+ */
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+
+typedef struct {
+    FILE *file;
+    uint16_t channels;
+    uint32_t sample_rate;
+    //! Frames in the file and frames already read
+    uint32_t frames;
+    uint32_t position;
+} wav_reader;
+
+typedef struct {
+    FILE *file;
+    uint16_t channels;
+    uint32_t sample_rate;
+    uint32_t frames;
+} wav_writer;
+
+bool wav_open_read(wav_reader *reader, const char *path);
+
+/**
+ * Reads up to `frames` frames as interleaved stereo. Mono files are duplicated
+ * into both channels and anything past the second channel is dropped. Returns
+ * the number of frames read, 0 at the end of the file.
+ */
+size_t wav_read_stereo(wav_reader *reader, int16_t *out, size_t frames);
+
+void wav_close_read(wav_reader *reader);
+
+bool wav_open_write(wav_writer *writer, const char *path, uint32_t sample_rate,
+                    uint16_t channels);
+
+bool wav_write(wav_writer *writer, const int16_t *samples, size_t frames);
+
+//! Drops whatever was written past the first `frames` frames
+bool wav_truncate(wav_writer *writer, uint32_t frames);
+
+//! Fills in the sizes the header was written without and closes the file
+void wav_close_write(wav_writer *writer);
+
+#endif
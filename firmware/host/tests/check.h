@@ -0,0 +1,44 @@
+#ifndef HOST_TESTS_CHECK_H
+#define HOST_TESTS_CHECK_H
+
+#include <stdio.h>
+
+/**
+ * Minimal assertions for the host tests. A failed check is reported with its
+ * location and counted, and the test's main returns check_result() so ctest
+ * sees the failure while every other check still runs.
+ */
+
+static int check_failures;
+
+#define CHECK(condition)                                                       \
+    do {                                                                       \
+        if (!(condition)) {                                                    \
+            fprintf(stderr, "%s:%d: check failed: %s\n", __FILE__, __LINE__,   \
+                    #condition);                                               \
+            check_failures++;                                                  \
+        }                                                                      \
+    } while (0)
+
+#define CHECK_EQUAL(actual, expected)                                          \
+    do {                                                                       \
+        long long actual_value = (long long)(actual);                          \
+        long long expected_value = (long long)(expected);                      \
+        if (actual_value != expected_value) {                                  \
+            fprintf(stderr, "%s:%d: %s is %lld, expected %lld\n", __FILE__,    \
+                    __LINE__, #actual, actual_value, expected_value);          \
+            check_failures++;                                                  \
+        }                                                                      \
+    } while (0)
+
+static inline int check_result(const char *name) {
+    if (check_failures == 0) {
+        printf("%s: all checks passed\n", name);
+        return 0;
+    }
+
+    printf("%s: %d checks failed\n", name, check_failures);
+    return 1;
+}
+
+#endif
@@ -0,0 +1,160 @@
+/**
+ * Runs the feedback suppressor over a recording of the simulator howling and
+ * checks that a notch locks onto the howl soon after it starts and takes it
+ * down. The recording is passed as the first argument, see CMakeLists.txt for
+ * how it was made.
+ */
+
+#include "audio_dsp/feedback.h"
+#include "check.h"
+#include "wav.h"
+#include <math.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define SAMPLE_RATE 48000
+
+//! Frames processed per call, the voice profile's block
+#define BLOCK_FRAMES 120
+
+//! Longest recording read
+#define MAX_FRAMES SAMPLE_RATE
+
+//! Frequency the recording howls at, found by scanning its spectrum
+#define HOWL_HZ 2560.0f
+//! Furthest the notch may sit from it, well inside the notch's own width
+#define HOWL_TOLERANCE_HZ 20.0f
+
+//! Howl builds from the start of the recording and has to be notched within
+//! a few analysis frames of it
+#define LOCK_DEADLINE_FRAMES (SAMPLE_RATE / 10)
+
+//! Cut at the howl frequency required over the second half of the recording,
+//! once the notch has had time to deepen
+#define MIN_ATTENUATION_DB 20.0
+
+static int16_t input[MAX_FRAMES];
+static int16_t output[MAX_FRAMES];
+
+static size_t read_recording(const char *path) {
+    wav_reader reader;
+    int16_t stereo[BLOCK_FRAMES * 2];
+    size_t frames = 0;
+
+    if (!wav_open_read(&reader, path)) {
+        fprintf(stderr, "Cannot read %s\n", path);
+        return 0;
+    }
+
+    CHECK_EQUAL(reader.sample_rate, SAMPLE_RATE);
+
+    size_t got;
+    while (frames < MAX_FRAMES &&
+           (got = wav_read_stereo(&reader, stereo, BLOCK_FRAMES)) > 0) {
+        for (size_t i = 0; i < got && frames < MAX_FRAMES; i++) {
+            input[frames++] = stereo[2 * i];
+        }
+    }
+
+    wav_close_read(&reader);
+    return frames;
+}
+
+//! Power of `samples` at `frequency` by the Goertzel algorithm
+static double tone_power(const int16_t *samples, size_t frames,
+                         double frequency) {
+    double coefficient = 2.0 * cos(2.0 * M_PI * frequency / SAMPLE_RATE);
+    double s1 = 0;
+    double s2 = 0;
+
+    for (size_t i = 0; i < frames; i++) {
+        double s0 = samples[i] + coefficient * s1 - s2;
+        s2 = s1;
+        s1 = s0;
+    }
+
+    return s1 * s1 + s2 * s2 - coefficient * s1 * s2;
+}
+
+//! The notch closest to `frequency`, NULL if none is locked
+static const feedback_notch *
+closest_notch(const feedback_suppressor *suppressor, float frequency) {
+    const feedback_notch *closest = NULL;
+
+    for (size_t i = 0; i < FEEDBACK_MAX_NOTCHES; i++) {
+        const feedback_notch *notch = &suppressor->notches[i];
+
+        if (notch->depth != 0 &&
+            (closest == NULL || fabsf(notch->frequency - frequency) <
+                                    fabsf(closest->frequency - frequency))) {
+            closest = notch;
+        }
+    }
+
+    return closest;
+}
+
+static void test_recorded_howl(const char *path) {
+    static feedback_suppressor suppressor;
+    size_t frames = read_recording(path);
+
+    CHECK(frames >= MAX_FRAMES / 2);
+    if (frames < MAX_FRAMES / 2) {
+        return;
+    }
+
+    feedback_init(&suppressor, SAMPLE_RATE);
+    memcpy(output, input, frames * sizeof(int16_t));
+
+    size_t locked_at = 0;
+    bool locked = false;
+
+    for (size_t done = 0; done < frames; done += BLOCK_FRAMES) {
+        size_t block = frames - done < BLOCK_FRAMES ? frames - done
+                                                    : BLOCK_FRAMES;
+        feedback_process(&suppressor, &output[done], block);
+
+        const feedback_notch *notch = closest_notch(&suppressor, HOWL_HZ);
+        if (!locked && notch != NULL &&
+            fabsf(notch->frequency - HOWL_HZ) < HOWL_TOLERANCE_HZ) {
+            locked = true;
+            locked_at = done + block;
+        }
+    }
+
+    const feedback_notch *notch = closest_notch(&suppressor, HOWL_HZ);
+
+    CHECK(locked);
+    CHECK(locked_at <= LOCK_DEADLINE_FRAMES);
+    CHECK(notch != NULL);
+    if (notch == NULL) {
+        return;
+    }
+    CHECK(fabsf(notch->frequency - HOWL_HZ) < HOWL_TOLERANCE_HZ);
+
+    size_t half = frames / 2;
+    double before = tone_power(&input[half], frames - half, notch->frequency);
+    double after = tone_power(&output[half], frames - half, notch->frequency);
+    double attenuation = 10.0 * log10(before / after);
+
+    printf("Notch at %.1f Hz, depth %u steps, locked after %zu frames, howl "
+           "cut by %.1f dB, limit %.1f dB\n",
+           notch->frequency, notch->depth, locked_at, attenuation,
+           MIN_ATTENUATION_DB);
+
+    CHECK(attenuation >= MIN_ATTENUATION_DB);
+}
+
+int main(int argc, char **argv) {
+    if (argc != 2) {
+        fprintf(stderr, "Usage: %s RECORDING\n", argv[0]);
+        return EXIT_FAILURE;
+    }
+
+    test_recorded_howl(argv[1]);
+
+    return check_result("feedback");
+}
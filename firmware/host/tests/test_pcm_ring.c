@@ -0,0 +1,216 @@
+/**
+ * Correctness tests for the SPSC PCM ring: wrapping around the end of the
+ * storage and of the free running indices, partial transfers at the capacity
+ * edge, telling full from empty, and a producer and consumer thread passing a
+ * numbered byte sequence through it.
+ */
+
+#include "audio_dsp/pcm_ring.h"
+#include "check.h"
+#include <pthread.h>
+#include <sched.h>
+#include <stdint.h>
+#include <string.h>
+
+#define CAPACITY 64
+
+//! Bytes streamed through the ring by the threaded test
+#define STREAM_BYTES (1u * 1024 * 1024)
+
+static uint8_t storage[CAPACITY];
+
+static void fill_pattern(uint8_t *out, size_t len, uint8_t first) {
+    for (size_t i = 0; i < len; i++) {
+        out[i] = first + i;
+    }
+}
+
+static void test_init(void) {
+    pcm_ring ring;
+
+    CHECK(!pcm_ring_init(&ring, storage, 0));
+    CHECK(!pcm_ring_init(&ring, storage, 48));
+    CHECK(!pcm_ring_init(&ring, NULL, CAPACITY));
+    CHECK(pcm_ring_init(&ring, storage, CAPACITY));
+}
+
+static void test_full_and_empty(void) {
+    pcm_ring ring;
+    uint8_t data[CAPACITY + 8];
+    uint8_t out[CAPACITY + 8];
+
+    pcm_ring_init(&ring, storage, CAPACITY);
+    fill_pattern(data, sizeof(data), 0);
+
+    // Empty: nothing to read, everything free
+    CHECK_EQUAL(pcm_ring_fill(&ring), 0);
+    CHECK_EQUAL(pcm_ring_space(&ring), CAPACITY);
+    CHECK_EQUAL(pcm_ring_read(&ring, out, 1), 0);
+
+    // Full uses every byte, with no slot sacrificed to tell it from empty
+    CHECK_EQUAL(pcm_ring_write(&ring, data, CAPACITY), CAPACITY);
+    CHECK_EQUAL(pcm_ring_fill(&ring), CAPACITY);
+    CHECK_EQUAL(pcm_ring_space(&ring), 0);
+    CHECK_EQUAL(pcm_ring_write(&ring, data, 1), 0);
+
+    CHECK_EQUAL(pcm_ring_read(&ring, out, CAPACITY), CAPACITY);
+    CHECK(memcmp(out, data, CAPACITY) == 0);
+    CHECK_EQUAL(pcm_ring_fill(&ring), 0);
+    CHECK_EQUAL(pcm_ring_space(&ring), CAPACITY);
+
+    // Discard empties without touching the producer's side
+    pcm_ring_write(&ring, data, 10);
+    pcm_ring_discard(&ring);
+    CHECK_EQUAL(pcm_ring_fill(&ring), 0);
+    CHECK_EQUAL(pcm_ring_space(&ring), CAPACITY);
+}
+
+static void test_partial_at_capacity(void) {
+    pcm_ring ring;
+    uint8_t data[CAPACITY * 2];
+    uint8_t out[CAPACITY * 2];
+
+    pcm_ring_init(&ring, storage, CAPACITY);
+    fill_pattern(data, sizeof(data), 0);
+
+    // A write larger than the space is cut short at exactly the space left
+    CHECK_EQUAL(pcm_ring_write(&ring, data, CAPACITY - 3), CAPACITY - 3);
+    CHECK_EQUAL(pcm_ring_write(&ring, &data[CAPACITY - 3], 10), 3);
+    CHECK_EQUAL(pcm_ring_space(&ring), 0);
+
+    // A read larger than the fill returns only what is there
+    memset(out, 0xEE, sizeof(out));
+    CHECK_EQUAL(pcm_ring_read(&ring, out, 5), 5);
+    CHECK_EQUAL(pcm_ring_read(&ring, &out[5], sizeof(out)), CAPACITY - 5);
+    CHECK(memcmp(out, data, CAPACITY) == 0);
+    // Nothing past what was read was written to
+    CHECK_EQUAL(out[CAPACITY], 0xEE);
+
+    CHECK_EQUAL(pcm_ring_read(&ring, out, sizeof(out)), 0);
+}
+
+static void test_wraparound(void) {
+    pcm_ring ring;
+    uint8_t data[CAPACITY];
+    uint8_t out[CAPACITY];
+
+    pcm_ring_init(&ring, storage, CAPACITY);
+
+    // Odd sized transfers walk the offsets through every position, so copies
+    // split across the end of the storage at every possible point
+    uint8_t next_write = 0;
+    uint8_t next_read = 0;
+
+    for (size_t round = 0; round < 1000; round++) {
+        size_t len = 1 + (round * 7) % (CAPACITY - 1);
+
+        fill_pattern(data, len, next_write);
+        size_t written = pcm_ring_write(&ring, data, len);
+        next_write += written;
+
+        size_t read = pcm_ring_read(&ring, out, 1 + (round * 5) % CAPACITY);
+        for (size_t i = 0; i < read; i++) {
+            if (out[i] != next_read) {
+                CHECK_EQUAL(out[i], next_read);
+                return;
+            }
+            next_read++;
+        }
+    }
+
+    CHECK_EQUAL(pcm_ring_fill(&ring), (uint8_t)(next_write - next_read));
+}
+
+static void test_index_overflow(void) {
+    pcm_ring ring;
+    uint8_t data[CAPACITY];
+    uint8_t out[CAPACITY];
+
+    pcm_ring_init(&ring, storage, CAPACITY);
+
+    // Both indices run freely, start them just short of wrapping the size_t
+    size_t start = SIZE_MAX - 20;
+    atomic_store(&ring.head, start);
+    atomic_store(&ring.tail, start);
+
+    CHECK_EQUAL(pcm_ring_fill(&ring), 0);
+    CHECK_EQUAL(pcm_ring_space(&ring), CAPACITY);
+
+    fill_pattern(data, CAPACITY, 100);
+    CHECK_EQUAL(pcm_ring_write(&ring, data, CAPACITY), CAPACITY);
+    CHECK(atomic_load(&ring.head) < start);
+    CHECK_EQUAL(pcm_ring_fill(&ring), CAPACITY);
+    CHECK_EQUAL(pcm_ring_space(&ring), 0);
+
+    CHECK_EQUAL(pcm_ring_read(&ring, out, CAPACITY), CAPACITY);
+    CHECK(memcmp(out, data, CAPACITY) == 0);
+    CHECK_EQUAL(pcm_ring_fill(&ring), 0);
+}
+
+static pcm_ring threaded_ring;
+
+static void *produce(void *arg) {
+    uint8_t chunk[37];
+    uint32_t sent = 0;
+
+    while (sent < STREAM_BYTES) {
+        size_t len = sizeof(chunk);
+        if (len > STREAM_BYTES - sent) {
+            len = STREAM_BYTES - sent;
+        }
+
+        fill_pattern(chunk, len, sent);
+        size_t written = pcm_ring_write(&threaded_ring, chunk, len);
+        // Whatever did not fit is offered again from the same position. A
+        // full ring yields, so the consumer gets to run on a single core
+        if (written == 0) {
+            sched_yield();
+        }
+        sent += written;
+    }
+
+    return NULL;
+}
+
+static void test_threaded_sequence(void) {
+    static uint8_t threaded_storage[256];
+    uint8_t chunk[53];
+    uint32_t received = 0;
+    uint32_t errors = 0;
+    pthread_t producer;
+
+    pcm_ring_init(&threaded_ring, threaded_storage, sizeof(threaded_storage));
+    pthread_create(&producer, NULL, produce, NULL);
+
+    while (received < STREAM_BYTES) {
+        size_t read = pcm_ring_read(&threaded_ring, chunk, sizeof(chunk));
+        if (read == 0) {
+            sched_yield();
+        }
+
+        for (size_t i = 0; i < read; i++) {
+            if (chunk[i] != (uint8_t)(received + i)) {
+                errors++;
+            }
+        }
+
+        received += read;
+    }
+
+    pthread_join(producer, NULL);
+
+    CHECK_EQUAL(errors, 0);
+    CHECK_EQUAL(received, STREAM_BYTES);
+    CHECK_EQUAL(pcm_ring_fill(&threaded_ring), 0);
+}
+
+int main(void) {
+    test_init();
+    test_full_and_empty();
+    test_partial_at_capacity();
+    test_wraparound();
+    test_index_overflow();
+    test_threaded_sequence();
+
+    return check_result("pcm_ring");
+}
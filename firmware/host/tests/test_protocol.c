@@ -0,0 +1,328 @@
+/**
+ * Regression and fuzz tests for the control channel frame parser. Valid frames
+ * are fed in arbitrary splits, and random bytes and mutated frames (bad CRC,
+ * truncated, oversized length) are fed ahead of known good ones, which must
+ * still come out intact once the parser has resynchronised.
+ *
+ * Every feed hands the parser a heap copy of exactly the bytes it covers, so
+ * with the sanitizers this test is built with any read past the end of a feed
+ * or of the parser's own buffer aborts the run.
+ */
+
+#include "audio_dsp/protocol.h"
+#include "check.h"
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+//! Mutated frames fed by the fuzz test, each followed by a good one
+#define FUZZ_ROUNDS 20000
+
+//! Random bytes fed by the noise test
+#define NOISE_BYTES (1024 * 1024)
+
+//! Frames the handler keeps a copy of
+#define RECORDED_FRAMES 64
+
+typedef struct {
+    uint8_t type;
+    uint8_t sequence;
+    uint16_t length;
+    uint8_t payload[PROTOCOL_MAX_PAYLOAD];
+} recorded_frame;
+
+static recorded_frame recorded[RECORDED_FRAMES];
+static size_t recorded_count;
+
+static uint32_t random_state = 0x12345678;
+
+//! xorshift32, so every run feeds the same bytes
+static uint32_t next_random(void) {
+    random_state ^= random_state << 13;
+    random_state ^= random_state >> 17;
+    random_state ^= random_state << 5;
+    return random_state;
+}
+
+static uint32_t random_below(uint32_t limit) {
+    return next_random() % limit;
+}
+
+static void record(void *ctx, const protocol_frame *frame) {
+    recorded_frame *copy = &recorded[recorded_count % RECORDED_FRAMES];
+
+    copy->type = frame->type;
+    copy->sequence = frame->sequence;
+    copy->length = frame->length;
+    // Touches every payload byte, so a payload reaching past the data it was
+    // parsed from is caught here
+    memcpy(copy->payload, frame->payload, frame->length);
+
+    recorded_count++;
+}
+
+static const recorded_frame *last_recorded(void) {
+    if (recorded_count == 0) {
+        return NULL;
+    }
+
+    return &recorded[(recorded_count - 1) % RECORDED_FRAMES];
+}
+
+/**
+ * Feeds `data` through a heap buffer of exactly its size
+ */
+static void feed_exact(protocol_parser *parser, const uint8_t *data,
+                       size_t len) {
+    uint8_t *copy = malloc(len > 0 ? len : 1);
+
+    memcpy(copy, data, len);
+    protocol_parser_feed(parser, copy, len);
+    free(copy);
+}
+
+/**
+ * Feeds `data` in random sized pieces, down to single bytes
+ */
+static void feed_split(protocol_parser *parser, const uint8_t *data,
+                       size_t len) {
+    while (len > 0) {
+        size_t piece = 1 + random_below(len < 64 ? len : 64);
+        if (random_below(4) == 0) {
+            piece = len;
+        }
+
+        feed_exact(parser, data, piece);
+        data += piece;
+        len -= piece;
+    }
+}
+
+static size_t random_frame(uint8_t *out, uint8_t sequence, uint16_t length) {
+    uint8_t payload[PROTOCOL_MAX_PAYLOAD];
+
+    for (uint16_t i = 0; i < length; i++) {
+        payload[i] = next_random();
+    }
+
+    return protocol_encode(out, PROTOCOL_MAX_FRAME, next_random(), sequence,
+                           payload, length);
+}
+
+static bool matches(const recorded_frame *frame, const uint8_t *encoded) {
+    uint16_t length = encoded[3] | (encoded[4] << 8);
+
+    return frame != NULL && frame->type == encoded[1] &&
+           frame->sequence == encoded[2] && frame->length == length &&
+           memcmp(frame->payload, &encoded[PROTOCOL_HEADER_SIZE], length) == 0;
+}
+
+static void test_split_frames(void) {
+    protocol_parser parser;
+    static uint8_t stream[16 * PROTOCOL_MAX_FRAME];
+    size_t offsets[16];
+    size_t length = 0;
+
+    protocol_parser_init(&parser, record, NULL);
+    recorded_count = 0;
+
+    // Empty and largest payloads included
+    static const uint16_t lengths[16] = {
+        0, 1, 2, PROTOCOL_MAX_PAYLOAD, 7, 300, 0, 64, 65, 3, 1023, 5, 0, 100,
+        PROTOCOL_MAX_PAYLOAD, 9,
+    };
+
+    for (size_t i = 0; i < 16; i++) {
+        offsets[i] = length;
+        length += random_frame(&stream[length], i, lengths[i]);
+    }
+
+    feed_split(&parser, stream, length);
+
+    CHECK_EQUAL(recorded_count, 16);
+    CHECK_EQUAL(parser.frames, 16);
+    CHECK_EQUAL(parser.crc_errors, 0);
+    CHECK_EQUAL(parser.length_errors, 0);
+    CHECK_EQUAL(parser.dropped_bytes, 0);
+    CHECK_EQUAL(parser.partial_length, 0);
+
+    for (size_t i = 0; i < 16 && i < recorded_count; i++) {
+        CHECK(matches(&recorded[i], &stream[offsets[i]]));
+    }
+}
+
+/**
+ * Feeds `bad` followed by good frames and returns true once one of them is
+ * delivered with nothing left over. A bad header can claim up to a whole frame
+ * of what follows it, so the good frame is repeated until that much has been
+ * fed, by which point the parser has to have found it again.
+ */
+static bool resync(protocol_parser *parser, const uint8_t *bad,
+                   size_t bad_length, bool split) {
+    uint8_t good[PROTOCOL_MAX_FRAME];
+    size_t good_length = random_frame(good, 0x5A, 1 + random_below(32));
+
+    if (split) {
+        feed_split(parser, bad, bad_length);
+    } else if (bad_length > 0) {
+        feed_exact(parser, bad, bad_length);
+    }
+
+    for (size_t fed = 0; fed < PROTOCOL_MAX_FRAME + good_length;
+         fed += good_length) {
+        if (split) {
+            feed_split(parser, good, good_length);
+        } else {
+            feed_exact(parser, good, good_length);
+        }
+
+        if (matches(last_recorded(), good) && parser->partial_length == 0) {
+            return true;
+        }
+    }
+
+    return false;
+}
+
+static void test_bad_crc(void) {
+    protocol_parser parser;
+    uint8_t frame[PROTOCOL_MAX_FRAME];
+
+    protocol_parser_init(&parser, record, NULL);
+    recorded_count = 0;
+
+    size_t length = random_frame(frame, 1, 20);
+    frame[length - 1] ^= 0x01;
+
+    CHECK(resync(&parser, frame, length, false));
+
+    CHECK_EQUAL(recorded_count, 1);
+    CHECK_EQUAL(parser.crc_errors, 1);
+}
+
+static void test_truncated(void) {
+    protocol_parser parser;
+    uint8_t frame[PROTOCOL_MAX_FRAME];
+
+    protocol_parser_init(&parser, record, NULL);
+    recorded_count = 0;
+
+    // The partial frame's length swallows the good frames after it, which have
+    // to be found again inside the bytes held back
+    size_t length = random_frame(frame, 1, 200);
+    CHECK(resync(&parser, frame, length / 2, false));
+    CHECK_EQUAL(parser.crc_errors, 1);
+
+    // Cut off inside the header too
+    CHECK(resync(&parser, frame, 3, true));
+}
+
+static void test_oversized_length(void) {
+    protocol_parser parser;
+    uint8_t frame[PROTOCOL_MAX_FRAME];
+
+    protocol_parser_init(&parser, record, NULL);
+    recorded_count = 0;
+
+    random_frame(frame, 1, 16);
+
+    static const uint16_t oversized[] = {PROTOCOL_MAX_PAYLOAD + 1, 0x8000,
+                                         0xFFFF};
+
+    for (size_t i = 0; i < 3; i++) {
+        frame[3] = oversized[i];
+        frame[4] = oversized[i] >> 8;
+
+        CHECK(resync(&parser, frame, PROTOCOL_HEADER_SIZE + 16, i == 2));
+    }
+
+    CHECK_EQUAL(recorded_count, 3);
+    CHECK_EQUAL(parser.length_errors, 3);
+}
+
+static void test_noise(void) {
+    protocol_parser parser;
+    uint8_t *noise = malloc(NOISE_BYTES);
+
+    protocol_parser_init(&parser, record, NULL);
+    recorded_count = 0;
+
+    // Start bytes are made common so plenty of candidate headers turn up
+    for (size_t i = 0; i < NOISE_BYTES; i++) {
+        noise[i] = random_below(8) == 0 ? PROTOCOL_START_OF_FRAME
+                                        : next_random();
+    }
+
+    feed_split(&parser, noise, NOISE_BYTES);
+    free(noise);
+
+    CHECK(parser.partial_length <= PROTOCOL_MAX_FRAME);
+
+    // Whatever the noise left half parsed, good frames come through again
+    CHECK(resync(&parser, NULL, 0, false));
+}
+
+/**
+ * Applies one random corruption to the frame in `frame` and returns its new
+ * length
+ */
+static size_t mutate(uint8_t *frame, size_t length) {
+    switch (random_below(5)) {
+        case 0:
+            // Flipped bits anywhere, caught by the CRC
+            for (uint32_t n = 1 + random_below(4); n > 0; n--) {
+                frame[random_below(length)] ^= 1 << random_below(8);
+            }
+            return length;
+        case 1:
+            // Cut short
+            return random_below(length);
+        case 2:
+            // Length beyond the largest payload
+            frame[3] = next_random();
+            frame[4] = 0x04 | next_random();
+            return length;
+        case 3:
+            // Length that disagrees with the payload sent
+            frame[3] = next_random();
+            frame[4] = random_below(4);
+            return length;
+        default:
+            // Start bytes inside the payload
+            for (uint32_t n = 1 + random_below(4); n > 0; n--) {
+                frame[random_below(length)] = PROTOCOL_START_OF_FRAME;
+            }
+            return length;
+    }
+}
+
+static void test_mutated_frames(void) {
+    protocol_parser parser;
+    uint8_t frame[PROTOCOL_MAX_FRAME];
+    uint32_t lost = 0;
+
+    protocol_parser_init(&parser, record, NULL);
+    recorded_count = 0;
+
+    for (uint32_t round = 0; round < FUZZ_ROUNDS; round++) {
+        size_t length = random_frame(frame, round, random_below(64));
+        length = mutate(frame, length);
+
+        if (!resync(&parser, frame, length, round % 2 == 0)) {
+            lost++;
+        }
+    }
+
+    CHECK_EQUAL(lost, 0);
+}
+
+int main(void) {
+    test_split_frames();
+    test_bad_crc();
+    test_truncated();
+    test_oversized_length();
+    test_noise();
+    test_mutated_frames();
+
+    return check_result("protocol");
+}
@@ -0,0 +1,200 @@
+/**
+ * THD+N of the polyphase resampler. Sines swept across the passband are
+ * converted from the A2DP rates up to the I2S rate, the fundamental is fitted
+ * out of each output by least squares, and what is left over, distortion,
+ * aliases and noise together, has to stay below a bound for each quality.
+ */
+
+#include "audio_dsp/resampler.h"
+#include "check.h"
+#include <inttypes.h>
+#include <math.h>
+#include <stdint.h>
+#include <stdio.h>
+
+#define OUTPUT_RATE 48000
+
+//! -6 dBFS, clear of clipping on any filter overshoot
+#define AMPLITUDE 16384.0
+
+//! Input frames converted per tone
+#define INPUT_FRAMES 8192
+//! Output frames left out of the measurement while the filter history fills
+#define SETTLE_FRAMES 256
+//! Output frames converted per call, the music profile's block
+#define BLOCK_FRAMES 480
+
+#define OUTPUT_FRAMES (INPUT_FRAMES * 4)
+
+typedef struct {
+    ResamplerQuality quality;
+    const char *name;
+    //! Highest tone swept as a fraction of the input Nyquist frequency. The
+    //! short low quality filter lets images through well below its passband
+    //! edge, so its bound only holds for the lower half of the band.
+    double top;
+    //! Worst THD+N allowed anywhere in the sweep, in dB below the fundamental
+    double limit_db;
+} quality_bound;
+
+static const quality_bound BOUNDS[] = {
+    {ResamplerLow, "low", 0.5, -60.0},
+    {ResamplerMedium, "medium", 0.75, -65.0},
+    {ResamplerHigh, "high", 0.75, -75.0},
+};
+
+static const uint32_t INPUT_RATES[] = {44100, 16000};
+
+//! Tones as fractions of the input Nyquist frequency, from the bass up to just
+//! inside the narrowest passband, in ascending order
+static const double SWEEP[] = {0.005, 0.02, 0.05, 0.1, 0.2, 0.3,
+                               0.4,   0.5,  0.6,  0.7, 0.75};
+
+static int16_t input[INPUT_FRAMES * RESAMPLER_CHANNELS];
+static int16_t output[OUTPUT_FRAMES * RESAMPLER_CHANNELS];
+
+/**
+ * Solves the 3 x 3 system `m` x = `v` in place by Gaussian elimination, the
+ * normal equations of the sine fit are well conditioned enough to skip
+ * pivoting
+ */
+static void solve3(double m[3][3], double v[3]) {
+    for (int col = 0; col < 3; col++) {
+        for (int row = col + 1; row < 3; row++) {
+            double factor = m[row][col] / m[col][col];
+            for (int k = col; k < 3; k++) {
+                m[row][k] -= factor * m[col][k];
+            }
+            v[row] -= factor * v[col];
+        }
+    }
+
+    for (int row = 2; row >= 0; row--) {
+        for (int k = row + 1; k < 3; k++) {
+            v[row] -= m[row][k] * v[k];
+        }
+        v[row] /= m[row][row];
+    }
+}
+
+/**
+ * Fits a sine of `frequency` plus an offset to one channel of the output and
+ * returns the energy of the residual relative to the fitted sine in dB
+ */
+static double thd_n_db(const int16_t *samples, size_t frames,
+                       double frequency) {
+    double w = 2.0 * M_PI * frequency / OUTPUT_RATE;
+    double m[3][3] = {{0}};
+    double v[3] = {0};
+
+    for (size_t i = 0; i < frames; i++) {
+        double basis[3] = {sin(w * i), cos(w * i), 1.0};
+        double y = samples[i * RESAMPLER_CHANNELS];
+
+        for (int r = 0; r < 3; r++) {
+            for (int c = 0; c < 3; c++) {
+                m[r][c] += basis[r] * basis[c];
+            }
+            v[r] += basis[r] * y;
+        }
+    }
+
+    solve3(m, v);
+
+    double signal = 0;
+    double residual = 0;
+
+    for (size_t i = 0; i < frames; i++) {
+        double fit = v[0] * sin(w * i) + v[1] * cos(w * i);
+        double error = samples[i * RESAMPLER_CHANNELS] - fit - v[2];
+
+        signal += fit * fit;
+        residual += error * error;
+    }
+
+    return 10.0 * log10(residual / signal);
+}
+
+/**
+ * Converts a tone of `frequency` in blocks like the output task does and
+ * returns its worst THD+N over both channels
+ */
+static double measure(resampler *converter, uint32_t input_rate,
+                      double frequency) {
+    // The right channel carries a lower tone, so channels bleeding into each
+    // other show up in the residual
+    double right_frequency = frequency * 3 / 4;
+
+    for (size_t i = 0; i < INPUT_FRAMES; i++) {
+        double t = (double)i / input_rate;
+        input[i * RESAMPLER_CHANNELS] =
+            (int16_t)lrint(AMPLITUDE * sin(2.0 * M_PI * frequency * t));
+        input[i * RESAMPLER_CHANNELS + 1] =
+            (int16_t)lrint(AMPLITUDE * sin(2.0 * M_PI * right_frequency * t));
+    }
+
+    resampler_reset(converter);
+
+    size_t used = 0;
+    size_t produced = 0;
+
+    while (used < INPUT_FRAMES && produced + BLOCK_FRAMES <= OUTPUT_FRAMES) {
+        size_t consumed;
+        size_t frames = resampler_process(
+            converter, &input[used * RESAMPLER_CHANNELS], INPUT_FRAMES - used,
+            &consumed, &output[produced * RESAMPLER_CHANNELS], BLOCK_FRAMES);
+
+        used += consumed;
+        produced += frames;
+    }
+
+    CHECK(produced > SETTLE_FRAMES * 2);
+
+    const int16_t *settled = &output[SETTLE_FRAMES * RESAMPLER_CHANNELS];
+    size_t frames = produced - SETTLE_FRAMES;
+
+    double left = thd_n_db(settled, frames, frequency);
+    double right = thd_n_db(settled + 1, frames, right_frequency);
+
+    return left > right ? left : right;
+}
+
+static void test_sweep(const quality_bound *bound, uint32_t input_rate) {
+    static resampler converter;
+
+    CHECK(resampler_configure(&converter, input_rate, OUTPUT_RATE,
+                              bound->quality));
+
+    double worst = -INFINITY;
+    double worst_frequency = 0;
+
+    for (size_t i = 0; i < sizeof(SWEEP) / sizeof(SWEEP[0]) &&
+                       SWEEP[i] <= bound->top;
+         i++) {
+        double frequency = SWEEP[i] * input_rate / 2;
+        double thd_n = measure(&converter, input_rate, frequency);
+
+        if (thd_n > worst) {
+            worst = thd_n;
+            worst_frequency = frequency;
+        }
+    }
+
+    printf("%" PRIu32 " Hz to %d Hz, %s quality: worst THD+N %.1f dB at "
+           "%.0f Hz, limit %.1f dB\n",
+           input_rate, OUTPUT_RATE, bound->name, worst, worst_frequency,
+           bound->limit_db);
+
+    CHECK(worst < bound->limit_db);
+}
+
+int main(void) {
+    for (size_t i = 0; i < sizeof(BOUNDS) / sizeof(BOUNDS[0]); i++) {
+        for (size_t j = 0; j < sizeof(INPUT_RATES) / sizeof(INPUT_RATES[0]);
+             j++) {
+            test_sweep(&BOUNDS[i], INPUT_RATES[j]);
+        }
+    }
+
+    return check_result("resampler");
+}
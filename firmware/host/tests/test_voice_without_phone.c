@@ -0,0 +1,137 @@
+/**
+ * Runs the simulator with a voice at the mic and no phone ever connecting, and
+ * checks that the voice is heard at the DAC output. With the analog bypass
+ * gone the voice only reaches the outputs through the DACs, so a DAC left
+ * muted until A2DP connects silences the whole unit.
+ *
+ * Takes the simulator and a directory for its files as arguments.
+ */
+
+#include "check.h"
+#include "wav.h"
+#include <math.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#define SAMPLE_RATE 48000
+#define FRAMES SAMPLE_RATE
+
+//! A 150 Hz buzz with harmonics, shaped like a voice so the feedback
+//! suppressor leaves it alone, at about -12 dBFS
+#define FUNDAMENTAL_HZ 150.0
+#define HARMONICS 8
+#define AMPLITUDE 8000.0
+
+//! Boot and the output's buffering are over well before then
+#define SETTLE_FRAMES (SAMPLE_RATE / 4)
+
+//! Quietest the voice may come out relative to the mic, the pipeline runs at
+//! unity with every effect off
+#define MIN_LEVEL_DB -6.0
+
+static int16_t mic[FRAMES];
+static int16_t out[FRAMES * 2];
+
+static bool write_mic(const char *path) {
+    wav_writer writer;
+
+    for (size_t i = 0; i < FRAMES; i++) {
+        double t = (double)i / SAMPLE_RATE;
+        double sample = 0;
+
+        for (int h = 1; h <= HARMONICS; h++) {
+            sample += sin(2.0 * M_PI * FUNDAMENTAL_HZ * h * t) / h;
+        }
+
+        mic[i] = (int16_t)lrint(AMPLITUDE / 2 * sample);
+    }
+
+    if (!wav_open_write(&writer, path, SAMPLE_RATE, 1)) {
+        return false;
+    }
+
+    bool written = wav_write(&writer, mic, FRAMES);
+    wav_close_write(&writer);
+
+    return written;
+}
+
+static size_t read_out(const char *path) {
+    wav_reader reader;
+
+    if (!wav_open_read(&reader, path)) {
+        return 0;
+    }
+
+    size_t frames = 0;
+    size_t got;
+    while (frames < FRAMES &&
+           (got = wav_read_stereo(&reader, &out[frames * 2],
+                                  FRAMES - frames)) > 0) {
+        frames += got;
+    }
+
+    wav_close_read(&reader);
+    return frames;
+}
+
+//! RMS of every `stride`th sample of `samples` over `frames` frames
+static double rms(const int16_t *samples, size_t frames, size_t stride) {
+    double sum = 0;
+
+    for (size_t i = 0; i < frames; i++) {
+        double sample = samples[i * stride];
+        sum += sample * sample;
+    }
+
+    return sqrt(sum / frames);
+}
+
+int main(int argc, char **argv) {
+    if (argc != 3) {
+        fprintf(stderr, "Usage: %s SIMULATOR DIRECTORY\n", argv[0]);
+        return EXIT_FAILURE;
+    }
+
+    char mic_path[1024];
+    char out_path[1024];
+    char command[4096];
+
+    snprintf(mic_path, sizeof(mic_path), "%s/voice_without_phone_mic.wav",
+             argv[2]);
+    snprintf(out_path, sizeof(out_path), "%s/voice_without_phone_out.wav",
+             argv[2]);
+
+    CHECK(write_mic(mic_path));
+
+    // The phone is due long after the run ends, so A2DP never connects
+    snprintf(command, sizeof(command),
+             "'%s' --mic '%s' --out '%s' --duration 1 --connect 60 "
+             "> /dev/null 2>&1",
+             argv[1], mic_path, out_path);
+    CHECK_EQUAL(system(command), 0);
+
+    size_t frames = read_out(out_path);
+    CHECK(frames > SETTLE_FRAMES * 2);
+    if (frames <= SETTLE_FRAMES * 2) {
+        return check_result("voice_without_phone");
+    }
+
+    double mic_level = rms(&mic[SETTLE_FRAMES], frames - SETTLE_FRAMES, 1);
+    double left = rms(&out[SETTLE_FRAMES * 2], frames - SETTLE_FRAMES, 2);
+    double right = rms(&out[SETTLE_FRAMES * 2 + 1], frames - SETTLE_FRAMES, 2);
+
+    double left_db = 20.0 * log10(left / mic_level);
+    double right_db = 20.0 * log10(right / mic_level);
+
+    printf("Voice without a phone: left %.1f dB, right %.1f dB relative to "
+           "the mic, limit %.1f dB\n",
+           left_db, right_db, MIN_LEVEL_DB);
+
+    CHECK(left_db > MIN_LEVEL_DB);
+    CHECK(right_db > MIN_LEVEL_DB);
+
+    return check_result("voice_without_phone");
+}
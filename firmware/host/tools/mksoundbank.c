@@ -0,0 +1,307 @@
+/**
+ * Builds a soundbank image from WAV files. Clips are IMA-ADPCM compressed by
+ * default, each is decoded again to report what the compression costs in
+ * signal to noise ratio.
+ *
+ * Usage: mksoundbank [options] -o bank.bin [name=]clip.wav...
+ *
+ * Clips are named after their file unless a name is given. Their index in the
+ * bank, which MessagePlayClip refers to, is the order on the command line.
+ */
+
+#include "audio_dsp/adpcm.h"
+#include "audio_dsp/soundbank.h"
+#include "wav.h"
+#include <getopt.h>
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+
+//! The rate the firmware mixes at, it refuses banks with any other
+#define DEFAULT_SAMPLE_RATE 48000
+
+//! Size of the soundbank partition in partitions.csv
+#define DEFAULT_MAX_SIZE 0x1F0000
+
+typedef struct {
+    char name[SOUNDBANK_NAME_SIZE + 1];
+    uint8_t channels;
+    uint32_t frames;
+    int16_t *samples;
+    uint8_t *data;
+    uint32_t size;
+    uint32_t offset;
+} clip;
+
+static void usage(const char *name) {
+    fprintf(stderr,
+            "Usage: %s [options] -o FILE [name=]clip.wav...\n"
+            "  -o, --output FILE    image to write\n"
+            "  --pcm                store clips uncompressed\n"
+            "  --rate HZ            sample rate every clip must have\n"
+            "  --max-size BYTES     fail if the image would not fit\n",
+            name);
+}
+
+static void *allocate(size_t size) {
+    void *memory = calloc(1, size ? size : 1);
+    if (memory == NULL) {
+        fprintf(stderr, "Out of memory\n");
+        exit(EXIT_FAILURE);
+    }
+    return memory;
+}
+
+static void put_u16(uint8_t *out, uint16_t value) {
+    out[0] = value;
+    out[1] = value >> 8;
+}
+
+static void put_u32(uint8_t *out, uint32_t value) {
+    out[0] = value;
+    out[1] = value >> 8;
+    out[2] = value >> 16;
+    out[3] = value >> 24;
+}
+
+/**
+ * Splits `name=path` and derives a name from the file otherwise
+ */
+static const char *parse_argument(const char *argument, char *name) {
+    const char *equals = strchr(argument, '=');
+    const char *path = argument;
+    const char *start;
+    size_t length;
+
+    if (equals != NULL) {
+        path = equals + 1;
+        start = argument;
+        length = equals - argument;
+    } else {
+        const char *slash = strrchr(argument, '/');
+        const char *dot = strrchr(argument, '.');
+
+        start = slash != NULL ? slash + 1 : argument;
+        length = dot != NULL && dot > start ? (size_t)(dot - start)
+                                            : strlen(start);
+    }
+
+    if (length > SOUNDBANK_NAME_SIZE) {
+        fprintf(stderr, "%s: name truncated to %d characters\n", argument,
+                SOUNDBANK_NAME_SIZE);
+        length = SOUNDBANK_NAME_SIZE;
+    }
+
+    memcpy(name, start, length);
+    name[length] = '\0';
+
+    return path;
+}
+
+static bool load(clip *entry, const char *path, uint32_t sample_rate) {
+    wav_reader reader;
+
+    if (!wav_open_read(&reader, path)) {
+        return false;
+    }
+
+    if (reader.sample_rate != sample_rate) {
+        fprintf(stderr, "%s: %lu Hz, resample it to %lu Hz first\n", path,
+                (unsigned long)reader.sample_rate, (unsigned long)sample_rate);
+        wav_close_read(&reader);
+        return false;
+    }
+
+    entry->channels = reader.channels > 1 ? 2 : 1;
+    entry->samples = allocate((size_t)reader.frames * 2 * sizeof(int16_t));
+    entry->frames = wav_read_stereo(&reader, entry->samples, reader.frames);
+    wav_close_read(&reader);
+
+    // Mono clips are stored mono, half the flash for the same sound
+    if (entry->channels == 1) {
+        for (uint32_t i = 0; i < entry->frames; i++) {
+            entry->samples[i] = entry->samples[2 * i];
+        }
+    }
+
+    if (entry->frames == 0) {
+        fprintf(stderr, "%s: no samples\n", path);
+        return false;
+    }
+
+    return true;
+}
+
+static void encode(clip *entry, SoundbankEncoding encoding) {
+    size_t samples = (size_t)entry->frames * entry->channels;
+
+    if (encoding == SoundbankImaAdpcm) {
+        entry->size = adpcm_encoded_size(entry->frames, entry->channels);
+        entry->data = allocate(entry->size);
+        adpcm_encode(entry->samples, entry->frames, entry->channels,
+                     entry->data);
+    } else {
+        entry->size = samples * sizeof(int16_t);
+        entry->data = allocate(entry->size);
+        for (size_t i = 0; i < samples; i++) {
+            put_u16(&entry->data[2 * i], entry->samples[i]);
+        }
+    }
+}
+
+/**
+ * Signal to noise ratio of the clip as the firmware will decode it, infinite
+ * for uncompressed clips
+ */
+static double snr_db(const clip *entry, SoundbankEncoding encoding) {
+    if (encoding != SoundbankImaAdpcm) {
+        return INFINITY;
+    }
+
+    size_t samples = (size_t)entry->frames * entry->channels;
+    int16_t *decoded = allocate(samples * sizeof(int16_t));
+
+    adpcm_decoder decoder;
+    adpcm_decoder_init(&decoder, entry->data, entry->channels);
+    adpcm_decode(&decoder, decoded, entry->frames);
+
+    double signal = 0;
+    double noise = 0;
+    for (size_t i = 0; i < samples; i++) {
+        double error = (double)decoded[i] - entry->samples[i];
+        signal += (double)entry->samples[i] * entry->samples[i];
+        noise += error * error;
+    }
+
+    free(decoded);
+
+    return noise == 0 ? INFINITY : 10 * log10(signal / noise);
+}
+
+int main(int argc, char **argv) {
+    static const struct option options[] = {
+        {"output", required_argument, NULL, 'o'},
+        {"pcm", no_argument, NULL, 'p'},
+        {"rate", required_argument, NULL, 'r'},
+        {"max-size", required_argument, NULL, 'm'},
+        {"help", no_argument, NULL, 'h'},
+        {NULL, 0, NULL, 0},
+    };
+
+    const char *output_path = NULL;
+    SoundbankEncoding encoding = SoundbankImaAdpcm;
+    uint32_t sample_rate = DEFAULT_SAMPLE_RATE;
+    uint64_t max_size = DEFAULT_MAX_SIZE;
+
+    int option;
+    while ((option = getopt_long(argc, argv, "o:h", options, NULL)) != -1) {
+        switch (option) {
+            case 'o':
+                output_path = optarg;
+                break;
+            case 'p':
+                encoding = SoundbankPcm16;
+                break;
+            case 'r':
+                sample_rate = strtoul(optarg, NULL, 10);
+                break;
+            case 'm':
+                max_size = strtoull(optarg, NULL, 0);
+                break;
+            default:
+                usage(argv[0]);
+                return option == 'h' ? EXIT_SUCCESS : EXIT_FAILURE;
+        }
+    }
+
+    size_t count = argc - optind;
+    if (output_path == NULL || count == 0) {
+        usage(argv[0]);
+        return EXIT_FAILURE;
+    }
+
+    if (count > SOUNDBANK_MAX_CLIPS) {
+        fprintf(stderr, "At most %d clips fit in a bank\n",
+                SOUNDBANK_MAX_CLIPS);
+        return EXIT_FAILURE;
+    }
+
+    clip *clips = allocate(count * sizeof(clip));
+    uint64_t size = SOUNDBANK_HEADER_SIZE + count * SOUNDBANK_ENTRY_SIZE;
+    uint64_t pcm_size = 0;
+
+    printf("%-16s %3s %8s %9s %8s %7s\n", "clip", "ch", "seconds", "bytes",
+           "ratio", "SNR dB");
+
+    for (size_t i = 0; i < count; i++) {
+        clip *entry = &clips[i];
+        const char *path = parse_argument(argv[optind + i], entry->name);
+
+        if (!load(entry, path, sample_rate)) {
+            return EXIT_FAILURE;
+        }
+
+        encode(entry, encoding);
+
+        // Clip data starts 4 byte aligned so it can be read in place
+        size = (size + 3) & ~(uint64_t)3;
+        entry->offset = size;
+        size += entry->size;
+
+        uint32_t raw = entry->frames * entry->channels * sizeof(int16_t);
+        pcm_size += raw;
+
+        printf("%-16s %3u %8.3f %9lu %7.2fx %7.1f\n", entry->name,
+               entry->channels, (double)entry->frames / sample_rate,
+               (unsigned long)entry->size, (double)raw / entry->size,
+               snr_db(entry, encoding));
+    }
+
+    printf("%zu clips, %llu bytes, %.2fx smaller than PCM, %.1f%% of %llu\n",
+           count, (unsigned long long)size, (double)pcm_size / size,
+           100.0 * size / max_size, (unsigned long long)max_size);
+
+    if (size > max_size) {
+        fprintf(stderr, "Image does not fit\n");
+        return EXIT_FAILURE;
+    }
+
+    uint8_t *image = allocate(size);
+
+    put_u32(&image[0], SOUNDBANK_MAGIC);
+    put_u16(&image[4], SOUNDBANK_VERSION);
+    put_u16(&image[6], count);
+    put_u32(&image[8], sample_rate);
+    put_u32(&image[12], size);
+
+    for (size_t i = 0; i < count; i++) {
+        const clip *entry = &clips[i];
+        uint8_t *table =
+            &image[SOUNDBANK_HEADER_SIZE + i * SOUNDBANK_ENTRY_SIZE];
+
+        put_u32(&table[0], entry->offset);
+        put_u32(&table[4], entry->size);
+        put_u32(&table[8], entry->frames);
+        table[12] = entry->channels;
+        table[13] = encoding;
+        memcpy(&table[16], entry->name, strlen(entry->name));
+
+        memcpy(&image[entry->offset], entry->data, entry->size);
+    }
+
+    // Catches any disagreement with the parser the firmware uses
+    soundbank bank;
+    if (!soundbank_open(&bank, image, size)) {
+        fprintf(stderr, "Built an image the firmware would reject\n");
+        return EXIT_FAILURE;
+    }
+
+    FILE *output = fopen(output_path, "wb");
+    if (output == NULL || fwrite(image, 1, size, output) != size ||
+        fclose(output) != 0) {
+        fprintf(stderr, "%s: cannot write\n", output_path);
+        return EXIT_FAILURE;
+    }
+
+    return EXIT_SUCCESS;
+}
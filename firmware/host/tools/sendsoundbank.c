@@ -0,0 +1,352 @@
+/**
+ * Uploads a soundbank image to the device over its SPP port and reports the
+ * throughput achieved. Interrupted uploads continue where they stopped when
+ * the same image is sent again.
+ *
+ * Usage: sendsoundbank [options] /dev/rfcomm0 bank.bin
+ *
+ * Chunks are streamed back to back, keeping as many unacknowledged as the
+ * device allows. A lost chunk rewinds the stream to the last committed offset,
+ * and if the device goes quiet the upload is begun again, which resumes it.
+ */
+
+#include "audio_dsp/protocol.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <getopt.h>
+#include <poll.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <termios.h>
+#include <time.h>
+#include <unistd.h>
+
+#define DEFAULT_TIMEOUT_MS 3000
+
+//! Begin requests sent before giving up on an unresponsive device
+#define MAX_ATTEMPTS 5
+
+typedef struct {
+    int fd;
+    protocol_parser parser;
+    uint8_t sequence;
+
+    //! Filled in by the begin reply
+    bool begun;
+    ProtocolStatus begin_status;
+    uint32_t resume_offset;
+    uint16_t chunk_size;
+    uint8_t window;
+
+    uint32_t committed;
+    size_t in_flight;
+    //! Chunks sent before the last rewind whose progress is still due
+    size_t stale;
+    uint32_t next;
+    bool rewind;
+
+    size_t retransmits;
+} session;
+
+static uint16_t get_u16(const uint8_t *in) { return in[0] | (in[1] << 8); }
+
+static uint32_t get_u32(const uint8_t *in) {
+    return in[0] | (in[1] << 8) | (in[2] << 16) | ((uint32_t)in[3] << 24);
+}
+
+static void put_u32(uint8_t *out, uint32_t value) {
+    out[0] = value;
+    out[1] = value >> 8;
+    out[2] = value >> 16;
+    out[3] = value >> 24;
+}
+
+static double now_s(void) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return now.tv_sec + now.tv_nsec / 1e9;
+}
+
+static bool write_all(int fd, const uint8_t *data, size_t len) {
+    while (len > 0) {
+        ssize_t written = write(fd, data, len);
+        if (written < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            perror("write");
+            return false;
+        }
+        data += written;
+        len -= written;
+    }
+    return true;
+}
+
+static void handle_frame(void *ctx, const protocol_frame *frame) {
+    session *link = ctx;
+
+    if (frame->type == (MessageUploadBegin | PROTOCOL_RESPONSE) &&
+        frame->length >= 1) {
+        link->begun = true;
+        link->begin_status = frame->payload[0];
+
+        if (frame->length >= 8) {
+            link->resume_offset = get_u32(&frame->payload[1]);
+            link->chunk_size = get_u16(&frame->payload[5]);
+            link->window = frame->payload[7];
+        }
+    } else if (frame->type == MessageUploadProgress && frame->length >= 9) {
+        ProtocolStatus status = frame->payload[0];
+
+        link->committed = get_u32(&frame->payload[5]);
+        if (link->in_flight > 0) {
+            link->in_flight--;
+        }
+
+        // Everything sent before a rewind is reported on but already
+        // accounted for
+        if (link->stale > 0) {
+            link->stale--;
+            return;
+        }
+
+        if (status == StatusMalformed) {
+            link->rewind = true;
+        }
+    }
+}
+
+/**
+ * Reads whatever arrives within `timeout_ms` and feeds it to the parser.
+ * Returns false if nothing did.
+ */
+static bool receive(session *link, int timeout_ms) {
+    struct pollfd ready = {.fd = link->fd, .events = POLLIN};
+
+    if (poll(&ready, 1, timeout_ms) <= 0) {
+        return false;
+    }
+
+    uint8_t buffer[1024];
+    ssize_t len = read(link->fd, buffer, sizeof(buffer));
+    if (len <= 0) {
+        return false;
+    }
+
+    protocol_parser_feed(&link->parser, buffer, len);
+    return true;
+}
+
+static bool begin(session *link, uint32_t size, uint32_t crc, int timeout_ms) {
+    uint8_t payload[8];
+    uint8_t frame[PROTOCOL_HEADER_SIZE + sizeof(payload) + PROTOCOL_CRC_SIZE];
+
+    put_u32(&payload[0], size);
+    put_u32(&payload[4], crc);
+
+    size_t length = protocol_encode(frame, sizeof(frame), MessageUploadBegin,
+                                    link->sequence++, payload, sizeof(payload));
+
+    link->begun = false;
+    if (!write_all(link->fd, frame, length)) {
+        return false;
+    }
+
+    // Progress for chunks still in the device's queue may come first
+    double deadline = now_s() + timeout_ms / 1000.0;
+    while (!link->begun && now_s() < deadline) {
+        receive(link, 100);
+    }
+
+    return link->begun;
+}
+
+static bool send_chunk(session *link, const uint8_t *image, uint32_t size,
+                       long corrupt, size_t *sent_chunks) {
+    static uint8_t chunk[PROTOCOL_CHUNK_MAX_SIZE];
+
+    uint32_t length = size - link->next;
+    if (length > link->chunk_size) {
+        length = link->chunk_size;
+    }
+
+    size_t chunk_length = protocol_encode_chunk(
+        chunk, sizeof(chunk), link->next, &image[link->next], length);
+
+    if ((long)(*sent_chunks)++ == corrupt) {
+        chunk[PROTOCOL_CHUNK_HEADER_SIZE] ^= 0x01;
+    }
+
+    link->next += length;
+    link->in_flight++;
+
+    return write_all(link->fd, chunk, chunk_length);
+}
+
+static void usage(const char *name) {
+    fprintf(stderr,
+            "Usage: %s [options] DEVICE IMAGE\n"
+            "  --timeout MS        silence before the upload is begun again\n"
+            "  --corrupt-chunk N   damage the Nth chunk sent, to exercise\n"
+            "                      recovery\n",
+            name);
+}
+
+static uint8_t *read_image(const char *path, uint32_t *size) {
+    FILE *file = fopen(path, "rb");
+    if (file == NULL) {
+        perror(path);
+        return NULL;
+    }
+
+    fseek(file, 0, SEEK_END);
+    long length = ftell(file);
+    fseek(file, 0, SEEK_SET);
+
+    uint8_t *image = malloc(length > 0 ? length : 1);
+    if (image == NULL || fread(image, 1, length, file) != (size_t)length) {
+        fprintf(stderr, "%s: cannot read\n", path);
+        fclose(file);
+        free(image);
+        return NULL;
+    }
+
+    fclose(file);
+    *size = length;
+
+    return image;
+}
+
+int main(int argc, char **argv) {
+    static const struct option options[] = {
+        {"timeout", required_argument, NULL, 't'},
+        {"corrupt-chunk", required_argument, NULL, 'c'},
+        {"help", no_argument, NULL, 'h'},
+        {NULL, 0, NULL, 0},
+    };
+
+    int timeout_ms = DEFAULT_TIMEOUT_MS;
+    long corrupt = -1;
+
+    int option;
+    while ((option = getopt_long(argc, argv, "h", options, NULL)) != -1) {
+        switch (option) {
+            case 't':
+                timeout_ms = atoi(optarg);
+                break;
+            case 'c':
+                corrupt = atol(optarg);
+                break;
+            default:
+                usage(argv[0]);
+                return option == 'h' ? EXIT_SUCCESS : EXIT_FAILURE;
+        }
+    }
+
+    if (argc - optind != 2) {
+        usage(argv[0]);
+        return EXIT_FAILURE;
+    }
+
+    uint32_t size;
+    uint8_t *image = read_image(argv[optind + 1], &size);
+    if (image == NULL) {
+        return EXIT_FAILURE;
+    }
+
+    static session link;
+    link.fd = open(argv[optind], O_RDWR | O_NOCTTY);
+    if (link.fd < 0) {
+        perror(argv[optind]);
+        return EXIT_FAILURE;
+    }
+
+    struct termios settings;
+    if (tcgetattr(link.fd, &settings) == 0) {
+        cfmakeraw(&settings);
+        tcsetattr(link.fd, TCSANOW, &settings);
+    }
+
+    protocol_parser_init(&link.parser, handle_frame, &link);
+
+    uint32_t crc = protocol_crc32(0, image, size);
+    size_t sent_chunks = 0;
+    size_t attempts = 0;
+    size_t resyncs = 0;
+    uint32_t first_offset = 0;
+    double start = 0;
+
+    for (;;) {
+        if (!begin(&link, size, crc, timeout_ms)) {
+            if (++attempts == MAX_ATTEMPTS) {
+                fprintf(stderr, "No reply from the device\n");
+                return EXIT_FAILURE;
+            }
+            continue;
+        }
+
+        if (link.begin_status != StatusOk || link.chunk_size == 0 ||
+            link.window == 0) {
+            fprintf(stderr, "Upload refused, status %d\n", link.begin_status);
+            return EXIT_FAILURE;
+        }
+
+        if (start == 0) {
+            start = now_s();
+            first_offset = link.resume_offset;
+            if (first_offset > 0) {
+                printf("Resuming at %u of %u bytes\n", first_offset, size);
+            }
+        }
+
+        link.committed = link.resume_offset;
+        link.next = link.resume_offset;
+        link.in_flight = 0;
+        link.stale = 0;
+        link.rewind = false;
+
+        while (link.committed < size) {
+            while (link.in_flight < link.window && link.next < size) {
+                if (!send_chunk(&link, image, size, corrupt, &sent_chunks)) {
+                    return EXIT_FAILURE;
+                }
+            }
+
+            if (!receive(&link, timeout_ms)) {
+                break;
+            }
+
+            if (link.rewind) {
+                link.rewind = false;
+                link.retransmits += (link.next - link.committed +
+                                     link.chunk_size - 1) /
+                                    link.chunk_size;
+                link.next = link.committed;
+                link.stale = link.in_flight;
+            }
+
+            printf("\r%u / %u bytes", link.committed, size);
+            fflush(stdout);
+        }
+
+        if (link.committed == size) {
+            break;
+        }
+
+        printf("\nDevice went quiet, beginning again\n");
+        resyncs++;
+        attempts = 0;
+    }
+
+    double elapsed = now_s() - start;
+    uint32_t transferred = size - first_offset;
+
+    printf("\r%u bytes in %.2f s, %.1f KB/s, %zu chunks resent, %zu "
+           "resyncs\n",
+           transferred, elapsed, transferred / elapsed / 1024,
+           link.retransmits, resyncs);
+
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,1016 @@
+/**
+ * This file decouples the A2DP decoder from the I2S peripheral. The Bluetooth
+ * data callback pushes PCM into a lock-free ring and returns immediately, and a
+ * dedicated writer task on the app core drains it into the I2S DMA buffers.
+ *
+ * I2S always runs at SAMPLE_RATE. The ring holds PCM at whatever rate the
+ * phone negotiated and the writer converts it with a polyphase resampler, so
+ * a rate change never has to stop and re-clock the I2S channel.
+ *
+ * When a voice pipeline is attached the same task also runs the full duplex
+ * mic path: each iteration reads one block from RX, runs it through the
+ * pipeline and mixes the result into the block written to TX. RX and TX share
+ * a clock, so the loop stays in lockstep with both DMA queues.
+ *
+ * Each codec is an output of its own, all on one clock. The stream, the sound
+ * effects and the voice are each rendered once per block and then mixed into
+ * whichever outputs they are routed to, so a second codec only adds the mix
+ * and whatever chain of its own its voice goes through.
+ *
+ * Every output has a mixer of its own that applies the source gains, ducks
+ * the stream while the wearer speaks and soft limits the sum. The voice keys
+ * the ducking on every output even where it is not routed, so music in the
+ * headset still dips for a voice that only goes out of the speaker.
+ *
+ * The last thing each output goes through is a lookahead limiter, always on,
+ * that keeps whatever the mix and tone add up to under the output's ceiling
+ * so the drivers are never hit with clipped full scale squares.
+ *
+ * How much is buffered is set by the active latency profile. Switching profile
+ * rebuilds every I2S channel with new DMA buffers from inside the writer task,
+ * between two blocks, so nothing else ever touches a channel mid teardown.
+ *
+ * Suspending for idle power-down works the same way: the writer stops every
+ * channel between two blocks and parks until resumed, then fades back in so
+ * the first block after the gap does not start with a step.
+ */
+
+#include "audio_output.h"
+#include "audio_dsp/limiter.h"
+#include "audio_dsp/meter.h"
+#include "audio_dsp/mixer.h"
+#include "audio_dsp/pcm_ring.h"
+#include "audio_dsp/resampler.h"
+#include "audio_dsp/tone.h"
+#include "codec/i2s.h"
+#include "driver/i2s_common.h"
+#include "esp_heap_caps.h"
+#include "esp_log.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/semphr.h"
+#include "freertos/task.h"
+#include "instrumentation.h"
+#include "latency_profile.h"
+#include "sound_effects.h"
+#include <inttypes.h>
+#include <stdatomic.h>
+#include <string.h>
+
+static const char *TAG = "AUDIO_OUT";
+
+//! Bytes per stereo 16 bit frame, writes are kept frame aligned
+#define FRAME_SIZE 4
+
+//! Source rate frames held between the ring and the resampler, enough for the
+//! largest block of 96 kHz input
+#define STAGING_FRAMES (LATENCY_PROFILE_MAX_BLOCK_FRAMES * 2 + 64)
+
+//! Weight of each new sample in the moving average of ring fill, as a shift
+#define FILL_AVERAGE_SHIFT 5
+
+//! Output fades in over this many frames after a resume, 5 ms
+#define RESUME_RAMP_FRAMES 240
+
+//! Blocks that peak below this, about -50 dBFS, count as silent. Mic noise
+//! and dither stay under it.
+#define AUDIBLE_THRESHOLD 100
+
+static TaskHandle_t output_task_handle;
+
+//! The headset codec's device leads the clocks and carries the mic
+static i2s_device devices[OutputCount];
+static size_t device_count;
+static audio_output_config output_config;
+
+static const latency_profile_config *profile;
+static _Atomic LatencyProfile active_profile;
+static _Atomic LatencyProfile requested_profile;
+//! Portion of the ring the producer may fill under the active profile
+static _Atomic size_t ring_depth;
+static _Atomic uint32_t fill_average;
+static _Atomic TickType_t profile_start;
+static _Atomic uint32_t profile_underruns;
+
+static pcm_ring ring;
+
+//! Outputs each source is mixed into, a bit per AudioOutput
+static _Atomic uint8_t routes[SourceCount];
+//! Shared stages render into these once per block
+static int16_t *stream_block;
+static int16_t *effects_block;
+//! What is written to each output
+static int16_t *output_blocks[OutputCount];
+//! Sources are added in AudioSource order, so a source is its mixer index
+static mixer mixers[OutputCount];
+
+static resampler stream_resampler;
+static int16_t staging[STAGING_FRAMES * 2];
+static size_t staged_frames;
+static uint32_t stream_rate;
+static ResamplerQuality stream_quality;
+static _Atomic uint32_t requested_rate;
+static _Atomic ResamplerQuality requested_quality;
+
+static audio_pipeline *_Atomic voice_pipeline;
+static uint32_t voice_latency_target_us;
+static int16_t *capture;
+static int16_t *voice;
+//! Processing applied to the voice on its way to one output only
+static audio_pipeline *_Atomic output_chains[OutputCount];
+//! Copy of the voice an output chain works on
+static int16_t *chain_voice;
+//! Tone control run on an output's mix when its codec does not do it
+static tone_control *_Atomic output_tones[OutputCount];
+static limiter limiters[OutputCount];
+
+//! Only the left ADC is captured, the right one may be powered down
+static atomic_bool mic_mono;
+//! Clock the voice pipeline measures its budgets against, 0 for no change
+static _Atomic uint32_t requested_cpu_hz;
+
+static atomic_bool suspend_requested;
+//! Given by the writer each time it has parked or started again
+static SemaphoreHandle_t suspend_changed;
+//! Frames into the fade after a resume, RESUME_RAMP_FRAMES once done
+static size_t ramp_position = RESUME_RAMP_FRAMES;
+//! Tick of the last block that had anything worth hearing in it
+static _Atomic TickType_t last_audible;
+
+static atomic_bool playing;
+static atomic_bool flush_requested;
+static _Atomic uint32_t underruns;
+static _Atomic uint32_t overruns;
+static _Atomic uint32_t dropped_bytes;
+
+/**
+ * Captures one block from the mic and runs the shared voice pipeline on it,
+ * leaving the result in `voice` for the outputs it is routed to
+ */
+static void process_voice(audio_pipeline *pipeline) {
+    size_t bytes_read = 0;
+    size_t frames = pipeline->block_frames;
+
+    i2s_channel_read(devices[OutputHeadset].rx, capture, frames * FRAME_SIZE,
+                     &bytes_read, portMAX_DELAY);
+
+    uint32_t start = instrumentation_begin();
+
+    // A short read only happens if RX was stopped, treat the rest as silence
+    size_t frames_read = bytes_read / FRAME_SIZE;
+
+    if (atomic_load(&mic_mono)) {
+        for (size_t i = 0; i < frames; i++) {
+            voice[i] = i < frames_read ? capture[2 * i] : 0;
+        }
+    } else {
+        for (size_t i = 0; i < frames; i++) {
+            voice[i] = i < frames_read
+                           ? (capture[2 * i] + capture[2 * i + 1]) >> 1
+                           : 0;
+        }
+    }
+
+    audio_pipeline_process(pipeline, voice);
+
+    if (meter_enabled()) {
+        meter_update(MeterVoice, voice, frames, 1);
+    }
+
+    instrumentation_end(SectionVoice, start);
+}
+
+/**
+ * Mixes one output's block from the sources rendered this block. The only
+ * processing of its own is the output's voice chain, if it has one and the
+ * voice is routed to it.
+ */
+static void mix_output(AudioOutput output, size_t frames, bool stream,
+                       bool effects, bool with_voice) {
+    mixer *mix = &mixers[output];
+    uint8_t bit = AUDIO_OUTPUT_TO(output);
+
+    const int16_t *inputs[SourceCount] = {
+        [SourceStream] = stream ? stream_block : NULL,
+        [SourceEffects] = effects ? effects_block : NULL,
+        [SourceVoice] = with_voice ? voice : NULL,
+    };
+
+    for (size_t i = 0; i < SourceCount; i++) {
+        mix->sources[i].samples = inputs[i];
+        mix->sources[i].muted = !(atomic_load(&routes[i]) & bit);
+    }
+
+    audio_pipeline *chain = atomic_load(&output_chains[output]);
+
+    if (with_voice && chain != NULL && !mix->sources[SourceVoice].muted) {
+        memcpy(chain_voice, voice, frames * sizeof(int16_t));
+        audio_pipeline_process(chain, chain_voice);
+        mix->sources[SourceVoice].samples = chain_voice;
+    }
+
+    mixer_process(mix, output_blocks[output], frames);
+}
+
+/**
+ * Picks up rate or quality changes requested from other tasks. The filter is
+ * redesigned here so the tables are never swapped under a running conversion.
+ */
+static void apply_stream_format(void) {
+    uint32_t rate = atomic_load(&requested_rate);
+    ResamplerQuality quality = atomic_load(&requested_quality);
+
+    if (rate == stream_rate && quality == stream_quality) {
+        return;
+    }
+
+    if (!resampler_configure(&stream_resampler, rate, SAMPLE_RATE, quality)) {
+        ESP_LOGE(TAG, "Cannot convert %" PRIu32 " Hz to %d Hz", rate,
+                 SAMPLE_RATE);
+        atomic_store(&requested_rate, stream_rate);
+        atomic_store(&requested_quality, stream_quality);
+        return;
+    }
+
+    if (rate != stream_rate) {
+        instrumentation_count_rate_switch();
+    }
+
+    stream_rate = rate;
+    stream_quality = quality;
+    staged_frames = 0;
+
+    ESP_LOGI(TAG, "Resampling %" PRIu32 " Hz to %d Hz with %d taps", rate,
+             SAMPLE_RATE, quality);
+}
+
+/**
+ * Time a block takes from being mixed to reaching the DAC: the limiter's
+ * lookahead and the DMA queue it is written behind
+ */
+static uint32_t output_delay_us(const latency_profile_config *config) {
+    uint32_t frames = config->lookahead_frames +
+                      config->dma_desc_num * config->dma_frame_num;
+
+    return (uint64_t)frames * 1000000 / SAMPLE_RATE;
+}
+
+static uint32_t voice_latency_us(const latency_profile_config *config,
+                                 const audio_pipeline *pipeline) {
+    uint32_t frames = config->block_frames;
+
+    if (pipeline != NULL) {
+        frames += audio_pipeline_latency_frames(pipeline);
+    }
+
+    return (uint64_t)frames * 1000000 / SAMPLE_RATE + output_delay_us(config);
+}
+
+/**
+ * Switches to a profile requested from another task. Every channel is rebuilt
+ * with the new DMA geometry, so one block of silence goes out on the switch but
+ * whatever is queued in the ring survives it.
+ */
+static void apply_latency_profile(void) {
+    LatencyProfile requested = atomic_load(&requested_profile);
+
+    if (requested == atomic_load(&active_profile)) {
+        return;
+    }
+
+    const latency_profile_config *next = latency_profile_get(requested);
+    audio_pipeline *pipeline = atomic_load(&voice_pipeline);
+
+    esp_err_t result = i2s_devices_set_dma_geometry(
+        devices, device_count, next->dma_desc_num, next->dma_frame_num);
+
+    if (result != ESP_OK) {
+        ESP_LOGE(TAG, "Failed to switch to %s profile: %s", next->name,
+                 esp_err_to_name(result));
+
+        // Try to get back to a working output with the old geometry
+        next = profile;
+        requested = atomic_load(&active_profile);
+        atomic_store(&requested_profile, requested);
+
+        ESP_ERROR_CHECK(i2s_devices_set_dma_geometry(devices, device_count,
+                                                     next->dma_desc_num,
+                                                     next->dma_frame_num));
+    }
+
+    if (pipeline != NULL) {
+        ESP_ERROR_CHECK(i2s_channel_enable(devices[OutputHeadset].rx));
+        audio_pipeline_set_block_frames(pipeline, next->block_frames);
+    }
+
+    for (size_t i = 0; i < OutputCount; i++) {
+        audio_pipeline *chain = atomic_load(&output_chains[i]);
+        if (chain != NULL) {
+            audio_pipeline_set_block_frames(chain, next->block_frames);
+        }
+    }
+
+    if (next == profile) {
+        return;
+    }
+
+    for (size_t i = 0; i < device_count; i++) {
+        limiter_set_lookahead(&limiters[i], next->lookahead_frames);
+    }
+
+    profile = next;
+    atomic_store(&ring_depth, next->ring_size);
+    atomic_store(&fill_average, 0);
+    atomic_store(&profile_underruns, atomic_load(&underruns));
+    atomic_store(&profile_start, xTaskGetTickCount());
+    atomic_store(&active_profile, requested);
+
+    ESP_LOGI(TAG, "Switched to %s profile, %" PRIu32 " x %" PRIu32
+                  " DMA frames",
+             next->name, next->dma_desc_num, next->dma_frame_num);
+
+    if (pipeline != NULL &&
+        voice_latency_us(next, pipeline) > voice_latency_target_us) {
+        ESP_LOGW(TAG,
+                 "Voice latency %" PRIu32 " us exceeds target of %" PRIu32
+                 " us",
+                 voice_latency_us(next, pipeline), voice_latency_target_us);
+    }
+}
+
+/**
+ * Rescales the cycle budgets of the voice pipeline and every output chain to a
+ * CPU frequency set from another task, so budgets keep meaning the same share
+ * of the block after the governor changes the clock
+ */
+static void apply_cpu_frequency(void) {
+    uint32_t cpu_hz = atomic_exchange(&requested_cpu_hz, 0);
+    audio_pipeline *pipeline = atomic_load(&voice_pipeline);
+
+    if (cpu_hz == 0) {
+        return;
+    }
+
+    if (pipeline != NULL) {
+        audio_pipeline_set_cpu_hz(pipeline, cpu_hz);
+    }
+
+    for (size_t i = 0; i < OutputCount; i++) {
+        audio_pipeline *chain = atomic_load(&output_chains[i]);
+        if (chain != NULL) {
+            audio_pipeline_set_cpu_hz(chain, cpu_hz);
+        }
+    }
+}
+
+/**
+ * Pulls source rate PCM from the ring and converts up to `frames` output frames
+ * from it, returning how many were produced
+ */
+static size_t read_stream(int16_t *out, size_t frames) {
+    uint32_t start = instrumentation_begin();
+    size_t needed = resampler_input_needed(&stream_resampler, frames);
+    if (needed > STAGING_FRAMES) {
+        needed = STAGING_FRAMES;
+    }
+
+    if (staged_frames < needed) {
+        size_t bytes =
+            pcm_ring_read(&ring, (uint8_t *)&staging[staged_frames * 2],
+                          (needed - staged_frames) * FRAME_SIZE);
+        staged_frames += bytes / FRAME_SIZE;
+    }
+
+    size_t consumed;
+    size_t produced = resampler_process(&stream_resampler, staging,
+                                        staged_frames, &consumed, out, frames);
+
+    staged_frames -= consumed;
+    memmove(staging, &staging[consumed * 2], staged_frames * FRAME_SIZE);
+
+    instrumentation_end(SectionResample, start);
+
+    return produced;
+}
+
+/**
+ * Stops every channel and blocks until resumed. Whatever is still queued is
+ * dropped, the output only suspends once it has gone quiet.
+ */
+static void park_output(void) {
+    if (!atomic_load(&suspend_requested)) {
+        return;
+    }
+
+    audio_pipeline *pipeline = atomic_load(&voice_pipeline);
+
+    i2s_devices_stop(devices, device_count);
+
+    pcm_ring_discard(&ring);
+    resampler_reset(&stream_resampler);
+    staged_frames = 0;
+    atomic_store(&playing, false);
+
+    xSemaphoreGive(suspend_changed);
+
+    while (atomic_load(&suspend_requested)) {
+        ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+    }
+
+    // Together, so the outputs come back as aligned as they started
+    ESP_ERROR_CHECK(i2s_devices_start(devices, device_count));
+    if (pipeline != NULL) {
+        ESP_ERROR_CHECK(i2s_channel_enable(devices[OutputHeadset].rx));
+    }
+
+    ramp_position = 0;
+    atomic_store(&last_audible, xTaskGetTickCount());
+
+    xSemaphoreGive(suspend_changed);
+}
+
+//! Fades a block in from `ramp_position`, which the caller advances once all
+//! outputs have had the same fade applied
+static void apply_resume_ramp(int16_t *stereo, size_t frames) {
+    size_t position = ramp_position;
+
+    for (size_t i = 0; i < frames && position < RESUME_RAMP_FRAMES; i++) {
+        stereo[2 * i] = stereo[2 * i] * (int32_t)position / RESUME_RAMP_FRAMES;
+        stereo[2 * i + 1] =
+            stereo[2 * i + 1] * (int32_t)position / RESUME_RAMP_FRAMES;
+        position++;
+    }
+}
+
+static bool audible(const int16_t *stereo, size_t frames) {
+    for (size_t i = 0; i < frames * 2; i++) {
+        if (stereo[i] > AUDIBLE_THRESHOLD || stereo[i] < -AUDIBLE_THRESHOLD) {
+            return true;
+        }
+    }
+
+    return false;
+}
+
+static void output_task(void *pvParameters) {
+    size_t bytes_written;
+
+    while (true) {
+        size_t frames = 0;
+
+        if (atomic_exchange(&flush_requested, false)) {
+            pcm_ring_discard(&ring);
+            resampler_reset(&stream_resampler);
+            staged_frames = 0;
+            atomic_store(&playing, false);
+        }
+
+        park_output();
+        apply_latency_profile();
+        apply_stream_format();
+        apply_cpu_frequency();
+
+        size_t chunk_frames = profile->block_frames;
+        size_t fill = pcm_ring_fill(&ring);
+        instrumentation_record_fill(fill, atomic_load(&ring_depth));
+
+        if (atomic_load(&playing)) {
+            if (fill < profile->stop_watermark) {
+                atomic_fetch_add(&underruns, 1);
+                atomic_store(&playing, false);
+            } else {
+                frames = read_stream(stream_block, chunk_frames);
+            }
+        } else if (fill >= profile->start_watermark) {
+            atomic_store(&playing, true);
+            frames = read_stream(stream_block, chunk_frames);
+        }
+
+        if (frames > 0) {
+            uint32_t average = atomic_load(&fill_average);
+            average += ((int32_t)fill - (int32_t)average) >> FILL_AVERAGE_SHIFT;
+            atomic_store(&fill_average, average);
+        }
+
+        // Keep the DMA fed with silence while buffering so the writer stays
+        // paced by the I2S clock instead of spinning
+        memset(&stream_block[frames * 2], 0,
+               (chunk_frames - frames) * FRAME_SIZE);
+
+        bool metering = meter_enabled();
+        if (metering) {
+            meter_update(MeterMusic, stream_block, chunk_frames, 2);
+        }
+
+        audio_pipeline *pipeline = atomic_load(&voice_pipeline);
+        if (pipeline != NULL) {
+            process_voice(pipeline);
+        }
+
+        // After the wait for the mic block, so a clip triggered meanwhile
+        // still makes this block rather than the next
+        memset(effects_block, 0, chunk_frames * FRAME_SIZE);
+        bool effects = sound_effects_mix(effects_block, chunk_frames,
+                                         output_delay_us(profile));
+
+        bool heard = frames > 0;
+        uint32_t mix_start = instrumentation_begin();
+
+        for (size_t i = 0; i < device_count; i++) {
+            mix_output(i, chunk_frames, frames > 0, effects, pipeline != NULL);
+
+            tone_control *tone = atomic_load(&output_tones[i]);
+            if (tone != NULL) {
+                uint32_t tone_start = instrumentation_begin();
+                tone_process(tone, output_blocks[i], chunk_frames);
+                instrumentation_end(SectionTone, tone_start);
+            }
+
+            uint32_t limit_start = instrumentation_begin();
+            limiter_process(&limiters[i], output_blocks[i], chunk_frames);
+            instrumentation_end(SectionLimit, limit_start);
+
+            heard = heard || audible(output_blocks[i], chunk_frames);
+
+            if (ramp_position < RESUME_RAMP_FRAMES) {
+                apply_resume_ramp(output_blocks[i], chunk_frames);
+            }
+        }
+
+        instrumentation_end(SectionMix, mix_start);
+
+        if (heard) {
+            atomic_store(&last_audible, xTaskGetTickCount());
+        }
+
+        ramp_position += chunk_frames;
+        if (ramp_position > RESUME_RAMP_FRAMES) {
+            ramp_position = RESUME_RAMP_FRAMES;
+        }
+
+        if (metering) {
+            meter_tap(output_blocks[OutputHeadset], chunk_frames);
+        }
+
+        // The second write finds room straight away, both DMA queues drain
+        // on the same clock
+        for (size_t i = 0; i < device_count; i++) {
+            i2s_channel_write(devices[i].tx, output_blocks[i],
+                              chunk_frames * FRAME_SIZE, &bytes_written,
+                              portMAX_DELAY);
+        }
+    }
+}
+
+/**
+ * Takes over the I2S devices of every output, indexed by AudioOutput, and
+ * starts them. The first leads the clocks of the others and is the one the mic
+ * is captured from. Their channels are not yet enabled, and they must use the
+ * configured profile's DMA geometry.
+ */
+esp_err_t audio_output_init(const i2s_device *outputs, size_t count,
+                            const audio_output_config *config) {
+    profile = latency_profile_get(config->profile);
+    if (profile == NULL || count == 0 || count > OutputCount) {
+        ESP_LOGE(TAG, "Invalid output configuration");
+        return ESP_ERR_INVALID_ARG;
+    }
+
+    memcpy(devices, outputs, count * sizeof(i2s_device));
+    device_count = count;
+    output_config = *config;
+
+    // Buffers are sized for the largest profile so switching never allocates.
+    // The shared stages get one block each and every output one more.
+    size_t block_size = LATENCY_PROFILE_MAX_BLOCK_FRAMES * FRAME_SIZE;
+    uint8_t *storage = heap_caps_malloc(LATENCY_PROFILE_MAX_RING_SIZE,
+                                        MALLOC_CAP_INTERNAL | MALLOC_CAP_8BIT);
+    uint8_t *blocks = heap_caps_malloc((2 + count) * block_size,
+                                       MALLOC_CAP_INTERNAL | MALLOC_CAP_8BIT);
+
+    if (storage == NULL || blocks == NULL) {
+        ESP_LOGE(TAG, "Failed to allocate output buffers");
+        heap_caps_free(storage);
+        heap_caps_free(blocks);
+        return ESP_ERR_NO_MEM;
+    }
+
+    stream_block = (int16_t *)blocks;
+    effects_block = (int16_t *)(blocks + block_size);
+    for (size_t i = 0; i < count; i++) {
+        output_blocks[i] = (int16_t *)(blocks + (2 + i) * block_size);
+    }
+
+    pcm_ring_init(&ring, storage, LATENCY_PROFILE_MAX_RING_SIZE);
+
+    if (!resampler_configure(&stream_resampler, output_config.input_rate,
+                             SAMPLE_RATE, output_config.resampler_quality)) {
+        ESP_LOGE(TAG, "Unsupported input rate %" PRIu32,
+                 output_config.input_rate);
+        heap_caps_free(storage);
+        heap_caps_free(blocks);
+        return ESP_ERR_INVALID_ARG;
+    }
+
+    for (size_t i = 0; i < SourceCount; i++) {
+        atomic_store(&routes[i], config->routes[i] & ((1 << count) - 1));
+    }
+
+    mixer_ducking_times times = MIXER_DEFAULT_DUCKING_TIMES();
+
+    for (size_t i = 0; i < count; i++) {
+        mixer_init(&mixers[i], SAMPLE_RATE, &times);
+        mixer_add_source(&mixers[i], 2, MixerDucked, MIXER_UNITY_GAIN);
+        mixer_add_source(&mixers[i], 2, 0, MIXER_UNITY_GAIN);
+        mixer_add_source(&mixers[i], 1, MixerSidechain, MIXER_UNITY_GAIN);
+        mixer_set_duck_threshold(&mixers[i], config->duck_threshold);
+        mixer_set_duck_depth(&mixers[i], config->duck_depth);
+
+        limiter_init(&limiters[i], SAMPLE_RATE, profile->lookahead_frames);
+        if (!limiter_configure(&limiters[i], &config->limiter)) {
+            ESP_LOGE(TAG, "Invalid limiter configuration");
+            heap_caps_free(storage);
+            heap_caps_free(blocks);
+            return ESP_ERR_INVALID_ARG;
+        }
+    }
+
+    stream_rate = output_config.input_rate;
+    stream_quality = output_config.resampler_quality;
+    atomic_store(&requested_rate, stream_rate);
+    atomic_store(&requested_quality, stream_quality);
+
+    atomic_store(&ring_depth, profile->ring_size);
+    atomic_store(&active_profile, output_config.profile);
+    atomic_store(&requested_profile, output_config.profile);
+    atomic_store(&profile_start, xTaskGetTickCount());
+
+    meter_init(SAMPLE_RATE);
+
+    suspend_changed = xSemaphoreCreateBinary();
+    if (suspend_changed == NULL) {
+        heap_caps_free(storage);
+        heap_caps_free(blocks);
+        return ESP_ERR_NO_MEM;
+    }
+
+    esp_err_t result = i2s_devices_start(devices, device_count);
+    if (result != ESP_OK) {
+        ESP_LOGE(TAG, "Failed to start I2S: %s", esp_err_to_name(result));
+        return result;
+    }
+
+    atomic_store(&last_audible, xTaskGetTickCount());
+
+    if (xTaskCreatePinnedToCore(output_task, "audio_out", 4096, NULL,
+                                output_config.task_priority,
+                                &output_task_handle,
+                                AUDIO_OUTPUT_CORE) != pdPASS) {
+        ESP_LOGE(TAG, "Failed to create output task");
+        return ESP_ERR_NO_MEM;
+    }
+
+    ESP_LOGI(TAG, "Output running on %zu codecs with %s profile",
+             device_count, profile->name);
+
+    return ESP_OK;
+}
+
+/**
+ * Queues PCM for playback without ever blocking. Whatever does not fit in the
+ * ring is dropped and counted as an overrun.
+ */
+size_t audio_output_write(const uint8_t *data, size_t len) {
+    instrumentation_record_arrival((uint64_t)len / FRAME_SIZE * 1000000 /
+                                   atomic_load(&requested_rate));
+
+    size_t depth = atomic_load(&ring_depth);
+    size_t fill = pcm_ring_fill(&ring);
+    size_t space = fill < depth ? depth - fill : 0;
+    size_t accepted = len;
+
+    if (accepted > space) {
+        accepted = space - (space % FRAME_SIZE);
+    }
+
+    size_t written = pcm_ring_write(&ring, data, accepted);
+
+    if (written < len) {
+        atomic_fetch_add(&overruns, 1);
+        atomic_fetch_add(&dropped_bytes, len - written);
+    }
+
+    return written;
+}
+
+/**
+ * Sets the rate of PCM passed to audio_output_write(). Anything already queued
+ * should be flushed first since it was produced at the old rate.
+ */
+void audio_output_set_input_rate(uint32_t sample_rate) {
+    atomic_store(&requested_rate, sample_rate);
+}
+
+void audio_output_set_resampler_quality(ResamplerQuality quality) {
+    atomic_store(&requested_quality, quality);
+}
+
+/**
+ * Tells the voice pipeline the CPU now runs at `cpu_hz`, so its budgets and
+ * deadline stay in real time
+ */
+void audio_output_set_cpu_hz(uint32_t cpu_hz) {
+    atomic_store(&requested_cpu_hz, cpu_hz);
+}
+
+//! Captures the voice from the left ADC alone instead of both
+void audio_output_set_mic_mono(bool mono) { atomic_store(&mic_mono, mono); }
+
+/**
+ * Drops everything still queued, the writer goes back to buffering silence
+ */
+void audio_output_flush(void) { atomic_store(&flush_requested, true); }
+
+/**
+ * Stops both I2S channels once the writer finishes its current block and
+ * waits up to `wait` for it to have done so. Only meant for when the output
+ * has gone quiet, anything still queued is dropped.
+ */
+esp_err_t audio_output_suspend(TickType_t wait) {
+    // A give left over from a suspend that timed out is stale
+    xSemaphoreTake(suspend_changed, 0);
+
+    atomic_store(&suspend_requested, true);
+
+    if (xSemaphoreTake(suspend_changed, wait) != pdTRUE) {
+        atomic_store(&suspend_requested, false);
+        xTaskNotifyGive(output_task_handle);
+        return ESP_ERR_TIMEOUT;
+    }
+
+    return ESP_OK;
+}
+
+/**
+ * Starts the channels again and waits up to `wait` for the writer to be back
+ * to writing blocks, which fade in from silence
+ */
+esp_err_t audio_output_resume(TickType_t wait) {
+    if (!atomic_exchange(&suspend_requested, false)) {
+        return ESP_ERR_INVALID_STATE;
+    }
+
+    xTaskNotifyGive(output_task_handle);
+
+    if (xSemaphoreTake(suspend_changed, wait) != pdTRUE) {
+        return ESP_ERR_TIMEOUT;
+    }
+
+    return ESP_OK;
+}
+
+//! Time since the output last carried stream audio or anything audible
+uint32_t audio_output_quiet_ms(void) {
+    return (xTaskGetTickCount() - atomic_load(&last_audible)) *
+           portTICK_PERIOD_MS;
+}
+
+void audio_output_get_stats(audio_output_stats *stats) {
+    stats->underruns = atomic_load(&underruns);
+    stats->overruns = atomic_load(&overruns);
+    stats->dropped_bytes = atomic_load(&dropped_bytes);
+    stats->fill = pcm_ring_fill(&ring);
+    stats->playing = atomic_load(&playing);
+}
+
+/**
+ * Frames between a sample arriving at the ADC and leaving the DAC: one block
+ * of capture, the delay the voice pipeline's stages add, the limiter's
+ * lookahead and whatever the TX DMA holds ahead of the DAC
+ */
+uint32_t audio_output_voice_latency_us(void) {
+    return voice_latency_us(latency_profile_get(atomic_load(&active_profile)),
+                            atomic_load(&voice_pipeline));
+}
+
+/**
+ * Starts the mic path. The pipeline's block size must match the active
+ * profile so capture and playback advance together, and the buffering plus the
+ * delay the stages add must fit within the latency target. Later profile
+ * switches keep the block size in step but only warn if the target is no
+ * longer met.
+ */
+esp_err_t audio_output_attach_voice(audio_pipeline *pipeline,
+                                    uint32_t latency_target_us) {
+    if (pipeline->block_frames != profile->block_frames) {
+        ESP_LOGE(TAG, "Voice block of %zu frames does not match output block",
+                 pipeline->block_frames);
+        return ESP_ERR_INVALID_ARG;
+    }
+
+    uint32_t latency_us = voice_latency_us(profile, pipeline);
+    if (latency_us > latency_target_us) {
+        ESP_LOGE(TAG,
+                 "Voice latency %" PRIu32 " us exceeds target of %" PRIu32
+                 " us",
+                 latency_us, latency_target_us);
+        return ESP_ERR_INVALID_ARG;
+    }
+
+    if (atomic_load(&voice_pipeline) != NULL ||
+        devices[OutputHeadset].rx == NULL) {
+        return ESP_ERR_INVALID_STATE;
+    }
+
+    capture = heap_caps_malloc(LATENCY_PROFILE_MAX_BLOCK_FRAMES * FRAME_SIZE,
+                               MALLOC_CAP_INTERNAL | MALLOC_CAP_8BIT);
+    voice = heap_caps_malloc(LATENCY_PROFILE_MAX_BLOCK_FRAMES * sizeof(int16_t),
+                             MALLOC_CAP_INTERNAL | MALLOC_CAP_8BIT);
+
+    if (capture == NULL || voice == NULL) {
+        ESP_LOGE(TAG, "Failed to allocate voice buffers");
+        heap_caps_free(capture);
+        heap_caps_free(voice);
+        return ESP_ERR_NO_MEM;
+    }
+
+    esp_err_t result = i2s_channel_enable(devices[OutputHeadset].rx);
+    if (result != ESP_OK) {
+        ESP_LOGE(TAG, "Failed to enable I2S RX: %s", esp_err_to_name(result));
+        return result;
+    }
+
+    voice_latency_target_us = latency_target_us;
+    atomic_store(&voice_pipeline, pipeline);
+    instrumentation_set_pipeline(pipeline);
+
+    ESP_LOGI(TAG, "Voice path running, %" PRIu32 " us latency", latency_us);
+
+    return ESP_OK;
+}
+
+/**
+ * Runs `tone` on everything mixed for `output`, or nothing for NULL. For
+ * codecs that cannot shape the tone themselves.
+ */
+esp_err_t audio_output_attach_tone(AudioOutput output, tone_control *tone) {
+    if (output >= device_count) {
+        return ESP_ERR_INVALID_ARG;
+    }
+
+    atomic_store(&output_tones[output], tone);
+
+    return ESP_OK;
+}
+
+/**
+ * Requests a different buffering preset. The writer task applies it before its
+ * next block, so this returns immediately and is safe from any task.
+ */
+esp_err_t audio_output_set_latency_profile(LatencyProfile profile) {
+    if (latency_profile_get(profile) == NULL) {
+        return ESP_ERR_INVALID_ARG;
+    }
+
+    atomic_store(&requested_profile, profile);
+
+    return ESP_OK;
+}
+
+LatencyProfile audio_output_get_latency_profile(void) {
+    return atomic_load(&active_profile);
+}
+
+/**
+ * Reports how the active profile is doing. Stream latency is measured from the
+ * average ring fill while playing, converted at the current input rate, plus
+ * the frames buffered in the DMA and the block being assembled.
+ */
+void audio_output_get_latency_report(audio_latency_report *report) {
+    LatencyProfile active = atomic_load(&active_profile);
+    const latency_profile_config *config = latency_profile_get(active);
+
+    uint32_t queued_frames = atomic_load(&fill_average) / FRAME_SIZE;
+    uint32_t output_frames = config->block_frames + config->lookahead_frames +
+                             config->dma_desc_num * config->dma_frame_num;
+
+    report->profile = active;
+    report->name = config->name;
+    report->stream_latency_us =
+        (uint64_t)queued_frames * 1000000 / atomic_load(&requested_rate) +
+        (uint64_t)output_frames * 1000000 / SAMPLE_RATE;
+    report->voice_latency_us =
+        voice_latency_us(config, atomic_load(&voice_pipeline));
+    report->underruns =
+        atomic_load(&underruns) - atomic_load(&profile_underruns);
+    report->active_ms = (xTaskGetTickCount() - atomic_load(&profile_start)) *
+                        portTICK_PERIOD_MS;
+    report->underruns_per_hour =
+        report->active_ms == 0
+            ? 0
+            : (uint64_t)report->underruns * 3600000 / report->active_ms;
+}
+
+/**
+ * Mixes `source` into the outputs in `outputs`, a bit per AudioOutput, from
+ * the next block on. 0 takes it off every output.
+ */
+esp_err_t audio_output_set_route(AudioSource source, uint8_t outputs) {
+    if (source >= SourceCount || outputs >> device_count != 0) {
+        return ESP_ERR_INVALID_ARG;
+    }
+
+    atomic_store(&routes[source], outputs);
+
+    return ESP_OK;
+}
+
+uint8_t audio_output_get_route(AudioSource source) {
+    return source < SourceCount ? atomic_load(&routes[source]) : 0;
+}
+
+/**
+ * Sets the gain `source` is mixed at on every output, MIXER_UNITY_GAIN being
+ * unity. The change ramps in over the next block.
+ */
+esp_err_t audio_output_set_source_gain(AudioSource source, uint16_t gain) {
+    if (source >= SourceCount) {
+        return ESP_ERR_INVALID_ARG;
+    }
+
+    for (size_t i = 0; i < device_count; i++) {
+        mixer_set_gain(&mixers[i], source, gain);
+    }
+
+    return ESP_OK;
+}
+
+/**
+ * Ducks the stream while the voice peaks at or above `threshold`, 0 never
+ * ducks
+ */
+void audio_output_set_duck_threshold(uint16_t threshold) {
+    for (size_t i = 0; i < device_count; i++) {
+        mixer_set_duck_threshold(&mixers[i], threshold);
+    }
+}
+
+//! Sets the gain the stream is ducked to, in mixer gain units
+void audio_output_set_duck_depth(uint16_t depth) {
+    for (size_t i = 0; i < device_count; i++) {
+        mixer_set_duck_depth(&mixers[i], depth);
+    }
+}
+
+/**
+ * Runs the voice through `chain` on its way to `output` only, after the shared
+ * voice pipeline. Like the voice pipeline its block size must match the
+ * active profile and it follows later profile switches.
+ */
+esp_err_t audio_output_attach_output_chain(AudioOutput output,
+                                           audio_pipeline *chain) {
+    if (output >= device_count ||
+        chain->block_frames != profile->block_frames) {
+        return ESP_ERR_INVALID_ARG;
+    }
+
+    if (atomic_load(&output_chains[output]) != NULL) {
+        return ESP_ERR_INVALID_STATE;
+    }
+
+    if (chain_voice == NULL) {
+        chain_voice =
+            heap_caps_malloc(LATENCY_PROFILE_MAX_BLOCK_FRAMES * sizeof(int16_t),
+                             MALLOC_CAP_INTERNAL | MALLOC_CAP_8BIT);
+        if (chain_voice == NULL) {
+            return ESP_ERR_NO_MEM;
+        }
+    }
+
+    atomic_store(&output_chains[output], chain);
+
+    return ESP_OK;
+}
+
+/**
+ * Changes the ceiling, release and compressor of `output`'s limiter from the
+ * next block on
+ */
+esp_err_t audio_output_set_limiter(AudioOutput output,
+                                   const limiter_config *config) {
+    if (output >= device_count ||
+        !limiter_configure(&limiters[output], config)) {
+        return ESP_ERR_INVALID_ARG;
+    }
+
+    return ESP_OK;
+}
+
+esp_err_t audio_output_get_limiter(AudioOutput output, limiter_config *config) {
+    if (output >= device_count) {
+        return ESP_ERR_INVALID_ARG;
+    }
+
+    limiter_get_config(&limiters[output], config);
+
+    return ESP_OK;
+}
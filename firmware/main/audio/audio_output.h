@@ -0,0 +1,157 @@
+#ifndef AUDIO_OUTPUT_H
+#define AUDIO_OUTPUT_H
+
+#include "audio/latency_profile.h"
+#include "audio_dsp/limiter.h"
+#include "audio_dsp/mixer.h"
+#include "audio_dsp/pipeline.h"
+#include "audio_dsp/resampler.h"
+#include "audio_dsp/tone.h"
+#include "codec/i2s.h"
+#include "esp_err.h"
+#include "freertos/FreeRTOS.h"
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+//! The writer task runs on the app core so it never competes with Bluedroid,
+//! which is pinned to core 0
+#define AUDIO_OUTPUT_CORE 1
+
+//! Codecs the output plays on, in the order their I2S devices are passed to
+//! audio_output_init
+typedef enum {
+    OutputHeadset,
+    OutputSpeaker,
+    OutputCount,
+} AudioOutput;
+
+//! What is mixed into the outputs, each rendered once whatever it is routed to
+typedef enum {
+    SourceStream,
+    SourceEffects,
+    SourceVoice,
+    SourceCount,
+} AudioSource;
+
+#define AUDIO_OUTPUT_TO(output) (1 << (output))
+
+typedef struct {
+    //! Buffering preset the output starts with, the I2S channels passed to
+    //! audio_output_init must already use its DMA geometry
+    LatencyProfile profile;
+    //! Rate of the PCM written into the ring until told otherwise
+    uint32_t input_rate;
+    ResamplerQuality resampler_quality;
+    uint8_t task_priority;
+    //! Outputs each source starts out mixed into, routes to outputs that were
+    //! not passed to audio_output_init are dropped
+    uint8_t routes[SourceCount];
+    //! Voice peak that ducks the stream, 0 never ducks
+    uint16_t duck_threshold;
+    //! Gain the stream is ducked to, in mixer gain units
+    uint16_t duck_depth;
+    //! Every output's limiter starts with these settings
+    limiter_config limiter;
+} audio_output_config;
+
+//! The stream stays in the headset while the voice and effects also go out
+//! of the speaker. Speaking above about -30 dBFS ducks the stream by 12 dB.
+#define AUDIO_OUTPUT_DEFAULT_CONFIG()                                          \
+    {                                                                          \
+        .profile = Balanced,                                                   \
+        .input_rate = 44100,                                                   \
+        .resampler_quality = ResamplerMedium,                                  \
+        .task_priority = 10,                                                   \
+        .routes =                                                              \
+            {                                                                  \
+                [SourceStream] = AUDIO_OUTPUT_TO(OutputHeadset),               \
+                [SourceEffects] = AUDIO_OUTPUT_TO(OutputHeadset) |             \
+                                  AUDIO_OUTPUT_TO(OutputSpeaker),              \
+                [SourceVoice] = AUDIO_OUTPUT_TO(OutputHeadset) |               \
+                                AUDIO_OUTPUT_TO(OutputSpeaker),                \
+            },                                                                 \
+        .duck_threshold = 1036,                                                \
+        .duck_depth = MIXER_UNITY_GAIN / 4,                                    \
+        .limiter = LIMITER_DEFAULT_CONFIG(),                                   \
+    }
+
+typedef struct {
+    //! Times the writer ran dry while playing and had to rebuffer
+    uint32_t underruns;
+    //! Times the producer found the ring full and dropped data
+    uint32_t overruns;
+    uint32_t dropped_bytes;
+    size_t fill;
+    bool playing;
+} audio_output_stats;
+
+typedef struct {
+    LatencyProfile profile;
+    const char *name;
+    //! Average time a sample written by the producer spends queued in the ring
+    //! and the DMA buffers before it reaches the DAC
+    uint32_t stream_latency_us;
+    //! Mic to DAC delay with the current block size and DMA geometry
+    uint32_t voice_latency_us;
+    //! Underruns since this profile became active
+    uint32_t underruns;
+    uint32_t underruns_per_hour;
+    uint32_t active_ms;
+} audio_latency_report;
+
+esp_err_t audio_output_init(const i2s_device *outputs, size_t count,
+                            const audio_output_config *config);
+
+size_t audio_output_write(const uint8_t *data, size_t len);
+
+void audio_output_set_input_rate(uint32_t sample_rate);
+
+void audio_output_set_resampler_quality(ResamplerQuality quality);
+
+void audio_output_set_cpu_hz(uint32_t cpu_hz);
+
+void audio_output_set_mic_mono(bool mono);
+
+void audio_output_flush(void);
+
+esp_err_t audio_output_suspend(TickType_t wait);
+
+esp_err_t audio_output_resume(TickType_t wait);
+
+uint32_t audio_output_quiet_ms(void);
+
+void audio_output_get_stats(audio_output_stats *stats);
+
+esp_err_t audio_output_attach_voice(audio_pipeline *pipeline,
+                                    uint32_t latency_target_us);
+
+uint32_t audio_output_voice_latency_us(void);
+
+esp_err_t audio_output_set_route(AudioSource source, uint8_t outputs);
+
+uint8_t audio_output_get_route(AudioSource source);
+
+esp_err_t audio_output_set_source_gain(AudioSource source, uint16_t gain);
+
+void audio_output_set_duck_threshold(uint16_t threshold);
+
+void audio_output_set_duck_depth(uint16_t depth);
+
+esp_err_t audio_output_attach_output_chain(AudioOutput output,
+                                           audio_pipeline *chain);
+
+esp_err_t audio_output_attach_tone(AudioOutput output, tone_control *tone);
+
+esp_err_t audio_output_set_limiter(AudioOutput output,
+                                   const limiter_config *config);
+
+esp_err_t audio_output_get_limiter(AudioOutput output, limiter_config *config);
+
+esp_err_t audio_output_set_latency_profile(LatencyProfile profile);
+
+LatencyProfile audio_output_get_latency_profile(void);
+
+void audio_output_get_latency_report(audio_latency_report *report);
+
+#endif
@@ -0,0 +1,229 @@
+/**
+ * This file puts the WM8988's level control, noise gate, tone control and 3D
+ * enhancement behind one API. Each block runs in the codec wherever the codec
+ * can apply it to the signal in question, which costs no CPU at all, and in
+ * software with the same settings otherwise: the level control as the first
+ * stage of the voice pipeline and the tone on the output's mix.
+ *
+ * The ALC works on the input PGAs, so the codec the mic is captured from is
+ * the only one that can level it. Tone and 3D are on the DAC path of every
+ * codec. CONFIG_CODEC_DSP_SOFTWARE moves everything to software, to compare
+ * the two or for a codec without these blocks.
+ *
+ * Codec registers are only changed in the shadow, they go out with whatever
+ * commits the codec next.
+ */
+
+#include "codec_dsp.h"
+#include "codec/settings.h"
+#include "esp_log.h"
+#include "sdkconfig.h"
+
+static const char *TAG = "CODEC_DSP";
+
+//! Share of each voice block the software ALC is budgeted, as a divisor
+#define ALC_BUDGET_DIVISOR 16
+
+#if CONFIG_CODEC_DSP_SOFTWARE
+#define IN_CODEC false
+#else
+#define IN_CODEC true
+#endif
+
+static const codec_dsp_config PRESETS[DspPresetCount] = {
+    // DspPresetFlat is all zeroes
+    // -12 dBFS with up to 18 dB of gain, gated below -60 dBFS. Bass is cut
+    // 3 dB under 200 Hz and treble lifted 3 dB above 4 kHz.
+    [DspPresetVoice] =
+        {
+            .alc =
+                {
+                    .enabled = true,
+                    .target = 11,
+                    .max_gain = 5,
+                    .hold = 6,
+                    .decay = 3,
+                    .attack = 1,
+                    .gate = true,
+                    .gate_threshold = 11,
+                    .gate_mutes = true,
+                },
+            .tone =
+                {
+                    .bass = -2,
+                    .bass_high_cutoff = true,
+                    .treble = 2,
+                    .treble_low_cutoff = true,
+                },
+        },
+    // -9 dBFS with up to 24 dB of gain and the fastest attack, gated below
+    // -54 dBFS. 4.5 dB of bass cut and treble lift.
+    [DspPresetLoud] =
+        {
+            .alc =
+                {
+                    .enabled = true,
+                    .target = 13,
+                    .max_gain = 6,
+                    .hold = 4,
+                    .decay = 2,
+                    .attack = 0,
+                    .gate = true,
+                    .gate_threshold = 15,
+                    .gate_mutes = true,
+                },
+            .tone =
+                {
+                    .bass = -3,
+                    .bass_high_cutoff = true,
+                    .treble = 3,
+                    .treble_low_cutoff = true,
+                },
+        },
+    // 3 dB of bass below 130 Hz, 1.5 dB of treble above 8 kHz and a third of
+    // the full width
+    [DspPresetMusic] =
+        {
+            .tone =
+                {
+                    .bass = 2,
+                    .treble = 1,
+                    .depth_3d = 5,
+                },
+        },
+};
+
+//! Indexed by AudioOutput
+static spi_codec_device codec_devices[OutputCount];
+static size_t codec_count;
+
+static audio_pipeline *pipeline;
+static bool hardware_alc;
+static alc software_alc;
+static int alc_stage = -1;
+
+static bool hardware_tone[OutputCount];
+static tone_control software_tones[OutputCount];
+
+const codec_dsp_config *codec_dsp_preset(DspPreset preset) {
+    return preset < DspPresetCount ? &PRESETS[preset] : NULL;
+}
+
+/**
+ * Works out where each block runs and sets up the software ones, all off. The
+ * output must already be running, and the voice pipeline must not have any
+ * stages yet so the software ALC comes first. Without a pipeline the ALC is
+ * only available in hardware.
+ */
+esp_err_t codec_dsp_init(const spi_codec_device *codecs, size_t count,
+                         audio_pipeline *voice_pipeline) {
+    if (count == 0 || count > OutputCount) {
+        return ESP_ERR_INVALID_ARG;
+    }
+
+    for (size_t i = 0; i < count; i++) {
+        codec_devices[i] = codecs[i];
+    }
+    codec_count = count;
+    pipeline = voice_pipeline;
+
+    hardware_alc = IN_CODEC;
+
+    if (!hardware_alc && pipeline != NULL) {
+        alc_init(&software_alc, pipeline->sample_rate);
+        alc_stage = audio_pipeline_add_stage(
+            pipeline, "alc", alc_process, &software_alc,
+            pipeline->block_cycles / ALC_BUDGET_DIVISOR);
+
+        if (alc_stage < 0) {
+            return ESP_ERR_NO_MEM;
+        }
+
+        audio_pipeline_set_enabled(pipeline, alc_stage, false);
+    }
+
+    for (size_t i = 0; i < count; i++) {
+        hardware_tone[i] = IN_CODEC;
+
+        if (!hardware_tone[i]) {
+            tone_init(&software_tones[i], SAMPLE_RATE);
+
+            esp_err_t result = audio_output_attach_tone(i, &software_tones[i]);
+            if (result != ESP_OK) {
+                return result;
+            }
+        }
+    }
+
+    ESP_LOGI(TAG, "Level control in %s, tone in %s",
+             hardware_alc ? "codec" : "software",
+             hardware_tone[0] ? "codec" : "software");
+
+    return ESP_OK;
+}
+
+/**
+ * Levels and gates the mic. While the codec does it, it also owns the input
+ * PGA gain.
+ */
+esp_err_t codec_dsp_set_alc(const alc_config *config) {
+    if (!alc_config_valid(config)) {
+        return ESP_ERR_INVALID_ARG;
+    }
+
+    if (hardware_alc) {
+        return set_alc(codec_devices[OutputHeadset], config);
+    }
+
+    if (alc_stage < 0) {
+        return ESP_ERR_NOT_SUPPORTED;
+    }
+
+    alc_configure(&software_alc, config);
+    audio_pipeline_set_enabled(pipeline, alc_stage, config->enabled);
+
+    return ESP_OK;
+}
+
+//! Shapes everything played on `output`
+esp_err_t codec_dsp_set_tone(AudioOutput output, const tone_config *config) {
+    if (output >= codec_count || !tone_config_valid(config)) {
+        return ESP_ERR_INVALID_ARG;
+    }
+
+    if (hardware_tone[output]) {
+        return set_tone(codec_devices[output], config);
+    }
+
+    tone_configure(&software_tones[output], config);
+
+    return ESP_OK;
+}
+
+//! Applies a preset's level control to the mic and its tone to every output
+esp_err_t codec_dsp_apply_preset(DspPreset preset) {
+    const codec_dsp_config *config = codec_dsp_preset(preset);
+
+    if (config == NULL) {
+        return ESP_ERR_INVALID_ARG;
+    }
+
+    esp_err_t result = codec_dsp_set_alc(&config->alc);
+
+    for (size_t i = 0; i < codec_count && result == ESP_OK; i++) {
+        result = codec_dsp_set_tone(i, &config->tone);
+    }
+
+    if (result != ESP_OK) {
+        ESP_LOGE(TAG, "Failed to apply preset %d: %s", preset,
+                 esp_err_to_name(result));
+    }
+
+    return result;
+}
+
+bool codec_dsp_alc_in_hardware(void) { return hardware_alc; }
+
+bool codec_dsp_tone_in_hardware(AudioOutput output) {
+    return output < codec_count && hardware_tone[output];
+}
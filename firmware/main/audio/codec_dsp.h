@@ -0,0 +1,47 @@
+#ifndef CODEC_DSP_H
+#define CODEC_DSP_H
+
+#include "audio/audio_output.h"
+#include "audio_dsp/alc.h"
+#include "audio_dsp/pipeline.h"
+#include "audio_dsp/tone.h"
+#include "codec/spi.h"
+#include "esp_err.h"
+#include <stdbool.h>
+#include <stddef.h>
+
+typedef enum {
+    //! Everything off, the codecs' reset state
+    DspPresetFlat,
+    //! Levelled, gated mic with the boom taken out and presence added
+    DspPresetVoice,
+    //! Harder levelling and more presence, for noisy rooms
+    DspPresetLoud,
+    //! Mic untouched, a little bass, treble and width on the outputs
+    DspPresetMusic,
+    DspPresetCount,
+} DspPreset;
+
+typedef struct {
+    //! Level control and gate on the mic
+    alc_config alc;
+    //! Tone on every output
+    tone_config tone;
+} codec_dsp_config;
+
+const codec_dsp_config *codec_dsp_preset(DspPreset preset);
+
+esp_err_t codec_dsp_init(const spi_codec_device *codecs, size_t count,
+                         audio_pipeline *voice_pipeline);
+
+esp_err_t codec_dsp_set_alc(const alc_config *config);
+
+esp_err_t codec_dsp_set_tone(AudioOutput output, const tone_config *config);
+
+esp_err_t codec_dsp_apply_preset(DspPreset preset);
+
+bool codec_dsp_alc_in_hardware(void);
+
+bool codec_dsp_tone_in_hardware(AudioOutput output);
+
+#endif
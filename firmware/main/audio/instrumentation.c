@@ -0,0 +1,169 @@
+/**
+ * This file contains the runtime instrumentation of the audio path. Every
+ * statistic has a single writer, the writer task or the A2DP callback, so
+ * recording is a couple of plain stores. Snapshots read them without locking
+ * and may mix values from adjacent blocks, which is fine for telemetry.
+ *
+ * Snapshots are little endian:
+ *
+ *   u8  version, section count, stage count, histogram bins
+ *   u32 uptime ms
+ *   u32 underruns, overruns, dropped frames, rate switches
+ *   per section:  u32 last cycles, max cycles
+ *   u32 pipeline block cycles, max cycles, deadline misses
+ *   per stage:    u32 last cycles, max cycles, budget, budget overruns
+ *   per histogram: u32 count per bin
+ */
+
+#include "instrumentation.h"
+#include "audio_output.h"
+#include "esp_timer.h"
+#include <stdatomic.h>
+
+#if CONFIG_AUDIO_INSTRUMENTATION
+
+//! Bytes per stereo 16 bit frame
+#define FRAME_SIZE 4
+
+typedef struct {
+    uint32_t last_cycles;
+    uint32_t max_cycles;
+} section_stats;
+
+static section_stats sections[SectionCount];
+static uint32_t histograms[HistogramCount][INSTRUMENTATION_HISTOGRAM_BINS];
+static _Atomic uint32_t rate_switches;
+static const audio_pipeline *_Atomic pipeline;
+
+static int64_t last_arrival;
+static uint32_t last_expected_us;
+
+static inline void record(InstrumentHistogram histogram, uint32_t bin) {
+    if (bin >= INSTRUMENTATION_HISTOGRAM_BINS) {
+        bin = INSTRUMENTATION_HISTOGRAM_BINS - 1;
+    }
+    histograms[histogram][bin]++;
+}
+
+void instrumentation_record_cycles(InstrumentSection section, uint32_t cycles) {
+    section_stats *stats = &sections[section];
+
+    stats->last_cycles = cycles;
+    if (cycles > stats->max_cycles) {
+        stats->max_cycles = cycles;
+    }
+}
+
+//! Records the cycles since `start` and returns them
+uint32_t instrumentation_end(InstrumentSection section, uint32_t start) {
+    uint32_t cycles = esp_cpu_get_cycle_count() - start;
+    instrumentation_record_cycles(section, cycles);
+    return cycles;
+}
+
+/**
+ * Called by the writer before each block. Fill can exceed the depth briefly
+ * after switching to a smaller profile, that lands in the top bin.
+ */
+void instrumentation_record_fill(size_t fill, size_t depth) {
+    if (depth == 0) {
+        return;
+    }
+    record(HistogramRingFill,
+           (uint64_t)fill * INSTRUMENTATION_HISTOGRAM_BINS / depth);
+}
+
+/**
+ * Called by the producer on every callback with the playback time of the data
+ * it carries. The next callback is expected exactly that much later, whatever
+ * it is off by in either direction is the jitter.
+ */
+void instrumentation_record_arrival(uint32_t expected_us) {
+    int64_t now = esp_timer_get_time();
+
+    if (last_arrival != 0) {
+        int64_t deviation = (now - last_arrival) - last_expected_us;
+        uint32_t jitter = deviation < 0 ? -deviation : deviation;
+
+        record(HistogramCallbackJitter,
+               jitter == 0 ? 0 : 32 - __builtin_clz(jitter));
+    }
+
+    last_arrival = now;
+    last_expected_us = expected_us;
+}
+
+void instrumentation_count_rate_switch(void) {
+    atomic_fetch_add(&rate_switches, 1);
+}
+
+void instrumentation_set_pipeline(const audio_pipeline *voice_pipeline) {
+    atomic_store(&pipeline, voice_pipeline);
+}
+
+static inline uint8_t *put_u32(uint8_t *out, uint32_t value) {
+    out[0] = value;
+    out[1] = value >> 8;
+    out[2] = value >> 16;
+    out[3] = value >> 24;
+    return out + 4;
+}
+
+/**
+ * Serialises everything collected so far into `out` and returns the number of
+ * bytes written, or 0 if `len` is smaller than INSTRUMENTATION_SNAPSHOT_MAX_SIZE
+ */
+size_t instrumentation_snapshot(uint8_t *out, size_t len) {
+    if (len < INSTRUMENTATION_SNAPSHOT_MAX_SIZE) {
+        return 0;
+    }
+
+    const audio_pipeline *voice_pipeline = atomic_load(&pipeline);
+    size_t stage_count =
+        voice_pipeline != NULL ? atomic_load(&voice_pipeline->stage_count) : 0;
+
+    audio_output_stats stats;
+    audio_output_get_stats(&stats);
+
+    uint8_t *cursor = out;
+
+    *cursor++ = INSTRUMENTATION_SNAPSHOT_VERSION;
+    *cursor++ = SectionCount;
+    *cursor++ = stage_count;
+    *cursor++ = INSTRUMENTATION_HISTOGRAM_BINS;
+
+    cursor = put_u32(cursor, esp_timer_get_time() / 1000);
+    cursor = put_u32(cursor, stats.underruns);
+    cursor = put_u32(cursor, stats.overruns);
+    cursor = put_u32(cursor, stats.dropped_bytes / FRAME_SIZE);
+    cursor = put_u32(cursor, atomic_load(&rate_switches));
+
+    for (size_t i = 0; i < SectionCount; i++) {
+        cursor = put_u32(cursor, sections[i].last_cycles);
+        cursor = put_u32(cursor, sections[i].max_cycles);
+    }
+
+    cursor = put_u32(cursor, voice_pipeline ? voice_pipeline->block_cycles : 0);
+    cursor = put_u32(cursor, voice_pipeline ? voice_pipeline->max_cycles : 0);
+    cursor =
+        put_u32(cursor, voice_pipeline ? voice_pipeline->deadline_misses : 0);
+
+    for (size_t i = 0; i < stage_count; i++) {
+        const audio_stage *stage = &voice_pipeline->stages[i];
+
+        cursor = put_u32(cursor, stage->last_cycles);
+        cursor = put_u32(cursor, stage->max_cycles);
+        cursor = put_u32(cursor, stage->cycle_budget);
+        cursor = put_u32(cursor, stage->budget_overruns);
+    }
+
+    for (size_t i = 0; i < HistogramCount; i++) {
+        for (size_t bin = 0; bin < INSTRUMENTATION_HISTOGRAM_BINS; bin++) {
+            cursor = put_u32(cursor, histograms[i][bin]);
+        }
+    }
+
+    return cursor - out;
+}
+
+#endif
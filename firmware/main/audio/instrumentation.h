@@ -0,0 +1,88 @@
+#ifndef AUDIO_INSTRUMENTATION_H
+#define AUDIO_INSTRUMENTATION_H
+
+#include "audio_dsp/pipeline.h"
+#include "sdkconfig.h"
+#include <stddef.h>
+#include <stdint.h>
+
+//! Code sections of the writer task timed with the cycle counter
+typedef enum {
+    SectionResample,
+    SectionVoice,
+    SectionEffects,
+    //! SectionEffects divided by the voices that were mixed
+    SectionEffectsVoice,
+    //! Mixing every output, software tone control and limiting included
+    SectionMix,
+    //! Software tone control, only while a codec's own is not used
+    SectionTone,
+    //! Output limiters and their compressors
+    SectionLimit,
+    SectionCount,
+} InstrumentSection;
+
+typedef enum {
+    //! Ring fill as a fraction of the active profile's ring depth
+    HistogramRingFill,
+    //! Microseconds between A2DP data callbacks beyond what the previous
+    //! callback's data covered, in power of two buckets
+    HistogramCallbackJitter,
+    HistogramCount,
+} InstrumentHistogram;
+
+#define INSTRUMENTATION_HISTOGRAM_BINS 16
+
+//! Upper bound on the size of a snapshot
+#define INSTRUMENTATION_SNAPSHOT_MAX_SIZE                                      \
+    (24 + SectionCount * 8 + 12 + AUDIO_PIPELINE_MAX_STAGES * 16 +              \
+     HistogramCount * INSTRUMENTATION_HISTOGRAM_BINS * 4)
+
+#define INSTRUMENTATION_SNAPSHOT_VERSION 1
+
+#if CONFIG_AUDIO_INSTRUMENTATION
+
+#include "esp_cpu.h"
+
+static inline uint32_t instrumentation_begin(void) {
+    return esp_cpu_get_cycle_count();
+}
+
+uint32_t instrumentation_end(InstrumentSection section, uint32_t start);
+
+void instrumentation_record_cycles(InstrumentSection section, uint32_t cycles);
+
+void instrumentation_record_fill(size_t fill, size_t depth);
+
+void instrumentation_record_arrival(uint32_t expected_us);
+
+void instrumentation_count_rate_switch(void);
+
+void instrumentation_set_pipeline(const audio_pipeline *pipeline);
+
+size_t instrumentation_snapshot(uint8_t *out, size_t len);
+
+#else
+
+static inline uint32_t instrumentation_begin(void) { return 0; }
+
+static inline uint32_t instrumentation_end(InstrumentSection section,
+                                           uint32_t start) {
+    return 0;
+}
+
+static inline void instrumentation_record_cycles(InstrumentSection section,
+                                                 uint32_t cycles) {}
+
+static inline void instrumentation_record_fill(size_t fill, size_t depth) {}
+
+static inline void instrumentation_record_arrival(uint32_t expected_us) {}
+
+static inline void instrumentation_count_rate_switch(void) {}
+
+static inline void
+instrumentation_set_pipeline(const audio_pipeline *pipeline) {}
+
+#endif
+
+#endif
@@ -0,0 +1,56 @@
+/**
+ * This file contains the buffering presets for the output path. Block sizes
+ * always match the DMA frame count so one iteration of the writer fills
+ * exactly one descriptor.
+ *
+ * The limiter's lookahead adds to the latency of everything played, so the
+ * voice profile, which is at its latency target already, limits without it.
+ */
+
+#include "latency_profile.h"
+
+static const latency_profile_config PROFILES[LatencyProfileCount] = {
+    // 3 x 120 frames keeps 7.5 ms queued ahead of the DAC
+    [LowLatencyVoice] =
+        {
+            .name = "voice",
+            .dma_desc_num = 3,
+            .dma_frame_num = 120,
+            .ring_size = 8192,
+            .start_watermark = 2048,
+            .stop_watermark = 1024,
+            .block_frames = 120,
+            .lookahead_frames = 0,
+        },
+    [Balanced] =
+        {
+            .name = "balanced",
+            .dma_desc_num = 4,
+            .dma_frame_num = 240,
+            .ring_size = 16384,
+            .start_watermark = 4096,
+            .stop_watermark = 1024,
+            .block_frames = 240,
+            .lookahead_frames = 48,
+        },
+    // Around 60 ms in DMA plus up to 185 ms of 44.1 kHz PCM in the ring
+    [RobustMusic] =
+        {
+            .name = "music",
+            .dma_desc_num = 6,
+            .dma_frame_num = 480,
+            .ring_size = 32768,
+            .start_watermark = 16384,
+            .stop_watermark = 4096,
+            .block_frames = 480,
+            .lookahead_frames = 240,
+        },
+};
+
+const latency_profile_config *latency_profile_get(LatencyProfile profile) {
+    if (profile >= LatencyProfileCount) {
+        return NULL;
+    }
+
+    return &PROFILES[profile];
+}
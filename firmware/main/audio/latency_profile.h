@@ -0,0 +1,46 @@
+#ifndef AUDIO_LATENCY_PROFILE_H
+#define AUDIO_LATENCY_PROFILE_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+/**
+ * Buffering presets for the output path. Each one sets the I2S DMA geometry,
+ * the usable depth of the PCM ring and the processing block size together so
+ * they can never be mixed into an inconsistent combination.
+ */
+typedef enum {
+    //! Smallest buffers, keeps the mic path within its latency target
+    LowLatencyVoice,
+    Balanced,
+    //! Deep buffers that ride out long gaps in A2DP traffic
+    RobustMusic,
+    LatencyProfileCount,
+} LatencyProfile;
+
+typedef struct {
+    const char *name;
+    uint32_t dma_desc_num;
+    uint32_t dma_frame_num;
+    //! Bytes of the PCM ring the producer may fill, a power of two
+    size_t ring_size;
+    //! Bytes that must be buffered before playback starts (or restarts after an
+    //! underrun)
+    size_t start_watermark;
+    //! Playback stops and rebuffers once fewer than this many bytes are queued
+    size_t stop_watermark;
+    //! Frames written to I2S and processed by the voice pipeline per iteration
+    size_t block_frames;
+    //! Frames the output limiter delays by to see peaks coming, at most
+    //! LIMITER_MAX_LOOKAHEAD
+    size_t lookahead_frames;
+} latency_profile_config;
+
+//! Largest ring and block of any profile, buffers are sized for these once so
+//! switching never allocates
+#define LATENCY_PROFILE_MAX_RING_SIZE 32768
+#define LATENCY_PROFILE_MAX_BLOCK_FRAMES 480
+
+const latency_profile_config *latency_profile_get(LatencyProfile profile);
+
+#endif
@@ -0,0 +1,271 @@
+/**
+ * This file plays costume sound effects from the soundbank partition. The
+ * image is memory mapped once at boot and clips are mixed straight out of
+ * flash, so starting one never copies or allocates anything.
+ *
+ * Any task may trigger a clip. Triggers go through a queue that the writer
+ * task drains right before it mixes each block, which keeps the voices owned
+ * by a single task and bounds the start latency to one block.
+ *
+ * A clip reaches the DAC once its block has gone through the limiter's
+ * lookahead and the DMA queue, the same buffering as every other sound. With
+ * the voice profile that is one 2.5 ms block of waiting for the writer plus
+ * 7.5 ms of DMA, so a trigger is heard within 10 ms rather than 5 ms. Getting
+ * under 5 ms would take shallower DMA than the voice profile can run without
+ * underruns, so the writer's share, one block, is what is bounded here, and
+ * the full trigger to DAC delay is measured alongside it.
+ *
+ * The bank can be released while a new image is written to the partition and
+ * mapped again afterwards. The writer holds the bank lock while it mixes and
+ * skips effects for a block rather than wait for it.
+ */
+
+#include "sound_effects.h"
+#include "audio_dsp/clip_player.h"
+#include "audio_dsp/soundbank.h"
+#include "codec/i2s.h"
+#include "esp_log.h"
+#include "esp_partition.h"
+#include "esp_timer.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/queue.h"
+#include "freertos/semphr.h"
+#include "instrumentation.h"
+#include <inttypes.h>
+#include <stdatomic.h>
+
+static const char *TAG = "EFFECTS";
+
+typedef struct {
+    uint16_t clip;
+    uint16_t gain;
+    int64_t queued_us;
+} trigger;
+
+//! Guards the bank and the mapping behind it
+static SemaphoreHandle_t bank_lock;
+static soundbank bank;
+static bool bank_loaded;
+static esp_partition_mmap_handle_t mmap_handle;
+//! Clips in the loaded bank, 0 if there is none. Readable without the lock.
+static _Atomic uint16_t clip_count;
+
+static clip_player player;
+static QueueHandle_t triggers;
+static atomic_bool stop_requested;
+
+static _Atomic uint32_t triggered;
+static _Atomic uint32_t dropped;
+static _Atomic uint32_t stolen;
+static _Atomic uint8_t active_voices;
+static _Atomic uint32_t last_start_latency_us;
+static _Atomic uint32_t max_start_latency_us;
+static _Atomic uint32_t last_dac_latency_us;
+static _Atomic uint32_t max_dac_latency_us;
+
+/**
+ * Maps and validates the image in the partition, called with the bank lock
+ * held. A missing or blank partition is not an error, effects just stay
+ * unavailable.
+ */
+static esp_err_t load_bank(void) {
+    const esp_partition_t *partition = esp_partition_find_first(
+        ESP_PARTITION_TYPE_DATA, SOUNDBANK_PARTITION_SUBTYPE,
+        SOUNDBANK_PARTITION_LABEL);
+
+    if (partition == NULL) {
+        ESP_LOGW(TAG, "No soundbank partition, effects disabled");
+        return ESP_OK;
+    }
+
+    uint8_t header[SOUNDBANK_HEADER_SIZE];
+    esp_err_t result = esp_partition_read(partition, 0, header, sizeof(header));
+    if (result != ESP_OK) {
+        return result;
+    }
+
+    // Only the image is mapped, the data MMU window is shared with the app
+    // and too small for the whole partition
+    uint32_t image_size = soundbank_image_size(header);
+    if (image_size == 0 || image_size > partition->size) {
+        ESP_LOGW(TAG, "No soundbank image flashed, effects disabled");
+        return ESP_OK;
+    }
+
+    const void *image;
+    result = esp_partition_mmap(partition, 0, image_size,
+                                ESP_PARTITION_MMAP_DATA, &image, &mmap_handle);
+    if (result != ESP_OK) {
+        ESP_LOGE(TAG, "Failed to map %" PRIu32 " byte soundbank: %s",
+                 image_size, esp_err_to_name(result));
+        return result;
+    }
+
+    if (!soundbank_open(&bank, image, image_size) ||
+        bank.sample_rate != SAMPLE_RATE) {
+        ESP_LOGE(TAG, "Invalid soundbank image, effects disabled");
+        esp_partition_munmap(mmap_handle);
+        return ESP_OK;
+    }
+
+    bank_loaded = true;
+    atomic_store(&clip_count, bank.clip_count);
+    ESP_LOGI(TAG, "Soundbank with %u clips, %" PRIu32 " bytes", bank.clip_count,
+             bank.size);
+
+    return ESP_OK;
+}
+
+esp_err_t sound_effects_init(void) {
+    clip_player_init(&player);
+
+    triggers = xQueueCreate(SOUND_EFFECTS_QUEUE_LENGTH, sizeof(trigger));
+    bank_lock = xSemaphoreCreateMutex();
+    if (triggers == NULL || bank_lock == NULL) {
+        return ESP_ERR_NO_MEM;
+    }
+
+    return load_bank();
+}
+
+/**
+ * Silences everything and unmaps the bank, so the partition can be rewritten.
+ * Waits for the writer to finish the block it is mixing.
+ */
+void sound_effects_release(void) {
+    xSemaphoreTake(bank_lock, portMAX_DELAY);
+
+    if (bank_loaded) {
+        atomic_store(&clip_count, 0);
+        clip_player_stop_all(&player);
+        xQueueReset(triggers);
+        esp_partition_munmap(mmap_handle);
+        bank_loaded = false;
+    }
+
+    xSemaphoreGive(bank_lock);
+}
+
+//! Maps whatever image the partition holds now
+esp_err_t sound_effects_reload(void) {
+    sound_effects_release();
+
+    xSemaphoreTake(bank_lock, portMAX_DELAY);
+    esp_err_t result = load_bank();
+    xSemaphoreGive(bank_lock);
+
+    return result;
+}
+
+/**
+ * Queues a clip to start with the next block. Never blocks, returns
+ * ESP_ERR_NO_MEM if too many triggers are already waiting.
+ */
+esp_err_t sound_effects_play(uint16_t clip, uint8_t volume) {
+    uint16_t clips = atomic_load(&clip_count);
+
+    if (clips == 0) {
+        return ESP_ERR_INVALID_STATE;
+    }
+
+    if (clip >= clips) {
+        return ESP_ERR_NOT_FOUND;
+    }
+
+    trigger request = {
+        .clip = clip,
+        // Maps 255 to unity
+        .gain = volume + (volume >> 7),
+        .queued_us = esp_timer_get_time(),
+    };
+
+    if (xQueueSend(triggers, &request, 0) != pdPASS) {
+        atomic_fetch_add(&dropped, 1);
+        return ESP_ERR_NO_MEM;
+    }
+
+    return ESP_OK;
+}
+
+void sound_effects_stop_all(void) { atomic_store(&stop_requested, true); }
+
+static void start_triggered(uint32_t output_delay_us) {
+    trigger request;
+
+    while (xQueueReceive(triggers, &request, 0) == pdPASS) {
+        soundbank_clip clip;
+
+        // The bank may have been replaced since the trigger was checked
+        if (!soundbank_clip_at(&bank, request.clip, &clip) ||
+            clip_player_start(&player, &clip, request.gain) < 0) {
+            continue;
+        }
+
+        uint32_t latency = esp_timer_get_time() - request.queued_us;
+        atomic_store(&last_start_latency_us, latency);
+        if (latency > atomic_load(&max_start_latency_us)) {
+            atomic_store(&max_start_latency_us, latency);
+        }
+
+        latency += output_delay_us;
+        atomic_store(&last_dac_latency_us, latency);
+        if (latency > atomic_load(&max_dac_latency_us)) {
+            atomic_store(&max_dac_latency_us, latency);
+        }
+
+        atomic_fetch_add(&triggered, 1);
+    }
+}
+
+/**
+ * Starts whatever was triggered since the last block and mixes all playing
+ * clips into it, returning whether any were. `output_delay_us` is how long the
+ * block takes from here to the DAC. Called by the writer task only.
+ */
+bool sound_effects_mix(int16_t *stereo, size_t frames,
+                       uint32_t output_delay_us) {
+    if (xSemaphoreTake(bank_lock, 0) != pdTRUE) {
+        return false;
+    }
+
+    if (!bank_loaded) {
+        xSemaphoreGive(bank_lock);
+        return false;
+    }
+
+    if (atomic_exchange(&stop_requested, false)) {
+        xQueueReset(triggers);
+        clip_player_stop_all(&player);
+    }
+
+    start_triggered(output_delay_us);
+
+    size_t voices = clip_player_active(&player);
+    if (voices > 0) {
+        uint32_t start = instrumentation_begin();
+        clip_player_mix(&player, stereo, frames);
+        uint32_t cycles = instrumentation_end(SectionEffects, start);
+
+        // What one more voice costs, compressed clips dominate this
+        instrumentation_record_cycles(SectionEffectsVoice, cycles / voices);
+    }
+
+    atomic_store(&active_voices, clip_player_active(&player));
+    atomic_store(&stolen, player.steals);
+
+    xSemaphoreGive(bank_lock);
+
+    return voices > 0;
+}
+
+void sound_effects_get_stats(sound_effects_stats *stats) {
+    stats->clips = atomic_load(&clip_count);
+    stats->active_voices = atomic_load(&active_voices);
+    stats->triggered = atomic_load(&triggered);
+    stats->dropped = atomic_load(&dropped);
+    stats->stolen = atomic_load(&stolen);
+    stats->last_start_latency_us = atomic_load(&last_start_latency_us);
+    stats->max_start_latency_us = atomic_load(&max_start_latency_us);
+    stats->last_dac_latency_us = atomic_load(&last_dac_latency_us);
+    stats->max_dac_latency_us = atomic_load(&max_dac_latency_us);
+}
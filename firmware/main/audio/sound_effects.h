@@ -0,0 +1,48 @@
+#ifndef SOUND_EFFECTS_H
+#define SOUND_EFFECTS_H
+
+#include "esp_err.h"
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+//! Data partition the soundbank image is flashed to, see partitions.csv
+#define SOUNDBANK_PARTITION_LABEL "soundbank"
+#define SOUNDBANK_PARTITION_SUBTYPE 0x40
+
+//! Triggers waiting for the next block, more are refused until it starts
+#define SOUND_EFFECTS_QUEUE_LENGTH 16
+
+typedef struct {
+    uint16_t clips;
+    uint8_t active_voices;
+    uint32_t triggered;
+    //! Triggers refused because the queue was full
+    uint32_t dropped;
+    //! Voices cut off to make room for a newer clip
+    uint32_t stolen;
+    //! Time from a trigger to its first samples being mixed
+    uint32_t last_start_latency_us;
+    uint32_t max_start_latency_us;
+    //! Time from a trigger to its first samples reaching the DAC, the start
+    //! latency plus the output buffering its block goes through
+    uint32_t last_dac_latency_us;
+    uint32_t max_dac_latency_us;
+} sound_effects_stats;
+
+esp_err_t sound_effects_init(void);
+
+void sound_effects_release(void);
+
+esp_err_t sound_effects_reload(void);
+
+esp_err_t sound_effects_play(uint16_t clip, uint8_t volume);
+
+void sound_effects_stop_all(void);
+
+bool sound_effects_mix(int16_t *stereo, size_t frames,
+                       uint32_t output_delay_us);
+
+void sound_effects_get_stats(sound_effects_stats *stats);
+
+#endif
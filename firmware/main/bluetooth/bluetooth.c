@@ -11,9 +11,8 @@
 #define TAG "BT"
 
 #define BT_DEVICE_NAME "CosplayCore"
-#define PAIRING_BUTTON_GPIO 21
 
-void bluetooth_init(i2s_chan_handle_t i2s_handle, spi_codec_device codec_dev) {
+void bluetooth_init(void) {
     ESP_LOGI(TAG, "Starting Bluetooth speaker");
 
     // Initialize Bluetooth stack
@@ -23,10 +22,10 @@ void bluetooth_init(i2s_chan_handle_t i2s_handle, spi_codec_device codec_dev) {
     esp_bt_gap_set_device_name(BT_DEVICE_NAME);
 
     // Initialize A2DP audio
-    ESP_ERROR_CHECK(bt_audio_init(i2s_handle, codec_dev));
+    ESP_ERROR_CHECK(bt_audio_init());
 
     // Initialize pairing control
-    bt_pairing_init(PAIRING_BUTTON_GPIO);
+    bt_pairing_init();
 
     bt_spp_init();
 
@@ -1,16 +1,12 @@
 #include "bt_audio.h"
-#include "codec/i2s.h"
-#include "codec/settings.h"
-#include "driver/i2s_common.h"
+#include "audio/audio_output.h"
 #include "esp_a2dp_api.h"
 #include "esp_log.h"
-#include "portmacro.h"
+#include "power/idle.h"
+#include <inttypes.h>
 
 #define TAG "BT_AUDIO"
 
-static i2s_chan_handle_t i2s_channel;
-static spi_codec_device codec_device;
-
 // A2DP sample frequency enum values from ESP-IDF
 typedef enum {
     A2D_SAMP_FREQ_96K = 0,
@@ -39,14 +35,10 @@ static uint32_t a2dp_freq_to_hz(uint8_t freq) {
     }
 }
 
+// Runs on the Bluedroid task, so this must never block. Anything that does not
+// fit in the output ring is dropped and counted by the output module.
 static void audio_data_callback(const uint8_t *data, uint32_t len) {
-    size_t bytes_written = 0;
-
-    i2s_channel_write(i2s_channel, data, len, &bytes_written, portMAX_DELAY);
-
-    if (bytes_written < len) {
-        ESP_LOGW(TAG, "I2S underrun: %d/%d bytes written", bytes_written, len);
-    }
+    audio_output_write(data, len);
 }
 
 static void a2dp_callback(esp_a2d_cb_event_t event, esp_a2d_cb_param_t *param) {
@@ -54,31 +46,35 @@ static void a2dp_callback(esp_a2d_cb_event_t event, esp_a2d_cb_param_t *param) {
         case ESP_A2D_CONNECTION_STATE_EVT:
             if (param->conn_stat.state == ESP_A2D_CONNECTION_STATE_CONNECTED) {
                 ESP_LOGI(TAG, "A2DP connected");
-                // Unmute DAC when A2DP connects
-                set_dac_mute(codec_device, false);
             } else if (param->conn_stat.state ==
                        ESP_A2D_CONNECTION_STATE_DISCONNECTED) {
                 ESP_LOGI(TAG, "A2DP disconnected");
-                // Mute DAC when A2DP disconnects
-                set_dac_mute(codec_device, true);
+                // Only the stream goes quiet, the DACs stay unmuted for the
+                // voice and effects
+                audio_output_flush();
+                power_idle_set_stream(false);
             }
             break;
 
         case ESP_A2D_AUDIO_STATE_EVT:
             if (param->audio_stat.state == ESP_A2D_AUDIO_STATE_STARTED) {
                 ESP_LOGI(TAG, "Audio playback started");
+                power_idle_set_stream(true);
             } else if (param->audio_stat.state == ESP_A2D_AUDIO_STATE_STOPPED) {
                 ESP_LOGI(TAG, "Audio playback stopped");
+                power_idle_set_stream(false);
             }
             break;
 
         case ESP_A2D_AUDIO_CFG_EVT: {
             uint8_t samp_freq = param->audio_cfg.mcc.cie.sbc_info.samp_freq;
             uint32_t sample_rate_hz = a2dp_freq_to_hz(samp_freq);
-            ESP_LOGI(TAG, "Audio config: sample_rate=%d (%lu Hz)", samp_freq,
-                     sample_rate_hz);
-            // Update I2S sample rate to match A2DP
-            i2s_set_sample_rate(sample_rate_hz);
+            ESP_LOGI(TAG, "Audio config: sample_rate=%d (%" PRIu32 " Hz)",
+                     samp_freq, sample_rate_hz);
+            // Anything still queued was decoded at the previous rate. I2S
+            // stays at its fixed rate, the output resampler absorbs the change
+            audio_output_flush();
+            audio_output_set_input_rate(sample_rate_hz);
             break;
         }
 
@@ -88,13 +84,9 @@ static void a2dp_callback(esp_a2d_cb_event_t event, esp_a2d_cb_param_t *param) {
     }
 }
 
-esp_err_t bt_audio_init(i2s_chan_handle_t i2s_handle,
-                        spi_codec_device codec_dev) {
+esp_err_t bt_audio_init(void) {
     esp_err_t ret;
 
-    i2s_channel = i2s_handle;
-    codec_device = codec_dev;
-
     // Register A2DP callback
     ret = esp_a2d_register_callback(a2dp_callback);
     if (ret != ESP_OK) {
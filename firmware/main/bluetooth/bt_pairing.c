@@ -1,20 +1,11 @@
 #include "bt_pairing.h"
-#include "driver/gpio.h"
 #include "esp_gap_bt_api.h"
 #include "esp_log.h"
-#include "freertos/FreeRTOS.h"
-
-#define BUTTON_DEBOUNCE_MS 50
-#define BUTTON_LONG_PRESS_MS 3000
-#define BUTTON_POLL_INTERVAL_MS 10
 
 #define TAG "BT_PAIRING"
 
 static bool discoverable = false;
 
-static uint32_t button_press_time = 0;
-static uint8_t button_gpio = 0;
-
 static void gap_callback(esp_bt_gap_cb_event_t event,
                          esp_bt_gap_cb_param_t *param) {
     switch (event) {
@@ -57,59 +48,16 @@ void bt_pairing_exit(void) {
 
 bool bt_pairing_is_active(void) { return discoverable; }
 
-static void button_task(void *pvParameters) {
-    bool last_state = true;
-    bool current_state;
-    uint32_t press_duration;
-
-    while (true) {
-        current_state = gpio_get_level(button_gpio);
-
-        // Button press (active low)
-        if (!current_state && last_state) {
-            vTaskDelay(pdMS_TO_TICKS(BUTTON_DEBOUNCE_MS));
-            current_state = gpio_get_level(button_gpio);
-
-            if (!current_state) {
-                button_press_time = xTaskGetTickCount() * portTICK_PERIOD_MS;
-            }
-        }
-        // Button release
-        else if (current_state && !last_state) {
-            vTaskDelay(pdMS_TO_TICKS(BUTTON_DEBOUNCE_MS));
-            current_state = gpio_get_level(button_gpio);
-
-            if (current_state) {
-                press_duration = (xTaskGetTickCount() * portTICK_PERIOD_MS) -
-                                 button_press_time;
-
-                // Short press: toggle pairing mode
-                if (press_duration < BUTTON_LONG_PRESS_MS) {
-                    if (discoverable) {
-                        bt_pairing_exit();
-                    } else {
-                        bt_pairing_enter();
-                    }
-                }
-            }
-        }
-
-        last_state = current_state;
-        vTaskDelay(pdMS_TO_TICKS(BUTTON_POLL_INTERVAL_MS));
+//! Bound to a short press of the pairing button
+void bt_pairing_toggle(void) {
+    if (discoverable) {
+        bt_pairing_exit();
+    } else {
+        bt_pairing_enter();
     }
 }
 
-void bt_pairing_init(uint8_t gpio_num) {
-    button_gpio = gpio_num;
-
-    // Configure button GPIO
-    gpio_config_t io_conf = {.pin_bit_mask = (1ULL << button_gpio),
-                             .mode = GPIO_MODE_INPUT,
-                             .pull_up_en = GPIO_PULLUP_ENABLE,
-                             .pull_down_en = GPIO_PULLDOWN_DISABLE,
-                             .intr_type = GPIO_INTR_DISABLE};
-    gpio_config(&io_conf);
-
+void bt_pairing_init(void) {
     // Register GAP callback
     esp_bt_gap_register_callback(gap_callback);
 
@@ -121,8 +69,5 @@ void bt_pairing_init(uint8_t gpio_num) {
     // Set non-discoverable by default
     esp_bt_gap_set_scan_mode(ESP_BT_CONNECTABLE, ESP_BT_NON_DISCOVERABLE);
 
-    // Create button monitoring task
-    xTaskCreate(button_task, "bt_button", 2048, NULL, 5, NULL);
-
-    ESP_LOGI(TAG, "Pairing control initialized (GPIO %d)", button_gpio);
+    ESP_LOGI(TAG, "Pairing control initialized");
 }
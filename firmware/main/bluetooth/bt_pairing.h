@@ -2,11 +2,11 @@
 #define BT_PAIRING_H
 
 #include <stdbool.h>
-#include <stdint.h>
 
-void bt_pairing_init(uint8_t button_gpio);
+void bt_pairing_init(void);
 void bt_pairing_enter(void);
 void bt_pairing_exit(void);
+void bt_pairing_toggle(void);
 bool bt_pairing_is_active(void);
 
 #endif
@@ -1,7 +1,12 @@
+#include "control/control.h"
 #include "esp_err.h"
 #include "esp_log.h"
 #include "esp_spp_api.h"
+#include "freertos/FreeRTOS.h"
+#include <stdatomic.h>
+#include <stdbool.h>
 #include <stdint.h>
+#include <string.h>
 
 #include "bt_spp.h"
 
@@ -11,6 +16,138 @@
 
 uint32_t spp_handle;
 
+//! Replies queued while a write is in flight are gathered here and sent
+//! together once it completes
+#define TX_BUFFER_SIZE 2048
+
+//! Largest telemetry batch handed over in one write
+#define TELEMETRY_BUFFER_SIZE 1024
+
+//! Guards the link state shared between the Bluedroid task and the telemetry
+//! task. Writes themselves are always issued outside of it.
+static portMUX_TYPE tx_lock = portMUX_INITIALIZER_UNLOCKED;
+
+static uint32_t connection_handle;
+static bool connected;
+//! Set by the stack when the peer cannot keep up, nothing new is written
+//! until it clears
+static bool congested;
+static bool tx_in_flight;
+
+//! SPP keeps a reference to written data until ESP_SPP_WRITE_EVT, so one
+//! buffer is in flight while the other collects the next write. The
+//! collecting buffer is only filled under tx_lock.
+static uint8_t tx_buffers[2][TX_BUFFER_SIZE];
+static uint8_t tx_collecting;
+static size_t tx_length;
+
+static uint8_t telemetry_buffer[TELEMETRY_BUFFER_SIZE];
+
+//! Receives incoming data instead of the control parser while set
+static _Atomic(bt_spp_bulk_handler) bulk_handler;
+
+/**
+ * Takes the link for one write if it is free. `replies_first` refuses it while
+ * replies are waiting, which is how telemetry yields to command traffic.
+ */
+static bool claim_link(bool replies_first) {
+    portENTER_CRITICAL(&tx_lock);
+
+    bool claimed = connected && !congested && !tx_in_flight &&
+                   !(replies_first && tx_length > 0);
+    if (claimed) {
+        tx_in_flight = true;
+    }
+
+    portEXIT_CRITICAL(&tx_lock);
+
+    return claimed;
+}
+
+static void release_link(void) {
+    portENTER_CRITICAL(&tx_lock);
+    tx_in_flight = false;
+    portEXIT_CRITICAL(&tx_lock);
+}
+
+static void flush_tx(void) {
+    if (!claim_link(false)) {
+        return;
+    }
+
+    portENTER_CRITICAL(&tx_lock);
+    uint8_t *buffer = tx_buffers[tx_collecting];
+    size_t length = tx_length;
+    if (length > 0) {
+        tx_collecting ^= 1;
+        tx_length = 0;
+    }
+    portEXIT_CRITICAL(&tx_lock);
+
+    if (length == 0 ||
+        esp_spp_write(connection_handle, length, buffer) != ESP_OK) {
+        release_link();
+    }
+}
+
+/**
+ * Queues data for the connected client. Safe to call from any task, never
+ * blocks and returns ESP_ERR_NO_MEM if the data does not fit behind what is
+ * already waiting.
+ */
+esp_err_t bt_spp_send(const uint8_t *data, size_t len) {
+    esp_err_t result = ESP_OK;
+
+    portENTER_CRITICAL(&tx_lock);
+    if (!connected) {
+        result = ESP_ERR_INVALID_STATE;
+    } else if (len == 0 || tx_length + len > TX_BUFFER_SIZE) {
+        result = ESP_ERR_NO_MEM;
+    } else {
+        memcpy(&tx_buffers[tx_collecting][tx_length], data, len);
+        tx_length += len;
+    }
+    portEXIT_CRITICAL(&tx_lock);
+
+    if (result == ESP_OK) {
+        flush_tx();
+    }
+
+    return result;
+}
+
+/**
+ * Routes everything received to `handler` until it is cleared with NULL, or
+ * the link closes. Used for bulk transfers that bypass the frame parser.
+ */
+void bt_spp_set_bulk_handler(bt_spp_bulk_handler handler) {
+    atomic_store(&bulk_handler, handler);
+}
+
+/**
+ * Writes a telemetry batch if the link is idle, uncongested and has no replies
+ * waiting. Nothing is queued, a busy link returns ESP_ERR_INVALID_STATE and
+ * the caller decides what to drop.
+ */
+esp_err_t bt_spp_send_telemetry(const uint8_t *data, size_t len) {
+    if (len == 0 || len > TELEMETRY_BUFFER_SIZE) {
+        return ESP_ERR_INVALID_SIZE;
+    }
+
+    if (!claim_link(true)) {
+        return ESP_ERR_INVALID_STATE;
+    }
+
+    memcpy(telemetry_buffer, data, len);
+
+    esp_err_t result = esp_spp_write(connection_handle, len, telemetry_buffer);
+    if (result != ESP_OK) {
+        release_link();
+    }
+
+    return result;
+}
+
 static void esp_spp_cb(esp_spp_cb_event_t event, esp_spp_cb_param_t *param) {
     switch (event) {
         case ESP_SPP_INIT_EVT:
@@ -29,6 +166,14 @@ static void esp_spp_cb(esp_spp_cb_event_t event, esp_spp_cb_param_t *param) {
             ESP_LOGI(TAG, "ESP_SPP_OPEN_EVT");
             break;
         case ESP_SPP_CLOSE_EVT:
+            portENTER_CRITICAL(&tx_lock);
+            connected = false;
+            congested = false;
+            tx_in_flight = false;
+            tx_length = 0;
+            portEXIT_CRITICAL(&tx_lock);
+            atomic_store(&bulk_handler, NULL);
+            control_reset();
             ESP_LOGI(TAG,
                      "ESP_SPP_CLOSE_EVT status:%d handle:%" PRIu32
                      " close_by_remote:%d",
@@ -50,18 +195,40 @@ static void esp_spp_cb(esp_spp_cb_event_t event, esp_spp_cb_param_t *param) {
         case ESP_SPP_CL_INIT_EVT:
             ESP_LOGI(TAG, "ESP_SPP_CL_INIT_EVT");
             break;
-        case ESP_SPP_DATA_IND_EVT:
-            ESP_LOGI(TAG, "ESP_SPP_DATA_IND_EVT: %s", param->data_ind.data);
+        case ESP_SPP_DATA_IND_EVT: {
+            ESP_LOGD(TAG, "ESP_SPP_DATA_IND_EVT len:%d", param->data_ind.len);
+            bt_spp_bulk_handler handler = atomic_load(&bulk_handler);
+            if (handler != NULL) {
+                handler(param->data_ind.data, param->data_ind.len);
+            } else {
+                control_receive(param->data_ind.data, param->data_ind.len);
+            }
             break;
+        }
         case ESP_SPP_CONG_EVT:
-            ESP_LOGI(TAG, "ESP_SPP_CONG_EVT");
+            ESP_LOGD(TAG, "ESP_SPP_CONG_EVT cong:%d", param->cong.cong);
+            portENTER_CRITICAL(&tx_lock);
+            congested = param->cong.cong;
+            portEXIT_CRITICAL(&tx_lock);
+            flush_tx();
             break;
         case ESP_SPP_WRITE_EVT:
-            ESP_LOGI(TAG, "ESP_SPP_WRITE_EVT");
+            ESP_LOGD(TAG, "ESP_SPP_WRITE_EVT");
+            portENTER_CRITICAL(&tx_lock);
+            tx_in_flight = false;
+            congested = param->write.cong;
+            portEXIT_CRITICAL(&tx_lock);
+            flush_tx();
             break;
         case ESP_SPP_SRV_OPEN_EVT:
             ESP_LOGI(TAG, "ESP_SPP_SRV_OPEN_EVT status:%d",
                      param->srv_open.status);
+            if (param->srv_open.status == ESP_SPP_SUCCESS) {
+                portENTER_CRITICAL(&tx_lock);
+                connection_handle = param->srv_open.handle;
+                connected = true;
+                portEXIT_CRITICAL(&tx_lock);
+            }
             break;
         case ESP_SPP_SRV_STOP_EVT:
             ESP_LOGI(TAG, "ESP_SPP_SRV_STOP_EVT");
@@ -2,7 +2,17 @@
 #define BT_SPP_H
 
 #include "esp_err.h"
+#include <stddef.h>
+#include <stdint.h>
+
+typedef void (*bt_spp_bulk_handler)(const uint8_t *data, size_t len);
 
 esp_err_t bt_spp_init();
 
+esp_err_t bt_spp_send(const uint8_t *data, size_t len);
+
+esp_err_t bt_spp_send_telemetry(const uint8_t *data, size_t len);
+
+void bt_spp_set_bulk_handler(bt_spp_bulk_handler handler);
+
 #endif
\ No newline at end of file
@@ -1,86 +1,197 @@
+/**
+ * This file brings up the I2S ports the codecs are wired to. The first codec's
+ * port generates the clocks. The second codec has BCLK and LRC pins of its own,
+ * but instead of running a divider of its own its port is a slave and those
+ * pins are driven from the first port's clock outputs through the GPIO matrix.
+ * The pads keep their input enabled, so the slave reads the clocks straight
+ * back off them.
+ *
+ * Both codecs therefore see the very same clock, and a slave TX enabled before
+ * the clock starts shifts out its first frame alongside the master's. Nothing
+ * can drift or slip between the two outputs after that.
+ */
+
 #include "i2s.h"
-#include "driver/i2s_std.h"
-#include "esp_log.h"
+#include "driver/gpio.h"
+#include "esp_rom_gpio.h"
+#include "soc/gpio_sig_map.h"
+
+//! Clock outputs of each port in the GPIO matrix, BCLK then LRC
+static const uint32_t CLOCK_SIGNALS[I2S_NUM_MAX][2] = {
+    [I2S_NUM_0] = {I2S0O_BCK_OUT_IDX, I2S0O_WS_OUT_IDX},
+    [I2S_NUM_1] = {I2S1O_BCK_OUT_IDX, I2S1O_WS_OUT_IDX},
+};
+
+/**
+ * Allocates the channels with the given DMA geometry and puts them into
+ * standard mode, all disabled. A follower's clock pins are then handed over to
+ * the leader's clock outputs, which the driver just set up as plain inputs.
+ */
+static esp_err_t create_channels(i2s_device *device, uint32_t dma_desc_num,
+                                 uint32_t dma_frame_num) {
+    bool follower = device->clock_port != device->port;
+
+    i2s_chan_config_t chan_cfg = I2S_CHANNEL_DEFAULT_CONFIG(
+        device->port, follower ? I2S_ROLE_SLAVE : I2S_ROLE_MASTER);
+    chan_cfg.dma_desc_num = dma_desc_num;
+    chan_cfg.dma_frame_num = dma_frame_num;
+
+    bool capture = device->config.gpio_cfg.din != I2S_GPIO_UNUSED;
+
+    esp_err_t result = i2s_new_channel(&chan_cfg, &device->tx,
+                                       capture ? &device->rx : NULL);
+    if (result != ESP_OK)
+        return result;
 
-static const char *TAG = "WM8988";
+    result = i2s_channel_init_std_mode(device->tx, &device->config);
+    if (result != ESP_OK)
+        return result;
 
-static i2s_chan_handle_t g_tx_handle = NULL;
+    if (capture) {
+        result = i2s_channel_init_std_mode(device->rx, &device->config);
+        if (result != ESP_OK)
+            return result;
+    }
 
-#define DEFAULT_SAMPLE_RATE 44100
+    if (!follower) {
+        return ESP_OK;
+    }
 
-esp_err_t i2s_device_init(i2s_chan_handle_t *tx_handle,
-                          i2s_chan_handle_t *rx_handle, uint8_t bclk_pin,
-                          uint8_t ws_pin, uint8_t dout_pin, uint8_t din_pin) {
-    i2s_chan_config_t chan_cfg =
-        I2S_CHANNEL_DEFAULT_CONFIG(I2S_NUM_0, I2S_ROLE_MASTER);
+    const int pins[] = {device->config.gpio_cfg.bclk,
+                        device->config.gpio_cfg.ws};
 
-    esp_err_t result = i2s_new_channel(&chan_cfg, tx_handle, rx_handle);
+    for (size_t i = 0; i < 2; i++) {
+        result = gpio_set_direction(pins[i], GPIO_MODE_INPUT_OUTPUT);
+        if (result != ESP_OK)
+            return result;
 
-    if (result != ESP_OK)
-        return result;
+        esp_rom_gpio_connect_out_signal(
+            pins[i], CLOCK_SIGNALS[device->clock_port][i], false, false);
+    }
 
-    // Store tx handle for dynamic reconfiguration
-    g_tx_handle = *tx_handle;
+    return ESP_OK;
+}
 
-    i2s_std_config_t std_cfg = {
-        .clk_cfg = I2S_STD_CLK_DEFAULT_CONFIG(DEFAULT_SAMPLE_RATE),
-        .slot_cfg = I2S_STD_PHILIPS_SLOT_DEFAULT_CONFIG(
-            I2S_DATA_BIT_WIDTH_16BIT, I2S_SLOT_MODE_STEREO),
-        .gpio_cfg =
+/**
+ * Sets up a port that generates its own clocks, the leader of any followers
+ * initialized after it. Without `capture` no RX channel is allocated and
+ * `din_pin` is ignored.
+ */
+esp_err_t i2s_device_init(i2s_device *device, i2s_port_t port, bool capture,
+                          uint32_t dma_desc_num, uint32_t dma_frame_num,
+                          uint8_t bclk_pin, uint8_t ws_pin, uint8_t dout_pin,
+                          uint8_t din_pin) {
+    *device = (i2s_device){
+        .port = port,
+        .clock_port = port,
+        .config =
             {
-                .mclk = 0,
-                .bclk = bclk_pin,
-                .ws = ws_pin,
-                .dout = dout_pin,
-                .din = din_pin,
-                .invert_flags =
+                .clk_cfg = I2S_STD_CLK_DEFAULT_CONFIG(SAMPLE_RATE),
+                .slot_cfg = I2S_STD_PHILIPS_SLOT_DEFAULT_CONFIG(
+                    I2S_DATA_BIT_WIDTH_16BIT, I2S_SLOT_MODE_STEREO),
+                .gpio_cfg =
                     {
-                        .mclk_inv = false,
-                        .bclk_inv = false,
-                        .ws_inv = false,
+                        .mclk = 0,
+                        .bclk = bclk_pin,
+                        .ws = ws_pin,
+                        .dout = dout_pin,
+                        .din = capture ? din_pin : I2S_GPIO_UNUSED,
+                        .invert_flags =
+                            {
+                                .mclk_inv = false,
+                                .bclk_inv = false,
+                                .ws_inv = false,
+                            },
                     },
             },
     };
 
-    result = i2s_channel_init_std_mode(*tx_handle, &std_cfg);
-    if (result != ESP_OK)
-        return result;
+    return create_channels(device, dma_desc_num, dma_frame_num);
+}
+
+/**
+ * Sets up a playback only port clocked by `leader`, whose BCLK and LRC are
+ * repeated on `bclk_pin` and `ws_pin`
+ */
+esp_err_t i2s_device_init_follower(i2s_device *device, i2s_port_t port,
+                                   const i2s_device *leader,
+                                   uint32_t dma_desc_num,
+                                   uint32_t dma_frame_num, uint8_t bclk_pin,
+                                   uint8_t ws_pin, uint8_t dout_pin) {
+    *device = (i2s_device){
+        .port = port,
+        .clock_port = leader->port,
+        .config = leader->config,
+    };
+
+    // GPIO0 already carries the leader's MCLK to both codecs
+    device->config.gpio_cfg.mclk = I2S_GPIO_UNUSED;
+    device->config.gpio_cfg.bclk = bclk_pin;
+    device->config.gpio_cfg.ws = ws_pin;
+    device->config.gpio_cfg.dout = dout_pin;
+    device->config.gpio_cfg.din = I2S_GPIO_UNUSED;
 
-    return i2s_channel_enable(*tx_handle);
+    return create_channels(device, dma_desc_num, dma_frame_num);
 }
 
-esp_err_t i2s_set_sample_rate(uint32_t sample_rate) {
-    if (g_tx_handle == NULL) {
-        ESP_LOGE(TAG, "I2S not initialized");
-        return ESP_ERR_INVALID_STATE;
+/**
+ * Starts TX on every device in one clock domain. Followers go first so they
+ * are waiting when the leader's clock starts, which makes every device shift
+ * out its first frame on the same LRC edge. RX is left to its consumer.
+ */
+esp_err_t i2s_devices_start(i2s_device *devices, size_t count) {
+    for (size_t i = count; i-- > 0;) {
+        esp_err_t result = i2s_channel_enable(devices[i].tx);
+        if (result != ESP_OK) {
+            return result;
+        }
     }
 
-    // Disable the channel first
-    esp_err_t result = i2s_channel_disable(g_tx_handle);
-    if (result != ESP_OK) {
-        ESP_LOGE(TAG, "Failed to disable I2S channel: %s",
-                 esp_err_to_name(result));
-        return result;
-    }
+    return ESP_OK;
+}
 
-    // Configure new clock settings
-    i2s_std_clk_config_t clk_cfg = I2S_STD_CLK_DEFAULT_CONFIG(sample_rate);
+/**
+ * Stops every channel, the leader first so no follower is ever clocked
+ * without the others. Channels already stopped are skipped.
+ */
+void i2s_devices_stop(i2s_device *devices, size_t count) {
+    for (size_t i = 0; i < count; i++) {
+        i2s_channel_disable(devices[i].tx);
+        if (devices[i].rx != NULL) {
+            i2s_channel_disable(devices[i].rx);
+        }
+    }
+}
 
-    result = i2s_channel_reconfig_std_clock(g_tx_handle, &clk_cfg);
-    if (result != ESP_OK) {
-        ESP_LOGE(TAG, "Failed to reconfigure I2S clock: %s",
-                 esp_err_to_name(result));
-        return result;
+/**
+ * Tears every channel down and rebuilds them with new DMA buffers. The DMA
+ * geometry is fixed at allocation so this is the only way to change it, and
+ * all devices of a clock domain have to change together to stay aligned. The
+ * handles are replaced and TX is started again, RX comes back disabled.
+ */
+esp_err_t i2s_devices_set_dma_geometry(i2s_device *devices, size_t count,
+                                       uint32_t dma_desc_num,
+                                       uint32_t dma_frame_num) {
+    i2s_devices_stop(devices, count);
+
+    for (size_t i = 0; i < count; i++) {
+        esp_err_t result = i2s_del_channel(devices[i].tx);
+        if (result != ESP_OK)
+            return result;
+
+        if (devices[i].rx != NULL) {
+            result = i2s_del_channel(devices[i].rx);
+            if (result != ESP_OK)
+                return result;
+        }
     }
 
-    // Re-enable the channel
-    result = i2s_channel_enable(g_tx_handle);
-    if (result != ESP_OK) {
-        ESP_LOGE(TAG, "Failed to enable I2S channel: %s",
-                 esp_err_to_name(result));
-        return result;
+    for (size_t i = 0; i < count; i++) {
+        esp_err_t result =
+            create_channels(&devices[i], dma_desc_num, dma_frame_num);
+        if (result != ESP_OK)
+            return result;
     }
 
-    ESP_LOGI(TAG, "I2S sample rate changed to %lu Hz", sample_rate);
-    return ESP_OK;
+    return i2s_devices_start(devices, count);
 }
@@ -1,15 +1,48 @@
 #ifndef CODEC_I2S_H
 #define CODEC_I2S_H
 
-#include "driver/i2s_types.h"
+#include "driver/i2s_std.h"
 #include "esp_err.h"
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
 
+//! I2S and the codec run at this rate permanently, other sources are
+//! resampled to it
 #define SAMPLE_RATE 48000
 
-esp_err_t i2s_device_init(i2s_chan_handle_t *tx_handle,
-                          i2s_chan_handle_t *rx_handle, uint8_t bclk_pin,
-                          uint8_t ws_pin, uint8_t dout_pin, uint8_t din_pin);
+/**
+ * One I2S port and the codec wired to it. A follower runs as a slave off the
+ * clocks of the leader, the first device of any set passed below, so their
+ * samples stay aligned for good.
+ */
+typedef struct {
+    i2s_port_t port;
+    i2s_chan_handle_t tx;
+    //! NULL when nothing is captured on this port
+    i2s_chan_handle_t rx;
+    //! Port generating the clocks, the device's own unless it is a follower
+    i2s_port_t clock_port;
+    i2s_std_config_t config;
+} i2s_device;
 
-esp_err_t i2s_set_sample_rate(uint32_t sample_rate);
+esp_err_t i2s_device_init(i2s_device *device, i2s_port_t port, bool capture,
+                          uint32_t dma_desc_num, uint32_t dma_frame_num,
+                          uint8_t bclk_pin, uint8_t ws_pin, uint8_t dout_pin,
+                          uint8_t din_pin);
+
+esp_err_t i2s_device_init_follower(i2s_device *device, i2s_port_t port,
+                                   const i2s_device *leader,
+                                   uint32_t dma_desc_num,
+                                   uint32_t dma_frame_num, uint8_t bclk_pin,
+                                   uint8_t ws_pin, uint8_t dout_pin);
+
+esp_err_t i2s_devices_start(i2s_device *devices, size_t count);
+
+void i2s_devices_stop(i2s_device *devices, size_t count);
+
+esp_err_t i2s_devices_set_dma_geometry(i2s_device *devices, size_t count,
+                                       uint32_t dma_desc_num,
+                                       uint32_t dma_frame_num);
 
 #endif
@@ -0,0 +1,152 @@
+/**
+ * This file keeps a shadow copy of each WM8988's register map. Setters change
+ * individual fields in the shadow and mark the register dirty, and
+ * codec_commit() later writes only the registers whose value actually changed.
+ */
+
+#include "registers.h"
+#include "esp_log.h"
+#include <string.h>
+
+static const char *TAG = "WM8988";
+
+//! Wait before committing again what the SPI queue could not take, a full
+//! queue of writes takes well under a millisecond to clock out
+#define COMMIT_RETRY_US 1000
+
+//! Power on values from the WM8988 datasheet register map, addresses that do
+//! not exist are left at zero and never written
+static const uint16_t REGISTER_DEFAULTS[CODEC_REGISTER_COUNT] = {
+    [LeftInputVolume] = 0x097,
+    [RightInputVolume] = 0x097,
+    [LeftOutput1Volume] = 0x079,
+    [RightOutput1Volume] = 0x079,
+    [ADCDACControl] = 0x008,
+    [AudioInterface] = 0x00A,
+    [SampleRate] = 0x000,
+    [LeftDACVolume] = 0x0FF,
+    [RightDACVolume] = 0x0FF,
+    [BassControl] = 0x00F,
+    [TrebleControl] = 0x00F,
+    [Control3D] = 0x000,
+    [ALC1] = 0x07B,
+    [ALC2] = 0x000,
+    [ALC3] = 0x032,
+    [NoiseGate] = 0x000,
+    [LeftADCVolume] = 0x0C3,
+    [RightADCVolume] = 0x0C3,
+    [AdditionalControl1] = 0x0C0,
+    [AdditionalControl2] = 0x000,
+    [PowerManagement1] = 0x000,
+    [PowerManagement2] = 0x000,
+    [AdditionalControl3] = 0x000,
+    [ADCInputMode] = 0x000,
+    [ADCLSignalPath] = 0x000,
+    [ADCRSignalPath] = 0x000,
+    [LeftOutMix1] = 0x050,
+    [LeftOutMix2] = 0x050,
+    [RightOutMix1] = 0x050,
+    [RightOutMix2] = 0x050,
+    [LeftOutput2Volume] = 0x079,
+    [RightOutput2Volume] = 0x079,
+    [LowPowerPlayback] = 0x000,
+};
+
+void codec_reset_shadow(spi_codec_device device) {
+    portENTER_CRITICAL(&device->lock);
+    memcpy(device->registers, REGISTER_DEFAULTS, sizeof(REGISTER_DEFAULTS));
+    memset(device->dirty, 0, sizeof(device->dirty));
+    portEXIT_CRITICAL(&device->lock);
+}
+
+/**
+ * Read-modify-writes the bits selected by mask in the shadow register. The
+ * register is only marked dirty when its value actually changes.
+ */
+esp_err_t codec_update_bits(spi_codec_device device, RegisterAddress address,
+                            uint16_t mask, uint16_t value) {
+    if (address >= CODEC_REGISTER_COUNT || address == Reset) {
+        ESP_LOGE(TAG, "Invalid shadowed register 0x%02x", address);
+        return ESP_ERR_INVALID_ARG;
+    }
+
+    portENTER_CRITICAL(&device->lock);
+
+    uint16_t current = device->registers[address];
+    uint16_t updated = ((current & ~mask) | (value & mask)) & 0x1FF;
+
+    if (updated != current) {
+        device->registers[address] = updated;
+        device->dirty[address / 32] |= 1u << (address % 32);
+    }
+
+    portEXIT_CRITICAL(&device->lock);
+
+    return ESP_OK;
+}
+
+uint16_t codec_read_shadow(spi_codec_device device, RegisterAddress address) {
+    portENTER_CRITICAL(&device->lock);
+    uint16_t value = device->registers[address];
+    portEXIT_CRITICAL(&device->lock);
+
+    return value;
+}
+
+bool codec_has_pending(spi_codec_device device) {
+    bool pending = false;
+
+    portENTER_CRITICAL(&device->lock);
+    for (size_t i = 0; i < sizeof(device->dirty) / sizeof(device->dirty[0]);
+         i++) {
+        pending |= device->dirty[i] != 0;
+    }
+    portEXIT_CRITICAL(&device->lock);
+
+    return pending;
+}
+
+/**
+ * Queues every dirty register to the codec in address order without blocking.
+ * Registers the SPI queue could not take stay dirty and are committed again
+ * shortly after, so a mute or volume change never waits on an unrelated write.
+ * Those it did take are not sent twice.
+ */
+esp_err_t codec_commit(spi_codec_device device) {
+    codec_register_write writes[SPI_QUEUE_DEPTH];
+    size_t count = 0;
+
+    portENTER_CRITICAL(&device->lock);
+
+    for (uint8_t address = 0;
+         address < CODEC_REGISTER_COUNT && count < SPI_QUEUE_DEPTH; address++) {
+        uint32_t bit = 1u << (address % 32);
+
+        if (device->dirty[address / 32] & bit) {
+            writes[count].address = address;
+            writes[count].value = device->registers[address];
+            device->dirty[address / 32] &= ~bit;
+            count++;
+        }
+    }
+
+    portEXIT_CRITICAL(&device->lock);
+
+    size_t queued;
+    esp_err_t result =
+        write_register_sequence(device, writes, count, NULL, NULL, 0, &queued);
+
+    if (result != ESP_OK) {
+        portENTER_CRITICAL(&device->lock);
+        for (size_t i = queued; i < count; i++) {
+            uint8_t address = writes[i].address;
+            device->dirty[address / 32] |= 1u << (address % 32);
+        }
+        portEXIT_CRITICAL(&device->lock);
+
+        // Fails harmlessly if a retry is already pending
+        esp_timer_start_once(device->retry_timer, COMMIT_RETRY_US);
+    }
+
+    return result;
+}
@@ -0,0 +1,57 @@
+#ifndef CODEC_REGISTERS_H
+#define CODEC_REGISTERS_H
+
+#include "codec/spi.h"
+#include "esp_err.h"
+#include <stdbool.h>
+#include <stdint.h>
+
+typedef enum {
+    LeftInputVolume = 0x00,
+    RightInputVolume = 0x01,
+    LeftOutput1Volume = 0x02,
+    RightOutput1Volume = 0x03,
+    ADCDACControl = 0x05,
+    AudioInterface = 0x07,
+    SampleRate = 0x08,
+    LeftDACVolume = 0x0A,
+    RightDACVolume = 0x0B,
+    BassControl = 0x0C,
+    TrebleControl = 0x0D,
+    Reset = 0x0F,
+    Control3D = 0x10,
+    ALC1 = 0x11,
+    ALC2 = 0x12,
+    ALC3 = 0x13,
+    NoiseGate = 0x14,
+    LeftADCVolume = 0x15,
+    RightADCVolume = 0x16,
+    AdditionalControl1 = 0x17,
+    AdditionalControl2 = 0x18,
+    PowerManagement1 = 0x19,
+    PowerManagement2 = 0x1A,
+    AdditionalControl3 = 0x1B,
+    ADCInputMode = 0x1F,
+    ADCLSignalPath = 0x20,
+    ADCRSignalPath = 0x21,
+    LeftOutMix1 = 0x22,
+    LeftOutMix2 = 0x23,
+    RightOutMix1 = 0x24,
+    RightOutMix2 = 0x25,
+    LeftOutput2Volume = 0x28,
+    RightOutput2Volume = 0x29,
+    LowPowerPlayback = 0x43,
+} RegisterAddress;
+
+void codec_reset_shadow(spi_codec_device device);
+
+esp_err_t codec_update_bits(spi_codec_device device, RegisterAddress address,
+                            uint16_t mask, uint16_t value);
+
+uint16_t codec_read_shadow(spi_codec_device device, RegisterAddress address);
+
+bool codec_has_pending(spi_codec_device device);
+
+esp_err_t codec_commit(spi_codec_device device);
+
+#endif
@@ -1,48 +1,13 @@
 #include "settings.h"
 #include "esp_err.h"
 #include "esp_log.h"
+#include "registers.h"
 #include "spi.h"
 #include <stdbool.h>
+#include <stdint.h>
 
 static const char *TAG = "WM8988";
 
-typedef enum {
-    LeftInputVolume = 0x00,
-    RightInputVolume = 0x01,
-    LeftOutput1Volume = 0x02,
-    RightOutput1Volume = 0x03,
-    ADCDACControl = 0x05,
-    AudioInterface = 0x07,
-    SampleRate = 0x08,
-    LeftDACVolume = 0x0A,
-    RightDACVolume = 0x0B,
-    BassControl = 0x0C,
-    TrebleControl = 0x0D,
-    Reset = 0x0F,
-    Control3D = 0x10,
-    ALC1 = 0x11,
-    ALC2 = 0x12,
-    ALC3 = 0x13,
-    NoiseGate = 0x14,
-    LeftADCVolume = 0x15,
-    RightADCVolume = 0x16,
-    AdditionalControl1 = 0x17,
-    AdditionalControl2 = 0x18,
-    PowerManagement1 = 0x19,
-    PowerManagement2 = 0x1A,
-    AdditionalControl3 = 0x1B,
-    ADCInputMode = 0x1F,
-    ADCLSignalPath = 0x20,
-    ADCRSignalPath = 0x21,
-    LeftOutMix1 = 0x22,
-    LeftOutMix2 = 0x23,
-    RightOutMix1 = 0x24,
-    RightOutMix2 = 0x25,
-    LeftOutput2Volume = 0x28,
-    RightOutput2Volume = 0x29,
-    LowPowerPlayback = 0x43,
-} RegisterAddress;
-
 esp_err_t set_input_volume(spi_codec_device device, Channel channel,
                            uint8_t volume) {
     uint8_t address = channel == Left ? LeftInputVolume : RightInputVolume;
@@ -56,12 +21,12 @@ esp_err_t set_input_volume(spi_codec_device device, Channel channel,
 
     bool update_immediate = true;
     bool mute = volume == 0;
-    bool zero_cross_detector = false;
 
-    uint16_t data = (update_immediate << 8) | (mute << 7) |
-                    (zero_cross_detector << 6) | (volume & 0b111111);
+    // The zero cross detector bit is left as it is
+    uint16_t data =
+        (update_immediate << 8) | (mute << 7) | (volume & 0b111111);
 
-    return write_register(address, data, device);
+    return codec_update_bits(device, address, 0x1BF, data);
 }
 
 esp_err_t set_output_volume(spi_codec_device device, Channel channel,
@@ -76,12 +41,11 @@ esp_err_t set_output_volume(spi_codec_device device, Channel channel,
     }
 
     bool update_immediate = true;
-    bool zero_cross_detector = false;
 
-    uint16_t data = (update_immediate << 8) | (zero_cross_detector << 7) |
-                    (volume & 0b1111111);
+    // The zero cross detector bit is left as it is
+    uint16_t data = (update_immediate << 8) | (volume & 0b1111111);
 
-    return write_register(address, data, device);
+    return codec_update_bits(device, address, 0x17F, data);
 }
 
 const int VALID_AUDIO_WORD_LENGTHS[] = {16, 20, 24, 32};
@@ -119,58 +83,74 @@ esp_err_t set_digital_audio_interface(spi_codec_device device,
                    (swap_left_right << 5) | (invert_lrc_polarity << 4) |
                    ((word_length_repr & 0b11) << 2) | (audio_format & 0b11);
 
-    return write_register(AudioInterface, data, device);
+    // Bit 8 (bit clock invert for DSP mode B) is not managed here
+    return codec_update_bits(device, AudioInterface, 0xFF, data);
+}
+
+esp_err_t set_vmid(spi_codec_device device, VmidSelection selection) {
+    return codec_update_bits(device, PowerManagement1, 0x180,
+                             (selection & 0b11) << 7);
 }
 
 esp_err_t set_power_management(spi_codec_device device, bool adc_left,
                                bool adc_right, bool dac_left, bool dac_right,
                                bool lout1, bool rout1) {
-    uint8_t vmid_selection = 0b01;
     bool vref = true;
 
-    bool pga_left = true;
-    bool pga_right = true;
+    // The input PGAs only feed their ADC, the analog bypass is never used
+    bool pga_left = adc_left;
+    bool pga_right = adc_right;
 
     bool lout2 = false;
     bool rout2 = false;
 
     bool master_clk_disabled = false;
 
-    uint16_t data1 = ((vmid_selection & 0b11) << 7) | (vref << 6) |
-                     (pga_left << 5) | (pga_right << 4) | (adc_left << 3) |
-                     (adc_right << 2);
+    uint16_t data1 = (vref << 6) | (pga_left << 5) | (pga_right << 4) |
+                     (adc_left << 3) | (adc_right << 2);
     uint16_t data2 = (dac_left << 8) | (dac_right << 7) | (lout1 << 6) |
                      (rout1 << 5) | (lout2 << 4) | (rout2 << 3) |
                      master_clk_disabled;
 
-    esp_err_t result = write_register(PowerManagement1, data1, device);
+    // VMID is set on its own with set_vmid. MICB and DIGENB in the low bits
+    // of PowerManagement1 and OUT3 in PowerManagement2 are left as they are.
+    esp_err_t result =
+        codec_update_bits(device, PowerManagement1, 0x07C, data1);
 
     if (result != ESP_OK) {
         return result;
     }
 
-    return write_register(PowerManagement2, data2, device);
+    return codec_update_bits(device, PowerManagement2, 0x1F9, data2);
 }
 
 esp_err_t set_dac_volume(spi_codec_device device, Channel channel,
                          uint8_t volume) {
     uint8_t address = channel == Left ? LeftDACVolume : RightDACVolume;
 
-    if (volume > MAX_DAC_VOLUME) {
-        ESP_LOGE(TAG, "Cannot set DAC volume greater than %d", MAX_DAC_VOLUME);
-
-        return ESP_FAIL;
-    }
+    // The volume field is the whole byte, so every value is in range
+    _Static_assert(MAX_DAC_VOLUME == UINT8_MAX,
+                   "DAC volume no longer fills a byte, check its range");
 
     bool update_immediate = true;
 
     uint16_t data = (update_immediate << 8) | volume;
 
-    return write_register(address, data, device);
+    return codec_update_bits(device, address, 0x1FF, data);
 }
 
+/**
+ * Resets the codec immediately, discarding any uncommitted changes since every
+ * register returns to its power on value
+ */
 esp_err_t reset_registers(spi_codec_device device) {
-    return write_register(Reset, 0, device);
+    esp_err_t result = write_register(Reset, 0, device);
+
+    if (result == ESP_OK) {
+        codec_reset_shadow(device);
+    }
+
+    return result;
 }
 
 typedef enum {
@@ -211,29 +191,110 @@ esp_err_t set_output_mix(spi_codec_device device, Channel channel,
     uint16_t data2 = (rightDac << 8) | (rightMixEnabled << 7) |
                      (((MAX_MIX_VOLUME - rightVolume) & 0b111) << 4);
 
-    esp_err_t result = write_register(address1, data1, device);
+    esp_err_t result = codec_update_bits(device, address1, 0x1F7, data1);
 
     if (result != ESP_OK) {
         return result;
     }
 
-    return write_register(address2, data2, device);
+    return codec_update_bits(device, address2, 0x1F0, data2);
 }
 
 esp_err_t set_dac_mute(spi_codec_device device, bool mute) {
-    bool adc_attenuate = false;
-    bool dac_attenuate = false;
+    // Only the soft mute bit changes, the ADC/DAC filter settings sharing this
+    // register are preserved
+    return codec_update_bits(device, ADCDACControl, 1 << 3, mute << 3);
+}
+
+//! ALCSEL value for both channels under level control
+#define ALC_STEREO 0b11
+
+//! NGG values, what the gate does while closed
+#define NOISE_GATE_HOLD_GAIN 0b00
+#define NOISE_GATE_MUTE 0b01
+
+/**
+ * Programs the ALC and noise gate on the input PGAs. While enabled the ALC
+ * owns the PGA gain, so input volume writes only take effect again once it is
+ * off. The gate only works with the ALC running.
+ */
+esp_err_t set_alc(spi_codec_device device, const alc_config *config) {
+    if (!alc_config_valid(config)) {
+        ESP_LOGE(TAG, "Invalid ALC settings");
+
+        return ESP_FAIL;
+    }
+
+    uint8_t channels = config->enabled ? ALC_STEREO : 0;
 
-    bool adchpd = false;
+    uint16_t alc1 =
+        (channels << 7) | (config->max_gain << 4) | (config->target & 0xF);
+    // The zero cross bit is left as it is
+    uint16_t alc2 = config->hold & 0xF;
+    uint16_t alc3 = (config->decay << 4) | (config->attack & 0xF);
 
-    bool hpor = false;
-    uint8_t adcpol = 0b00;
+    bool gate = config->enabled && config->gate;
+    uint8_t gate_mode =
+        config->gate_mutes ? NOISE_GATE_MUTE : NOISE_GATE_HOLD_GAIN;
+    uint16_t noise_gate =
+        (config->gate_threshold << 3) | (gate_mode << 1) | gate;
 
-    uint8_t demphasis = 0b00;
+    esp_err_t result = codec_update_bits(device, ALC1, 0x1FF, alc1);
 
-    uint16_t value = (adc_attenuate << 8) | (dac_attenuate << 7) |
-                     ((adchpd & 0b11) << 5) | (hpor << 4) | (mute << 3) |
-                     ((demphasis & 0b11) << 1) | adcpol;
+    if (result == ESP_OK) {
+        result = codec_update_bits(device, ALC2, 0x00F, alc2);
+    }
+    if (result == ESP_OK) {
+        result = codec_update_bits(device, ALC3, 0x0FF, alc3);
+    }
+    if (result == ESP_OK) {
+        result = codec_update_bits(device, NoiseGate, 0x0FF, noise_gate);
+    }
+
+    return result;
+}
+
+//! Intensity code for a shelf of `steps` of 1.5 dB, 0b0111 being flat
+static uint8_t tone_intensity(int8_t steps) { return 0b0111 - steps; }
+
+//! Intensity code that takes a shelf out of the path altogether
+#define TONE_BYPASS 0b1111
+
+/**
+ * Programs bass, treble and 3D on the DAC path. Shelves with no gain are
+ * bypassed rather than set flat.
+ */
+esp_err_t set_tone(spi_codec_device device, const tone_config *config) {
+    if (!tone_config_valid(config)) {
+        ESP_LOGE(TAG, "Invalid tone settings");
+
+        return ESP_FAIL;
+    }
+
+    bool adaptive_bass = false;
+    uint8_t bass =
+        config->bass == 0 ? TONE_BYPASS : tone_intensity(config->bass);
+    uint8_t treble =
+        config->treble == 0 ? TONE_BYPASS : tone_intensity(config->treble);
+
+    uint16_t bass_data =
+        (adaptive_bass << 7) | (config->bass_high_cutoff << 6) | bass;
+    uint16_t treble_data = (config->treble_low_cutoff << 6) | treble;
+
+    // 3D in the playback path, which MODE3D clear selects
+    bool enable_3d = config->depth_3d != 0;
+    uint16_t data_3d = (config->narrow_3d_high << 6) |
+                       (config->narrow_3d_low << 5) |
+                       ((config->depth_3d & 0xF) << 1) | enable_3d;
+
+    esp_err_t result = codec_update_bits(device, BassControl, 0x0CF, bass_data);
+
+    if (result == ESP_OK) {
+        result = codec_update_bits(device, TrebleControl, 0x04F, treble_data);
+    }
+    if (result == ESP_OK) {
+        result = codec_update_bits(device, Control3D, 0x0FF, data_3d);
+    }
 
-    return write_register(ADCDACControl, value, device);
+    return result;
 }
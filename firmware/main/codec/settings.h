@@ -1,6 +1,8 @@
 #ifndef CODEC_SETTINGS_H
 #define CODEC_SETTINGS_H
 
+#include "audio_dsp/alc.h"
+#include "audio_dsp/tone.h"
 #include "codec/spi.h"
 #include "stdint.h"
 
@@ -22,6 +24,19 @@ esp_err_t set_output_volume(spi_codec_device device, Channel channel,
 esp_err_t set_digital_audio_interface(spi_codec_device device,
                                       uint8_t word_length);
 
+/**
+ * Divider that biases the analog blocks to mid-rail. The low power standby
+ * divider keeps VMID charged with everything else powered down, so coming back
+ * from it is immediate and pop free, unlike charging it up from off.
+ */
+typedef enum {
+    VmidOff = 0b00,
+    VmidPlayback = 0b01,
+    VmidStandby = 0b10,
+} VmidSelection;
+
+esp_err_t set_vmid(spi_codec_device device, VmidSelection selection);
+
 esp_err_t set_power_management(spi_codec_device device, bool adc_left,
                                bool adc_right, bool dac_left, bool dac_right,
                                bool lout1, bool rout1);
@@ -40,4 +55,8 @@ esp_err_t set_output_mix(spi_codec_device device, Channel channel,
 
 esp_err_t set_dac_mute(spi_codec_device device, bool mute);
 
+esp_err_t set_alc(spi_codec_device device, const alc_config *config);
+
+esp_err_t set_tone(spi_codec_device device, const tone_config *config);
+
 #endif
@@ -1,14 +1,19 @@
 /**
  * This file contains logic for controlling the dual WM8988 codecs using the SPI
- * protocol
+ * protocol. Register writes are queued to the driver and clocked out by the SPI
+ * interrupt, so callers never wait on the bus unless they ask to.
  */
 
 #include "spi.h"
 #include "driver/spi_master.h"
 #include "esp_log.h"
+#include "registers.h"
 
 static const char *TAG = "WM8988";
 
+static spi_codec codecs[MAX_CODEC_DEVICES];
+static uint8_t codec_count = 0;
+
 /**
  * Initializes the ESP32s SPI2 driver for controlling WM8988s CODECs
  */
@@ -26,39 +31,215 @@ esp_err_t spi_bus_init(spi_host_device_t host_id, uint8_t clock_pin,
     return spi_bus_initialize(host_id, &bus_config, SPI_DMA_DISABLED);
 }
 
+static void IRAM_ATTR transaction_done(spi_transaction_t *transaction) {
+    spi_codec *codec = transaction->user;
+    size_t slot = transaction - codec->transactions;
+
+    if (codec->callbacks[slot] != NULL) {
+        codec->callbacks[slot](codec, codec->callback_args[slot]);
+    }
+}
+
+//! Commits whatever an earlier commit could not queue
+static void retry_commit(void *arg) { codec_commit(arg); }
+
 /**
  * Initializes an SPI device on the SPI2 driver to control a WM8988 CODEC
  */
 esp_err_t spi_device_init(uint8_t chip_select_pin, spi_codec_device *handle) {
+    if (codec_count >= MAX_CODEC_DEVICES) {
+        ESP_LOGE(TAG, "Cannot add more than %d codecs", MAX_CODEC_DEVICES);
+        return ESP_ERR_NO_MEM;
+    }
+
+    spi_codec *codec = &codecs[codec_count];
+
     spi_device_interface_config_t device_config = {
         .clock_speed_hz = SPI_FREQUENCY,
         .mode = 0,
         .spics_io_num = chip_select_pin,
-        .queue_size = 1,
+        .queue_size = SPI_QUEUE_DEPTH,
         .flags = SPI_DEVICE_NO_DUMMY,
+        .post_cb = transaction_done,
     };
 
-    return spi_bus_add_device(SPI2_HOST, &device_config, handle);
+    esp_timer_create_args_t timer_args = {
+        .callback = retry_commit,
+        .arg = codec,
+        .dispatch_method = ESP_TIMER_TASK,
+        .name = "codec",
+    };
+
+    esp_err_t result = esp_timer_create(&timer_args, &codec->retry_timer);
+    if (result != ESP_OK) {
+        return result;
+    }
+
+    codec->queue_mutex = xSemaphoreCreateMutex();
+    if (codec->queue_mutex == NULL) {
+        esp_timer_delete(codec->retry_timer);
+        return ESP_ERR_NO_MEM;
+    }
+
+    result = spi_bus_add_device(SPI2_HOST, &device_config, &codec->handle);
+
+    if (result != ESP_OK) {
+        vSemaphoreDelete(codec->queue_mutex);
+        codec->queue_mutex = NULL;
+        esp_timer_delete(codec->retry_timer);
+        return result;
+    }
+
+    portMUX_INITIALIZE(&codec->lock);
+    codec_reset_shadow(codec);
+
+    codec->next_slot = 0;
+    codec->in_flight = 0;
+
+    codec_count++;
+    *handle = codec;
+
+    return ESP_OK;
 }
 
-esp_err_t write_register(uint8_t address, uint16_t value,
-                         spi_codec_device device) {
-    // Each SPI word consists of a 7 bit address, followed by a 9 bit value
-    uint16_t data = ((address & 0x7F) << 9) | (value & 0x1FF);
+/**
+ * Collects finished transactions so their slots can be reused, waiting up to
+ * `wait` ticks until at least `needed` slots are free. Must be called with the
+ * queue mutex held.
+ */
+static esp_err_t reclaim_slots(spi_codec_device device, size_t needed,
+                               TickType_t wait) {
+    spi_transaction_t *done;
 
-    spi_transaction_t transaction = {
-        .length = 16,
-        .tx_data = {(data >> 8) & 0xFF, data & 0xFF},
-        .flags = SPI_TRANS_USE_TXDATA,
-    };
+    // Anything already finished is collected without blocking
+    while (device->in_flight > 0 &&
+           spi_device_get_trans_result(device->handle, &done, 0) == ESP_OK) {
+        device->in_flight--;
+    }
+
+    while ((size_t)(SPI_QUEUE_DEPTH - device->in_flight) < needed) {
+        if (spi_device_get_trans_result(device->handle, &done, wait) !=
+            ESP_OK) {
+            return ESP_ERR_TIMEOUT;
+        }
+
+        device->in_flight--;
+    }
+
+    return ESP_OK;
+}
+
+/**
+ * Queues a batch of register writes to be clocked out back to back. The
+ * callback, if any, runs from the SPI interrupt once the final write has
+ * completed.
+ *
+ * Queued writes cannot be taken back, so if the driver refuses one partway
+ * through, the writes before it still go out and the rest do not, callback
+ * included. `queued`, if not NULL, is set to how many went out either way.
+ */
+esp_err_t write_register_sequence(spi_codec_device device,
+                                  const codec_register_write *writes,
+                                  size_t count, codec_write_callback callback,
+                                  void *arg, TickType_t wait, size_t *queued) {
+    size_t done = 0;
+
+    if (queued != NULL) {
+        *queued = 0;
+    }
+
+    if (count == 0) {
+        return ESP_OK;
+    }
+
+    if (count > SPI_QUEUE_DEPTH) {
+        ESP_LOGE(TAG, "Cannot queue %zu writes, queue depth is %d", count,
+                 SPI_QUEUE_DEPTH);
+        return ESP_ERR_INVALID_SIZE;
+    }
+
+    if (xSemaphoreTake(device->queue_mutex, wait) != pdTRUE) {
+        return ESP_ERR_TIMEOUT;
+    }
+
+    esp_err_t result = reclaim_slots(device, count, wait);
+
+    for (size_t i = 0; i < count && result == ESP_OK; i++) {
+        uint8_t slot = device->next_slot;
+
+        // Each SPI word consists of a 7 bit address, followed by a 9 bit value
+        uint16_t data =
+            ((writes[i].address & 0x7F) << 9) | (writes[i].value & 0x1FF);
 
-    esp_err_t result = spi_device_polling_transmit(device, &transaction);
+        device->transactions[slot] = (spi_transaction_t){
+            .length = 16,
+            .tx_data = {(data >> 8) & 0xFF, data & 0xFF},
+            .flags = SPI_TRANS_USE_TXDATA,
+            .user = device,
+        };
+
+        bool last = i == count - 1;
+        device->callbacks[slot] = last ? callback : NULL;
+        device->callback_args[slot] = last ? arg : NULL;
+
+        // Slots were reserved above, so the driver queue has room
+        result = spi_device_queue_trans(device->handle,
+                                        &device->transactions[slot], 0);
+
+        if (result == ESP_OK) {
+            device->in_flight++;
+            device->next_slot = (slot + 1) % SPI_QUEUE_DEPTH;
+            done++;
+        }
+    }
+
+    xSemaphoreGive(device->queue_mutex);
+
+    if (queued != NULL) {
+        *queued = done;
+    }
 
     if (result != ESP_OK) {
-        ESP_LOGE(TAG, "SPI write failed: %s", esp_err_to_name(result));
+        ESP_LOGE(TAG, "SPI queue failed: %s", esp_err_to_name(result));
+    }
+
+    return result;
+}
+
+esp_err_t write_register_async(spi_codec_device device, uint8_t address,
+                               uint16_t value, TickType_t wait) {
+    codec_register_write write = {.address = address, .value = value};
+
+    return write_register_sequence(device, &write, 1, NULL, NULL, wait, NULL);
+}
+
+/**
+ * Blocks until every queued write to this codec has been clocked out
+ */
+esp_err_t spi_codec_wait_idle(spi_codec_device device, TickType_t wait) {
+    if (xSemaphoreTake(device->queue_mutex, wait) != pdTRUE) {
+        return ESP_ERR_TIMEOUT;
     }
 
-    vTaskDelay(pdMS_TO_TICKS(1)); // Might not be neccessary
+    esp_err_t result = reclaim_slots(device, SPI_QUEUE_DEPTH, wait);
+
+    xSemaphoreGive(device->queue_mutex);
 
     return result;
 }
+
+/**
+ * Writes a register and waits for it to reach the codec. Only meant for
+ * contexts that may block, everything else should queue writes instead.
+ */
+esp_err_t write_register(uint8_t address, uint16_t value,
+                         spi_codec_device device) {
+    esp_err_t result =
+        write_register_async(device, address, value, portMAX_DELAY);
+
+    if (result != ESP_OK) {
+        return result;
+    }
+
+    return spi_codec_wait_idle(device, portMAX_DELAY);
+}
@@ -2,12 +2,63 @@
 #define CODEC_SPI_H
 
 #include "driver/spi_master.h"
+#include "esp_timer.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/semphr.h"
 #include "hal/spi_types.h"
 #include "stdint.h"
+#include <stdbool.h>
 
 #define SPI_FREQUENCY 1000000
 
-typedef spi_device_handle_t spi_codec_device;
+//! One past the highest WM8988 register address (LowPowerPlayback, 0x43)
+#define CODEC_REGISTER_COUNT 0x44
+
+//! The board carries two WM8988s on the same SPI bus
+#define MAX_CODEC_DEVICES 2
+
+//! Transactions that can be in flight per codec, deep enough to queue a full
+//! register configuration without waiting
+#define SPI_QUEUE_DEPTH 40
+
+typedef struct spi_codec spi_codec;
+
+/**
+ * Called from the SPI interrupt once the last transaction of a write has been
+ * clocked out, so it must be placed in IRAM and only use ISR safe calls
+ */
+typedef void (*codec_write_callback)(spi_codec *device, void *arg);
+
+typedef struct {
+    uint8_t address;
+    uint16_t value;
+} codec_register_write;
+
+/**
+ * A WM8988 on the SPI bus. The codec's control interface is write only, so the
+ * last value written to every register is kept here and setters operate on
+ * this shadow copy rather than rebuilding whole register words.
+ */
+struct spi_codec {
+    spi_device_handle_t handle;
+    uint16_t registers[CODEC_REGISTER_COUNT];
+    uint32_t dirty[(CODEC_REGISTER_COUNT + 31) / 32];
+    portMUX_TYPE lock;
+
+    // Queued transactions are used round robin, the driver completes them in
+    // order so the oldest slot is always the next one to be reclaimed
+    spi_transaction_t transactions[SPI_QUEUE_DEPTH];
+    codec_write_callback callbacks[SPI_QUEUE_DEPTH];
+    void *callback_args[SPI_QUEUE_DEPTH];
+    uint8_t next_slot;
+    uint8_t in_flight;
+    SemaphoreHandle_t queue_mutex;
+
+    //! Commits again after a commit left registers dirty
+    esp_timer_handle_t retry_timer;
+};
+
+typedef spi_codec *spi_codec_device;
 
 esp_err_t spi_bus_init(spi_host_device_t host_id, uint8_t clock_pin,
                        uint8_t data_pin);
@@ -15,4 +66,12 @@ esp_err_t spi_device_init(uint8_t chip_select_pin, spi_codec_device *handle);
 esp_err_t write_register(uint8_t address, uint16_t value,
                          spi_codec_device device);
 
+esp_err_t write_register_async(spi_codec_device device, uint8_t address,
+                               uint16_t value, TickType_t wait);
+esp_err_t write_register_sequence(spi_codec_device device,
+                                  const codec_register_write *writes,
+                                  size_t count, codec_write_callback callback,
+                                  void *arg, TickType_t wait, size_t *queued);
+esp_err_t spi_codec_wait_idle(spi_codec_device device, TickType_t wait);
+
 #endif
@@ -0,0 +1,416 @@
+/**
+ * This file dispatches control channel requests into the codec and the audio
+ * path. Requests arrive on the Bluedroid task, so every handler only updates
+ * state and queues work, nothing here waits on the SPI bus or the audio core.
+ */
+
+#include "control.h"
+#include "audio/audio_output.h"
+#include "audio/codec_dsp.h"
+#include "audio/instrumentation.h"
+#include "audio/sound_effects.h"
+#include "audio_dsp/limiter.h"
+#include "audio_dsp/mixer.h"
+#include "audio_dsp/protocol.h"
+#include "bluetooth/bt_spp.h"
+#include "codec/registers.h"
+#include "codec/settings.h"
+#include "esp_log.h"
+#include "power/governor.h"
+#include "power/idle.h"
+#include "telemetry.h"
+#include "upload.h"
+#include <math.h>
+#include <string.h>
+
+#define TAG "CONTROL"
+
+//! Source gains in dB, the lowest mutes
+#define MIN_SOURCE_GAIN_DB -60
+#define MAX_SOURCE_GAIN_DB 12
+
+#define MAX_DUCK_DEPTH_DB 60
+#define MAX_DUCK_THRESHOLD_DB 90
+
+//! Indexed by AudioOutput, parameters without an output act on the headset
+static spi_codec_device codec_devices[OutputCount];
+static size_t codec_count;
+static pitch_shift *voice_pitch;
+static voice_fx *voice_effects;
+static audio_pipeline *pipeline;
+
+static protocol_parser parser;
+static uint8_t reply[PROTOCOL_MAX_FRAME];
+
+/**
+ * Frames a reply to `request` and hands it to SPP. The payload is expected to
+ * have been built in place after the header of the reply buffer.
+ */
+static void send_reply(const protocol_frame *request, uint16_t length) {
+    size_t size =
+        protocol_encode(reply, sizeof(reply), request->type | PROTOCOL_RESPONSE,
+                        request->sequence, &reply[PROTOCOL_HEADER_SIZE], length);
+
+    if (bt_spp_send(reply, size) != ESP_OK) {
+        ESP_LOGW(TAG, "Dropped reply to message 0x%02x", request->type);
+    }
+}
+
+static void send_status(const protocol_frame *request, ProtocolStatus status) {
+    reply[PROTOCOL_HEADER_SIZE] = status;
+    send_reply(request, 1);
+}
+
+static inline uint8_t *put_u32(uint8_t *out, uint32_t value) {
+    out[0] = value;
+    out[1] = value >> 8;
+    out[2] = value >> 16;
+    out[3] = value >> 24;
+    return out + 4;
+}
+
+static inline uint32_t get_u32(const uint8_t *in) {
+    return in[0] | (in[1] << 8) | (in[2] << 16) | ((uint32_t)in[3] << 24);
+}
+
+static bool parameter_valid(const protocol_parameter *parameter) {
+    uint16_t value = parameter->value;
+
+    switch (parameter->parameter) {
+        case ParamInputVolumeLeft:
+        case ParamInputVolumeRight:
+            return value <= MAX_INPUT_VOLUME;
+        case ParamOutputVolumeLeft:
+        case ParamOutputVolumeRight:
+            return value <= MAX_OUTPUT_VOLUME;
+        case ParamSpeakerVolumeLeft:
+        case ParamSpeakerVolumeRight:
+            return codec_count > OutputSpeaker && value <= MAX_OUTPUT_VOLUME;
+        case ParamDacVolumeLeft:
+        case ParamDacVolumeRight:
+            return value <= MAX_DAC_VOLUME;
+        case ParamDacMute:
+        case ParamFormantPreservation:
+            return value <= 1;
+        case ParamPitchSemitones:
+            return voice_pitch != NULL &&
+                   (int16_t)value >= -PITCH_SHIFT_MAX_SEMITONES &&
+                   (int16_t)value <= PITCH_SHIFT_MAX_SEMITONES;
+        case ParamStageEnabled:
+            return pipeline != NULL &&
+                   (value >> 8) < atomic_load(&pipeline->stage_count) &&
+                   (value & 0xFF) <= 1;
+        case ParamDspPreset:
+            return value < DspPresetCount;
+        case ParamVoicePreset:
+            return voice_effects != NULL && value < VoiceFxPresetCount;
+        case ParamLatencyProfile:
+            return value < LatencyProfileCount;
+        case ParamResamplerQuality:
+            return value == ResamplerLow || value == ResamplerMedium ||
+                   value == ResamplerHigh;
+        case ParamRoute:
+            return (value >> 8) < SourceCount &&
+                   (value & 0xFF) >> codec_count == 0;
+        case ParamSourceGain:
+            return (value >> 8) < SourceCount &&
+                   (int8_t)value >= MIN_SOURCE_GAIN_DB &&
+                   (int8_t)value <= MAX_SOURCE_GAIN_DB;
+        case ParamDuckDepth:
+            return value <= MAX_DUCK_DEPTH_DB;
+        case ParamDuckThreshold:
+            return value <= MAX_DUCK_THRESHOLD_DB;
+        case ParamLimiterCeiling:
+            return (value >> 8) < codec_count &&
+                   (value & 0xFF) <= LIMITER_MAX_CEILING_DB;
+        case ParamCompressor:
+            return (value >> 8) < codec_count && (value & 0xFF) <= 1;
+        case ParamPowerMode:
+            return value <= PowerModeCount;
+        case ParamIdleTimeout:
+            return true;
+        default:
+            return false;
+    }
+}
+
+//! Changes one setting of an output's limiter, leaving the rest as they are
+static void set_limiter(const protocol_parameter *parameter) {
+    AudioOutput output = parameter->value >> 8;
+    uint8_t value = parameter->value & 0xFF;
+    limiter_config config;
+
+    audio_output_get_limiter(output, &config);
+
+    if (parameter->parameter == ParamLimiterCeiling) {
+        config.ceiling_db = value;
+    } else {
+        config.compressor = value;
+    }
+
+    audio_output_set_limiter(output, &config);
+}
+
+static void apply_parameter(const protocol_parameter *parameter) {
+    uint16_t value = parameter->value;
+
+    switch (parameter->parameter) {
+        case ParamInputVolumeLeft:
+            set_input_volume(codec_devices[OutputHeadset], Left, value);
+            break;
+        case ParamInputVolumeRight:
+            set_input_volume(codec_devices[OutputHeadset], Right, value);
+            break;
+        case ParamOutputVolumeLeft:
+            power_governor_set_output_volume(OutputHeadset, Left, value);
+            break;
+        case ParamOutputVolumeRight:
+            power_governor_set_output_volume(OutputHeadset, Right, value);
+            break;
+        case ParamSpeakerVolumeLeft:
+            power_governor_set_output_volume(OutputSpeaker, Left, value);
+            break;
+        case ParamSpeakerVolumeRight:
+            power_governor_set_output_volume(OutputSpeaker, Right, value);
+            break;
+        case ParamDacVolumeLeft:
+            set_dac_volume(codec_devices[OutputHeadset], Left, value);
+            break;
+        case ParamDacVolumeRight:
+            set_dac_volume(codec_devices[OutputHeadset], Right, value);
+            break;
+        case ParamDacMute:
+            set_dac_mute(codec_devices[OutputHeadset], value);
+            break;
+        case ParamPitchSemitones:
+            pitch_shift_set_semitones(voice_pitch, (int16_t)value);
+            break;
+        case ParamFormantPreservation:
+            power_governor_set_formant_preservation(value);
+            break;
+        case ParamStageEnabled:
+            audio_pipeline_set_enabled(pipeline, value >> 8, value & 0xFF);
+            break;
+        case ParamDspPreset:
+            codec_dsp_apply_preset(value);
+            break;
+        case ParamVoicePreset:
+            voice_fx_set_preset(voice_effects, value);
+            break;
+        case ParamLatencyProfile:
+            audio_output_set_latency_profile(value);
+            break;
+        case ParamResamplerQuality:
+            power_governor_set_resampler_quality(value);
+            break;
+        case ParamRoute:
+            audio_output_set_route(value >> 8, value & 0xFF);
+            break;
+        case ParamSourceGain:
+            audio_output_set_source_gain(
+                value >> 8, (int8_t)value <= MIN_SOURCE_GAIN_DB
+                                ? 0
+                                : mixer_gain_from_db((int8_t)value));
+            break;
+        case ParamDuckDepth:
+            audio_output_set_duck_depth(mixer_gain_from_db(-(float)value));
+            break;
+        case ParamDuckThreshold:
+            audio_output_set_duck_threshold(
+                value == 0 ? 0
+                           : INT16_MAX * powf(10.0f, -(float)value / 20.0f));
+            break;
+        case ParamLimiterCeiling:
+        case ParamCompressor:
+            set_limiter(parameter);
+            break;
+        case ParamPowerMode:
+            power_governor_force_mode(value);
+            break;
+        case ParamIdleTimeout:
+            power_idle_set_timeout(value);
+            break;
+    }
+}
+
+/**
+ * Applies a batch of parameter records. Every record is checked before any is
+ * applied so a bad batch changes nothing, and the codec registers touched by
+ * the whole batch go out in a single commit.
+ */
+static void handle_set_parameters(const protocol_frame *frame) {
+    protocol_parameter parameter;
+    size_t offset = 0;
+    uint8_t index = 0;
+    ProtocolStatus status = StatusOk;
+
+    if (frame->length % PROTOCOL_PARAMETER_SIZE != 0) {
+        status = StatusMalformed;
+    }
+
+    while (status == StatusOk &&
+           protocol_next_parameter(frame, &offset, &parameter)) {
+        if (!parameter_valid(&parameter)) {
+            status = StatusInvalidParameter;
+            break;
+        }
+        index++;
+    }
+
+    if (status == StatusOk) {
+        offset = 0;
+        while (protocol_next_parameter(frame, &offset, &parameter)) {
+            apply_parameter(&parameter);
+        }
+
+        // Registers stay dirty in the shadow if the queue is full, so they go
+        // out with the next successful commit
+        for (size_t i = 0; i < codec_count; i++) {
+            if (codec_commit(codec_devices[i]) != ESP_OK) {
+                status = StatusBusy;
+            }
+        }
+    }
+
+    reply[PROTOCOL_HEADER_SIZE] = status;
+    reply[PROTOCOL_HEADER_SIZE + 1] = index;
+    send_reply(frame, 2);
+}
+
+static void handle_get_latency_report(const protocol_frame *frame) {
+    audio_latency_report report;
+    audio_output_get_latency_report(&report);
+
+    uint8_t *payload = &reply[PROTOCOL_HEADER_SIZE];
+    uint8_t *cursor = payload;
+
+    *cursor++ = StatusOk;
+    *cursor++ = report.profile;
+    cursor = put_u32(cursor, report.stream_latency_us);
+    cursor = put_u32(cursor, report.voice_latency_us);
+    cursor = put_u32(cursor, report.underruns);
+    cursor = put_u32(cursor, report.underruns_per_hour);
+    cursor = put_u32(cursor, report.active_ms);
+
+    send_reply(frame, cursor - payload);
+}
+
+static void handle_play_clip(const protocol_frame *frame) {
+    if (frame->length != 3) {
+        send_status(frame, StatusMalformed);
+        return;
+    }
+
+    uint16_t clip = frame->payload[0] | (frame->payload[1] << 8);
+
+    // The clip is mixed in once the output is back up
+    power_idle_wake();
+
+    switch (sound_effects_play(clip, frame->payload[2])) {
+        case ESP_OK:
+            send_status(frame, StatusOk);
+            break;
+        case ESP_ERR_NOT_FOUND:
+            send_status(frame, StatusInvalidParameter);
+            break;
+        default:
+            // No bank flashed, or too many clips triggered at once
+            send_status(frame, StatusBusy);
+            break;
+    }
+}
+
+static void handle_upload_begin(const protocol_frame *frame) {
+    if (frame->length != 8) {
+        send_status(frame, StatusMalformed);
+        return;
+    }
+
+    uint32_t size = get_u32(&frame->payload[0]);
+    uint32_t crc = get_u32(&frame->payload[4]);
+
+    // Replied to by the upload task once it has caught up
+    if (!upload_begin(frame->sequence, size, crc)) {
+        send_status(frame, StatusBusy);
+    }
+}
+
+static void handle_frame(void *ctx, const protocol_frame *frame) {
+    switch (frame->type) {
+        case MessagePing:
+            send_status(frame, StatusOk);
+            break;
+        case MessageSetParameters:
+            handle_set_parameters(frame);
+            break;
+#if CONFIG_AUDIO_INSTRUMENTATION
+        case MessageGetSnapshot: {
+            uint8_t *payload = &reply[PROTOCOL_HEADER_SIZE];
+
+            payload[0] = StatusOk;
+            size_t length = instrumentation_snapshot(
+                &payload[1], PROTOCOL_MAX_PAYLOAD - 1);
+            send_reply(frame, 1 + length);
+            break;
+        }
+#endif
+        case MessageGetLatencyReport:
+            handle_get_latency_report(frame);
+            break;
+        case MessageSetTelemetry:
+            send_status(frame, frame->length == 2 &&
+                                       telemetry_configure(frame->payload[0],
+                                                           frame->payload[1])
+                                   ? StatusOk
+                                   : StatusInvalidParameter);
+            break;
+        case MessagePlayClip:
+            handle_play_clip(frame);
+            break;
+        case MessageStopClips:
+            sound_effects_stop_all();
+            send_status(frame, StatusOk);
+            break;
+        case MessageUploadBegin:
+            handle_upload_begin(frame);
+            break;
+        default:
+            send_status(frame, StatusUnknownType);
+            break;
+    }
+}
+
+/**
+ * Sets up what requests act on, the codecs indexed by AudioOutput. The pitch
+ * shifter and pipeline may be NULL if the voice path is not running, and
+ * parameters for them or for codecs that are missing are then rejected.
+ */
+void control_init(const spi_codec_device *codecs, size_t count,
+                  pitch_shift *pitch, voice_fx *effects,
+                  audio_pipeline *voice_pipeline) {
+    memcpy(codec_devices, codecs, count * sizeof(spi_codec_device));
+    codec_count = count;
+    voice_pitch = pitch;
+    voice_effects = effects;
+    pipeline = voice_pipeline;
+
+    protocol_parser_init(&parser, handle_frame, NULL);
+}
+
+/**
+ * Feeds bytes received on the control channel to the parser. Complete frames
+ * are handled before this returns.
+ */
+void control_receive(const uint8_t *data, size_t len) {
+    protocol_parser_feed(&parser, data, len);
+}
+
+/**
+ * Drops any half received frame and stops telemetry, called when the link goes
+ * away
+ */
+void control_reset(void) {
+    protocol_parser_reset(&parser);
+    upload_reset();
+    telemetry_configure(0, 0);
+}
@@ -0,0 +1,19 @@
+#ifndef CONTROL_CONTROL_H
+#define CONTROL_CONTROL_H
+
+#include "audio_dsp/pipeline.h"
+#include "audio_dsp/pitch_shift.h"
+#include "audio_dsp/voice_fx.h"
+#include "codec/spi.h"
+#include <stddef.h>
+#include <stdint.h>
+
+void control_init(const spi_codec_device *codecs, size_t count,
+                  pitch_shift *pitch, voice_fx *effects,
+                  audio_pipeline *voice_pipeline);
+
+void control_receive(const uint8_t *data, size_t len);
+
+void control_reset(void);
+
+#endif
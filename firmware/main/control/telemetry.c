@@ -0,0 +1,239 @@
+/**
+ * This file streams telemetry samples to the SPP client. Samples are taken at
+ * the configured rate but coalesced into one write every TELEMETRY_COALESCE_MS
+ * so the link sees a few large writes instead of many small ones.
+ *
+ * Telemetry only ever gets the link when it is idle and no replies are
+ * waiting. While it is busy or congested samples pile up in a fixed batch, and
+ * once that is full it is decimated so it keeps covering the whole backlog at
+ * a lower rate instead of growing.
+ */
+
+#include "telemetry.h"
+#include "audio/audio_output.h"
+#include "audio_dsp/meter.h"
+#include "audio_dsp/protocol.h"
+#include "bluetooth/bt_spp.h"
+#include "esp_log.h"
+#include "esp_timer.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include <stdatomic.h>
+#include <string.h>
+
+#define TAG "TELEMETRY"
+
+//! How long samples are held back to be sent together
+#define TELEMETRY_COALESCE_MS 100
+
+//! Largest sample payload with every field present
+#define SAMPLE_PAYLOAD_SIZE (1 + 4 + 8 + METER_SPECTRUM_BINS + 4 + 16)
+#define SAMPLE_FRAME_SIZE                                                      \
+    (PROTOCOL_HEADER_SIZE + SAMPLE_PAYLOAD_SIZE + PROTOCOL_CRC_SIZE)
+
+//! Samples held while the link is busy, 16 covers half a second at 30 Hz
+#define TELEMETRY_BATCH_SAMPLES 16
+
+#define ALL_FIELDS                                                             \
+    (TelemetryLevels | TelemetrySpectrum | TelemetryBattery | TelemetryPipeline)
+
+//! Runs next to Bluedroid on the protocol core, it never needs to interrupt
+//! the audio core
+#define TELEMETRY_CORE 0
+#define TELEMETRY_PRIORITY 2
+
+static const audio_pipeline *pipeline;
+static TaskHandle_t task;
+
+static _Atomic uint8_t rate;
+static _Atomic uint8_t field_mask;
+
+static _Atomic uint16_t battery_millivolts;
+static _Atomic uint8_t battery_charge;
+static _Atomic uint8_t power_mode;
+
+static uint8_t batch[TELEMETRY_BATCH_SAMPLES * SAMPLE_FRAME_SIZE];
+static size_t batch_samples;
+static size_t sample_size;
+static uint8_t sequence;
+
+static inline uint8_t *put_u16(uint8_t *out, uint16_t value) {
+    out[0] = value;
+    out[1] = value >> 8;
+    return out + 2;
+}
+
+static inline uint8_t *put_u32(uint8_t *out, uint32_t value) {
+    out[0] = value;
+    out[1] = value >> 8;
+    out[2] = value >> 16;
+    out[3] = value >> 24;
+    return out + 4;
+}
+
+/**
+ * Encodes one sample as a complete frame at the end of the batch
+ */
+static void take_sample(uint8_t fields) {
+    uint8_t payload[SAMPLE_PAYLOAD_SIZE];
+    uint8_t *cursor = payload;
+
+    *cursor++ = fields;
+    cursor = put_u32(cursor, esp_timer_get_time() / 1000);
+
+    if (fields & TelemetryLevels) {
+        meter_level music;
+        meter_level voice;
+        meter_read(MeterMusic, &music);
+        meter_read(MeterVoice, &voice);
+
+        cursor = put_u16(cursor, music.peak);
+        cursor = put_u16(cursor, music.rms);
+        cursor = put_u16(cursor, voice.peak);
+        cursor = put_u16(cursor, voice.rms);
+    }
+
+    if (fields & TelemetrySpectrum) {
+        meter_spectrum(cursor);
+        cursor += METER_SPECTRUM_BINS;
+    }
+
+    if (fields & TelemetryBattery) {
+        cursor = put_u16(cursor, atomic_load(&battery_millivolts));
+        *cursor++ = atomic_load(&battery_charge);
+        *cursor++ = atomic_load(&power_mode);
+    }
+
+    if (fields & TelemetryPipeline) {
+        audio_output_stats stats;
+        audio_output_get_stats(&stats);
+
+        cursor = put_u32(cursor, stats.underruns);
+        cursor = put_u32(cursor, stats.overruns);
+        cursor = put_u32(cursor, pipeline ? pipeline->max_cycles : 0);
+        cursor = put_u32(cursor, pipeline ? pipeline->deadline_misses : 0);
+    }
+
+    sample_size = protocol_encode(&batch[batch_samples * SAMPLE_FRAME_SIZE],
+                                  SAMPLE_FRAME_SIZE, MessageTelemetry,
+                                  sequence++, payload, cursor - payload);
+    batch_samples++;
+}
+
+/**
+ * Drops every other sample, keeping the newer one of each pair. Samples are
+ * stored at a fixed stride so they can be moved without parsing them.
+ */
+static void decimate_batch(void) {
+    for (size_t i = 0; i < batch_samples / 2; i++) {
+        memcpy(&batch[i * SAMPLE_FRAME_SIZE],
+               &batch[(2 * i + 1) * SAMPLE_FRAME_SIZE], SAMPLE_FRAME_SIZE);
+    }
+    batch_samples /= 2;
+}
+
+/**
+ * Packs the stored frames back to back and tries to send them as one write
+ */
+static bool send_batch(void) {
+    static uint8_t packed[TELEMETRY_BATCH_SAMPLES * SAMPLE_FRAME_SIZE];
+
+    for (size_t i = 0; i < batch_samples; i++) {
+        memcpy(&packed[i * sample_size], &batch[i * SAMPLE_FRAME_SIZE],
+               sample_size);
+    }
+
+    return bt_spp_send_telemetry(packed, batch_samples * sample_size) ==
+           ESP_OK;
+}
+
+static void telemetry_task(void *pvParameters) {
+    uint8_t fields = 0;
+    TickType_t last_send = xTaskGetTickCount();
+
+    while (true) {
+        uint8_t hz = atomic_load(&rate);
+
+        if (hz == 0) {
+            batch_samples = 0;
+            ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+            last_send = xTaskGetTickCount();
+            continue;
+        }
+
+        TickType_t period = pdMS_TO_TICKS(1000 / hz);
+        if (period == 0) {
+            period = 1;
+        }
+
+        // A notification means the configuration changed, start over with it
+        if (ulTaskNotifyTake(pdTRUE, period) != 0) {
+            continue;
+        }
+
+        // Samples of different shapes are never mixed in one batch
+        uint8_t requested = atomic_load(&field_mask);
+        if (requested != fields) {
+            fields = requested;
+            batch_samples = 0;
+        }
+
+        if (batch_samples == TELEMETRY_BATCH_SAMPLES) {
+            decimate_batch();
+        }
+
+        take_sample(fields);
+
+        TickType_t now = xTaskGetTickCount();
+        if (now - last_send >= pdMS_TO_TICKS(TELEMETRY_COALESCE_MS) &&
+            send_batch()) {
+            batch_samples = 0;
+            last_send = now;
+        }
+    }
+}
+
+esp_err_t telemetry_init(const audio_pipeline *voice_pipeline) {
+    pipeline = voice_pipeline;
+
+    if (xTaskCreatePinnedToCore(telemetry_task, "telemetry", 3072, NULL,
+                                TELEMETRY_PRIORITY, &task,
+                                TELEMETRY_CORE) != pdPASS) {
+        ESP_LOGE(TAG, "Failed to create telemetry task");
+        return ESP_ERR_NO_MEM;
+    }
+
+    return ESP_OK;
+}
+
+/**
+ * Starts, changes or with a rate of 0 stops the stream. Metering on the audio
+ * core only runs while levels or the spectrum are being streamed.
+ */
+bool telemetry_configure(uint8_t rate_hz, uint8_t fields) {
+    if (rate_hz > TELEMETRY_MAX_RATE_HZ || (fields & ~ALL_FIELDS) != 0) {
+        return false;
+    }
+
+    atomic_store(&field_mask, fields);
+    atomic_store(&rate, fields != 0 ? rate_hz : 0);
+
+    meter_set_enabled(rate_hz != 0 &&
+                      (fields & (TelemetryLevels | TelemetrySpectrum)) != 0);
+
+    if (task != NULL) {
+        xTaskNotifyGive(task);
+    }
+
+    return true;
+}
+
+/**
+ * Called by whatever measures the battery, telemetry reports 0 until then
+ */
+void telemetry_set_battery(uint16_t millivolts, uint8_t state_of_charge,
+                           uint8_t mode) {
+    atomic_store(&battery_millivolts, millivolts);
+    atomic_store(&battery_charge, state_of_charge);
+    atomic_store(&power_mode, mode);
+}
@@ -0,0 +1,18 @@
+#ifndef CONTROL_TELEMETRY_H
+#define CONTROL_TELEMETRY_H
+
+#include "audio_dsp/pipeline.h"
+#include "esp_err.h"
+#include <stdbool.h>
+#include <stdint.h>
+
+#define TELEMETRY_MAX_RATE_HZ 50
+
+esp_err_t telemetry_init(const audio_pipeline *voice_pipeline);
+
+bool telemetry_configure(uint8_t rate_hz, uint8_t fields);
+
+void telemetry_set_battery(uint16_t millivolts, uint8_t state_of_charge,
+                           uint8_t mode);
+
+#endif
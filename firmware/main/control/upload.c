@@ -0,0 +1,483 @@
+/**
+ * This file writes soundbank images received over SPP into the soundbank
+ * partition. Once an upload has begun the link switches to bulk mode and
+ * carries raw chunks instead of frames, see protocol.h.
+ *
+ * Chunks are assembled on the Bluedroid task straight into one of
+ * UPLOAD_WINDOW slots and handed to the upload task, which checks and writes
+ * them while the next ones arrive. Every chunk is answered with a progress
+ * message once its slot is free again, so a sender that keeps at most
+ * UPLOAD_WINDOW chunks unacknowledged never overruns the slots.
+ *
+ * Flash is erased a sector ahead of the write cursor so the erase of the next
+ * chunk's sector overlaps with its transfer. On the ESP32 every flash
+ * operation stalls code running from flash on both cores, so erases are kept
+ * to single sectors, short enough for the audio buffers to ride out.
+ *
+ * The image header is held back in RAM and written last, once the CRC of the
+ * whole image has been checked. A partial image therefore never looks valid,
+ * and the old one is gone as soon as the first sector is erased. Progress is
+ * kept across disconnects, beginning the same image again resumes it.
+ */
+
+#include "upload.h"
+#include "audio/sound_effects.h"
+#include "audio_dsp/protocol.h"
+#include "audio_dsp/soundbank.h"
+#include "bluetooth/bt_spp.h"
+#include "control.h"
+#include "esp_log.h"
+#include "esp_partition.h"
+#include "esp_timer.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/queue.h"
+#include "freertos/task.h"
+#include <inttypes.h>
+#include <stdatomic.h>
+#include <string.h>
+
+#define TAG "UPLOAD"
+
+#define FLASH_SECTOR_SIZE 4096
+
+//! Sectors kept erased beyond the end of the written image
+#define ERASE_AHEAD_SECTORS 1
+
+//! Runs next to Bluedroid on the protocol core, below it so reception always
+//! wins over writing
+#define UPLOAD_CORE 0
+#define UPLOAD_PRIORITY 2
+
+//! Bytes read back per step when checking the finished image
+#define VERIFY_BUFFER_SIZE 1024
+
+//! A chunk that stalls for this long is dropped, its sender has gone away
+//! without the link noticing
+#define CHUNK_TIMEOUT_US 1000000
+
+//! Largest payload sent from here, a progress message
+#define MAX_PAYLOAD 9
+
+typedef enum {
+    CommandBegin,
+    CommandChunk,
+} CommandType;
+
+typedef struct {
+    CommandType type;
+    uint8_t slot;
+    uint8_t sequence;
+    uint32_t size;
+    uint32_t crc;
+} command;
+
+typedef struct {
+    uint8_t data[PROTOCOL_CHUNK_MAX_SIZE];
+    size_t length;
+} chunk_slot;
+
+static chunk_slot slots[UPLOAD_WINDOW];
+//! Filled chunks and begin requests, in arrival order
+static QueueHandle_t commands;
+static QueueHandle_t free_slots;
+
+// Assembly state, only touched by the Bluedroid task
+static uint8_t header[PROTOCOL_CHUNK_HEADER_SIZE];
+static size_t header_length;
+static int receiving_slot = -1;
+//! Data and CRC bytes of the current chunk still to come
+static size_t chunk_remaining;
+static int64_t last_receive_us;
+
+// Image state, only touched by the upload task
+static const esp_partition_t *partition;
+static uint32_t image_size;
+static uint32_t image_crc;
+static uint32_t erased;
+static uint8_t image_header[SOUNDBANK_HEADER_SIZE];
+static uint8_t verify_buffer[VERIFY_BUFFER_SIZE];
+
+//! Bytes of the image written so far, read by the Bluedroid task for replies
+static _Atomic uint32_t committed;
+
+//! Progress is reported from both tasks
+static _Atomic uint8_t progress_sequence;
+
+static inline uint8_t *put_u16(uint8_t *out, uint16_t value) {
+    out[0] = value;
+    out[1] = value >> 8;
+    return out + 2;
+}
+
+static inline uint8_t *put_u32(uint8_t *out, uint32_t value) {
+    out[0] = value;
+    out[1] = value >> 8;
+    out[2] = value >> 16;
+    out[3] = value >> 24;
+    return out + 4;
+}
+
+static uint32_t get_u32(const uint8_t *in) {
+    return in[0] | (in[1] << 8) | (in[2] << 16) | ((uint32_t)in[3] << 24);
+}
+
+static void send(uint8_t type, uint8_t sequence, const uint8_t *payload,
+                 uint16_t length) {
+    uint8_t reply[PROTOCOL_HEADER_SIZE + MAX_PAYLOAD + PROTOCOL_CRC_SIZE];
+    size_t size = protocol_encode(reply, sizeof(reply), type, sequence,
+                                  payload, length);
+
+    if (bt_spp_send(reply, size) != ESP_OK) {
+        ESP_LOGW(TAG, "Dropped message 0x%02x", type);
+    }
+}
+
+//! Reports what happened to the chunk at `offset`
+static void send_progress(ProtocolStatus status, uint32_t offset) {
+    uint8_t payload[9];
+
+    payload[0] = status;
+    put_u32(&payload[1], offset);
+    put_u32(&payload[5], atomic_load(&committed));
+
+    send(MessageUploadProgress, atomic_fetch_add(&progress_sequence, 1),
+         payload, sizeof(payload));
+}
+
+static void end_bulk_mode(const uint8_t *data, size_t len) {
+    header_length = 0;
+    bt_spp_set_bulk_handler(NULL);
+
+    if (len > 0) {
+        control_receive(data, len);
+    }
+}
+
+/**
+ * Takes the next chunk header apart once it is complete and picks a slot for
+ * the chunk. Returns false if the header is not one.
+ */
+static bool start_chunk(void) {
+    int length = protocol_chunk_length(header);
+    if (length < 0) {
+        return false;
+    }
+
+    chunk_remaining = length + PROTOCOL_CHUNK_CRC_SIZE;
+    header_length = 0;
+
+    uint8_t slot;
+    if (xQueueReceive(free_slots, &slot, 0) != pdPASS) {
+        // The sender ignored the window, the chunk is skipped and reported
+        // lost so it gets sent again
+        receiving_slot = -1;
+        send_progress(StatusMalformed, get_u32(&header[4]));
+        return true;
+    }
+
+    receiving_slot = slot;
+    memcpy(slots[slot].data, header, PROTOCOL_CHUNK_HEADER_SIZE);
+    slots[slot].length = PROTOCOL_CHUNK_HEADER_SIZE;
+
+    return true;
+}
+
+/**
+ * Drops a partly received chunk, called from the Bluedroid task when the link
+ * goes away. Written progress is kept for a resume.
+ */
+void upload_reset(void) {
+    if (receiving_slot >= 0) {
+        uint8_t slot = receiving_slot;
+        xQueueSend(free_slots, &slot, 0);
+        receiving_slot = -1;
+    }
+
+    header_length = 0;
+    chunk_remaining = 0;
+}
+
+/**
+ * Bulk mode handler, receives everything SPP delivers while an upload runs.
+ * A control frame where the next chunk should start ends bulk mode and goes
+ * to the control parser along with whatever follows it.
+ */
+static void receive(const uint8_t *data, size_t len) {
+    int64_t now = esp_timer_get_time();
+    if (now - last_receive_us > CHUNK_TIMEOUT_US) {
+        upload_reset();
+    }
+    last_receive_us = now;
+
+    while (len > 0) {
+        if (chunk_remaining == 0) {
+            if (header_length == 0 && data[0] != PROTOCOL_CHUNK_START) {
+                end_bulk_mode(data, len);
+                return;
+            }
+
+            size_t take = PROTOCOL_CHUNK_HEADER_SIZE - header_length;
+            if (take > len) {
+                take = len;
+            }
+
+            memcpy(&header[header_length], data, take);
+            header_length += take;
+            data += take;
+            len -= take;
+
+            if (header_length == PROTOCOL_CHUNK_HEADER_SIZE && !start_chunk()) {
+                end_bulk_mode(data, len);
+                return;
+            }
+            continue;
+        }
+
+        size_t take = chunk_remaining < len ? chunk_remaining : len;
+
+        if (receiving_slot >= 0) {
+            chunk_slot *slot = &slots[receiving_slot];
+            memcpy(&slot->data[slot->length], data, take);
+            slot->length += take;
+        }
+
+        chunk_remaining -= take;
+        data += take;
+        len -= take;
+
+        if (chunk_remaining == 0 && receiving_slot >= 0) {
+            command chunk = {.type = CommandChunk, .slot = receiving_slot};
+            receiving_slot = -1;
+
+            if (xQueueSend(commands, &chunk, 0) != pdPASS) {
+                // Begin requests crowded the queue, the chunk is dropped and
+                // reported busy so it gets sent again
+                xQueueSend(free_slots, &chunk.slot, 0);
+                send_progress(StatusBusy, get_u32(&slots[chunk.slot].data[4]));
+            }
+        }
+    }
+}
+
+/**
+ * Queues a begin request for the upload task, which replies once everything
+ * received before it has been written. Returns false if the queue is full.
+ */
+bool upload_begin(uint8_t sequence, uint32_t size, uint32_t crc) {
+    command begin = {
+        .type = CommandBegin,
+        .sequence = sequence,
+        .size = size,
+        .crc = crc,
+    };
+
+    return xQueueSend(commands, &begin, 0) == pdPASS;
+}
+
+static void reply_begin(uint8_t sequence, ProtocolStatus status) {
+    uint8_t payload[8];
+    uint8_t *cursor = payload;
+
+    *cursor++ = status;
+    cursor = put_u32(cursor, atomic_load(&committed));
+    cursor = put_u16(cursor, PROTOCOL_CHUNK_MAX_DATA);
+    *cursor++ = UPLOAD_WINDOW;
+
+    send(MessageUploadBegin | PROTOCOL_RESPONSE, sequence, payload,
+         cursor - payload);
+}
+
+static void handle_begin(const command *begin) {
+    if (begin->size == image_size && begin->crc == image_crc &&
+        image_size != 0) {
+        ESP_LOGI(TAG, "Resuming upload at %" PRIu32 " of %" PRIu32 " bytes",
+                 atomic_load(&committed), image_size);
+    } else if (partition == NULL || begin->size < SOUNDBANK_HEADER_SIZE ||
+               begin->size > partition->size) {
+        reply_begin(begin->sequence, StatusInvalidParameter);
+        return;
+    } else {
+        ESP_LOGI(TAG, "Receiving %" PRIu32 " byte soundbank", begin->size);
+
+        sound_effects_release();
+
+        image_size = begin->size;
+        image_crc = begin->crc;
+        erased = 0;
+        memset(image_header, 0xFF, sizeof(image_header));
+        atomic_store(&committed, 0);
+    }
+
+    // Nothing is left to send for a finished image
+    if (atomic_load(&committed) < image_size) {
+        bt_spp_set_bulk_handler(receive);
+    }
+
+    reply_begin(begin->sequence, StatusOk);
+}
+
+/**
+ * Erases whole sectors until at least `end` bytes of the partition are
+ * erased
+ */
+static esp_err_t erase_until(uint32_t end) {
+    uint32_t limit = partition->size;
+
+    while (erased < end && erased < limit) {
+        esp_err_t result =
+            esp_partition_erase_range(partition, erased, FLASH_SECTOR_SIZE);
+        if (result != ESP_OK) {
+            return result;
+        }
+        erased += FLASH_SECTOR_SIZE;
+    }
+
+    return ESP_OK;
+}
+
+/**
+ * Reads the written image back and compares its CRC to the announced one,
+ * then writes the header that makes it valid
+ */
+static bool finish_image(void) {
+    uint32_t crc = protocol_crc32(0, image_header, SOUNDBANK_HEADER_SIZE);
+
+    for (uint32_t offset = SOUNDBANK_HEADER_SIZE; offset < image_size;
+         offset += VERIFY_BUFFER_SIZE) {
+        uint32_t length = image_size - offset;
+        if (length > VERIFY_BUFFER_SIZE) {
+            length = VERIFY_BUFFER_SIZE;
+        }
+
+        if (esp_partition_read(partition, offset, verify_buffer, length) !=
+            ESP_OK) {
+            return false;
+        }
+
+        crc = protocol_crc32(crc, verify_buffer, length);
+    }
+
+    if (crc != image_crc) {
+        ESP_LOGE(TAG, "Image CRC %08" PRIx32 ", expected %08" PRIx32, crc,
+                 image_crc);
+        return false;
+    }
+
+    return esp_partition_write(partition, 0, image_header,
+                               SOUNDBANK_HEADER_SIZE) == ESP_OK;
+}
+
+static ProtocolStatus write_chunk(const chunk_slot *slot, uint32_t *offset) {
+    protocol_chunk chunk;
+
+    *offset = get_u32(&slot->data[4]);
+
+    if (!protocol_decode_chunk(slot->data, slot->length, &chunk)) {
+        return StatusMalformed;
+    }
+
+    uint32_t written = atomic_load(&committed);
+    uint32_t end = chunk.offset + chunk.length;
+
+    if (chunk.length == 0 || end < chunk.offset || end > image_size) {
+        return StatusInvalidParameter;
+    }
+
+    // Sent again after a rewind, it is already in flash
+    if (end <= written) {
+        return StatusOk;
+    }
+
+    if (chunk.offset != written) {
+        return StatusInvalidParameter;
+    }
+
+    const uint8_t *data = chunk.data;
+    uint32_t at = chunk.offset;
+    uint32_t length = chunk.length;
+
+    // The header only goes to flash once the image is complete
+    if (at < SOUNDBANK_HEADER_SIZE) {
+        uint32_t held = SOUNDBANK_HEADER_SIZE - at;
+        if (held > length) {
+            held = length;
+        }
+
+        memcpy(&image_header[at], data, held);
+        data += held;
+        at += held;
+        length -= held;
+    }
+
+    if (erase_until(end) != ESP_OK ||
+        (length > 0 &&
+         esp_partition_write(partition, at, data, length) != ESP_OK)) {
+        ESP_LOGE(TAG, "Flash write at %" PRIu32 " failed", at);
+        return StatusBusy;
+    }
+
+    atomic_store(&committed, end);
+
+    if (end == image_size) {
+        if (finish_image()) {
+            ESP_LOGI(TAG, "Soundbank upload complete");
+            sound_effects_reload();
+        } else {
+            // Nothing that was written can be trusted, start over
+            erased = 0;
+            atomic_store(&committed, 0);
+            return StatusMalformed;
+        }
+    } else {
+        // Overlaps with the transfer of the chunks behind this one
+        erase_until(end + ERASE_AHEAD_SECTORS * FLASH_SECTOR_SIZE);
+    }
+
+    return StatusOk;
+}
+
+static void upload_task(void *parameters) {
+    command next;
+
+    for (;;) {
+        xQueueReceive(commands, &next, portMAX_DELAY);
+
+        if (next.type == CommandBegin) {
+            handle_begin(&next);
+            continue;
+        }
+
+        uint32_t offset;
+        ProtocolStatus status = write_chunk(&slots[next.slot], &offset);
+
+        // Freed before reporting, the sender may send the next chunk the
+        // moment it sees the progress
+        xQueueSend(free_slots, &next.slot, 0);
+        send_progress(status, offset);
+    }
+}
+
+esp_err_t upload_init(void) {
+    partition = esp_partition_find_first(ESP_PARTITION_TYPE_DATA,
+                                         SOUNDBANK_PARTITION_SUBTYPE,
+                                         SOUNDBANK_PARTITION_LABEL);
+
+    commands = xQueueCreate(UPLOAD_WINDOW + 2, sizeof(command));
+    free_slots = xQueueCreate(UPLOAD_WINDOW, sizeof(uint8_t));
+    if (commands == NULL || free_slots == NULL) {
+        return ESP_ERR_NO_MEM;
+    }
+
+    for (uint8_t i = 0; i < UPLOAD_WINDOW; i++) {
+        xQueueSend(free_slots, &i, 0);
+    }
+
+    if (xTaskCreatePinnedToCore(upload_task, "upload", 3072, NULL,
+                                UPLOAD_PRIORITY, NULL,
+                                UPLOAD_CORE) != pdPASS) {
+        ESP_LOGE(TAG, "Failed to create upload task");
+        return ESP_ERR_NO_MEM;
+    }
+
+    return ESP_OK;
+}
@@ -0,0 +1,18 @@
+#ifndef CONTROL_UPLOAD_H
+#define CONTROL_UPLOAD_H
+
+#include "esp_err.h"
+#include <stdbool.h>
+#include <stdint.h>
+
+//! Chunks buffered between the link and flash, which is also the sender's
+//! window
+#define UPLOAD_WINDOW 3
+
+esp_err_t upload_init(void);
+
+bool upload_begin(uint8_t sequence, uint32_t size, uint32_t crc);
+
+void upload_reset(void);
+
+#endif
@@ -0,0 +1,267 @@
+/**
+ * This file owns the I2C port shared by the button and power boards. Clients
+ * never touch the driver themselves: they queue transactions and hear back
+ * through a callback on the bus task, so a device that stretches the clock or
+ * stops answering only ever holds up that task and never the one asking.
+ *
+ * High priority transactions always go first. Periodic ones, like battery
+ * sampling, are aligned to a common burst grid and run back to back, so the
+ * bus and the task wake once per burst rather than once per device.
+ */
+
+#include "i2c_bus.h"
+#include "esp_log.h"
+#include "esp_timer.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/queue.h"
+#include "freertos/task.h"
+#include <stdatomic.h>
+
+#define TAG "I2C_BUS"
+
+//! A device holding SCL low longer than this is given up on
+#define I2C_BUS_TIMEOUT_MS 20
+
+//! Below everything that handles audio or Bluetooth, the bus only serves
+//! buttons and slow sensors
+#define I2C_BUS_CORE 0
+#define I2C_BUS_PRIORITY 4
+
+typedef struct {
+    i2c_bus_transaction transaction;
+    uint32_t period_us;
+    int64_t due_us;
+} periodic_entry;
+
+static i2c_master_bus_handle_t bus;
+static TaskHandle_t task;
+static QueueHandle_t queues[I2cPriorityCount];
+
+static periodic_entry periodic[I2C_BUS_MAX_PERIODIC];
+static _Atomic size_t periodic_count;
+
+static _Atomic uint32_t transactions;
+static _Atomic uint32_t errors;
+static _Atomic uint32_t dropped;
+static _Atomic uint32_t bursts;
+static _Atomic uint32_t max_transaction_us;
+
+static void run(const i2c_bus_transaction *transaction) {
+    uint8_t data[I2C_BUS_MAX_READ];
+    esp_err_t result;
+
+    int64_t start = esp_timer_get_time();
+
+    if (transaction->read_length == 0) {
+        result = i2c_master_transmit(transaction->device, transaction->write,
+                                     transaction->write_length,
+                                     I2C_BUS_TIMEOUT_MS);
+    } else if (transaction->write_length == 0) {
+        result = i2c_master_receive(transaction->device, data,
+                                    transaction->read_length,
+                                    I2C_BUS_TIMEOUT_MS);
+    } else {
+        result = i2c_master_transmit_receive(
+            transaction->device, transaction->write, transaction->write_length,
+            data, transaction->read_length, I2C_BUS_TIMEOUT_MS);
+    }
+
+    uint32_t elapsed = esp_timer_get_time() - start;
+    if (elapsed > atomic_load(&max_transaction_us)) {
+        atomic_store(&max_transaction_us, elapsed);
+    }
+
+    atomic_fetch_add(&transactions, 1);
+    if (result != ESP_OK) {
+        atomic_fetch_add(&errors, 1);
+    }
+
+    if (transaction->callback != NULL) {
+        transaction->callback(transaction->ctx, result, data,
+                              result == ESP_OK ? transaction->read_length : 0);
+    }
+}
+
+//! Runs everything queued, re-checking the high priority queue after each
+static void drain_queues(void) {
+    i2c_bus_transaction transaction;
+
+    while (true) {
+        if (xQueueReceive(queues[I2cPriorityHigh], &transaction, 0) ==
+                pdPASS ||
+            xQueueReceive(queues[I2cPriorityLow], &transaction, 0) == pdPASS) {
+            run(&transaction);
+            continue;
+        }
+
+        return;
+    }
+}
+
+/**
+ * Runs every periodic transaction that is due and returns when the next burst
+ * is, 0 if nothing is periodic
+ */
+static int64_t run_burst(int64_t now) {
+    size_t count = atomic_load(&periodic_count);
+    int64_t next = 0;
+    bool ran = false;
+
+    for (size_t i = 0; i < count; i++) {
+        periodic_entry *entry = &periodic[i];
+
+        if (entry->due_us <= now) {
+            drain_queues();
+            run(&entry->transaction);
+            ran = true;
+
+            // Skips bursts that were missed rather than running them late
+            while (entry->due_us <= now) {
+                entry->due_us += entry->period_us;
+            }
+        }
+
+        if (next == 0 || entry->due_us < next) {
+            next = entry->due_us;
+        }
+    }
+
+    if (ran) {
+        atomic_fetch_add(&bursts, 1);
+    }
+
+    return next;
+}
+
+static void bus_task(void *parameters) {
+    while (true) {
+        drain_queues();
+
+        int64_t now = esp_timer_get_time();
+        int64_t next = run_burst(now);
+
+        TickType_t wait = portMAX_DELAY;
+        if (next != 0) {
+            now = esp_timer_get_time();
+            // Rounded up, waking a tick early would find nothing due
+            wait = next > now ? pdMS_TO_TICKS((next - now + 999) / 1000) + 1
+                              : 0;
+        }
+
+        ulTaskNotifyTake(pdTRUE, wait);
+    }
+}
+
+esp_err_t i2c_bus_init(i2c_port_num_t port, gpio_num_t sda, gpio_num_t scl) {
+    i2c_master_bus_config_t config = {
+        .i2c_port = port,
+        .sda_io_num = sda,
+        .scl_io_num = scl,
+        .clk_source = I2C_CLK_SRC_DEFAULT,
+        .glitch_ignore_cnt = 7,
+    };
+
+    esp_err_t result = i2c_new_master_bus(&config, &bus);
+    if (result != ESP_OK) {
+        return result;
+    }
+
+    for (size_t i = 0; i < I2cPriorityCount; i++) {
+        queues[i] =
+            xQueueCreate(I2C_BUS_QUEUE_LENGTH, sizeof(i2c_bus_transaction));
+        if (queues[i] == NULL) {
+            return ESP_ERR_NO_MEM;
+        }
+    }
+
+    if (xTaskCreatePinnedToCore(bus_task, "i2c_bus", 2560, NULL,
+                                I2C_BUS_PRIORITY, &task,
+                                I2C_BUS_CORE) != pdPASS) {
+        return ESP_ERR_NO_MEM;
+    }
+
+    ESP_LOGI(TAG, "I2C bus on SDA %d, SCL %d", sda, scl);
+
+    return ESP_OK;
+}
+
+esp_err_t i2c_bus_add_device(uint16_t address, uint32_t scl_speed_hz,
+                             i2c_master_dev_handle_t *device) {
+    i2c_device_config_t config = {
+        .dev_addr_length = I2C_ADDR_BIT_LEN_7,
+        .device_address = address,
+        .scl_speed_hz = scl_speed_hz,
+    };
+
+    return i2c_master_bus_add_device(bus, &config, device);
+}
+
+/**
+ * Queues a transaction without blocking. Returns ESP_ERR_NO_MEM if too many of
+ * the same priority are already waiting.
+ */
+esp_err_t i2c_bus_submit(const i2c_bus_transaction *transaction,
+                         I2cPriority priority) {
+    if (transaction->write_length > I2C_BUS_MAX_WRITE ||
+        transaction->read_length > I2C_BUS_MAX_READ) {
+        return ESP_ERR_INVALID_SIZE;
+    }
+
+    if (xQueueSend(queues[priority], transaction, 0) != pdPASS) {
+        atomic_fetch_add(&dropped, 1);
+        return ESP_ERR_NO_MEM;
+    }
+
+    xTaskNotifyGive(task);
+
+    return ESP_OK;
+}
+
+/**
+ * Repeats a transaction every `period_ms`, rounded up to whole bursts. Only
+ * meant to be called while the firmware starts up.
+ */
+esp_err_t i2c_bus_add_periodic(const i2c_bus_transaction *transaction,
+                               uint32_t period_ms) {
+    size_t count = atomic_load(&periodic_count);
+
+    if (count == I2C_BUS_MAX_PERIODIC) {
+        return ESP_ERR_NO_MEM;
+    }
+
+    if (transaction->write_length > I2C_BUS_MAX_WRITE ||
+        transaction->read_length > I2C_BUS_MAX_READ) {
+        return ESP_ERR_INVALID_SIZE;
+    }
+
+    uint32_t bursts_per_period =
+        (period_ms + I2C_BUS_BURST_MS - 1) / I2C_BUS_BURST_MS;
+    if (bursts_per_period == 0) {
+        bursts_per_period = 1;
+    }
+
+    uint32_t period_us = bursts_per_period * I2C_BUS_BURST_MS * 1000;
+    int64_t now = esp_timer_get_time();
+
+    periodic[count] = (periodic_entry){
+        .transaction = *transaction,
+        .period_us = period_us,
+        // Aligned to its own period, so entries with the same or related
+        // periods land in the same bursts
+        .due_us = (now / period_us + 1) * period_us,
+    };
+
+    // Published only once the entry is complete
+    atomic_store(&periodic_count, count + 1);
+    xTaskNotifyGive(task);
+
+    return ESP_OK;
+}
+
+void i2c_bus_get_stats(i2c_bus_stats *stats) {
+    stats->transactions = atomic_load(&transactions);
+    stats->errors = atomic_load(&errors);
+    stats->dropped = atomic_load(&dropped);
+    stats->bursts = atomic_load(&bursts);
+    stats->max_transaction_us = atomic_load(&max_transaction_us);
+}
@@ -0,0 +1,68 @@
+#ifndef I2C_BUS_H
+#define I2C_BUS_H
+
+#include "driver/i2c_master.h"
+#include "esp_err.h"
+#include <stdint.h>
+
+//! Transactions of each priority waiting for the bus, more are refused
+#define I2C_BUS_QUEUE_LENGTH 8
+
+//! Periodic transactions run together on this grid, so the bus task wakes
+//! once per burst instead of once per device
+#define I2C_BUS_BURST_MS 100
+
+#define I2C_BUS_MAX_PERIODIC 4
+
+//! Register pointers and short writes, nothing on the bus needs more
+#define I2C_BUS_MAX_WRITE 4
+#define I2C_BUS_MAX_READ 4
+
+typedef enum {
+    //! Someone is waiting on the result, like a button press
+    I2cPriorityHigh,
+    I2cPriorityLow,
+    I2cPriorityCount,
+} I2cPriority;
+
+/**
+ * Called on the bus task once a transaction is done. Must not block, the next
+ * transaction waits for it. `data` holds `length` bytes read, only valid for
+ * the duration of the call.
+ */
+typedef void (*i2c_bus_callback)(void *ctx, esp_err_t result,
+                                 const uint8_t *data, size_t length);
+
+typedef struct {
+    i2c_master_dev_handle_t device;
+    uint8_t write[I2C_BUS_MAX_WRITE];
+    uint8_t write_length;
+    uint8_t read_length;
+    //! May be NULL for writes nobody needs to hear back about
+    i2c_bus_callback callback;
+    void *ctx;
+} i2c_bus_transaction;
+
+typedef struct {
+    uint32_t transactions;
+    uint32_t errors;
+    //! Transactions refused because their queue was full
+    uint32_t dropped;
+    uint32_t bursts;
+    uint32_t max_transaction_us;
+} i2c_bus_stats;
+
+esp_err_t i2c_bus_init(i2c_port_num_t port, gpio_num_t sda, gpio_num_t scl);
+
+esp_err_t i2c_bus_add_device(uint16_t address, uint32_t scl_speed_hz,
+                             i2c_master_dev_handle_t *device);
+
+esp_err_t i2c_bus_submit(const i2c_bus_transaction *transaction,
+                         I2cPriority priority);
+
+esp_err_t i2c_bus_add_periodic(const i2c_bus_transaction *transaction,
+                               uint32_t period_ms);
+
+void i2c_bus_get_stats(i2c_bus_stats *stats);
+
+#endif
@@ -0,0 +1,85 @@
+/**
+ * This file acts on input events. The pairing button toggles pairing mode
+ * with a short press and silences all effects with a double press. Each
+ * button board input plays the soundbank clip of the same index the moment
+ * it is pressed, holding any of them down stops every clip. Any button also
+ * brings the output back from idle.
+ */
+
+#include "actions.h"
+#include "audio/sound_effects.h"
+#include "bluetooth/bt_pairing.h"
+#include "esp_log.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "input.h"
+#include "power/idle.h"
+
+#define TAG "ACTIONS"
+
+//! Above the input task, so an effect is triggered before the next edge is
+//! looked at
+#define ACTIONS_CORE 0
+#define ACTIONS_PRIORITY 6
+
+//! Clips triggered from the button board play at unity
+#define EFFECT_VOLUME 255
+
+static void handle_pairing(InputGesture gesture) {
+    switch (gesture) {
+        case InputShortPress:
+            bt_pairing_toggle();
+            break;
+        case InputDoublePress:
+            sound_effects_stop_all();
+            break;
+        default:
+            break;
+    }
+}
+
+static void handle_effect(uint16_t clip, InputGesture gesture) {
+    switch (gesture) {
+        case InputPressed: {
+            esp_err_t result = sound_effects_play(clip, EFFECT_VOLUME);
+            if (result != ESP_OK) {
+                ESP_LOGD(TAG, "Clip %u not played: %s", clip,
+                         esp_err_to_name(result));
+            }
+            break;
+        }
+        case InputLongPress:
+            sound_effects_stop_all();
+            break;
+        default:
+            break;
+    }
+}
+
+static void actions_task(void *parameters) {
+    input_event event;
+
+    while (true) {
+        if (!input_receive(&event, portMAX_DELAY)) {
+            continue;
+        }
+
+        power_idle_wake();
+
+        if (event.button == ButtonPairing) {
+            handle_pairing(event.gesture);
+        } else {
+            handle_effect(event.button - ButtonEffect0, event.gesture);
+        }
+    }
+}
+
+esp_err_t input_actions_init(void) {
+    if (xTaskCreatePinnedToCore(actions_task, "actions", 2560, NULL,
+                                ACTIONS_PRIORITY, NULL,
+                                ACTIONS_CORE) != pdPASS) {
+        return ESP_ERR_NO_MEM;
+    }
+
+    return ESP_OK;
+}
@@ -0,0 +1,8 @@
+#ifndef INPUT_ACTIONS_H
+#define INPUT_ACTIONS_H
+
+#include "esp_err.h"
+
+esp_err_t input_actions_init(void);
+
+#endif
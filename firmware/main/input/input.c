@@ -0,0 +1,496 @@
+/**
+ * This file turns button edges into press events. Nothing polls: the pairing
+ * button and the button board expander's INT line raise GPIO interrupts, and
+ * a one shot timer wakes the input task for the next debounce, long press or
+ * double press deadline. With no button in use the task never runs.
+ *
+ * A press is reported on its very first edge so effects start without waiting
+ * out the bounce. Every edge after that is ignored until the contacts have had
+ * INPUT_DEBOUNCE_US to settle, then the button is sampled again.
+ *
+ * Edge interrupts cannot wake the chip from light sleep, so while idle both
+ * lines are switched to low level wakeups. Each one fires once and is then
+ * masked until the edges are restored, otherwise a held button would keep
+ * interrupting.
+ */
+
+#include "input.h"
+#include "driver/gpio.h"
+#include "esp_attr.h"
+#include "esp_log.h"
+#include "esp_sleep.h"
+#include "esp_timer.h"
+#include "freertos/queue.h"
+#include "freertos/task.h"
+#include "i2c/i2c_bus.h"
+#include <stdatomic.h>
+
+#define TAG "INPUT"
+
+//! Longer than any of the switches bounce for
+#define INPUT_DEBOUNCE_US 20000
+
+//! How soon a failed expander read is tried again while INT stays asserted
+#define EXPANDER_RETRY_US 10000
+
+//! Catches a change whose INT edge was missed. Runs in the same bus burst as
+//! the battery sample, so it costs no wakeup of its own.
+#define EXPANDER_CHECK_MS 1000
+
+//! The PCF8574 only does standard mode
+#define EXPANDER_SCL_HZ 100000
+
+#define INPUT_CORE 0
+#define INPUT_PRIORITY 5
+
+typedef struct {
+    //! GPIO of the button, or -1 for one on the expander
+    int gpio;
+    //! Expander pin when gpio is -1
+    uint8_t expander_pin;
+    bool detect_double;
+
+    //! Debounced state
+    bool pressed;
+    //! Edges are ignored until then, 0 when settled
+    int64_t settle_us;
+    //! When InputLongPress is due, 0 when not held
+    int64_t long_us;
+    //! When a release turns into InputShortPress, 0 outside the window
+    int64_t click_us;
+    bool second_press;
+    bool long_reported;
+    //! Edge of the press or release being handled
+    uint32_t edge_us;
+} button_state;
+
+static button_state buttons[ButtonCount];
+
+static TaskHandle_t task;
+static QueueHandle_t events;
+static esp_timer_handle_t timer;
+static i2c_master_dev_handle_t expander;
+
+//! Last value read from the expander, a set bit is a released button.
+//! Written by the bus task.
+static _Atomic uint8_t expander_port = 0xFF;
+static atomic_bool read_pending;
+//! No read is submitted before then after one failed
+static _Atomic int64_t retry_us;
+
+//! Written by the interrupt, only the low 32 bits so it is a single store
+static _Atomic uint32_t last_edge_us;
+
+//! The lines are level wakeups rather than edge interrupts
+static atomic_bool wakeup_armed;
+
+static _Atomic uint32_t event_count;
+static _Atomic uint32_t dropped;
+static _Atomic uint32_t bounces;
+static _Atomic uint32_t expander_errors;
+static _Atomic uint32_t last_latency_us;
+static _Atomic uint32_t max_latency_us;
+
+static void IRAM_ATTR edge_isr(void *arg) {
+    BaseType_t woken = pdFALSE;
+
+    // A level stays asserted, needs CONFIG_GPIO_CTRL_FUNC_IN_IRAM
+    if (atomic_load(&wakeup_armed)) {
+        gpio_intr_disable((gpio_num_t)(intptr_t)arg);
+    }
+
+    atomic_store(&last_edge_us, (uint32_t)esp_timer_get_time());
+    vTaskNotifyGiveFromISR(task, &woken);
+
+    portYIELD_FROM_ISR(woken);
+}
+
+static void timer_expired(void *arg) { xTaskNotifyGive(task); }
+
+static void post(InputButton button, InputGesture gesture, uint32_t edge_us) {
+    input_event event = {
+        .button = button,
+        .gesture = gesture,
+        .edge_us = edge_us,
+    };
+
+    if (xQueueSend(events, &event, 0) != pdPASS) {
+        atomic_fetch_add(&dropped, 1);
+        return;
+    }
+
+    atomic_fetch_add(&event_count, 1);
+}
+
+static void expander_read(void *ctx, esp_err_t result, const uint8_t *data,
+                          size_t length) {
+    if (result == ESP_OK) {
+        atomic_store(&expander_port, data[0]);
+        atomic_store(&retry_us, 0);
+    } else {
+        atomic_fetch_add(&expander_errors, 1);
+        atomic_store(&retry_us, esp_timer_get_time() + EXPANDER_RETRY_US);
+    }
+
+    atomic_store(&read_pending, false);
+    xTaskNotifyGive(task);
+}
+
+static void expander_checked(void *ctx, esp_err_t result, const uint8_t *data,
+                             size_t length) {
+    if (result != ESP_OK ||
+        atomic_exchange(&expander_port, data[0]) == data[0]) {
+        return;
+    }
+
+    atomic_store(&last_edge_us, (uint32_t)esp_timer_get_time());
+    xTaskNotifyGive(task);
+}
+
+/**
+ * Queues a read of the expander if its INT line says an input changed, the
+ * read also releases the line. Returns when it has to be tried again, 0 if
+ * the task will be notified instead.
+ */
+static int64_t read_expander(int64_t now) {
+    if (gpio_get_level(EXPANDER_INT_GPIO) != 0 ||
+        atomic_load(&read_pending)) {
+        return 0;
+    }
+
+    int64_t retry = atomic_load(&retry_us);
+    if (retry > now) {
+        return retry;
+    }
+
+    i2c_bus_transaction read = {
+        .device = expander,
+        .read_length = 1,
+        .callback = expander_read,
+    };
+
+    atomic_store(&read_pending, true);
+    if (i2c_bus_submit(&read, I2cPriorityHigh) != ESP_OK) {
+        atomic_store(&read_pending, false);
+        return now + EXPANDER_RETRY_US;
+    }
+
+    return 0;
+}
+
+static bool sample(const button_state *button) {
+    if (button->gpio >= 0) {
+        return gpio_get_level(button->gpio) == 0;
+    }
+
+    return (atomic_load(&expander_port) & (1 << button->expander_pin)) == 0;
+}
+
+static void release(InputButton id, button_state *button, int64_t now) {
+    post(id, InputReleased, button->edge_us);
+    button->long_us = 0;
+
+    if (button->long_reported) {
+        button->long_reported = false;
+    } else if (button->second_press) {
+        button->second_press = false;
+        post(id, InputDoublePress, button->edge_us);
+    } else if (button->detect_double) {
+        button->click_us = now + INPUT_DOUBLE_PRESS_MS * 1000;
+    } else {
+        post(id, InputShortPress, button->edge_us);
+    }
+}
+
+static void press(InputButton id, button_state *button, int64_t now) {
+    post(id, InputPressed, button->edge_us);
+    button->long_us = now + INPUT_LONG_PRESS_MS * 1000;
+
+    if (button->click_us != 0) {
+        button->click_us = 0;
+        button->second_press = true;
+    }
+}
+
+/**
+ * Advances one button's state machine to `now`. Returns the next deadline it
+ * needs to be looked at again by, 0 for none.
+ */
+static int64_t update(InputButton id, int64_t now, uint32_t edge_us) {
+    button_state *button = &buttons[id];
+    bool raw = sample(button);
+
+    if (button->settle_us != 0 && now < button->settle_us) {
+        if (raw != button->pressed) {
+            atomic_fetch_add(&bounces, 1);
+        }
+    } else {
+        // A change found once settled happened at no known edge
+        bool settled = button->settle_us != 0;
+        button->settle_us = 0;
+
+        if (raw != button->pressed) {
+            button->pressed = raw;
+            button->settle_us = now + INPUT_DEBOUNCE_US;
+            button->edge_us = settled ? (uint32_t)now : edge_us;
+
+            if (raw) {
+                press(id, button, now);
+            } else {
+                release(id, button, now);
+            }
+        }
+    }
+
+    if (button->long_us != 0 && now >= button->long_us) {
+        button->long_us = 0;
+        button->long_reported = true;
+        button->second_press = false;
+        post(id, InputLongPress, (uint32_t)now);
+    }
+
+    if (button->click_us != 0 && now >= button->click_us) {
+        button->click_us = 0;
+        post(id, InputShortPress, (uint32_t)now);
+    }
+
+    int64_t next = 0;
+    int64_t deadlines[] = {button->settle_us, button->long_us,
+                           button->click_us};
+
+    for (size_t i = 0; i < sizeof(deadlines) / sizeof(deadlines[0]); i++) {
+        if (deadlines[i] != 0 && (next == 0 || deadlines[i] < next)) {
+            next = deadlines[i];
+        }
+    }
+
+    return next;
+}
+
+static void input_task(void *parameters) {
+    while (true) {
+        ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+
+        int64_t now = esp_timer_get_time();
+        uint32_t edge_us = atomic_load(&last_edge_us);
+
+        // Buttons on the expander are sampled once the read comes back and
+        // notifies the task again
+        int64_t next = read_expander(now);
+        for (InputButton id = 0; id < ButtonCount; id++) {
+            int64_t deadline = update(id, now, edge_us);
+
+            if (deadline != 0 && (next == 0 || deadline < next)) {
+                next = deadline;
+            }
+        }
+
+        esp_timer_stop(timer);
+        if (next != 0) {
+            esp_timer_start_once(timer, next > now ? next - now : 1);
+        }
+    }
+}
+
+static void expander_configured(void *ctx, esp_err_t result,
+                                const uint8_t *data, size_t length) {
+    if (result != ESP_OK) {
+        // The board may not be fitted, the pairing button works regardless
+        ESP_LOGW(TAG, "No button board: %s", esp_err_to_name(result));
+    }
+}
+
+static esp_err_t init_expander(void) {
+    esp_err_t result =
+        i2c_bus_add_device(EXPANDER_ADDRESS, EXPANDER_SCL_HZ, &expander);
+    if (result != ESP_OK) {
+        return result;
+    }
+
+    // Quasi-bidirectional pins only read as inputs with their latch high
+    i2c_bus_transaction configure = {
+        .device = expander,
+        .write = {0xFF},
+        .write_length = 1,
+        .callback = expander_configured,
+    };
+
+    i2c_bus_transaction check = {
+        .device = expander,
+        .read_length = 1,
+        .callback = expander_checked,
+    };
+
+    result = i2c_bus_submit(&configure, I2cPriorityHigh);
+    if (result == ESP_OK) {
+        result = i2c_bus_add_periodic(&check, EXPANDER_CHECK_MS);
+    }
+    if (result != ESP_OK) {
+        return result;
+    }
+
+    gpio_config_t int_config = {
+        .pin_bit_mask = 1ULL << EXPANDER_INT_GPIO,
+        .mode = GPIO_MODE_INPUT,
+        .pull_up_en = GPIO_PULLUP_ENABLE,
+        .pull_down_en = GPIO_PULLDOWN_DISABLE,
+        .intr_type = GPIO_INTR_NEGEDGE,
+    };
+
+    result = gpio_config(&int_config);
+    if (result != ESP_OK) {
+        return result;
+    }
+
+    return gpio_isr_handler_add(EXPANDER_INT_GPIO, edge_isr,
+                                (void *)EXPANDER_INT_GPIO);
+}
+
+esp_err_t input_init(void) {
+    buttons[ButtonPairing] = (button_state){
+        .gpio = PAIRING_BUTTON_GPIO,
+        .detect_double = true,
+    };
+
+    for (int pin = 0; pin < EXPANDER_BUTTONS; pin++) {
+        // Effects fire on InputPressed, waiting to rule out a double press
+        // would only delay the release events nobody acts on
+        buttons[ButtonEffect0 + pin] = (button_state){
+            .gpio = -1,
+            .expander_pin = pin,
+        };
+    }
+
+    events = xQueueCreate(INPUT_QUEUE_LENGTH, sizeof(input_event));
+    if (events == NULL) {
+        return ESP_ERR_NO_MEM;
+    }
+
+    esp_timer_create_args_t timer_args = {
+        .callback = timer_expired,
+        .dispatch_method = ESP_TIMER_TASK,
+        .name = "input",
+    };
+
+    esp_err_t result = esp_timer_create(&timer_args, &timer);
+    if (result != ESP_OK) {
+        return result;
+    }
+
+    // Created before any interrupt can try to notify it
+    if (xTaskCreatePinnedToCore(input_task, "input", 2560, NULL,
+                                INPUT_PRIORITY, &task,
+                                INPUT_CORE) != pdPASS) {
+        return ESP_ERR_NO_MEM;
+    }
+
+    // Other drivers may have installed the service already
+    result = gpio_install_isr_service(0);
+    if (result != ESP_OK && result != ESP_ERR_INVALID_STATE) {
+        return result;
+    }
+
+    gpio_config_t button_config = {
+        .pin_bit_mask = 1ULL << PAIRING_BUTTON_GPIO,
+        .mode = GPIO_MODE_INPUT,
+        .pull_up_en = GPIO_PULLUP_ENABLE,
+        .pull_down_en = GPIO_PULLDOWN_DISABLE,
+        .intr_type = GPIO_INTR_ANYEDGE,
+    };
+
+    result = gpio_config(&button_config);
+    if (result == ESP_OK) {
+        result = gpio_isr_handler_add(PAIRING_BUTTON_GPIO, edge_isr,
+                                      (void *)PAIRING_BUTTON_GPIO);
+    }
+    if (result == ESP_OK) {
+        result = init_expander();
+    }
+    if (result != ESP_OK) {
+        return result;
+    }
+
+    // Picks up whatever is held at boot and releases an INT asserted before
+    // the interrupt was enabled
+    atomic_store(&last_edge_us, (uint32_t)esp_timer_get_time());
+    xTaskNotifyGive(task);
+
+    ESP_LOGI(TAG, "Input ready, pairing button on GPIO %d",
+             PAIRING_BUTTON_GPIO);
+
+    return ESP_OK;
+}
+
+/**
+ * Switches the pairing button and expander INT lines between edge interrupts
+ * and light sleep wakeups. Arming fails, leaving the edges in place, while
+ * either line is held low, since it would wake the chip straight away and then
+ * stay masked.
+ */
+bool input_set_wakeup(bool armed) {
+    static const struct {
+        gpio_num_t gpio;
+        gpio_int_type_t edges;
+    } LINES[] = {
+        {PAIRING_BUTTON_GPIO, GPIO_INTR_ANYEDGE},
+        {EXPANDER_INT_GPIO, GPIO_INTR_NEGEDGE},
+    };
+
+    if (armed == atomic_load(&wakeup_armed)) {
+        return true;
+    }
+
+    for (size_t i = 0; armed && i < sizeof(LINES) / sizeof(LINES[0]); i++) {
+        if (gpio_get_level(LINES[i].gpio) == 0) {
+            return false;
+        }
+    }
+
+    atomic_store(&wakeup_armed, armed);
+
+    for (size_t i = 0; i < sizeof(LINES) / sizeof(LINES[0]); i++) {
+        gpio_intr_disable(LINES[i].gpio);
+
+        if (armed) {
+            gpio_wakeup_enable(LINES[i].gpio, GPIO_INTR_LOW_LEVEL);
+        } else {
+            gpio_wakeup_disable(LINES[i].gpio);
+            gpio_set_intr_type(LINES[i].gpio, LINES[i].edges);
+        }
+
+        gpio_intr_enable(LINES[i].gpio);
+    }
+
+    if (armed) {
+        esp_sleep_enable_gpio_wakeup();
+    } else {
+        // Edges that came while a line was masked were missed, sample again
+        atomic_store(&last_edge_us, (uint32_t)esp_timer_get_time());
+        xTaskNotifyGive(task);
+    }
+
+    return true;
+}
+
+bool input_receive(input_event *event, TickType_t ticks_to_wait) {
+    if (xQueueReceive(events, event, ticks_to_wait) != pdPASS) {
+        return false;
+    }
+
+    uint32_t latency = (uint32_t)esp_timer_get_time() - event->edge_us;
+    atomic_store(&last_latency_us, latency);
+    if (latency > atomic_load(&max_latency_us)) {
+        atomic_store(&max_latency_us, latency);
+    }
+
+    return true;
+}
+
+void input_get_stats(input_stats *stats) {
+    stats->events = atomic_load(&event_count);
+    stats->dropped = atomic_load(&dropped);
+    stats->bounces = atomic_load(&bounces);
+    stats->expander_errors = atomic_load(&expander_errors);
+    stats->last_latency_us = atomic_load(&last_latency_us);
+    stats->max_latency_us = atomic_load(&max_latency_us);
+}
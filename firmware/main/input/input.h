@@ -0,0 +1,72 @@
+#ifndef INPUT_H
+#define INPUT_H
+
+#include "esp_err.h"
+#include "freertos/FreeRTOS.h"
+#include <stdbool.h>
+#include <stdint.h>
+
+//! Active low with the internal pull-up
+#define PAIRING_BUTTON_GPIO 21
+
+//! PCF8574T on the button board, A2 to A0 tied low
+#define EXPANDER_ADDRESS 0x20
+//! Open drain, pulled up by the button board
+#define EXPANDER_INT_GPIO 23
+#define EXPANDER_BUTTONS 8
+
+//! Presses shorter than this are short presses
+#define INPUT_LONG_PRESS_MS 3000
+//! Second press has to follow a release within this to count as a double press
+#define INPUT_DOUBLE_PRESS_MS 300
+
+//! Events waiting for the actions task, more are dropped
+#define INPUT_QUEUE_LENGTH 16
+
+typedef enum {
+    ButtonPairing,
+    //! Button board inputs P0 to P7
+    ButtonEffect0,
+    ButtonCount = ButtonEffect0 + EXPANDER_BUTTONS,
+} InputButton;
+
+typedef enum {
+    //! Sent on the first edge, before the contacts have settled
+    InputPressed,
+    InputReleased,
+    //! Only follows once the double press window has passed, for buttons that
+    //! detect double presses
+    InputShortPress,
+    //! Sent while the button is still held
+    InputLongPress,
+    InputDoublePress,
+} InputGesture;
+
+typedef struct {
+    uint8_t button;
+    uint8_t gesture;
+    //! Low 32 bits of esp_timer_get_time() at the edge the event follows from
+    uint32_t edge_us;
+} input_event;
+
+typedef struct {
+    uint32_t events;
+    //! Events lost because the queue was full
+    uint32_t dropped;
+    //! Edges ignored while a button was settling
+    uint32_t bounces;
+    uint32_t expander_errors;
+    //! Time from an edge to its event being received
+    uint32_t last_latency_us;
+    uint32_t max_latency_us;
+} input_stats;
+
+esp_err_t input_init(void);
+
+bool input_set_wakeup(bool armed);
+
+bool input_receive(input_event *event, TickType_t ticks_to_wait);
+
+void input_get_stats(input_stats *stats);
+
+#endif
@@ -1,8 +1,27 @@
+#include "audio/audio_output.h"
+#include "audio/codec_dsp.h"
+#include "audio/latency_profile.h"
+#include "audio/sound_effects.h"
+#include "audio_dsp/feedback.h"
+#include "audio_dsp/pipeline.h"
+#include "audio_dsp/pitch_shift.h"
+#include "audio_dsp/voice_fx.h"
 #include "bluetooth/bluetooth.h"
 #include "codec/i2s.h"
+#include "codec/registers.h"
 #include "codec/settings.h"
 #include "codec/spi.h"
+#include "control/control.h"
+#include "control/telemetry.h"
+#include "control/upload.h"
 #include "hal/spi_types.h"
+#include "i2c/i2c_bus.h"
+#include "input/actions.h"
+#include "input/input.h"
+#include "power/battery.h"
+#include "power/governor.h"
+#include "power/idle.h"
+#include "sdkconfig.h"
 
 //! Changed between board versions V1.0 and V1.1 due to unsuitable GPIO issues
 #define SPI_MOSI_PIN 22
@@ -16,38 +35,165 @@
 #define EXT_INT_DAC_PIN 17
 #define EXT_INT_ADC_PIN 15
 
-i2s_chan_handle_t tx;
-i2s_chan_handle_t rx;
+//! The speaker codec's ADC data runs into GPIO12, which is never read since
+//! that codec's ADCs stay powered down
+#define INT_EXT_CLK_PIN 13
+#define INT_EXT_LRC_PIN 14
+#define INT_EXT_DAC_PIN 27
 
-void app_main(void) {
-    spi_bus_init(SPI2_HOST, SPI_CLK_PIN, SPI_MOSI_PIN);
+//! I2C_Dat and I2C_CLK, shared by the button and power boards
+#define I2C_SDA_PIN 18
+#define I2C_SCL_PIN 19
+
+//! Mic to speaker delay the voice path has to stay within, the voice
+//! profile's 10 ms of buffering plus the pitch shifter's lag
+#define VOICE_LATENCY_TARGET_US 15000
 
-    spi_codec_device ext_int_codec;
+static audio_pipeline voice_pipeline;
+static pitch_shift voice_pitch;
+static feedback_suppressor voice_feedback;
+static voice_fx voice_effects;
 
-    spi_device_init(EXT_INT_CSB_PIN, &ext_int_codec);
+/**
+ * Powers a codec up for playback at full volume with its DAC muted until the
+ * output writer is feeding it. Only the codec the mic is captured from powers
+ * its ADCs.
+ */
+static void configure_codec(spi_codec_device codec, bool capture) {
+    reset_registers(codec);
 
-    reset_registers(ext_int_codec);
+    set_vmid(codec, VmidPlayback);
+    set_power_management(codec, capture, capture, true, true, true, true);
 
-    set_power_management(ext_int_codec, false, false, true, true, true, true);
+    set_digital_audio_interface(codec, 16);
 
-    set_digital_audio_interface(ext_int_codec, 16);
+    set_dac_volume(codec, Left, MAX_DAC_VOLUME);
+    set_dac_volume(codec, Right, MAX_DAC_VOLUME);
 
-    set_dac_volume(ext_int_codec, Left, MAX_DAC_VOLUME);
-    set_dac_volume(ext_int_codec, Right, MAX_DAC_VOLUME);
+    set_dac_mute(codec, true);
 
-    set_dac_mute(ext_int_codec, true);
+    set_input_volume(codec, Left, MAX_INPUT_VOLUME);
+    set_input_volume(codec, Right, MAX_INPUT_VOLUME);
 
-    set_input_volume(ext_int_codec, Left, MAX_INPUT_VOLUME);
-    set_input_volume(ext_int_codec, Right, MAX_INPUT_VOLUME);
+    // The mic reaches the outputs through the digital voice pipeline, so the
+    // analog bypass into the output mixers is left off
+    set_output_mix(codec, Left, 0, 0);
+    set_output_mix(codec, Right, 0, 0);
 
-    set_output_mix(ext_int_codec, Left, MAX_MIX_VOLUME, 0);
-    set_output_mix(ext_int_codec, Right, 0, MAX_MIX_VOLUME);
+    set_output_volume(codec, Left, MAX_OUTPUT_VOLUME);
+    set_output_volume(codec, Right, MAX_OUTPUT_VOLUME);
 
-    set_output_volume(ext_int_codec, Left, MAX_OUTPUT_VOLUME);
-    set_output_volume(ext_int_codec, Right, MAX_OUTPUT_VOLUME);
+    // Push the whole configuration in one go, only registers that differ from
+    // their reset values are actually written
+    ESP_ERROR_CHECK(codec_commit(codec));
+}
 
-    i2s_device_init(&tx, &rx, EXT_INT_CLK_PIN, EXT_INT_LRC_PIN, EXT_INT_DAC_PIN,
-                    EXT_INT_ADC_PIN);
+void app_main(void) {
+    spi_bus_init(SPI2_HOST, SPI_CLK_PIN, SPI_MOSI_PIN);
 
-    bluetooth_init(tx, ext_int_codec);
+    // Indexed by AudioOutput, as is everything that takes all the codecs
+    spi_codec_device codecs[OutputCount];
+    size_t codec_count = 1;
+
+    ESP_ERROR_CHECK(spi_device_init(EXT_INT_CSB_PIN, &codecs[OutputHeadset]));
+    configure_codec(codecs[OutputHeadset], true);
+
+#if CONFIG_SPEAKER_CODEC
+    ESP_ERROR_CHECK(spi_device_init(CONFIG_SPEAKER_CODEC_CSB_PIN,
+                                    &codecs[OutputSpeaker]));
+    configure_codec(codecs[OutputSpeaker], false);
+    codec_count++;
+#endif
+
+    // Mic monitoring is on from boot, so start with the smallest buffers
+    audio_output_config output_config = AUDIO_OUTPUT_DEFAULT_CONFIG();
+    output_config.profile = LowLatencyVoice;
+
+    const latency_profile_config *profile =
+        latency_profile_get(output_config.profile);
+
+    i2s_device outputs[OutputCount];
+
+    ESP_ERROR_CHECK(i2s_device_init(
+        &outputs[OutputHeadset], I2S_NUM_0, true, profile->dma_desc_num,
+        profile->dma_frame_num, EXT_INT_CLK_PIN, EXT_INT_LRC_PIN,
+        EXT_INT_DAC_PIN, EXT_INT_ADC_PIN));
+
+#if CONFIG_SPEAKER_CODEC
+    ESP_ERROR_CHECK(i2s_device_init_follower(
+        &outputs[OutputSpeaker], I2S_NUM_1, &outputs[OutputHeadset],
+        profile->dma_desc_num, profile->dma_frame_num, INT_EXT_CLK_PIN,
+        INT_EXT_LRC_PIN, INT_EXT_DAC_PIN));
+#endif
+
+    ESP_ERROR_CHECK(sound_effects_init());
+    ESP_ERROR_CHECK(audio_output_init(outputs, codec_count, &output_config));
+
+    // The voice and effects only reach the outputs through the DACs, so they
+    // stay unmuted whether or not a phone is connected. A stream that stops
+    // is silenced by flushing it in the mixer instead.
+    for (size_t i = 0; i < codec_count; i++) {
+        set_dac_mute(codecs[i], false);
+        ESP_ERROR_CHECK(codec_commit(codecs[i]));
+    }
+
+    audio_pipeline_init(&voice_pipeline, profile->block_frames, SAMPLE_RATE,
+                        CONFIG_ESP_DEFAULT_CPU_FREQ_MHZ * 1000000);
+
+    // Before any other stage, so a software level control sees the raw mic
+    ESP_ERROR_CHECK(codec_dsp_init(codecs, codec_count, &voice_pipeline));
+
+    // The mic sits centimetres from the speakers with every gain at maximum,
+    // so resonances are notched out before anything else shapes the voice
+    feedback_init(&voice_feedback, SAMPLE_RATE);
+    audio_pipeline_add_stage(&voice_pipeline, "feedback", feedback_process,
+                             &voice_feedback, voice_pipeline.block_cycles / 8);
+
+    // The pitch shifter may use up to half of each block, leaving the rest of
+    // the core for whatever effects follow it
+    pitch_shift_init(&voice_pitch, SAMPLE_RATE);
+    int pitch_stage = audio_pipeline_add_stage(
+        &voice_pipeline, "pitch", pitch_shift_process, &voice_pitch,
+        voice_pipeline.block_cycles / 2);
+    // Its lag counts towards the voice latency, so it has to be known
+    ESP_ERROR_CHECK(pitch_stage < 0 ? ESP_ERR_NO_MEM : ESP_OK);
+    audio_pipeline_set_latency(&voice_pipeline, pitch_stage,
+                               pitch_shift_latency_frames(&voice_pitch));
+
+    // Character effects share what is left. They are off until a preset is
+    // picked, and each one only costs its budget while its preset uses it.
+    voice_fx_init(&voice_effects, SAMPLE_RATE);
+    audio_pipeline_add_stage(&voice_pipeline, "vocoder",
+                             voice_fx_vocoder_process, &voice_effects,
+                             voice_pipeline.block_cycles / 8);
+    audio_pipeline_add_stage(&voice_pipeline, "ring", voice_fx_ring_process,
+                             &voice_effects, voice_pipeline.block_cycles / 64);
+    audio_pipeline_add_stage(&voice_pipeline, "crush", voice_fx_crush_process,
+                             &voice_effects, voice_pipeline.block_cycles / 64);
+    audio_pipeline_add_stage(&voice_pipeline, "chorus",
+                             voice_fx_chorus_process, &voice_effects,
+                             voice_pipeline.block_cycles / 32);
+    ESP_ERROR_CHECK(
+        audio_output_attach_voice(&voice_pipeline, VOICE_LATENCY_TARGET_US));
+
+    control_init(codecs, codec_count, &voice_pitch, &voice_effects,
+                 &voice_pipeline);
+    ESP_ERROR_CHECK(telemetry_init(&voice_pipeline));
+    ESP_ERROR_CHECK(upload_init());
+
+    bluetooth_init();
+
+    // Up before the first battery sample, which may already call for a lower
+    // power mode
+    ESP_ERROR_CHECK(power_governor_init(codecs, codec_count, &voice_pitch,
+                                        output_config.resampler_quality));
+
+    ESP_ERROR_CHECK(i2c_bus_init(I2C_NUM_0, I2C_SDA_PIN, I2C_SCL_PIN));
+    ESP_ERROR_CHECK(battery_init());
+
+    // Buttons act on pairing and effects, so they come up last, the idle
+    // manager only once they can wake it
+    ESP_ERROR_CHECK(input_init());
+    ESP_ERROR_CHECK(power_idle_init(CONFIG_IDLE_TIMEOUT_S));
+    ESP_ERROR_CHECK(input_actions_init());
 }
@@ -0,0 +1,120 @@
+/**
+ * This file samples the battery through the power board's ADC081C021. Reads
+ * are periodic bus transactions, so they share a burst with whatever else is
+ * sampled regularly and cost no task of their own.
+ *
+ * State of charge is read off a typical single cell Li-ion discharge curve.
+ * It is only an estimate, the voltage sags under load, but it moves slowly
+ * enough for the governor to pick a power mode from.
+ */
+
+#include "battery.h"
+#include "esp_log.h"
+#include "governor.h"
+#include "i2c/i2c_bus.h"
+#include <stdatomic.h>
+
+#define TAG "BATTERY"
+
+//! Conversion result register, reading it starts the next conversion
+#define ADC_REGISTER_RESULT 0x00
+
+#define ADC_SCL_HZ 400000
+
+//! Weight of each new sample, as a shift. Smooths over the dips of loud
+//! passages without lagging a real discharge by more than a few samples.
+#define BATTERY_FILTER_SHIFT 2
+
+typedef struct {
+    uint16_t millivolts;
+    uint8_t charge;
+} discharge_point;
+
+//! Resting voltage against charge left, highest first
+static const discharge_point DISCHARGE_CURVE[] = {
+    {4200, 100}, {4100, 90}, {4000, 78}, {3900, 65}, {3800, 50}, {3750, 40},
+    {3700, 30},  {3650, 20}, {3600, 12}, {3500, 5},  {3300, 0},
+};
+
+#define DISCHARGE_POINTS (sizeof(DISCHARGE_CURVE) / sizeof(DISCHARGE_CURVE[0]))
+
+static i2c_master_dev_handle_t adc;
+
+//! Filtered voltage in millivolts, with BATTERY_FILTER_SHIFT fraction bits
+static uint32_t filtered;
+static _Atomic uint16_t millivolts;
+static _Atomic uint8_t charge;
+
+/**
+ * Interpolates the discharge curve. Never returns 0 for a real reading, which
+ * telemetry uses to mean unknown.
+ */
+static uint8_t estimate_charge(uint16_t cell_mv) {
+    if (cell_mv >= DISCHARGE_CURVE[0].millivolts) {
+        return 100;
+    }
+
+    for (size_t i = 1; i < DISCHARGE_POINTS; i++) {
+        const discharge_point *upper = &DISCHARGE_CURVE[i - 1];
+        const discharge_point *lower = &DISCHARGE_CURVE[i];
+
+        if (cell_mv >= lower->millivolts) {
+            uint8_t estimate =
+                lower->charge + (cell_mv - lower->millivolts) *
+                                    (upper->charge - lower->charge) /
+                                    (upper->millivolts - lower->millivolts);
+            return estimate > 0 ? estimate : 1;
+        }
+    }
+
+    return 1;
+}
+
+static void sample_done(void *ctx, esp_err_t result, const uint8_t *data,
+                        size_t length) {
+    if (result != ESP_OK || length != 2) {
+        ESP_LOGD(TAG, "Battery sample failed: %s", esp_err_to_name(result));
+        return;
+    }
+
+    // Big endian, the 8 bit result sits in bits 11 to 4
+    uint8_t code = ((data[0] << 8 | data[1]) >> 4) & 0xFF;
+    uint32_t sample =
+        (code * BATTERY_ADC_REFERENCE_MV + 128) / 256 * BATTERY_DIVIDER_RATIO;
+
+    if (filtered == 0) {
+        filtered = sample << BATTERY_FILTER_SHIFT;
+    } else {
+        filtered += sample - (filtered >> BATTERY_FILTER_SHIFT);
+    }
+
+    uint16_t value = filtered >> BATTERY_FILTER_SHIFT;
+    uint8_t estimate = estimate_charge(value);
+
+    atomic_store(&millivolts, value);
+    atomic_store(&charge, estimate);
+
+    power_governor_update(value, estimate);
+}
+
+esp_err_t battery_init(void) {
+    esp_err_t result =
+        i2c_bus_add_device(BATTERY_ADC_ADDRESS, ADC_SCL_HZ, &adc);
+    if (result != ESP_OK) {
+        return result;
+    }
+
+    i2c_bus_transaction sample = {
+        .device = adc,
+        .write = {ADC_REGISTER_RESULT},
+        .write_length = 1,
+        .read_length = 2,
+        .callback = sample_done,
+    };
+
+    return i2c_bus_add_periodic(&sample, BATTERY_SAMPLE_MS);
+}
+
+uint16_t battery_get_millivolts(void) { return atomic_load(&millivolts); }
+
+uint8_t battery_get_charge(void) { return atomic_load(&charge); }
@@ -0,0 +1,26 @@
+#ifndef BATTERY_H
+#define BATTERY_H
+
+#include "esp_err.h"
+#include <stdint.h>
+
+//! ADC081C021 on the power board, ADR0 left floating
+#define BATTERY_ADC_ADDRESS 0x54
+
+//! The ADC measures against its own 3.3 V supply
+#define BATTERY_ADC_REFERENCE_MV 3300
+
+//! The cell is halved by the divider in front of the ADC input
+#define BATTERY_DIVIDER_RATIO 2
+
+#define BATTERY_SAMPLE_MS 1000
+
+esp_err_t battery_init(void);
+
+//! Filtered cell voltage, 0 until the first sample arrives
+uint16_t battery_get_millivolts(void);
+
+//! Estimated state of charge in percent, 0 until the first sample arrives
+uint8_t battery_get_charge(void);
+
+#endif
@@ -0,0 +1,395 @@
+/**
+ * This file picks a power mode from the battery's state of charge and applies
+ * it to everything that draws current in proportion to how it is configured:
+ * the CPU clock, the DSP quality tiers the voice and stream paths run at, the
+ * codecs' analog blocks and their headphone amplifier volumes.
+ *
+ * Mode changes are applied on a task of their own, in an order that never
+ * leaves the audio core with more work than its clock allows. Going down the
+ * DSP load is shed before the clock drops, going up the clock is raised first.
+ *
+ * While the output is idle every codec block is powered down whatever the
+ * mode, and light sleep is allowed. Idle changes are applied right away on the
+ * caller's task since resuming from them is on the way to sound.
+ */
+
+#include "governor.h"
+#include "audio/audio_output.h"
+#include "codec/registers.h"
+#include "control/telemetry.h"
+#include "esp_log.h"
+#include "esp_pm.h"
+#include "esp_private/esp_clk.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/semphr.h"
+#include "freertos/task.h"
+#include "sdkconfig.h"
+#include <stdatomic.h>
+#include <string.h>
+
+#define TAG "GOVERNOR"
+
+//! Time the writer task gets to pick up lower quality settings before the
+//! clock they were budgeted against is taken away
+#define GOVERNOR_SETTLE_MS 50
+
+typedef struct {
+    const char *name;
+    //! Charge below which the mode is entered, unused for the first mode
+    uint8_t enter_below;
+    uint16_t cpu_mhz;
+    ResamplerQuality resampler_cap;
+    bool formant_allowed;
+    uint8_t volume_cap;
+    //! Voice is captured from the left mic only and the right ADC is powered
+    //! down
+    bool mic_mono;
+} power_mode_config;
+
+// Each volume step is 1 dB, so every mode below Full takes 6 dB off the
+// loudest the headphone amplifier may be driven
+static const power_mode_config MODES[PowerModeCount] = {
+    [PowerFull] =
+        {
+            .name = "full",
+            .cpu_mhz = CONFIG_ESP_DEFAULT_CPU_FREQ_MHZ,
+            .resampler_cap = ResamplerHigh,
+            .formant_allowed = true,
+            .volume_cap = MAX_OUTPUT_VOLUME,
+        },
+    [PowerBalanced] =
+        {
+            .name = "balanced",
+            .enter_below = GOVERNOR_BALANCED_BELOW,
+            .cpu_mhz = CONFIG_ESP_DEFAULT_CPU_FREQ_MHZ,
+            .resampler_cap = ResamplerMedium,
+            .formant_allowed = true,
+            .volume_cap = MAX_OUTPUT_VOLUME - 6,
+        },
+    [PowerSaver] =
+        {
+            .name = "saver",
+            .enter_below = GOVERNOR_SAVER_BELOW,
+            .cpu_mhz = 80,
+            .resampler_cap = ResamplerLow,
+            .formant_allowed = false,
+            .volume_cap = MAX_OUTPUT_VOLUME - 12,
+            .mic_mono = true,
+        },
+    [PowerCritical] =
+        {
+            .name = "critical",
+            .enter_below = GOVERNOR_CRITICAL_BELOW,
+            .cpu_mhz = 80,
+            .resampler_cap = ResamplerLow,
+            .formant_allowed = false,
+            .volume_cap = MAX_OUTPUT_VOLUME - 18,
+            .mic_mono = true,
+        },
+};
+
+//! Indexed by AudioOutput
+static spi_codec_device codec_devices[OutputCount];
+static size_t codec_count;
+static pitch_shift *voice_pitch;
+static TaskHandle_t task;
+//! Serialises the codec and power management updates of the governor task
+//! with idle changes
+static SemaphoreHandle_t apply_lock;
+static atomic_bool idle;
+
+//! Mode the charge calls for
+static _Atomic PowerMode charge_mode;
+//! 0 follows the charge, otherwise one more than the mode pinned over control
+static _Atomic uint8_t forced_mode;
+//! Mode whose caps the setters below apply
+static _Atomic PowerMode applied_mode;
+
+// What the user last asked for, before any cap
+static _Atomic uint8_t requested_volume[OutputCount][2];
+static _Atomic ResamplerQuality requested_quality;
+static atomic_bool requested_formant;
+
+static PowerMode target_mode(void) {
+    uint8_t forced = atomic_load(&forced_mode);
+
+    if (forced != 0) {
+        return (PowerMode)(forced - 1);
+    }
+
+    return atomic_load(&charge_mode);
+}
+
+static PowerMode mode_for_charge(PowerMode current, uint8_t charge) {
+    PowerMode mode = PowerFull;
+
+    while (mode + 1 < PowerModeCount && charge < MODES[mode + 1].enter_below) {
+        mode++;
+    }
+
+    // Only step back up once the charge clears the threshold by a margin
+    while (mode < current &&
+           charge < MODES[mode + 1].enter_below + GOVERNOR_HYSTERESIS) {
+        mode++;
+    }
+
+    return mode;
+}
+
+static uint8_t capped_volume(const power_mode_config *config,
+                             AudioOutput output, Channel channel) {
+    uint8_t volume = atomic_load(&requested_volume[output][channel]);
+
+    return volume < config->volume_cap ? volume : config->volume_cap;
+}
+
+static ResamplerQuality capped_quality(const power_mode_config *config) {
+    ResamplerQuality quality = atomic_load(&requested_quality);
+
+    return quality < config->resampler_cap ? quality : config->resampler_cap;
+}
+
+static void apply_dsp(const power_mode_config *config) {
+    audio_output_set_resampler_quality(capped_quality(config));
+
+    if (voice_pitch != NULL) {
+        pitch_shift_set_formant_preservation(
+            voice_pitch,
+            config->formant_allowed && atomic_load(&requested_formant));
+    }
+
+    audio_output_set_mic_mono(config->mic_mono);
+}
+
+static void apply_codec(const power_mode_config *config) {
+    xSemaphoreTake(apply_lock, portMAX_DELAY);
+
+    for (size_t i = 0; i < codec_count; i++) {
+        spi_codec_device codec = codec_devices[i];
+
+        // Only the headset codec's ADCs capture the mic
+        bool capture = i == OutputHeadset;
+
+        if (atomic_load(&idle)) {
+            set_power_management(codec, false, false, false, false, false,
+                                 false);
+            set_vmid(codec, VmidStandby);
+        } else {
+            set_vmid(codec, VmidPlayback);
+            set_power_management(codec, capture, capture && !config->mic_mono,
+                                 true, true, true, true);
+        }
+
+        set_output_volume(codec, Left, capped_volume(config, i, Left));
+        set_output_volume(codec, Right, capped_volume(config, i, Right));
+
+        esp_err_t result = codec_commit(codec);
+        if (result != ESP_OK) {
+            ESP_LOGW(TAG, "Codec %zu not updated: %s", i,
+                     esp_err_to_name(result));
+        }
+    }
+
+    xSemaphoreGive(apply_lock);
+}
+
+/**
+ * Light sleep is only allowed while idle. Not every driver holds a power
+ * management lock while it works, so outside idle the CPU stays awake.
+ */
+static esp_err_t configure_pm(const power_mode_config *config) {
+    esp_pm_config_t pm = {
+        .max_freq_mhz = config->cpu_mhz,
+        .min_freq_mhz = config->cpu_mhz,
+        .light_sleep_enable = atomic_load(&idle),
+    };
+
+    xSemaphoreTake(apply_lock, portMAX_DELAY);
+    esp_err_t result = esp_pm_configure(&pm);
+    xSemaphoreGive(apply_lock);
+
+    return result;
+}
+
+static void apply_cpu(const power_mode_config *config) {
+    esp_err_t result = configure_pm(config);
+    if (result != ESP_OK) {
+        ESP_LOGW(TAG, "CPU left at %lu MHz: %s",
+                 (unsigned long)(esp_clk_cpu_freq() / 1000000),
+                 esp_err_to_name(result));
+        return;
+    }
+
+    // The switch happens on the next tick, the pipeline budgets follow the
+    // frequency actually reached rather than the one asked for
+    vTaskDelay(1);
+    audio_output_set_cpu_hz(esp_clk_cpu_freq());
+}
+
+static void governor_task(void *parameters) {
+    while (true) {
+        ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+
+        PowerMode current = atomic_load(&applied_mode);
+        PowerMode mode = target_mode();
+
+        if (mode == current) {
+            continue;
+        }
+
+        const power_mode_config *config = &MODES[mode];
+
+        // Setters racing with the change see the new caps from here on
+        atomic_store(&applied_mode, mode);
+
+        if (mode > current) {
+            apply_dsp(config);
+            apply_codec(config);
+            vTaskDelay(pdMS_TO_TICKS(GOVERNOR_SETTLE_MS));
+            apply_cpu(config);
+        } else {
+            apply_cpu(config);
+            apply_dsp(config);
+            apply_codec(config);
+        }
+
+        ESP_LOGI(TAG, "Power mode %s, CPU %lu MHz", config->name,
+                 (unsigned long)(esp_clk_cpu_freq() / 1000000));
+    }
+}
+
+/**
+ * Starts the governor in the full mode. The codecs, indexed by AudioOutput,
+ * are expected to already be configured for it with every output volume at
+ * its maximum.
+ */
+esp_err_t power_governor_init(const spi_codec_device *codecs, size_t count,
+                              pitch_shift *pitch,
+                              ResamplerQuality resampler_quality) {
+    if (count == 0 || count > OutputCount) {
+        return ESP_ERR_INVALID_ARG;
+    }
+
+    memcpy(codec_devices, codecs, count * sizeof(spi_codec_device));
+    codec_count = count;
+    voice_pitch = pitch;
+
+    apply_lock = xSemaphoreCreateMutex();
+    if (apply_lock == NULL) {
+        return ESP_ERR_NO_MEM;
+    }
+
+    for (size_t i = 0; i < count; i++) {
+        atomic_store(&requested_volume[i][Left], MAX_OUTPUT_VOLUME);
+        atomic_store(&requested_volume[i][Right], MAX_OUTPUT_VOLUME);
+    }
+    atomic_store(&requested_quality, resampler_quality);
+    atomic_store(&requested_formant,
+                 pitch != NULL && atomic_load(&pitch->requested_formant));
+
+    if (xTaskCreatePinnedToCore(governor_task, "governor", 2560, NULL,
+                                GOVERNOR_PRIORITY, &task,
+                                GOVERNOR_CORE) != pdPASS) {
+        return ESP_ERR_NO_MEM;
+    }
+
+    return ESP_OK;
+}
+
+/**
+ * Called with every battery sample. A charge of 0 means it is not known yet
+ * and leaves the mode as it is.
+ */
+void power_governor_update(uint16_t millivolts, uint8_t charge) {
+    if (charge != 0) {
+        PowerMode current = atomic_load(&charge_mode);
+        PowerMode mode = mode_for_charge(current, charge);
+
+        if (mode != current) {
+            atomic_store(&charge_mode, mode);
+            xTaskNotifyGive(task);
+        }
+    }
+
+    telemetry_set_battery(millivolts, charge, atomic_load(&applied_mode));
+}
+
+/**
+ * 0 lets the governor follow the battery again, 1 + a PowerMode pins that mode
+ * whatever the charge. Returns false for anything else.
+ */
+bool power_governor_force_mode(uint8_t mode) {
+    if (mode > PowerModeCount) {
+        return false;
+    }
+
+    atomic_store(&forced_mode, mode);
+    xTaskNotifyGive(task);
+
+    return true;
+}
+
+/**
+ * Powers every block of every codec down, leaving VMID on its standby divider,
+ * and lets the CPU light sleep, or undoes that. The I2S channels must already
+ * be stopped before going idle.
+ */
+void power_governor_set_idle(bool enabled) {
+    if (atomic_exchange(&idle, enabled) == enabled) {
+        return;
+    }
+
+    const power_mode_config *config = &MODES[atomic_load(&applied_mode)];
+
+    // Going idle the codec is already silent, coming back it has to be up
+    // before the clocks start
+    apply_codec(config);
+
+    esp_err_t result = configure_pm(config);
+    if (result != ESP_OK) {
+        ESP_LOGW(TAG, "Light sleep not %s: %s",
+                 enabled ? "allowed" : "stopped", esp_err_to_name(result));
+    }
+}
+
+PowerMode power_governor_get_mode(void) { return atomic_load(&applied_mode); }
+
+const char *power_mode_name(PowerMode mode) {
+    return mode < PowerModeCount ? MODES[mode].name : "unknown";
+}
+
+/**
+ * Output volume as asked for over control, held under the current mode's cap.
+ * Only updates the shadow registers, the caller commits.
+ */
+bool power_governor_set_output_volume(AudioOutput output, Channel channel,
+                                      uint8_t volume) {
+    if (output >= codec_count) {
+        return false;
+    }
+
+    atomic_store(&requested_volume[output][channel], volume);
+
+    set_output_volume(codec_devices[output], channel,
+                      capped_volume(&MODES[atomic_load(&applied_mode)], output,
+                                    channel));
+
+    return true;
+}
+
+void power_governor_set_resampler_quality(ResamplerQuality quality) {
+    atomic_store(&requested_quality, quality);
+
+    audio_output_set_resampler_quality(
+        capped_quality(&MODES[atomic_load(&applied_mode)]));
+}
+
+void power_governor_set_formant_preservation(bool enabled) {
+    atomic_store(&requested_formant, enabled);
+
+    if (voice_pitch != NULL) {
+        pitch_shift_set_formant_preservation(
+            voice_pitch,
+            enabled && MODES[atomic_load(&applied_mode)].formant_allowed);
+    }
+}
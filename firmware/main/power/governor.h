@@ -0,0 +1,62 @@
+#ifndef GOVERNOR_H
+#define GOVERNOR_H
+
+#include "audio/audio_output.h"
+#include "audio_dsp/pitch_shift.h"
+#include "audio_dsp/resampler.h"
+#include "codec/settings.h"
+#include "codec/spi.h"
+#include "esp_err.h"
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+//! Low priority, a mode change is never urgent and the codec writes it makes
+//! must not get in the way of the audio or Bluetooth tasks
+#define GOVERNOR_CORE 0
+#define GOVERNOR_PRIORITY 3
+
+//! Charge below which each of the lower modes is entered
+#define GOVERNOR_BALANCED_BELOW 60
+#define GOVERNOR_SAVER_BELOW 30
+#define GOVERNOR_CRITICAL_BELOW 10
+
+//! Extra charge needed before stepping back up a mode, so a voltage that sags
+//! under load and recovers at rest does not flip between modes
+#define GOVERNOR_HYSTERESIS 5
+
+/**
+ * Power modes from most to least capable. Every mode caps what the user may
+ * ask for rather than overriding it, so the requested settings come back as
+ * soon as the battery allows.
+ */
+typedef enum {
+    PowerFull,
+    PowerBalanced,
+    PowerSaver,
+    PowerCritical,
+    PowerModeCount,
+} PowerMode;
+
+esp_err_t power_governor_init(const spi_codec_device *codecs, size_t count,
+                              pitch_shift *pitch,
+                              ResamplerQuality resampler_quality);
+
+void power_governor_update(uint16_t millivolts, uint8_t charge);
+
+bool power_governor_force_mode(uint8_t mode);
+
+void power_governor_set_idle(bool idle);
+
+PowerMode power_governor_get_mode(void);
+
+const char *power_mode_name(PowerMode mode);
+
+bool power_governor_set_output_volume(AudioOutput output, Channel channel,
+                                      uint8_t volume);
+
+void power_governor_set_resampler_quality(ResamplerQuality quality);
+
+void power_governor_set_formant_preservation(bool enabled);
+
+#endif
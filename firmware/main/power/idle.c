@@ -0,0 +1,198 @@
+/**
+ * This file powers the audio hardware down while nothing is playing. Once the
+ * output has carried neither stream audio nor anything audible from the mic
+ * or the soundbank for the idle timeout, the writer task stops both I2S
+ * channels, every codec block is powered down with VMID left on its standby
+ * divider and the CPU may light sleep, with Bluetooth in modem sleep.
+ *
+ * A2DP starting to stream, a button press or a clip requested over control
+ * wakes it again. Those bring the codec up first and then restart I2S, and the
+ * writer fades the output in from silence.
+ */
+
+#include "idle.h"
+#include "audio/audio_output.h"
+#include "esp_log.h"
+#include "esp_timer.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "governor.h"
+#include "input/input.h"
+#include <inttypes.h>
+#include <stdatomic.h>
+
+#define TAG "IDLE"
+
+static TaskHandle_t task;
+
+//! Seconds of quiet before suspending, 0 never suspends
+static _Atomic uint16_t timeout_s;
+//! A2DP is streaming, which keeps the output up even through silence
+static atomic_bool streaming;
+static atomic_bool wake_pending;
+//! esp_timer_get_time() of the last wake request
+static _Atomic int64_t wake_us;
+
+static atomic_bool suspended;
+static _Atomic TickType_t state_since;
+static _Atomic uint32_t active_ms;
+static _Atomic uint32_t idle_ms;
+static _Atomic uint32_t suspends;
+static _Atomic uint32_t last_resume_us;
+static _Atomic uint32_t max_resume_us;
+
+//! Time spent in the current state is added to its total
+static void account_state(void) {
+    TickType_t now = xTaskGetTickCount();
+    uint32_t elapsed =
+        (now - atomic_exchange(&state_since, now)) * portTICK_PERIOD_MS;
+
+    atomic_fetch_add(atomic_load(&suspended) ? &idle_ms : &active_ms, elapsed);
+}
+
+//! Quiet as far as the output goes and with no wake request since
+static uint32_t quiet_ms(void) {
+    uint32_t output = audio_output_quiet_ms();
+    uint32_t since_wake = (esp_timer_get_time() - atomic_load(&wake_us)) / 1000;
+
+    return output < since_wake ? output : since_wake;
+}
+
+static void suspend(void) {
+    // A held button would wake the chip straight away, it counts as activity
+    if (!input_set_wakeup(true)) {
+        atomic_store(&wake_us, esp_timer_get_time());
+        return;
+    }
+
+    esp_err_t result = audio_output_suspend(pdMS_TO_TICKS(IDLE_SWITCH_WAIT_MS));
+    if (result != ESP_OK) {
+        ESP_LOGW(TAG, "Output not suspended: %s", esp_err_to_name(result));
+        input_set_wakeup(false);
+        atomic_store(&wake_us, esp_timer_get_time());
+        return;
+    }
+
+    power_governor_set_idle(true);
+
+    account_state();
+    atomic_store(&suspended, true);
+    atomic_fetch_add(&suspends, 1);
+
+    ESP_LOGI(TAG, "Idle, audio powered down");
+}
+
+static void resume(void) {
+    // The codec is powered up before its clocks start
+    power_governor_set_idle(false);
+
+    esp_err_t result = audio_output_resume(pdMS_TO_TICKS(IDLE_SWITCH_WAIT_MS));
+    if (result != ESP_OK) {
+        ESP_LOGE(TAG, "Output not resumed: %s", esp_err_to_name(result));
+    }
+
+    uint32_t latency = esp_timer_get_time() - atomic_load(&wake_us);
+
+    // Off the path to sound, the buttons already did their job
+    input_set_wakeup(false);
+
+    account_state();
+    atomic_store(&suspended, false);
+    atomic_store(&last_resume_us, latency);
+    if (latency > atomic_load(&max_resume_us)) {
+        atomic_store(&max_resume_us, latency);
+    }
+
+    ESP_LOGI(TAG, "Awake, output running %" PRIu32 " us after the wake request",
+             latency);
+}
+
+static void idle_task(void *parameters) {
+    while (true) {
+        if (atomic_load(&suspended)) {
+            ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+
+            if (atomic_exchange(&wake_pending, false) ||
+                atomic_load(&streaming)) {
+                resume();
+            }
+            continue;
+        }
+
+        atomic_store(&wake_pending, false);
+
+        uint32_t timeout_ms = atomic_load(&timeout_s) * 1000;
+        TickType_t wait = portMAX_DELAY;
+
+        if (timeout_ms != 0 && !atomic_load(&streaming)) {
+            uint32_t quiet = quiet_ms();
+
+            if (quiet >= timeout_ms) {
+                suspend();
+                continue;
+            }
+
+            wait = pdMS_TO_TICKS(timeout_ms - quiet) + 1;
+        }
+
+        ulTaskNotifyTake(pdTRUE, wait);
+    }
+}
+
+esp_err_t power_idle_init(uint16_t timeout) {
+    atomic_store(&timeout_s, timeout);
+    atomic_store(&wake_us, esp_timer_get_time());
+    atomic_store(&state_since, xTaskGetTickCount());
+
+    if (xTaskCreatePinnedToCore(idle_task, "idle", 2560, NULL, IDLE_PRIORITY,
+                                &task, IDLE_CORE) != pdPASS) {
+        return ESP_ERR_NO_MEM;
+    }
+
+    return ESP_OK;
+}
+
+//! Takes effect from the next check, 0 keeps the output up for good
+void power_idle_set_timeout(uint16_t timeout) {
+    atomic_store(&timeout_s, timeout);
+
+    if (task != NULL) {
+        xTaskNotifyGive(task);
+    }
+}
+
+//! Follows the A2DP audio state, may be called before power_idle_init
+void power_idle_set_stream(bool active) {
+    atomic_store(&streaming, active);
+
+    if (active) {
+        power_idle_wake();
+    } else if (task != NULL) {
+        xTaskNotifyGive(task);
+    }
+}
+
+/**
+ * Brings the output back if it is suspended and restarts the idle timeout
+ * either way. Safe from any task and before power_idle_init.
+ */
+void power_idle_wake(void) {
+    atomic_store(&wake_us, esp_timer_get_time());
+    atomic_store(&wake_pending, true);
+
+    if (task != NULL) {
+        xTaskNotifyGive(task);
+    }
+}
+
+void power_idle_get_stats(power_idle_stats *stats) {
+    TickType_t now = xTaskGetTickCount();
+    uint32_t current = (now - atomic_load(&state_since)) * portTICK_PERIOD_MS;
+
+    stats->idle = atomic_load(&suspended);
+    stats->suspends = atomic_load(&suspends);
+    stats->active_ms = atomic_load(&active_ms) + (stats->idle ? 0 : current);
+    stats->idle_ms = atomic_load(&idle_ms) + (stats->idle ? current : 0);
+    stats->last_resume_us = atomic_load(&last_resume_us);
+    stats->max_resume_us = atomic_load(&max_resume_us);
+}
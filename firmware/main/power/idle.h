@@ -0,0 +1,36 @@
+#ifndef IDLE_H
+#define IDLE_H
+
+#include "esp_err.h"
+#include <stdbool.h>
+#include <stdint.h>
+
+//! Above the input and actions tasks, a resume is on the way to the sound
+//! whatever woke it is waiting for
+#define IDLE_CORE 0
+#define IDLE_PRIORITY 7
+
+//! Time the writer task gets to finish its block and stop or restart I2S
+#define IDLE_SWITCH_WAIT_MS 100
+
+typedef struct {
+    bool idle;
+    uint32_t suspends;
+    uint32_t active_ms;
+    uint32_t idle_ms;
+    //! Time from a wake request to the output running again
+    uint32_t last_resume_us;
+    uint32_t max_resume_us;
+} power_idle_stats;
+
+esp_err_t power_idle_init(uint16_t timeout_s);
+
+void power_idle_set_timeout(uint16_t timeout_s);
+
+void power_idle_set_stream(bool active);
+
+void power_idle_wake(void);
+
+void power_idle_get_stats(power_idle_stats *stats);
+
+#endif